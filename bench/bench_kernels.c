@@ -0,0 +1,290 @@
+// The CPU work of a wake without the radio, shared by the on-target bench app
+// and the host build in tools/. Each kernel is a copy of, or a call into, the
+// code the firmware runs, so the numbers track changes in main/.
+#include "bench_kernels.h"
+#include "config.h"
+#include "rtc_store.h"
+#include "scheduler.h"
+#include "thermistor.h"
+#include "wire_format.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef ESP_PLATFORM
+#include <esp_crc.h>
+#define rtc_crc32 esp_crc32_le
+#define RTC_CRC_NAME "esp_crc32_le"
+#else
+// No ROM on the host, same polynomial in software
+#define rtc_crc32 wire_crc32
+#define RTC_CRC_NAME "wire_crc32"
+#endif
+
+#define BENCH_REPETITIONS 5
+#define BENCH_EPOCH 1767225600UL // 2026-01-01
+
+static volatile uint32_t sink;
+static rtc_store_t store;
+static thermistor_table_t table;
+
+static void crc_hot(uint32_t iterations)
+{
+    for (uint32_t i = 0; i < iterations; i++)
+    {
+        sink += rtc_crc32(0, (const uint8_t *)&store.hot.data, sizeof(store.hot.data));
+    }
+}
+
+static void crc_batch(uint32_t iterations)
+{
+    for (uint32_t i = 0; i < iterations; i++)
+    {
+        sink += rtc_crc32(0, (const uint8_t *)&store.batch.data, sizeof(store.batch.data));
+    }
+}
+
+static void crc_cold(uint32_t iterations)
+{
+    for (uint32_t i = 0; i < iterations; i++)
+    {
+        sink += rtc_crc32(0, (const uint8_t *)&store.cold.data, sizeof(store.cold.data));
+    }
+}
+
+// Codes spread over the range so the lookups do not all hit one cache line
+static uint32_t sweep_code(uint32_t i)
+{
+    return (i * 2654435761u) % ((uint32_t)ADC_MAX_VALUE << ADC_CODE_FRACTION_BITS);
+}
+
+static void convert_lookup(uint32_t iterations)
+{
+    const int16_t *centi_table = thermistor_default_table_get();
+    for (uint32_t i = 0; i < iterations; i++)
+    {
+        sink += thermistor_lookup(centi_table, sweep_code(i));
+    }
+}
+
+// The beta formula the lookup replaced, still what a calibration evaluates
+static void convert_float(uint32_t iterations)
+{
+    for (uint32_t i = 0; i < iterations; i++)
+    {
+        float v_out = (float)sweep_code(i) / (1 << ADC_CODE_FRACTION_BITS) / ADC_MAX_VALUE * VREF;
+        float resistance = SERIES_RESISTOR * v_out / (VREF - v_out);
+        float kelvin = BETA / (log(resistance / R2) + (BETA / T2));
+        sink += (uint32_t)((kelvin - KELVIN_TO_CELSIUS) * 100);
+    }
+}
+
+static void build_table(uint32_t iterations)
+{
+    for (uint32_t i = 0; i < iterations; i++)
+    {
+        thermistor_build_table(&table, SERIES_RESISTOR + i);
+        sink += table.centi_celsius[100];
+    }
+}
+
+static void local_time(uint32_t iterations)
+{
+    for (uint32_t i = 0; i < iterations; i++)
+    {
+        time_t stamp = BENCH_EPOCH + i * 37;
+        struct tm timeinfo;
+        localtime_r(&stamp, &timeinfo);
+        sink += timeinfo.tm_sec;
+    }
+}
+
+// One line of the CSV uplink, as send_batch() in wifi_manager.c formats it
+static int format_csv(char *line, size_t size, uint32_t timestamp, int32_t centi_celsius)
+{
+    time_t stamp = (time_t)timestamp;
+    struct tm timeinfo;
+    localtime_r(&stamp, &timeinfo);
+    return snprintf(line, size, "%04d-%02d-%02d %02d:%02d:%02d+0000,%d,%.4f,%s\n",
+                    timeinfo.tm_year + 1900, timeinfo.tm_mon + 1, timeinfo.tm_mday,
+                    timeinfo.tm_hour, timeinfo.tm_min, timeinfo.tm_sec,
+                    DEVICE_GROUP_ID, centi_celsius / 100.0f, DATA_MESSAGE);
+}
+
+static void csv_line(uint32_t iterations)
+{
+    char line[96];
+    for (uint32_t i = 0; i < iterations; i++)
+    {
+        sink += format_csv(line, sizeof(line), BENCH_EPOCH + i * 37, -1800 + (int32_t)(i % 500));
+    }
+}
+
+static void wire_frame(uint32_t iterations)
+{
+    static uint8_t frame[WIRE_FRAME_SIZE(BATCH_CAPACITY)];
+    for (uint32_t i = 0; i < iterations; i++)
+    {
+        wire_writer_t writer;
+        wire_writer_init(&writer, frame, sizeof(frame), DEVICE_GROUP_ID, BENCH_EPOCH);
+        for (int r = 0; r < BATCH_CAPACITY; r++)
+        {
+            wire_writer_add(&writer, BENCH_EPOCH + r * 30, (int16_t)(-1800 + r));
+        }
+        sink += wire_writer_finish(&writer);
+    }
+}
+
+static void scheduler(uint32_t iterations)
+{
+    scheduler_state_t state;
+    scheduler_reset(&state);
+    for (uint32_t i = 0; i < iterations; i++)
+    {
+        scheduler_input_t input = {
+            .now = BENCH_EPOCH + i * 30,
+            .centi_celsius = -1800 + (int32_t)(i % 64) * 7,
+            .battery_mv = 3700};
+        sink += scheduler_step(&state, &SCHEDULER_POLICY, &input).sleep_sec;
+    }
+}
+
+const bench_kernel_t bench_kernels[] = {
+    {"crc32 rtc hot (" RTC_CRC_NAME ")", crc_hot, 1000},
+    {"crc32 rtc batch (" RTC_CRC_NAME ")", crc_batch, 1000},
+    {"crc32 rtc cold (" RTC_CRC_NAME ")", crc_cold, 1000},
+    {"convert table lookup", convert_lookup, 10000},
+    {"convert beta formula", convert_float, 1000},
+    {"build calibration table", build_table, 4},
+    {"localtime_r", local_time, 1000},
+    {"csv line (localtime_r + %.4f)", csv_line, 1000},
+    {"wire frame of a full batch", wire_frame, 1000},
+    {"scheduler step", scheduler, 10000},
+};
+const size_t bench_kernel_count = sizeof(bench_kernels) / sizeof(bench_kernels[0]);
+
+// The firmware sets the zone in init_time(), which makes localtime_r() dearer
+static void bench_setup(void)
+{
+    setenv("TZ", TIME_ZONE, 1);
+    tzset();
+    memset(&store, 0xA5, sizeof(store));
+}
+
+uint32_t bench_run(const bench_kernel_t *kernel)
+{
+    uint32_t best = UINT32_MAX;
+    for (int repetition = 0; repetition < BENCH_REPETITIONS; repetition++)
+    {
+        uint32_t start = bench_cycles();
+        kernel->run(kernel->iterations);
+        uint32_t elapsed = bench_cycles() - start;
+        if (elapsed < best)
+        {
+            best = elapsed;
+        }
+    }
+    return best / kernel->iterations;
+}
+
+void bench_run_all(void)
+{
+    bench_setup();
+    printf("%-36s %12s\n", "kernel", BENCH_CYCLE_UNIT "/call");
+    for (size_t i = 0; i < bench_kernel_count; i++)
+    {
+        printf("%-36s %12lu\n", bench_kernels[i].name, (unsigned long)bench_run(&bench_kernels[i]));
+    }
+}
+
+// Per reading: lookup, scheduler step and, for the readings the scheduler
+// reports, the serialization of full batches in both uplink formats
+int bench_replay(const char *text, size_t length)
+{
+    bench_setup();
+    const int16_t *centi_table = thermistor_default_table_get();
+    scheduler_state_t state;
+    scheduler_reset(&state);
+
+    static batch_record_t batch[BATCH_SEND_THRESHOLD];
+    static uint8_t frame[WIRE_FRAME_SIZE(BATCH_SEND_THRESHOLD)];
+    char line[96];
+    int readings = 0, reported = 0, batches = 0;
+    uint64_t convert = 0, schedule = 0, csv = 0, binary = 0;
+    size_t csv_bytes = 0, binary_bytes = 0;
+
+    const char *end = text + length;
+    for (const char *cursor = text; cursor < end;)
+    {
+        const char *next = memchr(cursor, '\n', end - cursor);
+        next = next ? next + 1 : end;
+        double seconds;
+        unsigned raw_q4;
+        if (*cursor == '#' || sscanf(cursor, "%lf,%u", &seconds, &raw_q4) != 2)
+        {
+            cursor = next;
+            continue;
+        }
+        cursor = next;
+        readings++;
+
+        uint32_t start = bench_cycles();
+        int32_t centi_celsius = thermistor_lookup(centi_table, raw_q4);
+        uint32_t converted = bench_cycles();
+        scheduler_input_t input = {
+            .now = BENCH_EPOCH + (uint32_t)seconds,
+            .centi_celsius = centi_celsius,
+            .battery_mv = 3700};
+        scheduler_decision_t decision = scheduler_step(&state, &SCHEDULER_POLICY, &input);
+        uint32_t scheduled = bench_cycles();
+        convert += converted - start;
+        schedule += scheduled - converted;
+
+        if (!decision.report)
+        {
+            continue;
+        }
+        batch[reported++ % BATCH_SEND_THRESHOLD] = (batch_record_t){.timestamp = input.now, .raw = (uint16_t)raw_q4};
+        if (reported % BATCH_SEND_THRESHOLD != 0)
+        {
+            continue;
+        }
+
+        batches++;
+        start = bench_cycles();
+        for (int i = 0; i < BATCH_SEND_THRESHOLD; i++)
+        {
+            csv_bytes += format_csv(line, sizeof(line), batch[i].timestamp,
+                                    thermistor_lookup(centi_table, batch[i].raw));
+        }
+        uint32_t formatted = bench_cycles();
+        wire_writer_t writer;
+        wire_writer_init(&writer, frame, sizeof(frame), DEVICE_GROUP_ID, batch[0].timestamp);
+        for (int i = 0; i < BATCH_SEND_THRESHOLD; i++)
+        {
+            wire_writer_add(&writer, batch[i].timestamp, (int16_t)thermistor_lookup(centi_table, batch[i].raw));
+        }
+        binary_bytes += wire_writer_finish(&writer);
+        csv += formatted - start;
+        binary += bench_cycles() - formatted;
+    }
+
+    if (readings == 0)
+    {
+        return 0;
+    }
+    printf("replayed %d readings, %d reported, %d batches of %d\n", readings, reported, batches,
+           BATCH_SEND_THRESHOLD);
+    printf("%-36s %12s\n", "stage", BENCH_CYCLE_UNIT "/reading");
+    printf("%-36s %12.0f\n", "convert", (double)convert / readings);
+    printf("%-36s %12.0f\n", "scheduler", (double)schedule / readings);
+    if (batches > 0)
+    {
+        int sent = batches * BATCH_SEND_THRESHOLD;
+        printf("%-36s %12.0f  (%zu bytes)\n", "serialize csv", (double)csv / sent, csv_bytes);
+        printf("%-36s %12.0f  (%zu bytes)\n", "serialize binary", (double)binary / sent, binary_bytes);
+    }
+    return readings;
+}
@@ -0,0 +1,45 @@
+#ifndef BENCH_KERNELS_H
+#define BENCH_KERNELS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Cycle counter of whatever runs the suite: the CPU performance counter on
+// the ESP32-C6, the TSC on x86 hosts, nanoseconds anywhere else
+#ifdef ESP_PLATFORM
+#include <esp_cpu.h>
+#define BENCH_CYCLE_UNIT "cycles"
+static inline uint32_t bench_cycles(void) { return esp_cpu_get_cycle_count(); }
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BENCH_CYCLE_UNIT "TSC ticks"
+static inline uint32_t bench_cycles(void) { return (uint32_t)__rdtsc(); }
+#else
+#include <time.h>
+#define BENCH_CYCLE_UNIT "ns"
+static inline uint32_t bench_cycles(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)(ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+#endif
+
+typedef struct {
+    const char *name;
+    void (*run)(uint32_t iterations);
+    uint32_t iterations; // Per repetition, small enough that the 32-bit counter does not wrap
+} bench_kernel_t;
+
+extern const bench_kernel_t bench_kernels[];
+extern const size_t bench_kernel_count;
+
+// Best of several repetitions, in BENCH_CYCLE_UNIT per call
+uint32_t bench_run(const bench_kernel_t *kernel);
+void bench_run_all(void);
+
+// Feeds "seconds,raw_q4" lines through conversion, scheduler and serialization
+// and prints the cost per reading of each stage. Returns the readings replayed.
+int bench_replay(const char *text, size_t length);
+
+#endif // BENCH_KERNELS_H
@@ -0,0 +1,13 @@
+#include "bench_kernels.h"
+#include <stdio.h>
+
+// Embedded by EMBED_TXTFILES, NUL terminated
+extern const char sample_trace_start[] asm("_binary_sample_trace_csv_start");
+extern const char sample_trace_end[] asm("_binary_sample_trace_csv_end");
+
+void app_main(void)
+{
+    bench_run_all();
+    printf("\n");
+    bench_replay(sample_trace_start, sample_trace_end - sample_trace_start - 1);
+}
@@ -0,0 +1,148 @@
+#include "adc_engine.h"
+#include "config.h"
+#include "thermistor.h"
+#include <esp_log.h>
+#include "esp_adc/adc_cali.h"
+#include "esp_adc/adc_cali_scheme.h"
+
+#define ADC_FRAME_SIZE (ADC_BURST_SAMPLES * SOC_ADC_DIGI_RESULT_BYTES)
+#define VREF_MV ((uint32_t)(VREF * 1000))
+
+static adc_continuous_handle_t adc_handle = NULL;
+static adc_cali_handle_t cali_handle = NULL;
+static uint8_t frame_buffer[ADC_FRAME_SIZE];
+
+esp_err_t init_adc_engine(void)
+{
+    adc_continuous_handle_cfg_t handle_config = {
+        .max_store_buf_size = ADC_FRAME_SIZE * 2,
+        .conv_frame_size = ADC_FRAME_SIZE};
+    esp_err_t err = adc_continuous_new_handle(&handle_config, &adc_handle);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG_ADC, "Failed to create continuous ADC: %s", esp_err_to_name(err));
+        return err;
+    }
+
+    // Curve fitting uses the per-chip eFuse calibration
+    adc_cali_curve_fitting_config_t cali_config = {
+        .unit_id = ADC_UNIT_1,
+        .chan = THERMISTOR_ADC_CHANNEL,
+        .atten = ADC_ATTEN_DB_12,
+        .bitwidth = ADC_BITWIDTH_12};
+    if (adc_cali_create_scheme_curve_fitting(&cali_config, &cali_handle) != ESP_OK)
+    {
+        ESP_LOGW(TAG_ADC, "No eFuse calibration, using linear conversion");
+        cali_handle = NULL;
+    }
+    return ESP_OK;
+}
+
+void deinit_adc_engine(void)
+{
+    if (adc_handle != NULL)
+    {
+        adc_continuous_deinit(adc_handle);
+        adc_handle = NULL;
+    }
+    if (cali_handle != NULL)
+    {
+        adc_cali_delete_scheme_curve_fitting(cali_handle);
+        cali_handle = NULL;
+    }
+}
+
+// Collect a DMA burst and average it, hundreds of samples take a few milliseconds
+esp_err_t adc_engine_sample(adc_channel_t channel, uint32_t samples, uint32_t *mean_q4)
+{
+    if (adc_handle == NULL || samples == 0)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    adc_digi_pattern_config_t pattern = {
+        .atten = ADC_ATTEN_DB_12,
+        .channel = channel,
+        .unit = ADC_UNIT_1,
+        .bit_width = ADC_BITWIDTH_12};
+    adc_continuous_config_t config = {
+        .pattern_num = 1,
+        .adc_pattern = &pattern,
+        .sample_freq_hz = ADC_BURST_FREQ_HZ,
+        .conv_mode = ADC_CONV_SINGLE_UNIT_1,
+        .format = ADC_DIGI_OUTPUT_FORMAT_TYPE2};
+    esp_err_t err = adc_continuous_config(adc_handle, &config);
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+
+    // Drop anything left over from a previous burst
+    adc_continuous_flush_pool(adc_handle);
+    err = adc_continuous_start(adc_handle);
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+
+    uint32_t sum = 0;
+    uint32_t collected = 0;
+    while (collected < samples)
+    {
+        uint32_t length = 0;
+        err = adc_continuous_read(adc_handle, frame_buffer, sizeof(frame_buffer), &length,
+                                  ADC_BURST_TIMEOUT_MS);
+        if (err != ESP_OK)
+        {
+            ESP_LOGE(TAG_ADC, "ADC read error: %s", esp_err_to_name(err));
+            break;
+        }
+
+        for (uint32_t i = 0; i + SOC_ADC_DIGI_RESULT_BYTES <= length && collected < samples;
+             i += SOC_ADC_DIGI_RESULT_BYTES)
+        {
+            adc_digi_output_data_t *result = (adc_digi_output_data_t *)&frame_buffer[i];
+            if (result->type2.channel != channel || result->type2.data > ADC_MAX_VALUE)
+            {
+                continue;
+            }
+            sum += result->type2.data;
+            collected++;
+        }
+    }
+    adc_continuous_stop(adc_handle);
+
+    if (collected == 0)
+    {
+        ESP_LOGE(TAG_ADC, "No valid ADC readings");
+        return err != ESP_OK ? err : ESP_ERR_INVALID_RESPONSE;
+    }
+    *mean_q4 = ((sum << ADC_CODE_FRACTION_BITS) + collected / 2) / collected;
+    return ESP_OK;
+}
+
+// Map an averaged code onto the code an ideal ADC with full scale VREF would report
+uint32_t adc_engine_linearize(uint32_t raw_q4)
+{
+    if (cali_handle == NULL)
+    {
+        return raw_q4;
+    }
+
+    // The curve works on whole codes, interpolate to keep the resolution of the average
+    int code = raw_q4 >> ADC_CODE_FRACTION_BITS;
+    int fraction = raw_q4 & ((1 << ADC_CODE_FRACTION_BITS) - 1);
+    int mv_low = 0;
+    int mv_high = 0;
+    adc_cali_raw_to_voltage(cali_handle, code, &mv_low);
+    mv_high = mv_low;
+    if (code < ADC_MAX_VALUE)
+    {
+        adc_cali_raw_to_voltage(cali_handle, code + 1, &mv_high);
+    }
+
+    uint32_t mv_q4 = ((uint32_t)mv_low << ADC_CODE_FRACTION_BITS) + (mv_high - mv_low) * fraction;
+    uint32_t linear_q4 = (mv_q4 * ADC_MAX_VALUE + VREF_MV / 2) / VREF_MV;
+    uint32_t max_q4 = (uint32_t)ADC_MAX_VALUE << ADC_CODE_FRACTION_BITS;
+    return linear_q4 > max_q4 ? max_q4 : linear_q4;
+}
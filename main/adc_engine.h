@@ -0,0 +1,12 @@
+#ifndef ADC_ENGINE_H
+#define ADC_ENGINE_H
+
+#include <esp_err.h>
+#include "esp_adc/adc_continuous.h"
+
+esp_err_t init_adc_engine(void);
+void deinit_adc_engine(void);
+esp_err_t adc_engine_sample(adc_channel_t channel, uint32_t samples, uint32_t *mean_q4);
+uint32_t adc_engine_linearize(uint32_t raw_q4);
+
+#endif // ADC_ENGINE_H
@@ -0,0 +1,170 @@
+#include "aggregator.h"
+#include "wire_format.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+void aggregator_init(aggregator_t *aggregator, const char *comment)
+{
+    memset(aggregator, 0, sizeof(*aggregator));
+    aggregator->comment = comment;
+}
+
+// Format: YYYY-MM-DD HH:MM:SS+0000,GROUP_ID,TEMPERATURE,COMMENT, as send_batch()
+// in wifi_manager.c sends it in CSV mode
+int aggregator_format_line(char *line, size_t size, uint32_t timestamp, uint16_t device_id,
+                           int16_t centi_celsius, const char *comment)
+{
+    time_t stamp = (time_t)timestamp;
+    struct tm timeinfo;
+    localtime_r(&stamp, &timeinfo);
+    return snprintf(line, size, "%04d-%02d-%02d %02d:%02d:%02d+0000,%d,%.4f,%s\n",
+                    timeinfo.tm_year + 1900, timeinfo.tm_mon + 1, timeinfo.tm_mday,
+                    timeinfo.tm_hour, timeinfo.tm_min, timeinfo.tm_sec,
+                    device_id, centi_celsius / 100.0f, comment);
+}
+
+// A full table forgets the sensor that was heard from least recently. It only
+// loses the duplicate suppression for that sensor's next frame.
+static aggregator_peer_t *find_peer(aggregator_t *aggregator, const uint8_t mac[6])
+{
+    aggregator_peer_t *oldest = NULL;
+    for (int i = 0; i < aggregator->peer_count; i++)
+    {
+        aggregator_peer_t *peer = &aggregator->peers[i];
+        if (memcmp(peer->mac, mac, sizeof(peer->mac)) == 0)
+        {
+            return peer;
+        }
+        if (oldest == NULL || peer->last_seen < oldest->last_seen)
+        {
+            oldest = peer;
+        }
+    }
+
+    aggregator_peer_t *peer = aggregator->peer_count < GATEWAY_MAX_PEERS
+                                  ? &aggregator->peers[aggregator->peer_count++]
+                                  : oldest;
+    memset(peer, 0, sizeof(*peer));
+    memcpy(peer->mac, mac, sizeof(peer->mac));
+    return peer;
+}
+
+// A sensor keeps its readings until a reply says they were stored, so after a
+// lost reply it sends them again. Its readings leave in time order, anything
+// not newer than what was taken already is such a repeat. A frame is taken
+// whole or not at all.
+aggregator_result_t aggregator_receive(aggregator_t *aggregator, const uint8_t mac[6],
+                                       const uint8_t *data, size_t length)
+{
+    static wire_reading_t readings[WIRE_MAX_RECORDS];
+    wire_header_t header;
+    if (!wire_decode(data, length, &header, readings, WIRE_MAX_RECORDS))
+    {
+        aggregator->frames_bad++;
+        return AGGREGATOR_BAD_FRAME;
+    }
+    aggregator->frames_ok++;
+
+    aggregator_peer_t *peer = find_peer(aggregator, mac);
+    peer->last_seen = ++aggregator->clock;
+    peer->frames++;
+    if (header.count == 0)
+    {
+        return AGGREGATOR_PROBE;
+    }
+
+    aggregator_peer_t before = *peer;
+    size_t length_before = aggregator->length;
+    uint32_t pending_before = aggregator->pending;
+    uint32_t duplicates = 0;
+    for (int i = 0; i < header.count; i++)
+    {
+        if (readings[i].timestamp <= peer->last_timestamp)
+        {
+            duplicates++;
+            continue;
+        }
+        peer->last_timestamp = readings[i].timestamp;
+
+        char line[AGGREGATOR_LINE_SIZE];
+        int line_length = aggregator_format_line(line, sizeof(line), readings[i].timestamp, header.device_id,
+                                                 readings[i].centi_celsius, aggregator->comment);
+        if (line_length < 0 || (size_t)line_length >= sizeof(line) ||
+            aggregator->length + line_length > sizeof(aggregator->lines))
+        {
+            *peer = before;
+            aggregator->length = length_before;
+            aggregator->pending = pending_before;
+            aggregator->refused++;
+            return AGGREGATOR_FULL;
+        }
+        memcpy(aggregator->lines + aggregator->length, line, line_length);
+        aggregator->length += line_length;
+        aggregator->pending++;
+    }
+    peer->duplicates += duplicates;
+    aggregator->duplicates += duplicates;
+    return AGGREGATOR_STORED;
+}
+
+// All lines or none, a failed sink keeps them for the next call
+bool aggregator_flush(aggregator_t *aggregator, aggregator_sink_t sink, void *context)
+{
+    if (aggregator->length == 0)
+    {
+        return true;
+    }
+    if (!sink(context, aggregator->lines, aggregator->length))
+    {
+        return false;
+    }
+    aggregator->readings_out += aggregator->pending;
+    aggregator->pending = 0;
+    aggregator->length = 0;
+    return true;
+}
+
+static void put_u32(uint8_t *p, uint32_t value)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        p[i] = (value >> (8 * i)) & 0xff;
+    }
+}
+
+static uint32_t get_u32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+uint32_t aggregator_frame_crc(const uint8_t *frame, size_t length)
+{
+    return length >= WIRE_CRC_SIZE ? get_u32(frame + length - WIRE_CRC_SIZE) : 0;
+}
+
+size_t aggregator_reply_encode(uint8_t *buffer, const aggregator_reply_t *reply)
+{
+    buffer[0] = 'I';
+    buffer[1] = 'T';
+    buffer[2] = AGGREGATOR_REPLY_VERSION;
+    buffer[3] = reply->flags;
+    put_u32(buffer + 4, (uint32_t)((uint64_t)reply->epoch_us & 0xffffffff));
+    put_u32(buffer + 8, (uint32_t)((uint64_t)reply->epoch_us >> 32));
+    put_u32(buffer + 12, reply->frame_crc);
+    put_u32(buffer + 16, wire_crc32(0, buffer, 16));
+    return AGGREGATOR_REPLY_SIZE;
+}
+
+bool aggregator_reply_decode(const uint8_t *buffer, size_t length, aggregator_reply_t *reply)
+{
+    if (length != AGGREGATOR_REPLY_SIZE || buffer[0] != 'I' || buffer[1] != 'T' ||
+        buffer[2] != AGGREGATOR_REPLY_VERSION || get_u32(buffer + 16) != wire_crc32(0, buffer, 16))
+    {
+        return false;
+    }
+    reply->flags = buffer[3];
+    reply->epoch_us = (int64_t)(get_u32(buffer + 4) | ((uint64_t)get_u32(buffer + 8) << 32));
+    reply->frame_crc = get_u32(buffer + 12);
+    return true;
+}
@@ -0,0 +1,74 @@
+#ifndef AGGREGATOR_H
+#define AGGREGATOR_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "config.h"
+
+// Gateway side of the ESP-NOW uplink, without any radio or socket so it also
+// builds on the host (tools/gateway_loopback.c). Frames from many sensors are
+// decoded, stripped of readings a sensor sent again after a lost reply, and
+// collected as CSV lines until a sink takes them all at once.
+
+// Every frame is answered, sensors only drop readings the gateway stored.
+// All fields little-endian:
+//   magic "IT" | version u8 | flags u8 | epoch_us i64 | frame_crc u32 | crc32
+// frame_crc is the CRC of the frame answered, epoch_us the gateway's clock.
+#define AGGREGATOR_REPLY_VERSION 1
+#define AGGREGATOR_REPLY_SIZE 20
+#define AGGREGATOR_REPLY_TIME_VALID 0x01
+#define AGGREGATOR_REPLY_STORED 0x02
+#define AGGREGATOR_LINE_SIZE 96
+
+typedef enum {
+    AGGREGATOR_BAD_FRAME,
+    AGGREGATOR_PROBE,  // No readings, the sensor looks for the gateway or the time
+    AGGREGATOR_STORED, // Readings kept, or known already
+    AGGREGATOR_FULL,   // No room, the sensor has to keep them
+} aggregator_result_t;
+
+typedef struct {
+    uint8_t flags;
+    int64_t epoch_us;
+    uint32_t frame_crc;
+} aggregator_reply_t;
+
+typedef struct {
+    uint8_t mac[6];
+    uint32_t last_timestamp; // Newest reading forwarded for this sensor
+    uint32_t last_seen;      // Aggregator clock when the last frame arrived, for eviction
+    uint32_t frames;
+    uint32_t duplicates;
+} aggregator_peer_t;
+
+// Returns true when it took all length bytes, false keeps them for the next flush
+typedef bool (*aggregator_sink_t)(void *context, const char *data, size_t length);
+
+typedef struct {
+    const char *comment;
+    aggregator_peer_t peers[GATEWAY_MAX_PEERS];
+    int peer_count;
+    uint32_t clock; // Frames received so far, orders the peers by last use
+    char lines[GATEWAY_BUFFER_SIZE];
+    size_t length;
+    uint32_t pending; // Readings in lines
+    uint32_t frames_ok;
+    uint32_t frames_bad;
+    uint32_t readings_out; // Handed to the sink
+    uint32_t duplicates;
+    uint32_t refused; // Frames that did not fit while the sink was failing
+} aggregator_t;
+
+void aggregator_init(aggregator_t *aggregator, const char *comment);
+aggregator_result_t aggregator_receive(aggregator_t *aggregator, const uint8_t mac[6],
+                                       const uint8_t *data, size_t length);
+bool aggregator_flush(aggregator_t *aggregator, aggregator_sink_t sink, void *context);
+int aggregator_format_line(char *line, size_t size, uint32_t timestamp, uint16_t device_id,
+                           int16_t centi_celsius, const char *comment);
+
+size_t aggregator_reply_encode(uint8_t *buffer, const aggregator_reply_t *reply);
+bool aggregator_reply_decode(const uint8_t *buffer, size_t length, aggregator_reply_t *reply);
+uint32_t aggregator_frame_crc(const uint8_t *frame, size_t length);
+
+#endif // AGGREGATOR_H
@@ -0,0 +1,53 @@
+#include "backoff.h"
+
+bool backoff_allows(const backoff_state_t *state, uint32_t now)
+{
+    // A retry time that is further away than any backoff means the clock was set back
+    return state->failures == 0 || now >= state->retry_after ||
+           state->retry_after - now > RETRY_BACKOFF_MAX_SEC;
+}
+
+// Doubles the wait with every failed wake up to the cap. Half of it is random,
+// so devices that lost the same AP do not all come back in the same second.
+// Returns the wait in seconds.
+uint32_t backoff_failure(backoff_state_t *state, uint32_t now, uint32_t radio_ms, uint32_t random)
+{
+    if (state->failures == 0)
+    {
+        state->outage_start = now;
+        state->outage_radio_ms = 0;
+        state->outages++;
+    }
+    if (state->failures < UINT16_MAX)
+    {
+        state->failures++;
+    }
+    state->outage_radio_ms += radio_ms;
+
+    uint32_t step = RETRY_BACKOFF_MAX_SEC;
+    if (state->failures <= 16 && ((uint32_t)RETRY_BACKOFF_BASE_SEC << (state->failures - 1)) < step)
+    {
+        step = (uint32_t)RETRY_BACKOFF_BASE_SEC << (state->failures - 1);
+    }
+    uint32_t wait = step / 2 + random % (step / 2 + 1);
+    state->retry_after = now + wait;
+    return wait;
+}
+
+// Returns the length of the outage that just ended, 0 when there was none
+uint32_t backoff_success(backoff_state_t *state, uint32_t now)
+{
+    if (state->failures == 0)
+    {
+        return 0;
+    }
+    uint32_t outage_sec = now > state->outage_start ? now - state->outage_start : 0;
+    if (outage_sec > state->longest_outage_sec)
+    {
+        state->longest_outage_sec = outage_sec;
+    }
+    state->failures = 0;
+    state->retry_after = 0;
+    state->outage_start = 0;
+    return outage_sec;
+}
@@ -0,0 +1,22 @@
+#ifndef BACKOFF_H
+#define BACKOFF_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "config.h"
+
+// Kept in RTC memory between wakes, times are time_now() seconds
+typedef struct {
+    uint16_t failures;           // Consecutive wakes that could not upload
+    uint32_t retry_after;        // No connection attempt before this time
+    uint32_t outage_start;       // First failure of the current outage, 0 while the link is up
+    uint32_t outages;            // Outages since the store was reset
+    uint32_t longest_outage_sec;
+    uint32_t outage_radio_ms;    // Radio-on time spent on failed wakes of the current outage
+} backoff_state_t;
+
+bool backoff_allows(const backoff_state_t *state, uint32_t now);
+uint32_t backoff_failure(backoff_state_t *state, uint32_t now, uint32_t radio_ms, uint32_t random);
+uint32_t backoff_success(backoff_state_t *state, uint32_t now);
+
+#endif // BACKOFF_H
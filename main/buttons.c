@@ -0,0 +1,177 @@
+#include "buttons.h"
+#include "config.h"
+#include "power_manager.h"
+#include <driver/gpio.h>
+#include <esp_log.h>
+#include <esp_sleep.h>
+#include <esp_task_wdt.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <stdint.h>
+
+#define BUTTON_COUNT 2
+#define BUTTON_QUEUE_LENGTH 4
+
+static const gpio_num_t button_pins[BUTTON_COUNT] = {BUTTON_CALIBRATE, BUTTON_START};
+static const button_event_t button_events[BUTTON_COUNT] = {BUTTON_EVENT_CALIBRATE, BUTTON_EVENT_START};
+static esp_timer_handle_t debounce_timers[BUTTON_COUNT];
+static bool pressed[BUTTON_COUNT]; // Debounced state
+static QueueHandle_t press_queue = NULL;
+static bool deep_sleep_capable = false;
+
+// Any edge starts the debounce, the pin stays masked until the timer samples it
+static void IRAM_ATTR button_isr(void *arg)
+{
+    int index = (int)(intptr_t)arg;
+    gpio_intr_disable(button_pins[index]);
+    esp_timer_start_once(debounce_timers[index], BUTTON_DEBOUNCE_MS * 1000);
+}
+
+// Runs in the esp_timer task once the contacts have settled
+static void debounce_done(void *arg)
+{
+    int index = (int)(intptr_t)arg;
+    bool is_pressed = gpio_get_level(button_pins[index]) == 0;
+    if (is_pressed != pressed[index])
+    {
+        pressed[index] = is_pressed;
+        if (is_pressed)
+        {
+            button_event_t event = button_events[index];
+            xQueueSend(press_queue, &event, 0);
+        }
+    }
+    gpio_intr_enable(button_pins[index]);
+}
+
+static void start_debounce(int index)
+{
+    gpio_intr_disable(button_pins[index]);
+    if (!esp_timer_is_active(debounce_timers[index]))
+    {
+        esp_timer_start_once(debounce_timers[index], BUTTON_DEBOUNCE_MS * 1000);
+    }
+}
+
+esp_err_t init_buttons(void)
+{
+    uint64_t pin_mask = 0;
+    deep_sleep_capable = true;
+    for (int i = 0; i < BUTTON_COUNT; i++)
+    {
+        pin_mask |= 1ULL << button_pins[i];
+        // Only LP IOs can wake the chip from deep sleep, GPIO 0-7 on the C6
+        deep_sleep_capable &= esp_sleep_is_valid_wakeup_gpio(button_pins[i]);
+    }
+
+    gpio_config_t io_conf = {
+        .intr_type = GPIO_INTR_ANYEDGE,
+        .mode = GPIO_MODE_INPUT,
+        .pin_bit_mask = pin_mask,
+        .pull_up_en = GPIO_PULLUP_ENABLE,
+    };
+    esp_err_t err = gpio_config(&io_conf);
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+
+    press_queue = xQueueCreate(BUTTON_QUEUE_LENGTH, sizeof(button_event_t));
+    if (press_queue == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+
+    err = gpio_install_isr_service(0);
+    if (err != ESP_OK && err != ESP_ERR_INVALID_STATE)
+    {
+        return err;
+    }
+
+    for (int i = 0; i < BUTTON_COUNT; i++)
+    {
+        esp_timer_create_args_t timer_args = {
+            .callback = debounce_done,
+            .arg = (void *)(intptr_t)i,
+            .name = "debounce"};
+        err = esp_timer_create(&timer_args, &debounce_timers[i]);
+        if (err != ESP_OK)
+        {
+            return err;
+        }
+        // A button still held from the press that woke us is not a new press
+        pressed[i] = gpio_get_level(button_pins[i]) == 0;
+        err = gpio_isr_handler_add(button_pins[i], button_isr, (void *)(intptr_t)i);
+        if (err != ESP_OK)
+        {
+            return err;
+        }
+    }
+    return ESP_OK;
+}
+
+static bool buttons_settled(void)
+{
+    for (int i = 0; i < BUTTON_COUNT; i++)
+    {
+        if (pressed[i] || esp_timer_is_active(debounce_timers[i]) || gpio_get_level(button_pins[i]) == 0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Light sleep keeps RAM and the task state, a low level on either button wakes the CPU
+static void light_sleep_until_press(void)
+{
+    for (int i = 0; i < BUTTON_COUNT; i++)
+    {
+        gpio_wakeup_enable(button_pins[i], GPIO_INTR_LOW_LEVEL);
+    }
+    esp_sleep_enable_gpio_wakeup();
+    esp_light_sleep_start();
+    esp_sleep_disable_wakeup_source(ESP_SLEEP_WAKEUP_GPIO);
+
+    // Wakeup reprograms the interrupt type, go back to edges and debounce the press that woke us
+    for (int i = 0; i < BUTTON_COUNT; i++)
+    {
+        gpio_wakeup_disable(button_pins[i]);
+        gpio_set_intr_type(button_pins[i], GPIO_INTR_ANYEDGE);
+        if (gpio_get_level(button_pins[i]) == 0)
+        {
+            start_debounce(i);
+        }
+        else
+        {
+            gpio_intr_enable(button_pins[i]);
+        }
+    }
+}
+
+// Sleep until a debounced press arrives. With both buttons on LP IOs the device
+// deep sleeps instead and the press comes back as the wake reason.
+button_event_t buttons_wait_press(void)
+{
+    button_event_t event;
+    for (;;)
+    {
+        if (xQueueReceive(press_queue, &event, pdMS_TO_TICKS(BUTTON_DEBOUNCE_MS * 2)) == pdTRUE)
+        {
+            return event;
+        }
+        esp_task_wdt_reset();
+        if (!buttons_settled())
+        {
+            continue;
+        }
+
+        if (deep_sleep_capable)
+        {
+            enter_idle_sleep((1ULL << BUTTON_CALIBRATE) | (1ULL << BUTTON_START));
+        }
+        ESP_LOGI(TAG_PM, "Idle, light sleep until a button is pressed");
+        light_sleep_until_press();
+    }
+}
@@ -0,0 +1,14 @@
+#ifndef BUTTONS_H
+#define BUTTONS_H
+
+#include <esp_err.h>
+
+typedef enum {
+    BUTTON_EVENT_CALIBRATE,
+    BUTTON_EVENT_START
+} button_event_t;
+
+esp_err_t init_buttons(void);
+button_event_t buttons_wait_press(void);
+
+#endif // BUTTONS_H
@@ -2,17 +2,74 @@
 #define CONFIG_H
 
 // WiFi configurations
-#define WIFI_CONNECT_TIMEOUT_MS 100000
-#define WIFI_MAXIMUM_RETRY 5
+#define WIFI_MAXIMUM_RETRY 5     // Reconnects after a disconnect, within the radio budget
+#define WIFI_RADIO_BUDGET_MS 8000 // Radio-on time one wake may spend connecting and syncing time
+#define RETRY_BACKOFF_BASE_SEC 60 // Wait after the first failed upload, doubled per failure
+#define RETRY_BACKOFF_MAX_SEC 3600
 #define DEVICE_NAME "Group 1"
+#define DEVICE_GROUP_ID 1
 #define WIFI_SSID "SSID"
 #define WIFI_PASS "PASSWORD"
 #define WIFI_AUTH WIFI_AUTH_WPA2_PSK
+#define FAST_CONNECT_TIMEOUT_MS 1500
+#define DHCP_LEASE_REUSE_SEC 3600
 
 // Server configurations
 #define SNTP_SERVER "pool.ntp.org"
 #define DATA_MESSAGE "Group 1 Temperature Sensor"
 #define SERVER_IP_ADDR "138.232.18.37"
+#define SERVER_PORT 22504
+
+// Uncomment to send compact binary frames to tools/gateway instead of CSV lines
+// #define UPLINK_BINARY
+#define GATEWAY_IP_ADDR "192.168.1.2"
+#define GATEWAY_PORT 22505
+
+#ifdef UPLINK_BINARY
+#define UPLINK_IP_ADDR GATEWAY_IP_ADDR
+#define UPLINK_PORT GATEWAY_PORT
+#else
+#define UPLINK_IP_ADDR SERVER_IP_ADDR
+#define UPLINK_PORT SERVER_PORT
+#endif
+#define UPLINK_TIMEOUT_SEC 5 // Socket send/receive timeout, also used by tools/fleet_sim
+
+// Uplink transport, see transport.h. transport_espnow skips association, DHCP and
+// TCP and sends the binary frames straight to a gateway built with DEVICE_ROLE_GATEWAY.
+#define UPLINK_TRANSPORT transport_tcp // or transport_espnow, transport_tls
+#define GATEWAY_MAC {0x40, 0x4C, 0xCA, 0x00, 0x00, 0x01} // Station MAC of the gateway
+#define ESPNOW_SEND_RETRIES 3      // Attempts per frame, on top of the MAC layer retries
+#define ESPNOW_ACK_TIMEOUT_MS 20   // Link-layer ack of one frame
+#define ESPNOW_REPLY_TIMEOUT_MS 50 // Gateway reply that it stored the frame, see aggregator.h
+#define ESPNOW_MAX_RECORDS 59      // Readings that fit the 250 byte ESP-NOW payload
+#define ESPNOW_CHANNEL_MAX 13      // Channels swept when the gateway moved
+
+// TLS uplink (transport_tls): a TLS terminator on TLS_PORT in front of the
+// endpoint, tools/tls_collector stands in for it. Sessions are resumed across
+// deep sleep, see tls_link.c.
+#define TLS_PORT 22443
+#define TLS_SERVER_NAME "pbl.permasense.uibk.ac.at" // SNI and the certificate's host name
+// #define TLS_CA_PEM "-----BEGIN CERTIFICATE-----\n..." // Pins a private CA, otherwise the ESP-IDF certificate bundle
+#define TLS_SESSION_MAX_SIZE 512 // Serialized session and ticket kept in RTC memory
+
+// Gateway role: stays powered on the AP's channel, collects the ESP-NOW frames of
+// many sensors and forwards them as CSV lines over one TCP connection to SERVER_PORT
+// #define DEVICE_ROLE_GATEWAY
+#define GATEWAY_MAX_PEERS 64        // Sensors tracked for duplicate suppression
+#define GATEWAY_BUFFER_SIZE 16384   // CSV lines held while the endpoint is unreachable
+#define GATEWAY_FLUSH_MS 1000       // Lines from all sensors go out together at most this often
+#define GATEWAY_QUEUE_LENGTH 32     // Received frames waiting for the gateway task
+#define GATEWAY_RECONNECT_MS 5000
+#define GATEWAY_STATS_SEC 600        // Log the counters this often
+#define GATEWAY_FORWARD_STACK_SIZE 4096
+
+// Time keeping configurations
+#define TIME_MAX_ERROR_MS 2000
+#define TIME_DRIFT_UNCALIBRATED_PPM 1000 // Internal RC slow clock before a drift estimate exists
+#define TIME_DRIFT_RESIDUAL_PPM 50
+#define TIME_DRIFT_MIN_INTERVAL_SEC 600
+#define TIME_SYNC_GRACE_MS 500
+#define TIME_ZONE "CET-1CEST,M3.5.0,M10.5.0/3"
 
 // Sensor configurations
 #define BETA 3976.0
@@ -20,19 +77,104 @@
 #define T2 298.15
 #define VREF 3.3
 #define SERIES_RESISTOR 15000.0
+// Uncomment when the top of the divider is wired to a GPIO instead of the supply
+// rail, it then only draws current during acquisition
+// #define THERMISTOR_EXCITATION_GPIO GPIO_NUM_18
+// Uncomment when the top of the divider is also wired to an ADC pin, readings
+// then become a ratio that does not depend on the excitation voltage
+// #define THERMISTOR_EXCITATION_ADC_CHANNEL ADC_CHANNEL_4
+#define EXCITATION_SENSE_DIVIDER 1         // Excitation over sense pin voltage, keeps it below 12 dB full scale
+#define EXCITATION_SAMPLES 64
+#define EXCITATION_SETTLE_DEFAULT_US 1000  // Until calibrate_sensor() has measured it
+#define EXCITATION_SETTLE_MAX_US 5000
+#define EXCITATION_SETTLE_MARGIN_US 100
+#define EXCITATION_SETTLE_PROBE_SAMPLES 8  // Burst length of the settling self-test
+#define EXCITATION_SETTLE_TOLERANCE_Q4 8   // Half an LSB
 
 // ADC configurations
-#define ADC_SAMPLES 5
-#define ADC_SAMPLE_DELAY_MS 10
+#define THERMISTOR_ADC_CHANNEL ADC_CHANNEL_2
+#define ADC_BURST_SAMPLES 256
+#define ADC_CALIBRATION_SAMPLES 1024
+#define ADC_BURST_FREQ_HZ 20000
+#define ADC_BURST_TIMEOUT_MS 100
 #define ADC_MAX_VALUE 4095
 #define KELVIN_TO_CELSIUS 273.15f
+#define THERMISTOR_SEGMENT_BITS 3 // Conversion table has one entry every 8 codes
+#define ACQUIRE_TASK_STACK_SIZE 4096
+#define ACQUIRE_TASK_PRIORITY 5
+// #define BATTERY_ADC_CHANNEL ADC_CHANNEL_3 // Uncomment when a supply divider is fitted
+#define BATTERY_DIVIDER_RATIO 2           // Supply voltage over ADC pin voltage
+#define BATTERY_SAMPLES 64
+#define BATTERY_MIN_MV 2500 // Readings outside these are a floating or miswired pin
+#define BATTERY_MAX_MV 4500
 
 // System configurations
 #define DEEP_SLEEP_TIME_SEC 30
 #define REQUIRED_MEASUREMENTS 10
 #define MEASUREMENT_WINDOW_SEC 300
 #define WATCHDOG_TIMEOUT_SEC 30
-#define RETRY_DELAY_MS 1000
+
+// Wake-cycle phase deadlines, see wake_cycle.h. A phase past its deadline is
+// aborted and what it did not finish is left to a later wake.
+#define CYCLE_ACQUIRE_DEADLINE_MS 1000 // Counted again from the join, after connect
+#define CYCLE_CONNECT_DEADLINE_MS WIFI_RADIO_BUDGET_MS // The transport stops at the radio budget
+#define CYCLE_TIME_SYNC_DEADLINE_MS 10000 // First SNTP sync, also bounded by the rest of the radio budget
+#define CYCLE_TRANSMIT_DEADLINE_MS 20000  // No new spool batch is started after it, below the watchdog
+#define CYCLE_PERSIST_DEADLINE_MS 1000
+#define CYCLE_MAX_INTERRUPTS 2 // Resets within one phase before a resumed cycle skips it
+
+// Power management configurations, need CONFIG_PM_ENABLE and tickless idle in sdkconfig
+#define PM_MAX_FREQ_MHZ 160 // Only while a cpu_boost is held, see power_manager.h
+#define PM_MIN_FREQ_MHZ 40  // XTAL, the lowest step on the ESP32-C6
+#define PM_LIGHT_SLEEP      // Light sleep whenever every task is blocked
+
+// Stay-connected mode, picked per wake when it draws less than deep sleep and reconnecting
+#define STAY_CONNECTED                    // Needs PM_LIGHT_SLEEP
+#define STAY_CONNECTED_LISTEN_INTERVAL 10 // Beacon intervals between wakes in WIFI_PS_MAX_MODEM
+// #define STAY_CONNECTED_TWT             // Individual TWT at the sample interval on Wi-Fi 6 APs
+#define STAY_CONNECTED_UA 500             // Associated, light sleep at the listen interval
+#define DEEP_SLEEP_UA 10
+#define WAKE_BOOT_MS 40    // Boot and init of a wake that does not use the radio
+#define CPU_ACTIVE_MA 25   // Supply current of that boot
+#define RADIO_ACTIVE_MA 80 // Supply current while connecting, see fast_connect_t.wake_to_ip_ms
+
+// Sampling scheduler configurations
+#define SCHEDULER_POLICY scheduler_policy_adaptive // or scheduler_policy_fixed
+#define SCHEDULER_MIN_INTERVAL_SEC 15
+#define SCHEDULER_MAX_INTERVAL_SEC 300
+#define SCHEDULER_STEP_CENTI 25      // Wake often enough to see at most 0.25 °C between readings
+#define SCHEDULER_DEADBAND_CENTI 20  // Readings closer than 0.2 °C to the last reported one stay local
+#define SCHEDULER_HEARTBEAT_SEC 1800 // Report at least this often regardless of the deadband
+#define SCHEDULER_BATTERY_OK_MV 3600
+#define SCHEDULER_BATTERY_LOW_MV 3300
+#define SCHEDULER_LOW_BATTERY_WAKES_PER_HOUR 12 // Energy budget once the supply reaches BATTERY_LOW
+
+// Batch uplink configurations
+#define BATCH_CAPACITY 32
+#define BATCH_SEND_THRESHOLD 10
+#define BATCH_MAX_AGE_SEC 600
+#define MIN_VALID_EPOCH 1704067200UL // 2024-01-01, earlier means the clock was never set
+#define ALARM_HIGH_CENTI 800 // Readings outside the alarm range are uploaded at once
+#define ALARM_LOW_CENTI -4000
+
+// Flash spool configurations, see partitions.csv
+#define SPOOL_PARTITION_LABEL "spool"
+#define SPOOL_PARTITION_SUBTYPE 0x40
+#define SPOOL_DRAIN_BATCH 128         // Readings per send while draining the backlog
+#define SPOOL_DRAIN_MAX_PER_WAKE 2048 // Bounds the radio-on time of a single wake
+
+// RF calibration configurations, see rf_cal.c
+#define RF_CAL_DELTA_CENTI 1000 // Stored data is used up to 10°C from where it was calibrated
+#define RF_CAL_SLOTS 2          // Calibrations kept in NVS, e.g. one for the freezer and one for defrost
+
+// Wake-cycle trace configurations
+#define TRACE_ENABLE     // Per-phase timing and heap/stack watermarks kept in RTC memory
+// #define TRACE_UPLINK  // Append the aggregate as a "#trace" line to CSV uploads
+
+// Deferred logging configurations, see event_log.h and tools/log_decode
+#define LOG_DEFERRED     // Per-wake messages only go to the RTC ring, undefine to also print them
+#define LOG_RING_WORDS 384 // 1.5 kB, the messages of about 15 wakes without an uplink
+// #define LOG_UPLINK    // Append the ring as "#log" lines to CSV uploads, delivered entries are dropped
 
 // GPIO configurations
 #define BUTTON_CALIBRATE GPIO_NUM_23
@@ -45,5 +187,8 @@
 #define TAG_TEMP "temp"
 #define TAG_PM "power"
 #define TAG_SNTP "time"
+#define TAG_SPOOL "spool"
+#define TAG_TRACE "trace"
+#define TAG_GATEWAY "gateway"
 
 #endif // CONFIG_H
\ No newline at end of file
@@ -0,0 +1,239 @@
+#include "transport.h"
+#include "aggregator.h"
+#include "config.h"
+#include "event_log.h"
+#include "power_manager.h"
+#include "rf_cal.h"
+#include "rtc_store.h"
+#include "time_manager.h"
+#include "trace.h"
+#include "uplink.h"
+#include "wire_format.h"
+#include <esp_event.h>
+#include <esp_log.h>
+#include <esp_now.h>
+#include <esp_rtc_time.h>
+#include <esp_timer.h>
+#include <esp_wifi.h>
+#include <esp_bit_defs.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/event_groups.h>
+#include <string.h>
+
+// Set from the ESP-NOW callbacks in the WiFi task
+#define ESPNOW_ACKED_BIT BIT0
+#define ESPNOW_NOT_ACKED_BIT BIT1
+#define ESPNOW_REPLY_BIT BIT2
+
+static const uint8_t gateway_mac[6] = GATEWAY_MAC;
+static EventGroupHandle_t espnow_events = NULL;
+static bool link_up = false;
+static aggregator_reply_t last_reply;
+static uint64_t last_reply_rtc_us;
+
+static void on_sent(const uint8_t *mac, esp_now_send_status_t status)
+{
+    (void)mac;
+    xEventGroupSetBits(espnow_events, status == ESP_NOW_SEND_SUCCESS ? ESPNOW_ACKED_BIT : ESPNOW_NOT_ACKED_BIT);
+}
+
+// The gateway's time is paired with the RTC clock on arrival, not when the main task gets to it
+static void on_received(const esp_now_recv_info_t *info, const uint8_t *data, int length)
+{
+    aggregator_reply_t reply;
+    if (memcmp(info->src_addr, gateway_mac, sizeof(gateway_mac)) == 0 &&
+        aggregator_reply_decode(data, length, &reply))
+    {
+        last_reply_rtc_us = esp_rtc_get_time_us();
+        last_reply = reply;
+        xEventGroupSetBits(espnow_events, ESPNOW_REPLY_BIT);
+    }
+}
+
+// Replies to earlier attempts of the same frame count as well, the gateway
+// answers a repeat the same way
+static bool wait_reply(uint32_t frame_crc, aggregator_reply_t *reply)
+{
+    int64_t deadline_us = esp_timer_get_time() + ESPNOW_REPLY_TIMEOUT_MS * 1000LL;
+    for (;;)
+    {
+        int64_t left_us = deadline_us - esp_timer_get_time();
+        if (left_us <= 0)
+        {
+            return false;
+        }
+        EventBits_t bits = xEventGroupWaitBits(espnow_events, ESPNOW_REPLY_BIT, pdTRUE, pdFALSE,
+                                               pdMS_TO_TICKS(left_us / 1000) + 1);
+        if ((bits & ESPNOW_REPLY_BIT) && last_reply.frame_crc == frame_crc)
+        {
+            *reply = last_reply;
+            return true;
+        }
+    }
+}
+
+// Readings only count as delivered once the gateway replied that it stored
+// them. The link-layer ack tells within a millisecond whether the frame got
+// through, after the MAC layer's own retries; the reply whether the gateway had
+// room. A lost reply makes us send again and the gateway drops the repeat.
+static esp_err_t send_frame(const uint8_t *frame, size_t length, aggregator_reply_t *reply)
+{
+    uint32_t frame_crc = aggregator_frame_crc(frame, length);
+    for (int attempt = 0; attempt < ESPNOW_SEND_RETRIES; attempt++)
+    {
+        xEventGroupClearBits(espnow_events, ESPNOW_ACKED_BIT | ESPNOW_NOT_ACKED_BIT);
+        if (esp_now_send(gateway_mac, frame, length) != ESP_OK)
+        {
+            continue;
+        }
+        EventBits_t bits = xEventGroupWaitBits(espnow_events, ESPNOW_ACKED_BIT | ESPNOW_NOT_ACKED_BIT,
+                                               pdTRUE, pdFALSE, pdMS_TO_TICKS(ESPNOW_ACK_TIMEOUT_MS));
+        if ((bits & ESPNOW_ACKED_BIT) && wait_reply(frame_crc, reply))
+        {
+            return (reply->flags & AGGREGATOR_REPLY_STORED) ? ESP_OK : ESP_ERR_NO_MEM;
+        }
+    }
+    return ESP_ERR_TIMEOUT;
+}
+
+// A frame without readings, answered with the gateway's time
+static bool probe(uint8_t channel)
+{
+    uint8_t frame[WIRE_FRAME_SIZE(0)];
+    size_t length;
+    uplink_frame(frame, sizeof(frame), NULL, 0, &length);
+
+    esp_wifi_set_channel(channel, WIFI_SECOND_CHAN_NONE);
+    aggregator_reply_t reply;
+    if (send_frame(frame, length, &reply) != ESP_OK)
+    {
+        return false;
+    }
+    if ((reply.flags & AGGREGATOR_REPLY_TIME_VALID) && time_needs_sync())
+    {
+        time_sync_sample(reply.epoch_us, last_reply_rtc_us);
+    }
+    return true;
+}
+
+// The gateway follows its AP's channel, which only changes when the AP moves.
+// The sweep stops at the deadline, a probe is bounded by its ack and reply timeouts.
+static uint8_t find_gateway(int64_t deadline_us)
+{
+    uint8_t cached = rtc_store.hot.data.gateway_channel;
+    if (cached != 0 && probe(cached))
+    {
+        return cached;
+    }
+    for (uint8_t channel = 1; channel <= ESPNOW_CHANNEL_MAX && esp_timer_get_time() < deadline_us; channel++)
+    {
+        if (channel != cached && probe(channel))
+        {
+            EVENT_LOG(EVENT_GATEWAY_FOUND, channel);
+            update_gateway_channel(channel);
+            return channel;
+        }
+    }
+    return 0;
+}
+
+// No association, no DHCP: the radio starts on the gateway's channel and the
+// link is up as soon as the gateway answers a probe
+static esp_err_t espnow_connect(int64_t deadline_us)
+{
+    if (link_up)
+    {
+        return ESP_OK;
+    }
+
+    trace_begin(TRACE_ASSOCIATE);
+    cpu_boost_begin(CPU_BOOST_ASSOCIATE);
+    if (espnow_events == NULL)
+    {
+        espnow_events = xEventGroupCreate();
+        esp_err_t err = esp_event_loop_create_default();
+        if (err != ESP_OK && err != ESP_ERR_INVALID_STATE)
+        {
+            ESP_ERROR_CHECK(err);
+        }
+    }
+    wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
+    ESP_ERROR_CHECK(esp_wifi_init(&cfg));
+    ESP_ERROR_CHECK(esp_wifi_set_storage(WIFI_STORAGE_RAM));
+    ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
+    ESP_ERROR_CHECK(rf_start());
+    ESP_ERROR_CHECK(esp_now_init());
+    ESP_ERROR_CHECK(esp_now_register_send_cb(on_sent));
+    ESP_ERROR_CHECK(esp_now_register_recv_cb(on_received));
+
+    // Channel 0 follows whatever channel the radio is on during the sweep
+    esp_now_peer_info_t peer = {.channel = 0, .ifidx = WIFI_IF_STA, .encrypt = false};
+    memcpy(peer.peer_addr, gateway_mac, sizeof(gateway_mac));
+    ESP_ERROR_CHECK(esp_now_add_peer(&peer));
+
+    link_up = find_gateway(deadline_us) != 0;
+    cpu_boost_end(CPU_BOOST_ASSOCIATE);
+    trace_end(TRACE_ASSOCIATE);
+
+    if (!link_up)
+    {
+        ESP_LOGE(TAG_WIFI, "No gateway on any channel");
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+static bool espnow_connected(void)
+{
+    return link_up;
+}
+
+static esp_err_t espnow_open(void)
+{
+    return link_up ? ESP_OK : ESP_ERR_INVALID_STATE;
+}
+
+static esp_err_t espnow_send(const batch_record_t *records, int count)
+{
+    static uint8_t frame[WIRE_FRAME_SIZE(ESPNOW_MAX_RECORDS)];
+    int index = 0;
+
+    while (index < count)
+    {
+        size_t length;
+        int taken = uplink_frame(frame, sizeof(frame), records + index, count - index, &length);
+        aggregator_reply_t reply;
+        esp_err_t result = send_frame(frame, length, &reply);
+        if (result != ESP_OK)
+        {
+            // The caller keeps all of them, the gateway drops the ones it already has
+            return result;
+        }
+        index += taken;
+    }
+    return ESP_OK;
+}
+
+// Every frame was answered on its own, there is nothing to finish
+static void espnow_close(esp_err_t result)
+{
+    (void)result;
+}
+
+static void espnow_disconnect(void)
+{
+    esp_now_deinit();
+    esp_wifi_stop();
+    esp_wifi_deinit();
+    link_up = false;
+}
+
+const transport_t transport_espnow = {
+    .name = "espnow",
+    .has_ip = false,
+    .connect = espnow_connect,
+    .connected = espnow_connected,
+    .open = espnow_open,
+    .send = espnow_send,
+    .close = espnow_close,
+    .disconnect = espnow_disconnect};
@@ -0,0 +1,81 @@
+#include "event_log.h"
+#include "config.h"
+#include "rtc_store.h"
+#include "time_manager.h"
+#include <esp_attr.h>
+#include <esp_log.h>
+#include <esp_rom_sys.h>
+#include <esp_rtc_time.h>
+#include <esp_sleep.h>
+#include <freertos/FreeRTOS.h>
+
+// No-init RTC memory also survives panics and watchdog resets, the entries
+// leading up to one are what the ring is most wanted for. After power-on it
+// holds garbage until init_event_log() finds that out.
+RTC_NOINIT_ATTR static event_ring_t ring;
+static portMUX_TYPE ring_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// The first entry of a wake ties the RTC times that follow to the wall clock
+void init_event_log(void)
+{
+    if (!event_ring_valid(&ring))
+    {
+        event_ring_reset(&ring);
+    }
+    EVENT_LOG(EVENT_WAKE, esp_sleep_get_wakeup_cause(), rtc_store.hot.data.boot_count,
+              time_is_valid() ? time_now() : 0);
+}
+
+// An entry costs a few word copies, the console line it replaces about 87 us
+// per character at 115200 baud
+void event_log_write(event_id_t id, const uint32_t *args, int argc)
+{
+    uint32_t time_ms = (uint32_t)(esp_rtc_get_time_us() / 1000);
+    portENTER_CRITICAL(&ring_lock);
+    event_ring_push(&ring, id, time_ms, args, argc);
+    portEXIT_CRITICAL(&ring_lock);
+
+#ifndef LOG_DEFERRED
+    event_entry_t entry = {.id = id, .argc = argc > EVENT_MAX_ARGS ? EVENT_MAX_ARGS : argc};
+    memcpy(entry.args, args, entry.argc * sizeof(uint32_t));
+    char message[128];
+    event_format(&entry, message, sizeof(message));
+    ESP_LOGI(event_tag(id), "%s", message);
+#endif
+}
+
+// Straight to the UART, the lines must not pick up a log prefix
+void event_log_dump(void)
+{
+    event_cursor_t cursor = event_log_begin();
+    char line[EVENT_LINE_MAX];
+    while (event_log_next_line(&cursor, line, sizeof(line)) > 0)
+    {
+        esp_rom_printf("%s", line);
+    }
+}
+
+event_cursor_t event_log_begin(void)
+{
+    portENTER_CRITICAL(&ring_lock);
+    event_cursor_t cursor = event_ring_begin(&ring);
+    portEXIT_CRITICAL(&ring_lock);
+    return cursor;
+}
+
+// The event handler may add entries meanwhile, so one entry at a time under the lock
+int event_log_next_line(event_cursor_t *cursor, char *line, size_t size)
+{
+    event_entry_t entry;
+    portENTER_CRITICAL(&ring_lock);
+    bool found = event_ring_read(&ring, cursor, &entry);
+    portEXIT_CRITICAL(&ring_lock);
+    return found ? event_entry_line(&entry, DEVICE_GROUP_ID, line, size) : 0;
+}
+
+void event_log_consume(const event_cursor_t *cursor)
+{
+    portENTER_CRITICAL(&ring_lock);
+    event_ring_consume(&ring, cursor->seq);
+    portEXIT_CRITICAL(&ring_lock);
+}
@@ -0,0 +1,27 @@
+#ifndef EVENT_LOG_H
+#define EVENT_LOG_H
+
+#include "event_ring.h"
+
+// Per-wake messages as binary entries in an RTC ring instead of formatted
+// console lines, see EVENT_TABLE. Arguments are converted to 32-bit words,
+// floats have to go through event_float().
+#define EVENT_LOG(id, ...)                                                                  \
+    do                                                                                      \
+    {                                                                                       \
+        const uint32_t event_args_[] = {0, ##__VA_ARGS__};                                  \
+        event_log_write((id), event_args_ + 1, sizeof(event_args_) / sizeof(uint32_t) - 1); \
+    } while (0)
+
+// Before the first message of a wake
+void init_event_log(void);
+void event_log_write(event_id_t id, const uint32_t *args, int argc);
+// Prints the ring as "#log" lines for tools/log_decode, it stays as it is
+void event_log_dump(void);
+
+// Reading for the uplink: lines from the cursor on, then consume up to it once delivered
+event_cursor_t event_log_begin(void);
+int event_log_next_line(event_cursor_t *cursor, char *line, size_t size);
+void event_log_consume(const event_cursor_t *cursor);
+
+#endif // EVENT_LOG_H
@@ -0,0 +1,291 @@
+#include "event_ring.h"
+#include <stdio.h>
+
+#define EVENT_RING_MAGIC 0x4c4f4701 // Changes with the layout of event_ring_t or of its entries
+#define EVENT_MARKER 0xa5u          // Top byte of every header word
+
+#define EVENT_DESCRIPTION(id, tag, format) {tag, format},
+static const struct {
+    const char *tag;
+    const char *format;
+} events[EVENT_COUNT] = {EVENT_TABLE(EVENT_DESCRIPTION)};
+#undef EVENT_DESCRIPTION
+
+static uint32_t header_word(uint16_t id, int argc)
+{
+    return (EVENT_MARKER << 24) | ((uint32_t)argc << 16) | id;
+}
+
+static bool header_valid(uint32_t header)
+{
+    return (header >> 24) == EVENT_MARKER && ((header >> 16) & 0xff) <= EVENT_MAX_ARGS;
+}
+
+static int header_argc(uint32_t header)
+{
+    return (header >> 16) & 0xff;
+}
+
+static uint16_t wrap(uint32_t position)
+{
+    return position % LOG_RING_WORDS;
+}
+
+static void drop_oldest(event_ring_t *ring)
+{
+    uint16_t size = 2 + header_argc(ring->words[ring->first]);
+    ring->first = wrap(ring->first + size);
+    ring->used -= size;
+    ring->count--;
+    ring->first_seq++;
+}
+
+void event_ring_reset(event_ring_t *ring)
+{
+    memset(ring, 0, sizeof(*ring));
+    ring->magic = EVENT_RING_MAGIC;
+}
+
+bool event_ring_valid(const event_ring_t *ring)
+{
+    if (ring->magic != EVENT_RING_MAGIC || ring->first >= LOG_RING_WORDS || ring->used > LOG_RING_WORDS)
+    {
+        return false;
+    }
+
+    uint32_t walked = 0;
+    for (uint16_t i = 0; i < ring->count; i++)
+    {
+        uint32_t header = ring->words[wrap(ring->first + walked)];
+        if (walked >= ring->used || !header_valid(header))
+        {
+            return false;
+        }
+        walked += 2 + header_argc(header);
+    }
+    return walked == ring->used;
+}
+
+void event_ring_push(event_ring_t *ring, uint16_t id, uint32_t time_ms, const uint32_t *args, int argc)
+{
+    if (argc > EVENT_MAX_ARGS)
+    {
+        argc = EVENT_MAX_ARGS;
+    }
+    uint16_t size = 2 + argc;
+    while (ring->used + size > LOG_RING_WORDS)
+    {
+        drop_oldest(ring);
+    }
+
+    uint16_t head = wrap(ring->first + ring->used);
+    ring->words[head] = header_word(id, argc);
+    ring->words[wrap(head + 1)] = time_ms;
+    for (int i = 0; i < argc; i++)
+    {
+        ring->words[wrap(head + 2 + i)] = args[i];
+    }
+    ring->used += size;
+    ring->count++;
+}
+
+event_cursor_t event_ring_begin(const event_ring_t *ring)
+{
+    return (event_cursor_t){.seq = ring->first_seq, .position = ring->first};
+}
+
+bool event_ring_read(const event_ring_t *ring, event_cursor_t *cursor, event_entry_t *entry)
+{
+    if (cursor->seq < ring->first_seq)
+    {
+        *cursor = event_ring_begin(ring);
+    }
+    if (cursor->seq >= ring->first_seq + ring->count)
+    {
+        return false;
+    }
+
+    uint32_t header = ring->words[cursor->position];
+    entry->seq = cursor->seq;
+    entry->id = header & 0xffff;
+    entry->argc = header_argc(header);
+    entry->time_ms = ring->words[wrap(cursor->position + 1)];
+    for (int i = 0; i < entry->argc; i++)
+    {
+        entry->args[i] = ring->words[wrap(cursor->position + 2 + i)];
+    }
+    cursor->position = wrap(cursor->position + 2 + entry->argc);
+    cursor->seq++;
+    return true;
+}
+
+void event_ring_consume(event_ring_t *ring, uint32_t seq)
+{
+    while (ring->count > 0 && ring->first_seq < seq)
+    {
+        drop_oldest(ring);
+    }
+}
+
+const char *event_tag(uint16_t id)
+{
+    return id < EVENT_COUNT ? events[id].tag : "?";
+}
+
+// Walks the format one conversion at a time, flags, width and precision are
+// kept and the length modifier is replaced with the one of the argument type
+int event_format(const event_entry_t *entry, char *buffer, size_t size)
+{
+    if (entry->id >= EVENT_COUNT)
+    {
+        return snprintf(buffer, size, "Unknown event %u", entry->id);
+    }
+
+    const char *format = events[entry->id].format;
+    int arg = 0;
+    size_t used = 0;
+    while (*format != '\0' && used + 1 < size)
+    {
+        if (*format != '%')
+        {
+            buffer[used++] = *format++;
+            continue;
+        }
+
+        char spec[16] = "%";
+        size_t length = 1;
+        format++;
+        while (*format != '\0' && strchr("-+ #0123456789.", *format) != NULL && length < sizeof(spec) - 3)
+        {
+            spec[length++] = *format++;
+        }
+        while (*format != '\0' && strchr("hlLqjzt", *format) != NULL)
+        {
+            format++;
+        }
+        char conversion = *format;
+        if (conversion != '\0')
+        {
+            format++;
+        }
+        if (conversion == '%')
+        {
+            buffer[used++] = '%';
+            continue;
+        }
+
+        uint32_t value = arg < entry->argc ? entry->args[arg] : 0;
+        bool present = arg++ < entry->argc;
+        int written;
+        switch (present ? conversion : '?')
+        {
+        case 'd':
+        case 'i':
+            spec[length++] = 'l';
+            spec[length] = 'd';
+            written = snprintf(buffer + used, size - used, spec, (long)(int32_t)value);
+            break;
+        case 'u':
+        case 'x':
+        case 'X':
+        case 'o':
+            spec[length++] = 'l';
+            spec[length] = conversion;
+            written = snprintf(buffer + used, size - used, spec, (unsigned long)value);
+            break;
+        case 'c':
+            spec[length] = 'c';
+            written = snprintf(buffer + used, size - used, spec, (int)value);
+            break;
+        case 'f':
+        case 'e':
+        case 'E':
+        case 'g':
+        case 'G':
+        {
+            float number;
+            memcpy(&number, &value, sizeof(number));
+            spec[length] = conversion;
+            written = snprintf(buffer + used, size - used, spec, (double)number);
+            break;
+        }
+        default:
+            written = snprintf(buffer + used, size - used, "?");
+            break;
+        }
+        used += written > 0 ? (size_t)written : 0;
+    }
+    if (used >= size)
+    {
+        used = size - 1;
+    }
+    buffer[used] = '\0';
+    return (int)used;
+}
+
+int event_entry_line(const event_entry_t *entry, int group, char *buffer, size_t size)
+{
+    int used = snprintf(buffer, size, "#log,%d,%lu,%08lx%08lx", group, (unsigned long)entry->seq,
+                        (unsigned long)header_word(entry->id, entry->argc), (unsigned long)entry->time_ms);
+    for (int i = 0; i < entry->argc && used > 0 && (size_t)used < size; i++)
+    {
+        used += snprintf(buffer + used, size - used, "%08lx", (unsigned long)entry->args[i]);
+    }
+    if (used < 0 || (size_t)used + 1 >= size)
+    {
+        return -1;
+    }
+    buffer[used++] = '\n';
+    buffer[used] = '\0';
+    return used;
+}
+
+static bool parse_word(const char *hex, uint32_t *word)
+{
+    *word = 0;
+    for (int i = 0; i < 8; i++)
+    {
+        char c = hex[i];
+        int digit = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10
+                                                   : c >= 'A' && c <= 'F' ? c - 'A' + 10
+                                                                          : -1;
+        if (digit < 0)
+        {
+            return false;
+        }
+        *word = (*word << 4) | (uint32_t)digit;
+    }
+    return true;
+}
+
+// The line may carry a prefix, e.g. the timestamp of a console capture
+bool event_entry_parse(const char *line, int *group, event_entry_t *entry)
+{
+    const char *start = strstr(line, "#log,");
+    unsigned long seq;
+    int offset = 0;
+    if (start == NULL || sscanf(start, "#log,%d,%lu,%n", group, &seq, &offset) != 2 || offset == 0)
+    {
+        return false;
+    }
+
+    uint32_t words[2 + EVENT_MAX_ARGS];
+    int count = 0;
+    const char *hex = start + offset;
+    while (count < 2 + EVENT_MAX_ARGS && parse_word(hex, &words[count]))
+    {
+        count++;
+        hex += 8;
+    }
+    if (count < 2 || !header_valid(words[0]) || header_argc(words[0]) != count - 2)
+    {
+        return false;
+    }
+
+    entry->seq = (uint32_t)seq;
+    entry->id = words[0] & 0xffff;
+    entry->argc = count - 2;
+    entry->time_ms = words[1];
+    memcpy(entry->args, words + 2, entry->argc * sizeof(words[0]));
+    return true;
+}
@@ -0,0 +1,124 @@
+#ifndef EVENT_RING_H
+#define EVENT_RING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "config.h"
+
+// Every deferred log message as X(id, tag, format). Entries only carry the id,
+// the host decoder (tools/log_decode) formats them with this same table, so new
+// messages go at the end and old ones keep their place. Arguments are 32-bit
+// words: %d/%i signed, %u/%x/%c unsigned, %f/%e/%g a float from event_float().
+// Length modifiers are ignored, there is no %s.
+#define EVENT_TABLE(X)                                                                                     \
+    X(EVENT_WAKE, TAG_PM, "Wake cause %u, boot count %u, epoch %lu")                                       \
+    X(EVENT_CYCLE_START, TAG_ADC, "Starting measurement cycle")                                            \
+    X(EVENT_MEASURE_FAILED, TAG_ADC, "Measurement failed with error: %d")                                  \
+    X(EVENT_TEMPERATURE, TAG_TEMP, "Temperature: %.2f°C")                                                  \
+    X(EVENT_SERIES_PROGRESS, TAG_TEMP, "Measurement %d/10 (Elapsed: %ld sec)")                             \
+    X(EVENT_NEXT_WAKE, TAG_TEMP, "Next wake in %lu s (battery %lu mV)")                                    \
+    X(EVENT_DEADBAND, TAG_TEMP, "Within deadband of the last reported reading, not queued")                \
+    X(EVENT_BUFFERED, TAG_PM, "Buffered %d/%d readings, skipping uplink")                                  \
+    X(EVENT_SERIES_DONE, TAG_PM, "Completed %d measurements.")                                             \
+    X(EVENT_SLEEP, TAG_PM, "Measurement %d/%d completed. Sleeping %lu s.")                                 \
+    X(EVENT_WATCHDOG_REINIT, TAG_PM, "Previous watchdog deinitialized")                                    \
+    X(EVENT_STAY_CONNECTED, TAG_PM, "Staying connected, sampling every %lu s")                             \
+    X(EVENT_STAY_CONNECTED_END, TAG_PM, "Leaving stay-connected mode")                                     \
+    X(EVENT_UPLOAD_OK, TAG_PM, "Batch upload successful")                                                  \
+    X(EVENT_UPLOAD_FAILED, TAG_WIFI, "Batch upload failed with error: %d")                                 \
+    X(EVENT_CONNECT_FAILED, TAG_WIFI, "Failed to connect")                                                 \
+    X(EVENT_UPLINK_BACK, TAG_WIFI, "Uplink back after %lu s, %lu ms radio time spent on failed wakes")     \
+    X(EVENT_UPLINK_BACKOFF, TAG_WIFI,                                                                      \
+      "Uplink failed %u times in a row, next attempt in %lu s (%lu outages, longest %lu s)")               \
+    X(EVENT_WIFI_START, TAG_WIFI, "WiFi station mode starting...")                                         \
+    X(EVENT_WIFI_CONNECTED, TAG_WIFI, "WiFi connected on channel %d")                                      \
+    X(EVENT_WIFI_DISCONNECTED, TAG_WIFI, "WiFi disconnected, reason %d")                                   \
+    X(EVENT_GOT_IP, TAG_WIFI, "Got IP address: %u.%u.%u.%u")                                               \
+    X(EVENT_WAKE_TO_IP_FAST, TAG_WIFI, "Wake to IP: %lu ms (fast reconnect)")                              \
+    X(EVENT_WAKE_TO_IP_FULL, TAG_WIFI, "Wake to IP: %lu ms (full connect)")                                \
+    X(EVENT_FAST_CONNECT_FAILED, TAG_WIFI, "Fast reconnect failed, falling back to full connect")          \
+    X(EVENT_WIFI_UP, TAG_WIFI, "WiFi connected successfully, boot_count: %d")                              \
+    X(EVENT_GATEWAY_FOUND, TAG_WIFI, "Gateway found on channel %u")                                        \
+    X(EVENT_UPLINK_CLOSED, TAG_WIFI, "Uplink closed by the server, reconnecting")                          \
+    X(EVENT_TLS_FULL, TAG_WIFI, "TLS full handshake: %lu ms, %u bytes out, %u in, session %u bytes")       \
+    X(EVENT_TLS_RESUMED, TAG_WIFI, "TLS resumed handshake: %lu ms, %u bytes out, %u in, session %u bytes") \
+    X(EVENT_SENDING, TAG_WIFI, "Sending %d readings")                                                      \
+    X(EVENT_DRAINED, TAG_WIFI, "Drained %d spooled readings, %lu left")                                    \
+    X(EVENT_SPOOLED, TAG_SPOOL, "Spooled %d readings, %lu pending")                                        \
+    X(EVENT_SPOOL_SCANNED, TAG_SPOOL, "Scanned spool: %lu pending readings")                               \
+    X(EVENT_SNTP_START, TAG_SNTP, "Starting SNTP, estimated clock error %lu ms")                           \
+    X(EVENT_CLOCK_OFF, TAG_SNTP, "Clock was off by %ld ms after %ld s")                                    \
+    X(EVENT_DRIFT, TAG_SNTP, "RTC drift estimate: %ld ppb")                                                \
+    X(EVENT_TIME_SYNCED, TAG_SNTP, "Time synchronized successfully, epoch %lu")                            \
+    X(EVENT_RF_CAL_FIRST, TAG_WIFI, "Full RF calibration at %.2f°C")                                       \
+    X(EVENT_RF_CAL, TAG_WIFI, "Full RF calibration at %.2f°C, the nearest stored data is from %.2f°C")     \
+    X(EVENT_RF_CAL_LOADED, TAG_WIFI, "RF calibration data from %.2f°C loaded at %.2f°C")                   \
+    X(EVENT_CYCLE_RESUMED, TAG_PM, "Reset reason %u, resuming the wake cycle at phase %u")                 \
+    X(EVENT_PHASE_OVERRUN, TAG_PM, "Phase %u overran its %lu ms deadline by %lu ms")                       \
+    X(EVENT_PHASE_DEFERRED, TAG_PM, "Phase %u interrupted %u times, deferred to a later wake")
+
+#define EVENT_ID(id, tag, format) id,
+typedef enum {
+    EVENT_TABLE(EVENT_ID)
+    EVENT_COUNT
+} event_id_t;
+#undef EVENT_ID
+
+#define EVENT_MAX_ARGS 4
+// "#log,group,seq," and up to 2 + EVENT_MAX_ARGS words in hex
+#define EVENT_LINE_MAX (32 + (2 + EVENT_MAX_ARGS) * 8)
+
+// Entries of 2 + argc words: header (marker, argc, id), RTC time in ms, args.
+// The oldest entries make room for new ones. Sequence numbers count entries
+// since the ring was reset, a reader notices from them what it has missed.
+typedef struct {
+    uint32_t magic;
+    uint32_t first_seq; // Of the oldest entry
+    uint16_t first;     // Word where the oldest entry starts
+    uint16_t used;      // Words taken by entries
+    uint16_t count;     // Entries
+    uint16_t reserved;
+    uint32_t words[LOG_RING_WORDS];
+} event_ring_t;
+
+typedef struct {
+    uint32_t seq;
+    uint16_t id;
+    uint8_t argc;
+    uint32_t time_ms;
+    uint32_t args[EVENT_MAX_ARGS];
+} event_entry_t;
+
+typedef struct {
+    uint32_t seq;      // Entry read next
+    uint16_t position; // Word it starts at
+} event_cursor_t;
+
+static inline uint32_t event_float(float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+void event_ring_reset(event_ring_t *ring);
+// Checks the bookkeeping and walks every entry, for rings that may hold garbage
+bool event_ring_valid(const event_ring_t *ring);
+void event_ring_push(event_ring_t *ring, uint16_t id, uint32_t time_ms, const uint32_t *args, int argc);
+
+event_cursor_t event_ring_begin(const event_ring_t *ring);
+// Skips ahead to the oldest entry when the cursor's was overwritten meanwhile
+bool event_ring_read(const event_ring_t *ring, event_cursor_t *cursor, event_entry_t *entry);
+// Drops the entries before seq, e.g. once they have been delivered
+void event_ring_consume(event_ring_t *ring, uint32_t seq);
+
+const char *event_tag(uint16_t id);
+// The message of an entry without tag and time, as ESP_LOGI would have printed it
+int event_format(const event_entry_t *entry, char *buffer, size_t size);
+// "#log,group,seq,<words in hex>\n" and back
+int event_entry_line(const event_entry_t *entry, int group, char *buffer, size_t size);
+bool event_entry_parse(const char *line, int *group, event_entry_t *entry);
+
+#endif // EVENT_RING_H
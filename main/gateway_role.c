@@ -0,0 +1,229 @@
+#include "gateway_role.h"
+#include "aggregator.h"
+#include "config.h"
+#include "rtc_store.h"
+#include "time_manager.h"
+#include "wifi_manager.h"
+#include <esp_log.h>
+#include <esp_now.h>
+#include <esp_timer.h>
+#include <esp_wifi.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/task.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <string.h>
+#include <unistd.h>
+
+typedef struct {
+    uint8_t mac[6];
+    uint8_t length;
+    uint8_t data[ESP_NOW_MAX_DATA_LEN];
+} gateway_frame_t;
+
+static QueueHandle_t frames = NULL;
+static volatile uint32_t queue_overflows = 0;
+static aggregator_t aggregator;
+
+// Lines handed from the gateway task to the forwarding task, which owns them
+// until the endpoint took all of them
+static char outbox[GATEWAY_BUFFER_SIZE];
+static volatile size_t outbox_length = 0;
+static TaskHandle_t forward_task_handle = NULL;
+
+// Runs in the WiFi task, anything beyond a copy waits for the gateway task
+static void on_received(const esp_now_recv_info_t *info, const uint8_t *data, int length)
+{
+    gateway_frame_t frame;
+    if (length <= 0 || length > (int)sizeof(frame.data))
+    {
+        return;
+    }
+    memcpy(frame.mac, info->src_addr, sizeof(frame.mac));
+    frame.length = (uint8_t)length;
+    memcpy(frame.data, data, length);
+    if (xQueueSend(frames, &frame, 0) != pdTRUE)
+    {
+        queue_overflows++;
+    }
+}
+
+// Every frame is answered, with the time and whether its readings are stored.
+// A peer is only needed to send to it, a full peer table gives up its first entry.
+static void reply(const gateway_frame_t *frame, aggregator_result_t result)
+{
+    if (!esp_now_is_peer_exist(frame->mac))
+    {
+        esp_now_peer_info_t peer = {.channel = 0, .ifidx = WIFI_IF_STA, .encrypt = false};
+        memcpy(peer.peer_addr, frame->mac, sizeof(peer.peer_addr));
+        if (esp_now_add_peer(&peer) == ESP_ERR_ESPNOW_FULL)
+        {
+            esp_now_peer_info_t first;
+            if (esp_now_fetch_peer(true, &first) == ESP_OK)
+            {
+                esp_now_del_peer(first.peer_addr);
+            }
+            esp_now_add_peer(&peer);
+        }
+    }
+
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    aggregator_reply_t answer = {
+        .flags = (time_is_valid() ? AGGREGATOR_REPLY_TIME_VALID : 0) |
+                 (result != AGGREGATOR_FULL ? AGGREGATOR_REPLY_STORED : 0),
+        .epoch_us = (int64_t)now.tv_sec * 1000000 + now.tv_usec,
+        .frame_crc = aggregator_frame_crc(frame->data, frame->length)};
+    uint8_t buffer[AGGREGATOR_REPLY_SIZE];
+    esp_now_send(frame->mac, buffer, aggregator_reply_encode(buffer, &answer));
+}
+
+// Sink of the aggregator, never blocks the gateway task on the network
+static bool hand_over(void *context, const char *data, size_t length)
+{
+    (void)context;
+    if (outbox_length != 0)
+    {
+        return false;
+    }
+    memcpy(outbox, data, length);
+    outbox_length = length;
+    xTaskNotifyGive(forward_task_handle);
+    return true;
+}
+
+static bool send_all(int sock, const char *data, size_t length)
+{
+    size_t sent = 0;
+    while (sent < length)
+    {
+        int result = send(sock, data + sent, length - sent, 0);
+        if (result <= 0)
+        {
+            return false;
+        }
+        sent += result;
+    }
+    return true;
+}
+
+// One connection to the endpoint for all sensors, reopened when it breaks. A
+// send that fails halfway is repeated in full, the endpoint may see a line twice.
+static void forward_task(void *arg)
+{
+    (void)arg;
+    int sock = -1;
+    for (;;)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        while (outbox_length != 0)
+        {
+            if (sock >= 0 && !uplink_alive(sock))
+            {
+                close(sock);
+                sock = -1;
+            }
+            if (sock < 0 && wifi_connected)
+            {
+                sock = open_uplink(SERVER_IP_ADDR, SERVER_PORT);
+            }
+            if (sock >= 0 && send_all(sock, outbox, outbox_length))
+            {
+                outbox_length = 0;
+                break;
+            }
+
+            ESP_LOGW(TAG_GATEWAY, "Forwarding to %s:%d failed, retrying in %d ms",
+                     SERVER_IP_ADDR, SERVER_PORT, GATEWAY_RECONNECT_MS);
+            if (sock >= 0)
+            {
+                close(sock);
+                sock = -1;
+            }
+            vTaskDelay(pdMS_TO_TICKS(GATEWAY_RECONNECT_MS));
+        }
+    }
+}
+
+// wifi_manager.c gives up after WIFI_MAXIMUM_RETRY, a gateway never does
+static void keep_associated(void)
+{
+    static int64_t next_attempt_us = 0;
+    if (wifi_connected || esp_timer_get_time() < next_attempt_us)
+    {
+        return;
+    }
+    esp_wifi_connect();
+    next_attempt_us = esp_timer_get_time() + GATEWAY_RECONNECT_MS * 1000LL;
+}
+
+static void log_stats(void)
+{
+    ESP_LOGI(TAG_GATEWAY, "%d sensors, %lu frames ok, %lu bad, %lu readings forwarded, "
+                          "%lu duplicates, %lu frames refused, %lu queue overflows",
+             aggregator.peer_count, (unsigned long)aggregator.frames_ok, (unsigned long)aggregator.frames_bad,
+             (unsigned long)aggregator.readings_out, (unsigned long)aggregator.duplicates,
+             (unsigned long)aggregator.refused, (unsigned long)queue_overflows);
+}
+
+// Stays associated without power save so sensors find it on the AP's channel
+// at any time, and flushes the lines of all sensors together
+void gateway_run(void)
+{
+    init_rtc_data();
+    init_time();
+    aggregator_init(&aggregator, DATA_MESSAGE);
+    frames = xQueueCreate(GATEWAY_QUEUE_LENGTH, sizeof(gateway_frame_t));
+    xTaskCreate(forward_task, "forward", GATEWAY_FORWARD_STACK_SIZE, NULL, tskIDLE_PRIORITY + 1,
+                &forward_task_handle);
+
+    wifi_init();
+    while (!wifi_connected)
+    {
+        keep_associated();
+        vTaskDelay(pdMS_TO_TICKS(GATEWAY_RECONNECT_MS));
+    }
+    ESP_ERROR_CHECK(esp_wifi_set_ps(WIFI_PS_NONE));
+    time_sync_start();
+    ESP_ERROR_CHECK(esp_now_init());
+    ESP_ERROR_CHECK(esp_now_register_recv_cb(on_received));
+
+    uint8_t channel;
+    wifi_second_chan_t second;
+    esp_wifi_get_channel(&channel, &second);
+    ESP_LOGI(TAG_GATEWAY, "Gateway listening on channel %u", channel);
+
+    int64_t next_flush_us = esp_timer_get_time() + GATEWAY_FLUSH_MS * 1000LL;
+    int64_t next_stats_us = esp_timer_get_time() + GATEWAY_STATS_SEC * 1000000LL;
+    for (;;)
+    {
+        gateway_frame_t frame;
+        int64_t wait_us = next_flush_us - esp_timer_get_time();
+        if (wait_us > 0 && xQueueReceive(frames, &frame, pdMS_TO_TICKS(wait_us / 1000) + 1) == pdTRUE)
+        {
+            aggregator_result_t result = aggregator_receive(&aggregator, frame.mac, frame.data, frame.length);
+            if (result != AGGREGATOR_BAD_FRAME)
+            {
+                reply(&frame, result);
+            }
+            // Flush early rather than turn sensors away
+            if (aggregator.length < sizeof(aggregator.lines) / 2)
+            {
+                continue;
+            }
+        }
+
+        time_sync_apply();
+        // Lines wait in the aggregator until the AP is back
+        keep_associated();
+        aggregator_flush(&aggregator, hand_over, NULL);
+        next_flush_us = esp_timer_get_time() + GATEWAY_FLUSH_MS * 1000LL;
+
+        if (esp_timer_get_time() >= next_stats_us)
+        {
+            log_stats();
+            next_stats_us += GATEWAY_STATS_SEC * 1000000LL;
+        }
+    }
+}
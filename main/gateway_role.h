@@ -0,0 +1,8 @@
+#ifndef GATEWAY_ROLE_H
+#define GATEWAY_ROLE_H
+
+// Firmware of a mains-powered gateway, selected with DEVICE_ROLE_GATEWAY.
+// Never returns.
+void gateway_run(void);
+
+#endif // GATEWAY_ROLE_H
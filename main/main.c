@@ -2,10 +2,21 @@
 #include "rtc_store.h"
 #include "wifi_manager.h"
 #include "sensor.h"
+#include "adc_engine.h"
 #include "power_manager.h"
+#include "time_manager.h"
+#include "wake_pipeline.h"
+#include "spool.h"
+#include "buttons.h"
+#include "trace.h"
+#include "uplink.h"
+#include "gateway_role.h"
+#include "event_log.h"
+#include "wake_cycle.h"
 #include <nvs_flash.h>
-#include <driver/gpio.h>
 #include <esp_log.h>
+#include <esp_random.h>
+#include <esp_timer.h>
 
 typedef enum
 {
@@ -14,15 +25,23 @@ typedef enum
     STATE_SLEEPING
 } system_state_t;
 
-static void init_buttons(void)
+// Decided when a cycle starts, a resumed one keeps them
+#define CYCLE_FLAG_UPLOAD 0x01 // The radio goes on this wake
+#define CYCLE_FLAG_SPOOL 0x02  // The batch moves to the spool without an upload
+
+static bool alarm_pending = false;
+static int64_t radio_start_us = 0; // When the connection attempt of this wake started
+
+// Fresh counters and scheduler history for a new measurement series
+static void start_measurement_series(void)
 {
-    gpio_config_t io_conf = {
-        .intr_type = GPIO_INTR_DISABLE,
-        .mode = GPIO_MODE_INPUT,
-        .pin_bit_mask = (1ULL << BUTTON_CALIBRATE) | (1ULL << BUTTON_START),
-        .pull_up_en = GPIO_PULLUP_ENABLE,
-    };
-    ESP_ERROR_CHECK(gpio_config(&io_conf));
+    update_rtc_data(rtc_store.hot.data.boot_count,
+                    0,
+                    0,
+                    rtc_store.cold.data.calibrated_resistor);
+    scheduler_state_t scheduler;
+    scheduler_reset(&scheduler);
+    update_scheduler(&scheduler);
 }
 
 static void init_nvs(void)
@@ -36,95 +55,377 @@ static void init_nvs(void)
     ESP_ERROR_CHECK(ret);
 }
 
-static adc_oneshot_unit_handle_t init_adc(void)
+// SNTP runs alongside the upload and is only waited for before the very first
+// sync. Without IP the gateway's reply to the link probe carried the time.
+static bool sync_time(uint32_t timeout_ms)
 {
-    adc_oneshot_unit_handle_t adc1_handle;
-    adc_oneshot_unit_init_cfg_t init_config1 = {
-        .unit_id = ADC_UNIT_1,
-        .ulp_mode = ADC_ULP_MODE_DISABLE};
-    ESP_ERROR_CHECK(adc_oneshot_new_unit(&init_config1, &adc1_handle));
+    if (UPLINK_TRANSPORT.has_ip && time_needs_sync())
+    {
+        time_sync_start();
+    }
+    time_sync_apply();
+    if (timeout_ms > wifi_budget_left_ms())
+    {
+        timeout_ms = wifi_budget_left_ms();
+    }
+    if (!time_is_valid() && !time_sync_wait(timeout_ms))
+    {
+        ESP_LOGE(TAG_SNTP, "Time sync failed, keeping readings buffered");
+        return false;
+    }
+    pipeline_complete(PIPELINE_TIME_READY);
+    return true;
+}
+
+static esp_err_t transmit(int64_t deadline_us)
+{
+#ifdef SEND_DATA
+    esp_err_t result = send_data(deadline_us);
+#else
+    (void)deadline_us;
+    rtc_batch_drop(rtc_batch_pending());
+    esp_err_t result = ESP_OK;
+#endif
 
-    adc_oneshot_chan_cfg_t config = {
-        .atten = ADC_ATTEN_DB_12,
-        .bitwidth = ADC_BITWIDTH_12};
-    ESP_ERROR_CHECK(adc_oneshot_config_channel(adc1_handle, ADC_CHANNEL_2, &config));
-    return adc1_handle;
+    // Give a resync that is still in flight a short grace period
+    if (time_needs_sync())
+    {
+        time_sync_wait(TIME_SYNC_GRACE_MS);
+    }
+    return result;
 }
 
-static void handle_measurements(adc_oneshot_unit_handle_t adc1_handle)
+// The uploads of stay-connected mode, under the deadlines of a wake cycle and
+// never past the one of the linger phase
+static esp_err_t upload_batch(int64_t linger_deadline_us)
 {
-    ESP_LOGI(TAG_ADC, "Starting measurement cycle");
-    esp_task_wdt_reset();
+    uint32_t left_ms = wake_cycle_left_ms(linger_deadline_us);
+    if (!sync_time(left_ms < CYCLE_TIME_SYNC_DEADLINE_MS ? left_ms : CYCLE_TIME_SYNC_DEADLINE_MS))
+    {
+        return ESP_ERR_TIMEOUT;
+    }
+    int64_t deadline_us = esp_timer_get_time() + CYCLE_TRANSMIT_DEADLINE_MS * 1000LL;
+    return transmit(deadline_us < linger_deadline_us ? deadline_us : linger_deadline_us);
+}
+
+static bool is_alarm(const sensor_reading_t *reading)
+{
+    return reading->centi_celsius > ALARM_HIGH_CENTI || reading->centi_celsius < ALARM_LOW_CENTI;
+}
+
+// After failed uploads the radio stays off until the backoff expires, the
+// readings meanwhile go to the spool batch by batch
+static bool connect_due(uint32_t now)
+{
+    return rtc_batch_upload_due(now, 1) && backoff_allows(&rtc_store.hot.data.backoff, now);
+}
 
-    // Try to connect to WiFi with retries
-    int wifi_retry = 0;
-    const int max_wifi_retries = 3;
+static bool spool_due(uint32_t now)
+{
+    return rtc_batch_upload_due(now, 1) && rtc_batch_pending() + 1 >= BATCH_SEND_THRESHOLD;
+}
 
-    while (!wifi_connected && wifi_retry < max_wifi_retries)
+// One result per wake that used the radio, kept with the outage statistics in RTC
+static void record_upload(bool success, int64_t radio_start_us)
+{
+    backoff_state_t backoff = rtc_store.hot.data.backoff;
+    uint32_t now = time_now();
+    if (success)
     {
-        wifi_quick_connect();
-        if (wifi_connected)
+        uint32_t outage_sec = backoff_success(&backoff, now);
+        if (outage_sec > 0)
         {
-            break;
+            EVENT_LOG(EVENT_UPLINK_BACK, outage_sec, backoff.outage_radio_ms);
         }
-        wifi_retry++;
-        ESP_LOGI(TAG_WIFI, "WiFi connection attempt %d/%d failed", wifi_retry, max_wifi_retries);
-        vTaskDelay(pdMS_TO_TICKS(1000));
+    }
+    else
+    {
+        uint32_t radio_ms = (uint32_t)((esp_timer_get_time() - radio_start_us) / 1000);
+        uint32_t wait_sec = backoff_failure(&backoff, now, radio_ms, esp_random());
+        EVENT_LOG(EVENT_UPLINK_BACKOFF, backoff.failures, wait_sec, backoff.outages, backoff.longest_outage_sec);
+    }
+    update_backoff(&backoff);
+}
+
+// Timer wakes that only buffer a reading skip NVS, the spool, the watchdog and
+// the acquisition task. Returns only when the wake needs the full path.
+static void sample_only_wake(void)
+{
+    if (esp_sleep_get_wakeup_cause() != ESP_SLEEP_WAKEUP_TIMER || !is_rtc_data_valid() ||
+        connect_due(time_now()) || spool_due(time_now()) || init_adc_engine() != ESP_OK)
+    {
+        return;
+    }
+
+    init_sensor();
+    sensor_reading_t reading;
+    esp_err_t result = measure_temperature(&reading);
+    deinit_adc_engine();
+    if (result != ESP_OK)
+    {
+        EVENT_LOG(EVENT_MEASURE_FAILED, result);
+        enter_deep_sleep();
+    }
+
+    // An alarm is measured again and uploaded by the full path
+    if (is_alarm(&reading))
+    {
+        ESP_LOGW(TAG_TEMP, "Alarm at %.2f°C, uploading now", reading.centi_celsius / 100.0f);
+        alarm_pending = true;
+        return;
+    }
+
+    queue_reading(&reading);
+    EVENT_LOG(EVENT_BUFFERED, rtc_batch_pending(), BATCH_SEND_THRESHOLD);
+    enter_deep_sleep();
+}
+
+// Short intervals keep the association and the uplink socket. The device light
+// sleeps between samples and reports each queued reading right away, until the
+// scheduler stretches the interval past the break-even, the AP drops us or the
+// deadline of the phase comes.
+static void stay_connected(int64_t deadline_us)
+{
+    uint32_t interval_sec = rtc_store.hot.data.scheduler.interval_sec;
+    if (!UPLINK_TRANSPORT.has_ip || !stay_connected_pays_off(interval_sec))
+    {
+        return;
     }
 
-    if (wifi_connected)
+    EVENT_LOG(EVENT_STAY_CONNECTED, interval_sec);
+    wifi_stay_connected(true, interval_sec);
+    int64_t next_sample_us = esp_timer_get_time() + interval_sec * 1000000LL;
+    while (wifi_connected && stay_connected_pays_off(interval_sec) && next_sample_us < deadline_us)
     {
-        esp_err_t result = measure_and_send(adc1_handle);
-        if (result == ESP_OK)
+        light_sleep_until(next_sample_us);
+
+        sensor_reading_t reading;
+        esp_err_t result = measure_temperature(&reading);
+        if (result != ESP_OK)
         {
-            ESP_LOGI(TAG_PM, "Measurement successful");
-            // Make sure WiFi is properly stopped
-            esp_wifi_disconnect();
-            esp_wifi_stop();
-            esp_wifi_deinit();
-
-            adc_oneshot_del_unit(adc1_handle);
-            esp_task_wdt_delete(NULL);
-            enter_deep_sleep();
+            EVENT_LOG(EVENT_MEASURE_FAILED, result);
         }
         else
         {
-            ESP_LOGI(TAG_ADC, "Measurement failed with error: %d", result);
-            // Reset measurement count on failure
-            update_rtc_data(rtc_store.data.boot_count,
-                            0,
-                            0,
-                            rtc_store.data.calibrated_resistor);
-            esp_wifi_stop();
-            vTaskDelay(pdMS_TO_TICKS(1000));
+            queue_reading(&reading);
+        }
+        if (rtc_batch_pending() > 0)
+        {
+            result = upload_batch(deadline_us);
+            if (result != ESP_OK)
+            {
+                // The readings stay in the batch for the next attempt
+                EVENT_LOG(EVENT_UPLOAD_FAILED, result);
+            }
         }
+
+        interval_sec = rtc_store.hot.data.scheduler.interval_sec;
+        next_sample_us += interval_sec * 1000000LL;
     }
-    else
+    wifi_stay_connected(false, 0);
+    EVENT_LOG(EVENT_STAY_CONNECTED_END);
+}
+
+// Sampling runs in its own task while the radio associates
+static phase_result_t acquire_start(int64_t deadline_us)
+{
+    (void)deadline_us;
+    // An alarm ignores the backoff, the radio budget still bounds it
+    uint32_t now = time_now();
+    bool upload_due = alarm_pending || connect_due(now);
+    wake_cycle_set_flags(upload_due ? CYCLE_FLAG_UPLOAD : spool_due(now) ? CYCLE_FLAG_SPOOL : 0);
+    pipeline_start_acquisition();
+    return PHASE_PENDING;
+}
+
+// Joined before anything is transmitted
+static phase_result_t acquire_join(int64_t deadline_us)
+{
+    sensor_reading_t reading;
+    esp_err_t result = pipeline_acquisition_result(&reading, wake_cycle_left_ms(deadline_us));
+    if (result != ESP_OK)
+    {
+        EVENT_LOG(EVENT_MEASURE_FAILED, result);
+        // Reset measurement count on failure
+        update_rtc_data(rtc_store.hot.data.boot_count,
+                        0,
+                        0,
+                        rtc_store.cold.data.calibrated_resistor);
+        return PHASE_ABORTED;
+    }
+    queue_reading(&reading);
+    return PHASE_DONE;
+}
+
+// One attempt per wake, the transport retries within the radio budget. The
+// radio stays off until the batch is full enough or too old, or while backing off.
+static phase_result_t connect_uplink(int64_t deadline_us)
+{
+    if (!(wake_cycle_flags() & CYCLE_FLAG_UPLOAD))
     {
-        ESP_LOGI(TAG_WIFI, "Failed to connect to WiFi after multiple attempts");
+        return PHASE_ABORTED;
+    }
+    radio_start_us = esp_timer_get_time();
+    if (UPLINK_TRANSPORT.connect(deadline_us) != ESP_OK)
+    {
+        EVENT_LOG(EVENT_CONNECT_FAILED);
+        record_upload(false, radio_start_us);
         // Reset boot count to force full WiFi initialization next time
         update_rtc_data(0,
-                        rtc_store.data.measurement_count,
-                        rtc_store.data.first_measurement_time,
-                        rtc_store.data.calibrated_resistor);
-        vTaskDelay(pdMS_TO_TICKS(1000));
+                        rtc_store.hot.data.measurement_count,
+                        rtc_store.hot.data.first_measurement_time,
+                        rtc_store.cold.data.calibrated_resistor);
+        return PHASE_ABORTED;
+    }
+    pipeline_complete(PIPELINE_NETWORK_READY);
+    return PHASE_DONE;
+}
+
+static phase_result_t sync_clock(int64_t deadline_us)
+{
+    if (!sync_time(wake_cycle_left_ms(deadline_us)))
+    {
+        record_upload(false, radio_start_us);
+        EVENT_LOG(EVENT_UPLOAD_FAILED, ESP_ERR_TIMEOUT);
+        return PHASE_ABORTED;
     }
+    return PHASE_DONE;
+}
+
+static phase_result_t transmit_batch(int64_t deadline_us)
+{
+    esp_err_t result = transmit(deadline_us);
+    record_upload(result == ESP_OK, radio_start_us);
+    if (result != ESP_OK)
+    {
+        EVENT_LOG(EVENT_UPLOAD_FAILED, result);
+        return PHASE_ABORTED;
+    }
+    EVENT_LOG(EVENT_UPLOAD_OK);
+    return PHASE_DONE;
+}
+
+static phase_result_t linger(int64_t deadline_us)
+{
+    stay_connected(deadline_us);
+    return PHASE_DONE;
+}
+
+// Readings of an upload that was not due, failed or was deferred go to the spool.
+// The configuration stays dirty in RTC memory when the deadline leaves no time
+// for an NVS commit, the next wake commits it.
+static phase_result_t persist(int64_t deadline_us)
+{
+    uint8_t flags = wake_cycle_flags();
+    if (radio_start_us != 0)
+    {
+        // Make sure the radio is properly stopped
+        UPLINK_TRANSPORT.disconnect();
+    }
+    if (flags & CYCLE_FLAG_UPLOAD)
+    {
+        if (!wake_cycle_done(CYCLE_TRANSMIT))
+        {
+            spool_store_batch();
+        }
+    }
+    else
+    {
+        if (flags & CYCLE_FLAG_SPOOL)
+        {
+            spool_store_batch();
+        }
+        EVENT_LOG(EVENT_BUFFERED, rtc_batch_pending(), BATCH_SEND_THRESHOLD);
+    }
+    if (wake_cycle_left_ms(deadline_us) == 0)
+    {
+        return PHASE_ABORTED;
+    }
+    backup_to_nvs();
+    return PHASE_DONE;
+}
+
+// Durable phases leave their result in RTC memory or flash, a resumed cycle
+// repeats the others from the resume phase of the one that was interrupted
+static const cycle_phase_desc_t cycle_phases[CYCLE_PHASE_COUNT] = {
+    [CYCLE_ACQUIRE] = {CYCLE_ACQUIRE_DEADLINE_MS, acquire_start, acquire_join, true, CYCLE_CONNECT, CYCLE_ACQUIRE},
+    [CYCLE_CONNECT] = {CYCLE_CONNECT_DEADLINE_MS, connect_uplink, NULL, false, CYCLE_PERSIST, CYCLE_ACQUIRE},
+    [CYCLE_TIME_SYNC] = {CYCLE_TIME_SYNC_DEADLINE_MS, sync_clock, NULL, false, CYCLE_PERSIST, CYCLE_ACQUIRE},
+    [CYCLE_TRANSMIT] = {CYCLE_TRANSMIT_DEADLINE_MS, transmit_batch, NULL, true, CYCLE_PERSIST, CYCLE_ACQUIRE},
+    [CYCLE_STAY_CONNECTED] = {0, linger, NULL, false, CYCLE_PERSIST, CYCLE_PERSIST},
+    [CYCLE_PERSIST] = {CYCLE_PERSIST_DEADLINE_MS, persist, NULL, false, CYCLE_PHASE_COUNT, CYCLE_PERSIST},
+};
+
+static void handle_measurements(void)
+{
+    EVENT_LOG(EVENT_CYCLE_START);
+    wake_cycle_run(cycle_phases);
+    // A burst that is still running is left to deep sleep, which powers the ADC down
+    if (pipeline_finish_acquisition(ADC_BURST_TIMEOUT_MS))
+    {
+        deinit_adc_engine();
+    }
+    esp_task_wdt_delete(NULL);
+    enter_deep_sleep();
 }
 
 void app_main(void)
 {
+    init_trace();
+    init_event_log();
+    init_wake_cycle();
+    init_power_management();
+#ifdef DEVICE_ROLE_GATEWAY
+    init_nvs();
+    gateway_run();
+#endif
+    sample_only_wake();
+
     // Initialize components
+    trace_begin(TRACE_INIT);
+    init_pipeline();
     init_nvs();
+    pipeline_complete(PIPELINE_NVS_READY);
     init_rtc_data();
+    init_spool();
+    init_time();
     init_watchdog();
-    adc_oneshot_unit_handle_t adc1_handle = init_adc();
-    init_buttons();
+    ESP_ERROR_CHECK(init_adc_engine());
+    init_sensor();
+    ESP_ERROR_CHECK(init_buttons());
+    trace_end(TRACE_INIT);
     system_state_t current_state = STATE_IDLE;
     bool start_measurements = false;
-    if (!is_fresh_start())
+
+    // A button press during idle deep sleep arrives as the wake reason. Someone
+    // pressed a button or reset the board, so someone may be at the console.
+    wake_reason_t wake_reason = get_wake_reason();
+    if (wake_reason != WAKE_TIMER)
+    {
+        event_log_dump();
+    }
+    switch (wake_reason)
     {
+    case WAKE_TIMER:
         current_state = STATE_MEASURING;
         start_measurements = true;
+        break;
+    case WAKE_CALIBRATE:
+        calibrate_sensor();
+        break;
+    case WAKE_START:
+        start_measurement_series();
+        current_state = STATE_MEASURING;
+        start_measurements = true;
+        break;
+    case WAKE_FRESH_START:
+        // A crash or brownout in the middle of a series carries on with it
+        if (wake_cycle_interrupted())
+        {
+            current_state = STATE_MEASURING;
+            start_measurements = true;
+        }
+        break;
     }
 
     while (1)
@@ -134,50 +435,25 @@ void app_main(void)
         switch (current_state)
         {
         case STATE_IDLE:
-            // Handle calibration button
-            if (gpio_get_level(BUTTON_CALIBRATE) == 0)
-            {
-                vTaskDelay(pdMS_TO_TICKS(BUTTON_DEBOUNCE_MS));
-                if (gpio_get_level(BUTTON_CALIBRATE) == 0)
-                {
-                    calibrate_sensor(adc1_handle);
-                    // Wait for button release
-                    while (gpio_get_level(BUTTON_CALIBRATE) == 0)
-                    {
-                        vTaskDelay(pdMS_TO_TICKS(10));
-                    }
-                    // Add delay after calibration
-                    vTaskDelay(pdMS_TO_TICKS(1000));
-                }
-            }
-
-            // Handle start button
-            if (gpio_get_level(BUTTON_START) == 0)
+            wake_cycle_stop();
+            // Sleeps until a debounced press, no polling
+            switch (buttons_wait_press())
             {
-                vTaskDelay(pdMS_TO_TICKS(BUTTON_DEBOUNCE_MS));
-                if (gpio_get_level(BUTTON_START) == 0)
-                {
-                    // Reset measurement counters
-                    update_rtc_data(rtc_store.data.boot_count,
-                                    0,
-                                    0,
-                                    rtc_store.data.calibrated_resistor);
-                    start_measurements = true;
-                    current_state = STATE_MEASURING;
-                    // Wait for button release
-                    while (gpio_get_level(BUTTON_START) == 0)
-                    {
-                        vTaskDelay(pdMS_TO_TICKS(10));
-                    }
-                }
+            case BUTTON_EVENT_CALIBRATE:
+                calibrate_sensor();
+                break;
+            case BUTTON_EVENT_START:
+                start_measurement_series();
+                start_measurements = true;
+                current_state = STATE_MEASURING;
+                break;
             }
-            vTaskDelay(pdMS_TO_TICKS(100));
             break;
 
         case STATE_MEASURING:
             if (start_measurements)
             {
-                handle_measurements(adc1_handle);
+                handle_measurements();
                 current_state = STATE_SLEEPING;
             }
             break;
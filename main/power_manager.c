@@ -1,30 +1,75 @@
 #include "power_manager.h"
 #include "config.h"
 #include "rtc_store.h"
+#include "trace.h"
+#include "event_log.h"
 #include <esp_sleep.h>
+#include <driver/gpio.h>
 #include <esp_task_wdt.h>
+#include <esp_timer.h>
+#include <esp_pm.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
 #include <esp_log.h>
 
 RTC_DATA_ATTR uint32_t esp_reset_count = 0;
 
-bool is_fresh_start(void)
+#ifdef CONFIG_PM_ENABLE
+static const char *const boost_names[CPU_BOOST_COUNT] = {"associate", "convert", "send"};
+static esp_pm_lock_handle_t boost_locks[CPU_BOOST_COUNT];
+static bool boost_held[CPU_BOOST_COUNT];
+static int boosts_active = 0;
+static int64_t boost_since_us = 0;
+static int64_t boosted_us = 0;     // This wake with at least one boost held
+static int64_t light_sleep_us = 0; // This wake in automatic light sleep
+static portMUX_TYPE boost_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Runs in the idle task with interrupts off, right after the CPU is back
+static esp_err_t IRAM_ATTR light_sleep_exit(int64_t sleep_time_us, void *arg)
+{
+    (void)arg;
+    light_sleep_us += sleep_time_us;
+    return ESP_OK;
+}
+#endif
+
+wake_reason_t get_wake_reason(void)
 {
-    esp_sleep_wakeup_cause_t wakeup_reason = esp_sleep_get_wakeup_cause();
-    // If it's not a deep sleep wakeup, increment reset count
-    if (wakeup_reason != ESP_SLEEP_WAKEUP_TIMER)
+    switch (esp_sleep_get_wakeup_cause())
     {
-        rtc_store.data.boot_count = 0;
-        esp_reset_count++;
-        return true;
+    case ESP_SLEEP_WAKEUP_TIMER:
+        return WAKE_TIMER;
+    case ESP_SLEEP_WAKEUP_GPIO:
+    {
+        uint64_t pins = esp_sleep_get_gpio_wakeup_status();
+        if (pins & (1ULL << BUTTON_CALIBRATE))
+        {
+            return WAKE_CALIBRATE;
+        }
+        if (pins & (1ULL << BUTTON_START))
+        {
+            return WAKE_START;
+        }
+        break;
     }
-    return false;
+    default:
+        break;
+    }
+
+    // Anything else is treated like a reset
+    update_rtc_data(0,
+                    rtc_store.hot.data.measurement_count,
+                    rtc_store.hot.data.first_measurement_time,
+                    rtc_store.cold.data.calibrated_resistor);
+    esp_reset_count++;
+    return WAKE_FRESH_START;
 }
 
 void init_watchdog(void)
 {
     if (esp_task_wdt_deinit() == ESP_OK)
     {
-        ESP_LOGI(TAG_PM, "Previous watchdog deinitialized");
+        EVENT_LOG(EVENT_WATCHDOG_REINIT);
     }
     esp_task_wdt_config_t wdt_config = {
         .timeout_ms = WATCHDOG_TIMEOUT_SEC * 1000,
@@ -34,28 +79,173 @@ void init_watchdog(void)
     ESP_ERROR_CHECK(esp_task_wdt_add(NULL));
 }
 
+// The clock follows the locks: PM_MAX_FREQ_MHZ while a boost or a driver holds
+// one, PM_MIN_FREQ_MHZ otherwise, and light sleep once every task is blocked
+void init_power_management(void)
+{
+#ifdef CONFIG_PM_ENABLE
+    esp_pm_config_t pm_config = {
+        .max_freq_mhz = PM_MAX_FREQ_MHZ,
+        .min_freq_mhz = PM_MIN_FREQ_MHZ,
+#ifdef PM_LIGHT_SLEEP
+        .light_sleep_enable = true
+#endif
+    };
+    ESP_ERROR_CHECK(esp_pm_configure(&pm_config));
+
+    for (int i = 0; i < CPU_BOOST_COUNT; i++)
+    {
+        ESP_ERROR_CHECK(esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, boost_names[i], &boost_locks[i]));
+    }
+
+    esp_pm_sleep_cbs_register_config_t sleep_cbs = {
+        .exit_cb = light_sleep_exit};
+    ESP_ERROR_CHECK(esp_pm_light_sleep_register_cbs(&sleep_cbs));
+#endif
+}
+
+// Nested and overlapping boosts are fine, each one is held at most once
+void cpu_boost_begin(cpu_boost_t boost)
+{
+    (void)boost;
+#ifdef CONFIG_PM_ENABLE
+    if (boost_locks[boost] == NULL)
+    {
+        return;
+    }
+    portENTER_CRITICAL(&boost_lock);
+    bool acquire = !boost_held[boost];
+    if (acquire)
+    {
+        boost_held[boost] = true;
+        if (boosts_active++ == 0)
+        {
+            boost_since_us = esp_timer_get_time();
+        }
+    }
+    portEXIT_CRITICAL(&boost_lock);
+    if (acquire)
+    {
+        esp_pm_lock_acquire(boost_locks[boost]);
+    }
+#endif
+}
+
+// Safe to call on every exit path, ending a boost that is not held does nothing
+void cpu_boost_end(cpu_boost_t boost)
+{
+    (void)boost;
+#ifdef CONFIG_PM_ENABLE
+    if (boost_locks[boost] == NULL)
+    {
+        return;
+    }
+    portENTER_CRITICAL(&boost_lock);
+    bool release = boost_held[boost];
+    if (release)
+    {
+        boost_held[boost] = false;
+        if (--boosts_active == 0)
+        {
+            boosted_us += esp_timer_get_time() - boost_since_us;
+        }
+    }
+    portEXIT_CRITICAL(&boost_lock);
+    if (release)
+    {
+        esp_pm_lock_release(boost_locks[boost]);
+    }
+#endif
+}
+
+// Average current of the deep sleep cycle at this interval: sleep, a boot per
+// sample and a reconnect per upload. Staying associated pays off when it is lower.
+bool stay_connected_pays_off(uint32_t interval_sec)
+{
+    (void)interval_sec;
+#if defined(STAY_CONNECTED) && defined(PM_LIGHT_SLEEP) && defined(CONFIG_PM_ENABLE)
+    const fast_connect_t *cached = &rtc_store.hot.data.fast_connect;
+    if (interval_sec == 0 || !cached->valid || cached->wake_to_ip_ms == 0)
+    {
+        return false;
+    }
+
+    uint32_t upload_sec = interval_sec * BATCH_SEND_THRESHOLD;
+    if (upload_sec > BATCH_MAX_AGE_SEC)
+    {
+        upload_sec = interval_sec > BATCH_MAX_AGE_SEC ? interval_sec : BATCH_MAX_AGE_SEC;
+    }
+    // mA times ms is uA times s
+    uint32_t boot_uas = WAKE_BOOT_MS * CPU_ACTIVE_MA;
+    uint32_t reconnect_uas = cached->wake_to_ip_ms * RADIO_ACTIVE_MA;
+    uint32_t deep_sleep_ua = DEEP_SLEEP_UA + boot_uas / interval_sec + reconnect_uas / upload_sec;
+    return deep_sleep_ua > STAY_CONNECTED_UA;
+#else
+    return false;
+#endif
+}
+
+// Blocks in short steps for the watchdog, tickless idle light sleeps in between
+void light_sleep_until(int64_t wake_at_us)
+{
+    const int64_t step_us = WATCHDOG_TIMEOUT_SEC * 1000000LL / 2;
+    for (int64_t now = esp_timer_get_time(); now < wake_at_us; now = esp_timer_get_time())
+    {
+        int64_t wait_us = wake_at_us - now < step_us ? wake_at_us - now : step_us;
+        vTaskDelay(pdMS_TO_TICKS(wait_us / 1000) + 1);
+        esp_task_wdt_reset();
+    }
+}
+
+// Split of the active period by clock: boosted, driver chosen or idle, and
+// light sleep. esp_timer keeps counting through light sleep.
+static void trace_power_modes(void)
+{
+#ifdef CONFIG_PM_ENABLE
+    for (int i = 0; i < CPU_BOOST_COUNT; i++)
+    {
+        cpu_boost_end(i);
+    }
+    int64_t awake_us = esp_timer_get_time();
+    int64_t dfs_us = awake_us - boosted_us - light_sleep_us;
+    trace_record(TRACE_CPU_MAX, (uint32_t)boosted_us);
+    trace_record(TRACE_CPU_DFS, dfs_us > 0 ? (uint32_t)dfs_us : 0);
+    trace_record(TRACE_LIGHT_SLEEP, (uint32_t)light_sleep_us);
+#endif
+}
+
 void enter_deep_sleep(void)
 {
-    if (rtc_store.data.measurement_count >= REQUIRED_MEASUREMENTS)
+    // Configuration changes of this wake are committed once, right before sleeping
+    backup_to_nvs();
+
+    // The interval was chosen by the scheduler when the last reading was queued
+    uint32_t sleep_sec = rtc_store.hot.data.scheduler.interval_sec;
+    if (sleep_sec == 0)
     {
-        ESP_LOGI(TAG_PM, "Completed %d measurements. Going to extended sleep.",
-                 REQUIRED_MEASUREMENTS);
+        sleep_sec = DEEP_SLEEP_TIME_SEC;
+    }
+
+    if (rtc_store.hot.data.measurement_count >= REQUIRED_MEASUREMENTS)
+    {
+        EVENT_LOG(EVENT_SERIES_DONE, REQUIRED_MEASUREMENTS);
         // Reset measurement count and first measurement time
-        update_rtc_data(rtc_store.data.boot_count,
+        update_rtc_data(rtc_store.hot.data.boot_count,
                         0, // Reset measurement count
                         0, // Reset first measurement time
-                        rtc_store.data.calibrated_resistor);
-        esp_deep_sleep(MEASUREMENT_WINDOW_SEC * 1000000ULL);
-    }
-    else
-    {
-        ESP_LOGI(TAG_PM, "Measurement %d/%d completed. Short sleep.",
-                 rtc_store.data.measurement_count, REQUIRED_MEASUREMENTS);
-        // Keep the current measurement count
-        update_rtc_data(rtc_store.data.boot_count,
-                        rtc_store.data.measurement_count,
-                        rtc_store.data.first_measurement_time,
-                        rtc_store.data.calibrated_resistor);
-        esp_deep_sleep(DEEP_SLEEP_TIME_SEC * 1000000ULL);
+                        rtc_store.cold.data.calibrated_resistor);
     }
+    EVENT_LOG(EVENT_SLEEP, rtc_store.hot.data.measurement_count, REQUIRED_MEASUREMENTS, sleep_sec);
+    trace_power_modes();
+    trace_sleep(sleep_sec * 1000000ULL);
+    esp_deep_sleep(sleep_sec * 1000000ULL);
+}
+
+// Idle without a timer, only a button press wakes the device again
+void enter_idle_sleep(uint64_t wake_pins)
+{
+    backup_to_nvs();
+    ESP_LOGI(TAG_PM, "Idle, deep sleep until a button is pressed");
+    esp_deep_sleep_enable_gpio_wakeup(wake_pins, ESP_GPIO_WAKEUP_GPIO_LOW);
+    esp_deep_sleep_start();
 }
@@ -2,12 +2,35 @@
 #define POWER_MANAGER_H
 
 #include <stdbool.h>
+#include <stdint.h>
 #include "esp_sleep.h"
 
+typedef enum {
+    WAKE_FRESH_START, // Power-on or reset
+    WAKE_TIMER,       // Scheduled measurement
+    WAKE_CALIBRATE,   // Calibrate button pressed during idle deep sleep
+    WAKE_START        // Start button pressed during idle deep sleep
+} wake_reason_t;
+
+// Work that finishes sooner at full clock, everything else runs at the
+// frequency the drivers ask for, or sleeps
+typedef enum {
+    CPU_BOOST_ASSOCIATE, // WPA handshake until the AP accepted us
+    CPU_BOOST_CONVERT,   // Conversion and calibration table rebuilds
+    CPU_BOOST_SEND,      // TCP connect and transmission
+    CPU_BOOST_COUNT
+} cpu_boost_t;
+
 extern uint32_t esp_reset_count;
 
-bool is_fresh_start(void);
+wake_reason_t get_wake_reason(void);
 void enter_deep_sleep(void);
+void enter_idle_sleep(uint64_t wake_pins);
 void init_watchdog(void);
+void init_power_management(void);
+void cpu_boost_begin(cpu_boost_t boost);
+void cpu_boost_end(cpu_boost_t boost);
+bool stay_connected_pays_off(uint32_t interval_sec);
+void light_sleep_until(int64_t wake_at_us);
 
 #endif // POWER_MANAGER_H
\ No newline at end of file
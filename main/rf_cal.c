@@ -0,0 +1,190 @@
+#include "rf_cal.h"
+#include "config.h"
+#include "event_log.h"
+#include "rtc_store.h"
+#include "trace.h"
+#include <esp_log.h>
+#include <esp_phy_init.h>
+#include <esp_wifi.h>
+#include <nvs_flash.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// ESP-IDF keeps one set of RF calibration data in NVS. A boot without any runs
+// a full calibration and stores it, deep sleep wakes load it as it is, other
+// resets calibrate partially on top of it. Left alone, a device calibrated on
+// the bench keeps the bench data for good after it went into a freezer.
+//
+// Here every full calibration is also saved to one of RF_CAL_SLOTS slots with
+// the temperature it was taken at. The first start of a wake keeps ESP-IDF's
+// data while it is from within RF_CAL_DELTA_CENTI of the latest reading, copies
+// a slot that is, or erases the data to make the PHY calibrate in full. A slot
+// per temperature the device spends time at makes defrost cycles cost a copy
+// each way instead of two calibrations.
+#define RF_CAL_NAMESPACE "rf_cal"
+
+static bool started = false; // The PHY only initializes on its first start after boot
+
+#ifdef RF_CAL_DELTA_CENTI
+static esp_phy_calibration_data_t blob; // Close to 2 KB, not for the stack of the main task
+
+// The reading of this wake is still being taken while the radio starts
+static bool latest_reading(int16_t *centi_celsius)
+{
+    const scheduler_state_t *scheduler = &rtc_store.hot.data.scheduler;
+    if (scheduler->count == 0)
+    {
+        return false;
+    }
+    *centi_celsius = scheduler->centi_celsius[(scheduler->head + SCHEDULER_HISTORY - 1) % SCHEDULER_HISTORY];
+    return true;
+}
+
+static int nearest_slot(const rf_cal_state_t *state, int16_t centi_celsius)
+{
+    int nearest = -1;
+    for (int i = 0; i < RF_CAL_SLOTS; i++)
+    {
+        if ((state->stored & (1u << i)) &&
+            (nearest < 0 || abs(centi_celsius - state->centi_celsius[i]) <
+                                abs(centi_celsius - state->centi_celsius[nearest])))
+        {
+            nearest = i;
+        }
+    }
+    return nearest;
+}
+
+// An empty slot, otherwise the nearest one, which is out of range anyway
+static int replaced_slot(const rf_cal_state_t *state, int nearest)
+{
+    for (int i = 0; i < RF_CAL_SLOTS; i++)
+    {
+        if (!(state->stored & (1u << i)))
+        {
+            return i;
+        }
+    }
+    return nearest;
+}
+
+static esp_err_t transfer_slot(int slot, bool save)
+{
+    char key[8];
+    snprintf(key, sizeof(key), "slot%d", slot);
+    nvs_handle_t nvs_handle;
+    esp_err_t err = nvs_open(RF_CAL_NAMESPACE, save ? NVS_READWRITE : NVS_READONLY, &nvs_handle);
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+    if (save)
+    {
+        err = nvs_set_blob(nvs_handle, key, &blob, sizeof(blob));
+        if (err == ESP_OK)
+        {
+            err = nvs_commit(nvs_handle);
+        }
+    }
+    else
+    {
+        size_t length = sizeof(blob);
+        err = nvs_get_blob(nvs_handle, key, &blob, &length);
+        if (err == ESP_OK && length != sizeof(blob))
+        {
+            err = ESP_ERR_INVALID_SIZE;
+        }
+    }
+    nvs_close(nvs_handle);
+    return err;
+}
+
+// Returns the slot the full calibration goes to, -1 when none is needed
+static int prepare_calibration(rf_cal_state_t *state, int16_t centi_celsius)
+{
+    int nearest = nearest_slot(state, centi_celsius);
+    if (nearest >= 0 && abs(centi_celsius - state->centi_celsius[nearest]) <= RF_CAL_DELTA_CENTI)
+    {
+        if (nearest == state->active)
+        {
+            return -1;
+        }
+        // ESP-IDF validates the data against its version and the MAC on loading
+        if (transfer_slot(nearest, false) == ESP_OK && esp_phy_store_cal_data_to_nvs(&blob) == ESP_OK)
+        {
+            EVENT_LOG(EVENT_RF_CAL_LOADED, event_float(state->centi_celsius[nearest] / 100.0f),
+                      event_float(centi_celsius / 100.0f));
+            state->active = nearest;
+            return -1;
+        }
+        ESP_LOGW(TAG_WIFI, "RF calibration slot %d unreadable", nearest);
+        state->stored &= ~(1u << nearest);
+        nearest = nearest_slot(state, centi_celsius);
+    }
+
+    if (nearest < 0)
+    {
+        EVENT_LOG(EVENT_RF_CAL_FIRST, event_float(centi_celsius / 100.0f));
+    }
+    else
+    {
+        EVENT_LOG(EVENT_RF_CAL, event_float(centi_celsius / 100.0f),
+                  event_float(state->centi_celsius[nearest] / 100.0f));
+    }
+    state->active = RF_CAL_SLOTS;
+    esp_err_t err = esp_phy_erase_cal_data_in_nvs();
+    if (err != ESP_OK)
+    {
+        ESP_LOGW(TAG_WIFI, "Failed to erase RF calibration data: %s", esp_err_to_name(err));
+        return -1;
+    }
+    return replaced_slot(state, nearest);
+}
+
+// ESP-IDF stored the data of the full calibration while starting
+static void save_calibration(rf_cal_state_t *state, int slot, int16_t centi_celsius)
+{
+    esp_err_t err = esp_phy_load_cal_data_from_nvs(&blob);
+    if (err == ESP_OK)
+    {
+        err = transfer_slot(slot, true);
+    }
+    if (err != ESP_OK)
+    {
+        ESP_LOGW(TAG_WIFI, "Failed to save RF calibration data: %s", esp_err_to_name(err));
+        state->stored &= ~(1u << slot);
+        return;
+    }
+    state->centi_celsius[slot] = centi_celsius;
+    state->stored |= 1u << slot;
+    state->active = slot;
+}
+#endif
+
+esp_err_t rf_start(void)
+{
+#ifdef RF_CAL_DELTA_CENTI
+    rf_cal_state_t state = rtc_store.cold.data.rf_cal;
+    int16_t centi_celsius = 0;
+    int slot = -1;
+    if (!started && latest_reading(&centi_celsius))
+    {
+        slot = prepare_calibration(&state, centi_celsius);
+    }
+#endif
+    started = true;
+
+    trace_begin(TRACE_RF_START);
+    esp_err_t err = esp_wifi_start();
+    trace_end(TRACE_RF_START);
+
+#ifdef RF_CAL_DELTA_CENTI
+    if (slot >= 0 && err == ESP_OK)
+    {
+        save_calibration(&state, slot, centi_celsius);
+    }
+    update_rf_calibration(&state);
+#endif
+    return err;
+}
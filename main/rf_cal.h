@@ -0,0 +1,10 @@
+#ifndef RF_CAL_H
+#define RF_CAL_H
+
+#include <esp_err.h>
+
+// esp_wifi_start() for every WiFi and ESP-NOW bring-up. Before the first start
+// of a wake it picks the RF calibration data for the latest temperature reading.
+esp_err_t rf_start(void);
+
+#endif // RF_CAL_H
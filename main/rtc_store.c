@@ -3,62 +3,166 @@
 #include <esp_log.h>
 #include <nvs_flash.h>
 #include <esp_crc.h>
+#include <string.h>
 
-RTC_DATA_ATTR rtc_store_t rtc_store = {
-    .crc = 0,
-    .data = {
-        .boot_count = 0,
-        .measurement_count = 0,
-        .first_measurement_time = 0,
-        .calibrated_resistor = SERIES_RESISTOR,
-    }};
+// NVS keys of the cold region and its layout version
+#define NVS_KEY_COLD "cold"
+#define NVS_KEY_VERSION "version"
+#define NVS_KEY_LEGACY "rtc_data"
 
-static uint32_t calculate_rtc_crc(void)
+// What NVS_KEY_LEGACY holds: the whole store of the firmware before the regions
+typedef struct {
+    int boot_count;
+    int measurement_count;
+    uint64_t first_measurement_time;
+    float calibrated_resistor;
+    wifi_config_t wifi_config;
+} legacy_data_t;
+
+// Earlier layouts of the cold region under NVS_KEY_COLD, by NVS_KEY_VERSION
+typedef struct {
+    uint32_t crc;
+    struct {
+        float calibrated_resistor;
+        wifi_config_t wifi_config;
+    } data;
+} cold_v2_t; // Versions 2 and 3
+
+typedef struct {
+    uint32_t crc;
+    struct {
+        float calibrated_resistor;
+        uint32_t excitation_settle_us;
+        wifi_config_t wifi_config;
+    } data;
+} cold_v4_t; // Versions 4 to 6
+
+typedef union {
+    rtc_cold_t current;
+    cold_v2_t v2;
+    cold_v4_t v4;
+} cold_blob_t;
+
+// Garbage on power-up, init_rtc_data() then sees a version mismatch. No-init,
+// so queued readings survive the panics and brownouts a wake cycle resumes from.
+RTC_NOINIT_ATTR rtc_store_t rtc_store;
+
+static uint32_t region_crc(const void *data, size_t size)
 {
-    return esp_crc32_le(0, (uint8_t *)&rtc_store.data, sizeof(rtc_store.data));
+    return esp_crc32_le(0, (const uint8_t *)data, size);
 }
 
-bool is_rtc_data_valid(void)
+static void seal_hot(void)
 {
-    if (rtc_store.data.boot_count < 0 ||
-        rtc_store.data.measurement_count < 0 ||
-        rtc_store.data.measurement_count > REQUIRED_MEASUREMENTS ||
-        rtc_store.data.calibrated_resistor <= 0)
-    {
-        return false;
-    }
+    rtc_store.hot.crc = region_crc(&rtc_store.hot.data, sizeof(rtc_store.hot.data));
+}
+
+static void seal_batch(void)
+{
+    rtc_store.batch.crc = region_crc(&rtc_store.batch.data, sizeof(rtc_store.batch.data));
+}
+
+static void seal_cold(void)
+{
+    rtc_store.cold.crc = region_crc(&rtc_store.cold.data, sizeof(rtc_store.cold.data));
+    rtc_store.cold_dirty = true;
+}
+
+static bool is_hot_valid(void)
+{
+    return rtc_store.hot.data.boot_count >= 0 &&
+           rtc_store.hot.data.measurement_count >= 0 &&
+           rtc_store.hot.data.measurement_count <= REQUIRED_MEASUREMENTS &&
+           rtc_store.hot.crc == region_crc(&rtc_store.hot.data, sizeof(rtc_store.hot.data));
+}
+
+static bool is_batch_valid(void)
+{
+    return rtc_store.batch.data.head < BATCH_CAPACITY &&
+           rtc_store.batch.data.count <= BATCH_CAPACITY &&
+           rtc_store.batch.crc == region_crc(&rtc_store.batch.data, sizeof(rtc_store.batch.data));
+}
+
+static bool is_cold_valid(const rtc_cold_t *cold)
+{
+    return cold->data.calibrated_resistor > 0 &&
+           cold->crc == region_crc(&cold->data, sizeof(cold->data));
+}
 
-    uint32_t calculated_crc = calculate_rtc_crc();
-    return (calculated_crc == rtc_store.crc);
+bool is_rtc_data_valid(void)
+{
+    return rtc_store.version == RTC_STORE_VERSION && is_hot_valid() && is_batch_valid() &&
+           is_cold_valid(&rtc_store.cold);
 }
 
 void update_rtc_data(int boot_count, int measurement_count,
                      uint64_t first_measurement_time, float calibrated_resistor)
 {
-    rtc_store.data.boot_count = boot_count;
-    rtc_store.data.measurement_count = measurement_count;
-    rtc_store.data.first_measurement_time = first_measurement_time;
-    rtc_store.data.calibrated_resistor = calibrated_resistor;
-    rtc_store.crc = calculate_rtc_crc();
+    // Only the regions that actually change are re-sealed
+    if (rtc_store.hot.data.boot_count != boot_count ||
+        rtc_store.hot.data.measurement_count != measurement_count ||
+        rtc_store.hot.data.first_measurement_time != first_measurement_time)
+    {
+        rtc_store.hot.data.boot_count = boot_count;
+        rtc_store.hot.data.measurement_count = measurement_count;
+        rtc_store.hot.data.first_measurement_time = first_measurement_time;
+        seal_hot();
+    }
+    if (rtc_store.cold.data.calibrated_resistor != calibrated_resistor)
+    {
+        rtc_store.cold.data.calibrated_resistor = calibrated_resistor;
+        seal_cold();
+    }
 }
 
-// Initialize RTC data
+// Validate and recover each region on its own
 void init_rtc_data(void)
 {
-    if (!is_rtc_data_valid())
+    if (rtc_store.version != RTC_STORE_VERSION)
+    {
+        ESP_LOGI(TAG_PM, "RTC layout version %lu, expected %d, discarding",
+                 (unsigned long)rtc_store.version, RTC_STORE_VERSION);
+        memset(&rtc_store, 0, sizeof(rtc_store));
+        rtc_store.version = RTC_STORE_VERSION;
+    }
+
+    if (!is_hot_valid())
+    {
+        ESP_LOGI(TAG_PM, "RTC counters invalid, resetting");
+        memset(&rtc_store.hot.data, 0, sizeof(rtc_store.hot.data));
+        seal_hot();
+    }
+
+    if (!is_batch_valid())
+    {
+        ESP_LOGI(TAG_PM, "RTC batch invalid, discarding buffered readings");
+        memset(&rtc_store.batch.data, 0, sizeof(rtc_store.batch.data));
+        seal_batch();
+    }
+
+    if (!is_cold_valid(&rtc_store.cold))
     {
-        ESP_LOGI(TAG_PM, "RTC data invalid, attempting restore from NVS");
+        ESP_LOGI(TAG_PM, "RTC configuration invalid, attempting restore from NVS");
         if (!restore_from_nvs())
         {
             ESP_LOGI(TAG_PM, "NVS restore failed, resetting to defaults");
-            // Reset to defaults
-            update_rtc_data(0, 0, 0, SERIES_RESISTOR);
+            memset(&rtc_store.cold.data, 0, sizeof(rtc_store.cold.data));
+            rtc_store.cold.data.calibrated_resistor = SERIES_RESISTOR;
+            seal_cold();
+            // Defaults are not worth a flash write
+            rtc_store.cold_dirty = false;
         }
     }
 }
-// Backup data to NVS
+
+// Commit the cold region to NVS, a no-op unless it changed since the last commit
 void backup_to_nvs(void)
 {
+    if (!rtc_store.cold_dirty)
+    {
+        return;
+    }
+
     nvs_handle_t nvs_handle;
     esp_err_t err = nvs_open(RTC_STORE_NAMESPACE, NVS_READWRITE, &nvs_handle);
     if (err != ESP_OK)
@@ -67,22 +171,93 @@ void backup_to_nvs(void)
         return;
     }
 
-    err = nvs_set_blob(nvs_handle, "rtc_data", &rtc_store.data, sizeof(rtc_store.data));
+    err = nvs_set_blob(nvs_handle, NVS_KEY_COLD, &rtc_store.cold, sizeof(rtc_store.cold));
+    if (err == ESP_OK)
+    {
+        err = nvs_set_u32(nvs_handle, NVS_KEY_VERSION, RTC_STORE_VERSION);
+    }
     if (err != ESP_OK)
     {
         ESP_LOGE(TAG_PM, "Error writing to NVS: %s", esp_err_to_name(err));
     }
 
-    err = nvs_commit(nvs_handle);
-    if (err != ESP_OK)
+    if (err == ESP_OK)
+    {
+        err = nvs_commit(nvs_handle);
+        if (err != ESP_OK)
+        {
+            ESP_LOGE(TAG_PM, "Error committing NVS: %s", esp_err_to_name(err));
+        }
+    }
+    if (err == ESP_OK)
     {
-        ESP_LOGE(TAG_PM, "Error committing NVS: %s", esp_err_to_name(err));
+        rtc_store.cold_dirty = false;
+        // The full-state blob of earlier firmware is superseded once the region
+        // that took over its configuration is committed
+        if (nvs_erase_key(nvs_handle, NVS_KEY_LEGACY) == ESP_OK)
+        {
+            nvs_commit(nvs_handle);
+        }
     }
 
     nvs_close(nvs_handle);
 }
 
-// Restore data from NVS
+// Fields an earlier layout did not have start out as after a reset to defaults.
+// The cold region is left dirty, so backup_to_nvs() stores it in the current layout.
+static void take_over_cold(float calibrated_resistor, uint32_t excitation_settle_us,
+                           const wifi_config_t *wifi_config)
+{
+    memset(&rtc_store.cold.data, 0, sizeof(rtc_store.cold.data));
+    rtc_store.cold.data.calibrated_resistor = calibrated_resistor;
+    rtc_store.cold.data.excitation_settle_us = excitation_settle_us;
+    rtc_store.cold.data.rf_cal.active = RF_CAL_SLOTS;
+    memcpy(&rtc_store.cold.data.wifi_config, wifi_config, sizeof(wifi_config_t));
+    seal_cold();
+}
+
+// Takes the configuration over from the blob of earlier firmware, which
+// backup_to_nvs() erases once the cold region is committed
+static bool migrate_legacy(nvs_handle_t nvs_handle)
+{
+    legacy_data_t legacy;
+    size_t length = sizeof(legacy);
+    esp_err_t err = nvs_get_blob(nvs_handle, NVS_KEY_LEGACY, &legacy, &length);
+    if (err != ESP_OK || length != sizeof(legacy) || !(legacy.calibrated_resistor > 0))
+    {
+        return false;
+    }
+
+    ESP_LOGI(TAG_PM, "Migrating the configuration of earlier firmware");
+    take_over_cold(legacy.calibrated_resistor, 0, &legacy.wifi_config);
+    return true;
+}
+
+// Field by field from the cold region of an earlier layout version. The new
+// blob overwrites it when backup_to_nvs() commits the migrated region.
+static bool migrate_cold(uint32_t version, const cold_blob_t *blob, size_t length)
+{
+    if (version >= 2 && version <= 3 && length == sizeof(blob->v2) && blob->v2.data.calibrated_resistor > 0 &&
+        blob->v2.crc == region_crc(&blob->v2.data, sizeof(blob->v2.data)))
+    {
+        take_over_cold(blob->v2.data.calibrated_resistor, 0, &blob->v2.data.wifi_config);
+    }
+    else if (version >= 4 && version <= 6 && length == sizeof(blob->v4) &&
+             blob->v4.data.calibrated_resistor > 0 &&
+             blob->v4.crc == region_crc(&blob->v4.data, sizeof(blob->v4.data)))
+    {
+        take_over_cold(blob->v4.data.calibrated_resistor, blob->v4.data.excitation_settle_us,
+                       &blob->v4.data.wifi_config);
+    }
+    else
+    {
+        return false;
+    }
+    ESP_LOGI(TAG_PM, "Migrating the NVS configuration from layout version %lu", (unsigned long)version);
+    return true;
+}
+
+// Restore the cold region from NVS
 bool restore_from_nvs(void)
 {
     nvs_handle_t nvs_handle;
@@ -93,8 +268,19 @@ bool restore_from_nvs(void)
         return false;
     }
 
-    size_t required_size = sizeof(rtc_store.data);
-    err = nvs_get_blob(nvs_handle, "rtc_data", &rtc_store.data, &required_size);
+    uint32_t version = 0;
+    cold_blob_t blob;
+    size_t required_size = sizeof(blob);
+    err = nvs_get_u32(nvs_handle, NVS_KEY_VERSION, &version);
+    if (err == ESP_OK)
+    {
+        err = nvs_get_blob(nvs_handle, NVS_KEY_COLD, &blob, &required_size);
+    }
+    if (err == ESP_ERR_NVS_NOT_FOUND && migrate_legacy(nvs_handle))
+    {
+        nvs_close(nvs_handle);
+        return true;
+    }
     nvs_close(nvs_handle);
 
     if (err != ESP_OK)
@@ -102,7 +288,166 @@ bool restore_from_nvs(void)
         ESP_LOGE(TAG_PM, "Error reading from NVS: %s", esp_err_to_name(err));
         return false;
     }
+    // The blob is written before its version, a reset in between leaves a
+    // current blob under the version it replaced
+    bool current = version <= RTC_STORE_VERSION && required_size == sizeof(blob.current) &&
+                   is_cold_valid(&blob.current);
+    if (!current)
+    {
+        if (version < RTC_STORE_VERSION && migrate_cold(version, &blob, required_size))
+        {
+            return true;
+        }
+        ESP_LOGE(TAG_PM, "NVS configuration is stale or corrupt");
+        return false;
+    }
 
-    rtc_store.crc = calculate_rtc_crc();
+    memcpy(&rtc_store.cold, &blob.current, sizeof(blob.current));
+    rtc_store.cold_dirty = false;
     return true;
 }
+
+void update_fast_connect(const fast_connect_t *fast_connect)
+{
+    memcpy(&rtc_store.hot.data.fast_connect, fast_connect, sizeof(fast_connect_t));
+    seal_hot();
+}
+
+void update_clock_sync(const clock_sync_t *clock)
+{
+    memcpy(&rtc_store.hot.data.clock, clock, sizeof(clock_sync_t));
+    seal_hot();
+}
+
+void update_scheduler(const scheduler_state_t *scheduler)
+{
+    memcpy(&rtc_store.hot.data.scheduler, scheduler, sizeof(scheduler_state_t));
+    seal_hot();
+}
+
+void update_backoff(const backoff_state_t *backoff)
+{
+    memcpy(&rtc_store.hot.data.backoff, backoff, sizeof(backoff_state_t));
+    seal_hot();
+}
+
+void update_gateway_channel(uint8_t channel)
+{
+    rtc_store.hot.data.gateway_channel = channel;
+    seal_hot();
+}
+
+// Marks the configuration dirty only when it differs from what is stored
+void update_wifi_config(const wifi_config_t *wifi_config)
+{
+    if (memcmp(&rtc_store.cold.data.wifi_config, wifi_config, sizeof(wifi_config_t)) != 0)
+    {
+        memcpy(&rtc_store.cold.data.wifi_config, wifi_config, sizeof(wifi_config_t));
+        seal_cold();
+    }
+}
+
+void update_excitation_settle(uint32_t settle_us)
+{
+    if (rtc_store.cold.data.excitation_settle_us != settle_us)
+    {
+        rtc_store.cold.data.excitation_settle_us = settle_us;
+        seal_cold();
+    }
+}
+
+void update_rf_calibration(const rf_cal_state_t *rf_cal)
+{
+    if (memcmp(&rtc_store.cold.data.rf_cal, rf_cal, sizeof(rf_cal_state_t)) != 0)
+    {
+        memcpy(&rtc_store.cold.data.rf_cal, rf_cal, sizeof(rf_cal_state_t));
+        seal_cold();
+    }
+}
+
+// Append a reading to the batch ring, overwriting the oldest one when full
+void rtc_batch_append(uint16_t raw, uint32_t timestamp)
+{
+    uint16_t index = (rtc_store.batch.data.head + rtc_store.batch.data.count) % BATCH_CAPACITY;
+    rtc_store.batch.data.records[index].raw = raw;
+    rtc_store.batch.data.records[index].timestamp = timestamp;
+
+    if (rtc_store.batch.data.count < BATCH_CAPACITY)
+    {
+        rtc_store.batch.data.count++;
+    }
+    else
+    {
+        rtc_store.batch.data.head = (rtc_store.batch.data.head + 1) % BATCH_CAPACITY;
+        ESP_LOGW(TAG_PM, "Batch full, dropped oldest reading");
+    }
+    seal_batch();
+}
+
+int rtc_batch_pending(void)
+{
+    return rtc_store.batch.data.count;
+}
+
+// Index 0 is the oldest pending reading
+const batch_record_t *rtc_batch_get(int index)
+{
+    if (index < 0 || index >= rtc_store.batch.data.count)
+    {
+        return NULL;
+    }
+    return &rtc_store.batch.data.records[(rtc_store.batch.data.head + index) % BATCH_CAPACITY];
+}
+
+// Remove the oldest readings once they have been delivered
+void rtc_batch_drop(int count)
+{
+    if (count > rtc_store.batch.data.count)
+    {
+        count = rtc_store.batch.data.count;
+    }
+    rtc_store.batch.data.head = (rtc_store.batch.data.head + count) % BATCH_CAPACITY;
+    rtc_store.batch.data.count -= count;
+    seal_batch();
+}
+
+// The radio only comes up once the batch is full enough or too old,
+// incoming counts readings that are still being acquired
+bool rtc_batch_upload_due(uint32_t now, int incoming)
+{
+    int count = rtc_store.batch.data.count + incoming;
+    if (count == 0)
+    {
+        return false;
+    }
+    if (count >= BATCH_SEND_THRESHOLD)
+    {
+        return true;
+    }
+
+    // Without a valid clock we need a connection for SNTP anyway
+    if (now < MIN_VALID_EPOCH)
+    {
+        return true;
+    }
+    if (rtc_store.batch.data.count == 0)
+    {
+        return false;
+    }
+    uint32_t oldest = rtc_batch_get(0)->timestamp;
+    return oldest < MIN_VALID_EPOCH || (now - oldest) >= BATCH_MAX_AGE_SEC;
+}
+
+// Move readings taken before the first sync onto the synced time base
+void rtc_batch_rebase(uint32_t offset)
+{
+    for (int i = 0; i < rtc_store.batch.data.count; i++)
+    {
+        batch_record_t *record = &rtc_store.batch.data.records[(rtc_store.batch.data.head + i) % BATCH_CAPACITY];
+        if (record->timestamp < MIN_VALID_EPOCH)
+        {
+            record->timestamp += offset;
+        }
+    }
+    seal_batch();
+}
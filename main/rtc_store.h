@@ -2,19 +2,92 @@
 #define RTC_STORE_H
 
 #include <esp_wifi.h>
+#include <esp_netif.h>
+#include "config.h"
+#include "scheduler.h"
+#include "backoff.h"
 
 // Define the NVS namespace
 #define RTC_STORE_NAMESPACE "storage"
 
+typedef struct {
+    uint32_t timestamp; // Epoch seconds when the reading was taken
+    uint16_t raw;       // Divider ratio as a linearized ADC code in 1/16 LSB
+} batch_record_t;
+
+// Last known good association, reused to skip the scan and DHCP after deep sleep
+typedef struct {
+    bool valid;
+    uint8_t bssid[6];
+    uint8_t channel;
+    esp_netif_ip_info_t ip_info;
+    esp_netif_dns_info_t dns;
+    uint32_t lease_time;       // Epoch seconds when the DHCP lease was obtained
+    uint32_t wake_to_ip_ms;    // From the start of the last successful connection to its IP
+} fast_connect_t;
+
+// Reference point of the last SNTP sync, the RTC clock extrapolates from it
+typedef struct {
+    bool synced;
+    int64_t sync_epoch_us; // SNTP time at the last sync
+    uint64_t sync_rtc_us;  // RTC clock at the last sync
+    int32_t drift_ppb;     // Estimated RTC clock drift, positive when it runs fast
+    bool drift_valid;
+} clock_sync_t;
+
+// RF calibration data saved per temperature, see rf_cal.c
+typedef struct {
+    int16_t centi_celsius[RF_CAL_SLOTS]; // Temperature each slot was calibrated at
+    uint8_t stored;                      // Bit per slot that holds data
+    uint8_t active;                      // Slot copied into ESP-IDF's own entry, RF_CAL_SLOTS when unknown
+} rf_cal_state_t;
+
+// Bumped whenever the layout below changes. Older contents of RTC memory are
+// discarded, restore_from_nvs() migrates the cold region in NVS.
+#define RTC_STORE_VERSION 7
+
+// Changes on most wakes and is only kept in RTC memory
 typedef struct {
     uint32_t crc;
     struct {
         int boot_count;
         int measurement_count;
         uint64_t first_measurement_time;
+        fast_connect_t fast_connect;
+        clock_sync_t clock;
+        scheduler_state_t scheduler;
+        backoff_state_t backoff;
+        uint8_t gateway_channel; // Where the ESP-NOW gateway last acked, 0 before that
+    } data;
+} rtc_hot_t;
+
+typedef struct {
+    uint32_t crc;
+    struct {
+        uint16_t head; // Index of the oldest pending reading
+        uint16_t count;
+        batch_record_t records[BATCH_CAPACITY];
+    } data;
+} rtc_batch_t;
+
+// Calibration and network configuration, mirrored in NVS
+typedef struct {
+    uint32_t crc;
+    struct {
         float calibrated_resistor;
+        uint32_t excitation_settle_us; // Measured by calibrate_sensor(), 0 until then
+        rf_cal_state_t rf_cal;
         wifi_config_t wifi_config;
     } data;
+} rtc_cold_t;
+
+// Each region has its own CRC so a corrupted counter does not cost the calibration
+typedef struct {
+    uint32_t version;
+    rtc_hot_t hot;
+    rtc_batch_t batch;
+    rtc_cold_t cold;
+    bool cold_dirty; // Cold region changed since the last NVS commit
 } rtc_store_t;
 
 void init_rtc_data(void);
@@ -23,6 +96,21 @@ void update_rtc_data(int boot_count, int measurement_count,
 bool is_rtc_data_valid(void);
 void backup_to_nvs(void);
 bool restore_from_nvs(void);
+void update_fast_connect(const fast_connect_t *fast_connect);
+void update_clock_sync(const clock_sync_t *clock);
+void update_wifi_config(const wifi_config_t *wifi_config);
+void update_excitation_settle(uint32_t settle_us);
+void update_rf_calibration(const rf_cal_state_t *rf_cal);
+void update_scheduler(const scheduler_state_t *scheduler);
+void update_backoff(const backoff_state_t *backoff);
+void update_gateway_channel(uint8_t channel);
+
+void rtc_batch_append(uint16_t raw, uint32_t timestamp);
+int rtc_batch_pending(void);
+const batch_record_t *rtc_batch_get(int index);
+void rtc_batch_drop(int count);
+bool rtc_batch_upload_due(uint32_t now, int incoming);
+void rtc_batch_rebase(uint32_t offset);
 
 extern rtc_store_t rtc_store;
 
@@ -0,0 +1,144 @@
+#include "scheduler.h"
+#include <string.h>
+
+void scheduler_reset(scheduler_state_t *state)
+{
+    memset(state, 0, sizeof(*state));
+}
+
+static void record(scheduler_state_t *state, const scheduler_input_t *input)
+{
+    state->centi_celsius[state->head] = (int16_t)input->centi_celsius;
+    state->timestamp[state->head] = input->now;
+    state->head = (state->head + 1) % SCHEDULER_HISTORY;
+    if (state->count < SCHEDULER_HISTORY)
+    {
+        state->count++;
+    }
+}
+
+// Index 0 is the newest reading
+static int history_index(const scheduler_state_t *state, int age)
+{
+    return (state->head + SCHEDULER_HISTORY - 1 - age) % SCHEDULER_HISTORY;
+}
+
+// Time in which the temperature moves SCHEDULER_STEP_CENTI at the rate seen between two readings
+static uint32_t interval_for_step(const scheduler_state_t *state, int newer, int older)
+{
+    int a = history_index(state, newer);
+    int b = history_index(state, older);
+    uint32_t dt = state->timestamp[a] - state->timestamp[b];
+    int32_t delta = state->centi_celsius[a] - state->centi_celsius[b];
+    uint32_t change = (uint32_t)(delta < 0 ? -delta : delta);
+    if (change == 0 || dt == 0)
+    {
+        return SCHEDULER_MAX_INTERVAL_SEC;
+    }
+    uint64_t interval = (uint64_t)SCHEDULER_STEP_CENTI * dt / change;
+    return interval > SCHEDULER_MAX_INTERVAL_SEC ? SCHEDULER_MAX_INTERVAL_SEC : (uint32_t)interval;
+}
+
+// The original schedule: REQUIRED_MEASUREMENTS short sleeps, then one long one
+static uint32_t fixed_next_interval(scheduler_state_t *state, const scheduler_input_t *input)
+{
+    (void)input;
+    if (++state->wakes >= REQUIRED_MEASUREMENTS)
+    {
+        state->wakes = 0;
+        return MEASUREMENT_WINDOW_SEC;
+    }
+    return DEEP_SLEEP_TIME_SEC;
+}
+
+// Sample faster while the temperature moves. The last step reacts to the start
+// of a defrost, the whole history keeps noise from shortening the interval.
+static uint32_t adaptive_next_interval(scheduler_state_t *state, const scheduler_input_t *input)
+{
+    (void)input;
+    if (state->count < 2)
+    {
+        return SCHEDULER_MIN_INTERVAL_SEC;
+    }
+
+    uint32_t recent = interval_for_step(state, 0, 1);
+    uint32_t window = interval_for_step(state, 0, state->count - 1);
+    uint32_t interval = recent < window ? recent : window;
+
+    // Back off gradually so a single quiet step does not skip a whole transient
+    if (state->interval_sec > 0 && interval > state->interval_sec * 2)
+    {
+        interval = state->interval_sec * 2;
+    }
+    return interval;
+}
+
+const scheduler_policy_t scheduler_policy_fixed = {
+    .name = "fixed",
+    .next_interval = fixed_next_interval,
+    .deadband = false,
+};
+
+const scheduler_policy_t scheduler_policy_adaptive = {
+    .name = "adaptive",
+    .next_interval = adaptive_next_interval,
+    .deadband = true,
+};
+
+// Below SCHEDULER_BATTERY_OK_MV the shortest interval stretches linearly
+// towards the one the low battery wake budget allows
+static uint32_t battery_floor(uint32_t battery_mv)
+{
+    const uint32_t budget_interval = 3600 / SCHEDULER_LOW_BATTERY_WAKES_PER_HOUR;
+    if (battery_mv == 0 || battery_mv >= SCHEDULER_BATTERY_OK_MV)
+    {
+        return 0;
+    }
+    if (battery_mv <= SCHEDULER_BATTERY_LOW_MV)
+    {
+        return budget_interval;
+    }
+    uint32_t span = SCHEDULER_BATTERY_OK_MV - SCHEDULER_BATTERY_LOW_MV;
+    uint32_t depth = SCHEDULER_BATTERY_OK_MV - battery_mv;
+    return SCHEDULER_MIN_INTERVAL_SEC + (budget_interval - SCHEDULER_MIN_INTERVAL_SEC) * depth / span;
+}
+
+static bool is_report_due(const scheduler_state_t *state, const scheduler_input_t *input)
+{
+    if (!state->reported || input->now < state->reported_time ||
+        input->now - state->reported_time >= SCHEDULER_HEARTBEAT_SEC)
+    {
+        return true;
+    }
+    int32_t delta = input->centi_celsius - state->reported_centi;
+    return delta >= SCHEDULER_DEADBAND_CENTI || delta <= -SCHEDULER_DEADBAND_CENTI;
+}
+
+scheduler_decision_t scheduler_step(scheduler_state_t *state, const scheduler_policy_t *policy,
+                                    const scheduler_input_t *input)
+{
+    scheduler_decision_t decision;
+    record(state, input);
+
+    uint32_t interval = policy->next_interval(state, input);
+    uint32_t floor = battery_floor(input->battery_mv);
+    if (interval < floor)
+    {
+        interval = floor;
+    }
+    if (interval < SCHEDULER_MIN_INTERVAL_SEC)
+    {
+        interval = SCHEDULER_MIN_INTERVAL_SEC;
+    }
+    state->interval_sec = interval;
+    decision.sleep_sec = interval;
+
+    decision.report = !policy->deadband || is_report_due(state, input);
+    if (decision.report)
+    {
+        state->reported = true;
+        state->reported_centi = (int16_t)input->centi_celsius;
+        state->reported_time = input->now;
+    }
+    return decision;
+}
@@ -0,0 +1,48 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "config.h"
+
+#define SCHEDULER_HISTORY 8
+
+// Kept in RTC memory between wakes
+typedef struct {
+    int16_t centi_celsius[SCHEDULER_HISTORY];
+    uint32_t timestamp[SCHEDULER_HISTORY];
+    uint8_t head; // Next slot to write
+    uint8_t count;
+    uint16_t wakes; // Wakes since the policy last started a new cycle
+    uint32_t interval_sec;
+    bool reported;
+    int16_t reported_centi;
+    uint32_t reported_time;
+} scheduler_state_t;
+
+typedef struct {
+    uint32_t now; // Seconds, only differences are used
+    int32_t centi_celsius;
+    uint32_t battery_mv; // 0 when not measured
+} scheduler_input_t;
+
+typedef struct {
+    uint32_t sleep_sec;
+    bool report; // Queue this reading for the uplink
+} scheduler_decision_t;
+
+// A policy picks the next interval from the history, the reading is already recorded
+typedef struct {
+    const char *name;
+    uint32_t (*next_interval)(scheduler_state_t *state, const scheduler_input_t *input);
+    bool deadband; // Only report readings that moved or are due for a heartbeat
+} scheduler_policy_t;
+
+extern const scheduler_policy_t scheduler_policy_fixed;
+extern const scheduler_policy_t scheduler_policy_adaptive;
+
+void scheduler_reset(scheduler_state_t *state);
+scheduler_decision_t scheduler_step(scheduler_state_t *state, const scheduler_policy_t *policy,
+                                    const scheduler_input_t *input);
+
+#endif // SCHEDULER_H
@@ -1,117 +1,297 @@
 #include "sensor.h"
 #include "config.h"
 #include "rtc_store.h"
+#include "adc_engine.h"
+#include "thermistor.h"
+#include "power_manager.h"
 #include "wifi_manager.h"
+#include "time_manager.h"
+#include "scheduler.h"
+#include "trace.h"
+#include "event_log.h"
 #include <esp_log.h>
 #include <math.h>
+#include <stdlib.h>
 #include <esp_timer.h>
+#ifdef THERMISTOR_EXCITATION_GPIO
+#include <driver/gpio.h>
+#include <esp_rom_sys.h>
+#endif
+
+#define EXCITATION_SETTLE_PROBES 32
+
+// Only rebuilt when calibration moved the series resistor away from the generated default
+RTC_DATA_ATTR static thermistor_table_t calibrated_table;
 
-void calibrate_sensor(adc_oneshot_unit_handle_t adc1_handle)
+static void refresh_conversion_table(void)
 {
-    ESP_LOGI(TAG_ADC, "Starting calibration at 0°C...");
+    float series_resistor = rtc_store.cold.data.calibrated_resistor;
+    if (series_resistor != SERIES_RESISTOR && calibrated_table.series_resistor != series_resistor)
+    {
+        // A few hundred libm calls, worth the full clock
+        cpu_boost_begin(CPU_BOOST_CONVERT);
+        thermistor_build_table(&calibrated_table, series_resistor);
+        cpu_boost_end(CPU_BOOST_CONVERT);
+        ESP_LOGI(TAG_TEMP, "Conversion table rebuilt for %.2f Ohm", series_resistor);
+    }
+}
+
+static const int16_t *conversion_table(void)
+{
+    if (rtc_store.cold.data.calibrated_resistor == SERIES_RESISTOR)
+    {
+        return thermistor_default_table_get();
+    }
+    return calibrated_table.centi_celsius;
+}
+
+#ifdef THERMISTOR_EXCITATION_GPIO
+// Wait for the divider and the ADC input to charge. Short enough to busy wait,
+// and the ADC driver holds off light sleep during acquisition anyway.
+static void excitation_on(uint32_t settle_us)
+{
+    gpio_set_level(THERMISTOR_EXCITATION_GPIO, 1);
+    esp_rom_delay_us(settle_us);
+}
+
+static void excitation_off(void)
+{
+    gpio_set_level(THERMISTOR_EXCITATION_GPIO, 0);
+}
+
+static uint32_t excitation_settle_us(void)
+{
+    uint32_t settle_us = rtc_store.cold.data.excitation_settle_us;
+    return settle_us != 0 ? settle_us : EXCITATION_SETTLE_DEFAULT_US;
+}
+
+// Discharge the divider, switch it on and probe with short bursts until well
+// past the longest allowed wait. The settling time is the start of the first
+// burst from which on every burst is within tolerance of the last one.
+static uint32_t measure_settling(void)
+{
+    static uint32_t probes[EXCITATION_SETTLE_PROBES];
+    static int64_t probe_us[EXCITATION_SETTLE_PROBES];
+
+    excitation_off();
+    esp_rom_delay_us(EXCITATION_SETTLE_MAX_US);
+    excitation_on(0);
+    int64_t start_us = esp_timer_get_time();
+    int count = 0;
+    while (count < EXCITATION_SETTLE_PROBES && esp_timer_get_time() - start_us < 2 * EXCITATION_SETTLE_MAX_US)
+    {
+        probe_us[count] = esp_timer_get_time() - start_us;
+        if (adc_engine_sample(THERMISTOR_ADC_CHANNEL, EXCITATION_SETTLE_PROBE_SAMPLES, &probes[count]) != ESP_OK)
+        {
+            break;
+        }
+        count++;
+    }
+    excitation_off();
+    if (count < 2)
+    {
+        return EXCITATION_SETTLE_MAX_US;
+    }
+
+    uint32_t settled = probes[count - 1];
+    int first = count - 1;
+    while (first > 0 && abs((int)probes[first - 1] - (int)settled) <= EXCITATION_SETTLE_TOLERANCE_Q4)
+    {
+        first--;
+    }
+    return (uint32_t)probe_us[first];
+}
+
+static void calibrate_settling(void)
+{
+    uint32_t settle_us = measure_settling() + EXCITATION_SETTLE_MARGIN_US;
+    if (settle_us > EXCITATION_SETTLE_MAX_US)
+    {
+        ESP_LOGW(TAG_ADC, "Divider did not settle within %d us", EXCITATION_SETTLE_MAX_US);
+        settle_us = EXCITATION_SETTLE_MAX_US;
+    }
+    ESP_LOGI(TAG_ADC, "Divider settles in %lu us", (unsigned long)settle_us);
+    update_excitation_settle(settle_us);
+}
+#endif
+
+// One divider reading as a linearized code with full scale at the top of the
+// divider, which is what the conversion table expects
+static esp_err_t sample_divider(uint32_t samples, uint32_t *code_q4)
+{
+    uint32_t raw_q4;
+#ifdef THERMISTOR_EXCITATION_GPIO
+    excitation_on(excitation_settle_us());
+#endif
+    esp_err_t ret = adc_engine_sample(THERMISTOR_ADC_CHANNEL, samples, &raw_q4);
+#ifdef THERMISTOR_EXCITATION_ADC_CHANNEL
+    uint32_t top_q4;
+    if (ret == ESP_OK)
+    {
+        ret = adc_engine_sample(THERMISTOR_EXCITATION_ADC_CHANNEL, EXCITATION_SAMPLES, &top_q4);
+    }
+#endif
+#ifdef THERMISTOR_EXCITATION_GPIO
+    excitation_off();
+#endif
+    if (ret != ESP_OK)
+    {
+        return ret;
+    }
 
-    // Take multiple readings
-    int32_t adc_sum = 0;
-    for (int i = 0; i < ADC_SAMPLES * 2; i++)
+    *code_q4 = adc_engine_linearize(raw_q4);
+#ifdef THERMISTOR_EXCITATION_ADC_CHANNEL
+    // Ratiometric: the excitation voltage cancels, VREF only names the full scale
+    uint32_t full_scale_q4 = (uint32_t)ADC_MAX_VALUE << ADC_CODE_FRACTION_BITS;
+    uint32_t excitation_q4 = adc_engine_linearize(top_q4) * EXCITATION_SENSE_DIVIDER;
+    if (excitation_q4 == 0)
     {
-        int raw_value;
-        ESP_ERROR_CHECK(adc_oneshot_read(adc1_handle, ADC_CHANNEL_2, &raw_value));
-        adc_sum += raw_value;
-        vTaskDelay(pdMS_TO_TICKS(ADC_SAMPLE_DELAY_MS));
+        return ESP_ERR_INVALID_RESPONSE;
     }
+    uint64_t ratio_q4 = (uint64_t)*code_q4 * full_scale_q4 / excitation_q4;
+    *code_q4 = ratio_q4 > full_scale_q4 ? full_scale_q4 : (uint32_t)ratio_q4;
+#endif
+    return ESP_OK;
+}
 
-    float raw_value = (float)adc_sum / (ADC_SAMPLES * 2);
-    float v_out = (raw_value / ADC_MAX_VALUE) * VREF;
+void init_sensor(void)
+{
+#ifdef THERMISTOR_EXCITATION_GPIO
+    gpio_config_t io_conf = {
+        .pin_bit_mask = 1ULL << THERMISTOR_EXCITATION_GPIO,
+        .mode = GPIO_MODE_OUTPUT};
+    gpio_config(&io_conf);
+    excitation_off();
+#endif
+    refresh_conversion_table();
+}
+
+void calibrate_sensor(void)
+{
+    ESP_LOGI(TAG_ADC, "Starting calibration at 0°C...");
+
+#ifdef THERMISTOR_EXCITATION_GPIO
+    // Measured first, so the calibration reading already uses the short wait
+    calibrate_settling();
+#endif
+
+    // One long burst instead of a delay loop
+    uint32_t code_q4;
+    ESP_ERROR_CHECK(sample_divider(ADC_CALIBRATION_SAMPLES, &code_q4));
+    cpu_boost_begin(CPU_BOOST_CONVERT);
+    float code = (float)code_q4 / (1 << ADC_CODE_FRACTION_BITS);
+    float v_out = (code / ADC_MAX_VALUE) * VREF;
 
     // Calculate new series resistor value for 0°C (273.15K)
     float r_thermistor = R2 * exp((BETA / 273.15) - (BETA / T2));
     float new_resistor = (r_thermistor * (VREF - v_out)) / v_out;
+    cpu_boost_end(CPU_BOOST_CONVERT);
 
     // Update RTC store with new calibrated value
-    update_rtc_data(rtc_store.data.boot_count,
+    update_rtc_data(rtc_store.hot.data.boot_count,
                     0, // Reset measurement count after calibration
                     0, // Reset first measurement time
                     new_resistor);
 
-    ESP_LOGI(TAG_ADC, "Calibration complete. New resistor value: %.2f", rtc_store.data.calibrated_resistor);
+    ESP_LOGI(TAG_ADC, "Calibration complete. New resistor value: %.2f", rtc_store.cold.data.calibrated_resistor);
+    refresh_conversion_table();
 
     // Backup to NVS immediately after calibration
     backup_to_nvs();
 }
 
-// Function to handle measurements and data sending
-esp_err_t measure_and_send(adc_oneshot_unit_handle_t adc1_handle)
+static uint32_t measure_battery(void)
 {
-    if (adc1_handle == NULL)
+#ifdef BATTERY_ADC_CHANNEL
+    uint32_t raw_q4;
+    if (adc_engine_sample(BATTERY_ADC_CHANNEL, BATTERY_SAMPLES, &raw_q4) != ESP_OK)
     {
-        return ESP_ERR_INVALID_ARG;
+        return 0;
     }
-
-    int32_t adc_sum = 0;
-    int32_t real_number_of_samples = 0;
-    for (int i = 0; i < ADC_SAMPLES; i++)
+    uint32_t full_scale_q4 = (uint32_t)ADC_MAX_VALUE << ADC_CODE_FRACTION_BITS;
+    uint32_t battery_mv = adc_engine_linearize(raw_q4) * (uint32_t)(VREF * 1000) / full_scale_q4 * BATTERY_DIVIDER_RATIO;
+    // The scheduler would stretch the interval for a low battery that is not there
+    if (battery_mv < BATTERY_MIN_MV || battery_mv > BATTERY_MAX_MV)
     {
-        int raw_value;
-        esp_err_t ret = adc_oneshot_read(adc1_handle, ADC_CHANNEL_2, &raw_value);
-        if (ret != ESP_OK)
-        {
-            ESP_LOGE(TAG_ADC, "ADC read error: %d", ret);
-            return ret;
-        }
-        if (raw_value < 0 || raw_value > ADC_MAX_VALUE)
-        {
-            ESP_LOGE(TAG_ADC, "Invalid ADC reading: %d", raw_value);
-            continue;
-        }
-        real_number_of_samples++;
-        adc_sum += raw_value;
-        vTaskDelay(pdMS_TO_TICKS(ADC_SAMPLE_DELAY_MS));
+        return 0;
     }
-    if (real_number_of_samples == 0)
+    return battery_mv;
+#else
+    return 0;
+#endif
+}
+
+// Sample and convert only, this runs next to the WiFi bring-up and must not touch rtc_store
+esp_err_t measure_temperature(sensor_reading_t *reading)
+{
+    trace_begin(TRACE_ACQUIRE);
+    esp_err_t ret = sample_divider(ADC_BURST_SAMPLES, &reading->raw_q4);
+    if (ret != ESP_OK)
     {
-        ESP_LOGE(TAG_ADC, "No valid ADC readings");
-        return ESP_ERR_INVALID_RESPONSE;
+        trace_end(TRACE_ACQUIRE);
+        return ret;
     }
-    float raw_value = (float)adc_sum / real_number_of_samples;
-
-    // Convert to temperature
-    float v_out = (raw_value / ADC_MAX_VALUE) * VREF;
-    float resistance = rtc_store.data.calibrated_resistor * v_out / (VREF - v_out);
-    float temperature_kelvin = BETA / (log(resistance / R2) + (BETA / T2));
-    float temperature_celsius = temperature_kelvin - KELVIN_TO_CELSIUS;
+    reading->centi_celsius = convert_to_centi_celsius(reading->raw_q4);
+    reading->battery_mv = measure_battery();
+    trace_end(TRACE_ACQUIRE);
+    return ESP_OK;
+}
 
-    ESP_LOGI(TAG_TEMP, "Temperature: %.2f°C", temperature_celsius);
+// Account for a reading and queue it for the next batch uplink
+void queue_reading(const sensor_reading_t *reading)
+{
+    EVENT_LOG(EVENT_TEMPERATURE, event_float(reading->centi_celsius / 100.0f));
 
     // Track first measurement time
-    if (rtc_store.data.measurement_count == 0)
+    int measurement_count = rtc_store.hot.data.measurement_count;
+    uint64_t first_measurement_time = rtc_store.hot.data.first_measurement_time;
+    if (measurement_count == 0)
     {
-        rtc_store.data.first_measurement_time = esp_timer_get_time();
+        first_measurement_time = esp_timer_get_time();
     }
 
     // Increment measurement count
-    rtc_store.data.measurement_count++;
+    measurement_count++;
 
     // Calculate elapsed time in seconds
-    uint64_t elapsed_time = (esp_timer_get_time() - rtc_store.data.first_measurement_time) / 1000000;
+    uint64_t elapsed_time = (esp_timer_get_time() - first_measurement_time) / 1000000;
 
-    ESP_LOGI(TAG_TEMP, "Measurement %d/10 (Elapsed: %lld sec)",
-             rtc_store.data.measurement_count, elapsed_time);
+    EVENT_LOG(EVENT_SERIES_PROGRESS, measurement_count, elapsed_time);
 
-    if (!initialize_sntp())
+    // Reset counters if measurement window exceeded
+    if (elapsed_time >= MEASUREMENT_WINDOW_SEC)
     {
-        ESP_LOGE(TAG_SNTP, "Time sync failed, skipping data send");
-        return ESP_OK;
+        measurement_count = 0;
+        first_measurement_time = 0;
     }
+    update_rtc_data(rtc_store.hot.data.boot_count,
+                    measurement_count,
+                    first_measurement_time,
+                    rtc_store.cold.data.calibrated_resistor);
 
-    // Reset counters if measurement window exceeded
-    if (elapsed_time >= MEASUREMENT_WINDOW_SEC)
+    // The scheduler picks the next wake and whether this reading is worth sending
+    scheduler_state_t scheduler = rtc_store.hot.data.scheduler;
+    scheduler_input_t input = {
+        .now = time_now(),
+        .centi_celsius = reading->centi_celsius,
+        .battery_mv = reading->battery_mv};
+    scheduler_decision_t decision = scheduler_step(&scheduler, &SCHEDULER_POLICY, &input);
+    update_scheduler(&scheduler);
+    EVENT_LOG(EVENT_NEXT_WAKE, decision.sleep_sec, reading->battery_mv);
+
+    // Queue the reading, the uplink sends the whole batch at once
+    if (decision.report)
     {
-        rtc_store.data.measurement_count = 0;
-        rtc_store.data.first_measurement_time = 0;
+        rtc_batch_append((uint16_t)reading->raw_q4, input.now);
     }
-#ifdef SEND_DATA
-    return send_data(temperature_celsius);
-#else
-    return ESP_OK;
-#endif
+    else
+    {
+        EVENT_LOG(EVENT_DEADBAND);
+    }
+}
+
+// Table lookup on the code from sample_divider(), no libm on the per-wake path
+int32_t convert_to_centi_celsius(uint32_t code_q4)
+{
+    return thermistor_lookup(conversion_table(), code_q4);
 }
@@ -1,9 +1,18 @@
 #ifndef SENSOR_H
 #define SENSOR_H
 
-#include "esp_adc/adc_oneshot.h"
+#include <esp_err.h>
 
-void calibrate_sensor(adc_oneshot_unit_handle_t adc1_handle);
-esp_err_t measure_and_send(adc_oneshot_unit_handle_t adc1_handle);
+typedef struct {
+    uint32_t raw_q4;       // Divider ratio as a linearized ADC code in 1/16 LSB
+    int32_t centi_celsius;
+    uint32_t battery_mv;   // 0 when no supply divider is fitted
+} sensor_reading_t;
+
+void init_sensor(void);
+void calibrate_sensor(void);
+esp_err_t measure_temperature(sensor_reading_t *reading);
+void queue_reading(const sensor_reading_t *reading);
+int32_t convert_to_centi_celsius(uint32_t code_q4);
 
 #endif // SENSOR_H
\ No newline at end of file
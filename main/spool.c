@@ -0,0 +1,335 @@
+#include "spool.h"
+#include "config.h"
+#include "event_log.h"
+#include <esp_log.h>
+#include <esp_crc.h>
+#include <esp_attr.h>
+#include <esp_partition.h>
+#include <stddef.h>
+#include <string.h>
+
+#define SPOOL_RECORD_MAGIC 0x5A
+#define SPOOL_FLAG_PENDING 0xFF
+#define SPOOL_FLAG_CONSUMED 0x00
+
+typedef struct {
+    uint8_t magic;
+    uint8_t consumed; // Programmed to 0x00 after delivery, not covered by the CRC
+    uint16_t raw;
+    uint32_t timestamp;
+    uint32_t sequence; // Write order, survives wrapping around the partition
+    uint32_t crc;
+} spool_record_t;
+
+_Static_assert(sizeof(spool_record_t) == 16, "spool records must tile flash sectors");
+
+#define RECORDS_PER_SECTOR (SPI_FLASH_SEC_SIZE / sizeof(spool_record_t))
+
+// Cursors survive deep sleep, the partition is only scanned after a power cycle
+typedef struct {
+    uint32_t crc;
+    struct {
+        uint32_t partition_size;
+        uint32_t write_offset; // Next slot to program
+        uint32_t read_offset;  // Oldest record that may still be pending
+        uint32_t next_sequence;
+        uint32_t pending;
+    } data;
+} spool_cursor_t;
+
+RTC_DATA_ATTR static spool_cursor_t cursor;
+static const esp_partition_t *partition = NULL;
+
+static uint32_t calculate_cursor_crc(void)
+{
+    return esp_crc32_le(0, (uint8_t *)&cursor.data, sizeof(cursor.data));
+}
+
+static void save_cursor(void)
+{
+    cursor.crc = calculate_cursor_crc();
+}
+
+static uint32_t record_crc(const spool_record_t *record)
+{
+    spool_record_t copy = *record;
+    copy.consumed = SPOOL_FLAG_PENDING;
+    return esp_crc32_le(0, (uint8_t *)&copy, offsetof(spool_record_t, crc));
+}
+
+static bool is_record_valid(const spool_record_t *record)
+{
+    return record->magic == SPOOL_RECORD_MAGIC && record->crc == record_crc(record);
+}
+
+static bool is_record_pending(const spool_record_t *record)
+{
+    return is_record_valid(record) && record->consumed == SPOOL_FLAG_PENDING;
+}
+
+static bool is_slot_blank(const spool_record_t *record)
+{
+    const uint8_t *bytes = (const uint8_t *)record;
+    for (size_t i = 0; i < sizeof(spool_record_t); i++)
+    {
+        if (bytes[i] != 0xFF)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static uint32_t next_offset(uint32_t offset)
+{
+    offset += sizeof(spool_record_t);
+    return offset >= cursor.data.partition_size ? 0 : offset;
+}
+
+// Rebuild the cursors from flash: the newest record ends the log and the
+// oldest pending one starts it
+static void scan_partition(void)
+{
+    static spool_record_t sector[RECORDS_PER_SECTOR];
+    bool found = false;
+    uint32_t newest_sequence = 0, newest_offset = 0;
+    uint32_t oldest_sequence = UINT32_MAX, oldest_offset = 0;
+    uint32_t pending = 0;
+
+    for (uint32_t base = 0; base < partition->size; base += SPI_FLASH_SEC_SIZE)
+    {
+        if (esp_partition_read(partition, base, sector, sizeof(sector)) != ESP_OK)
+        {
+            continue;
+        }
+        for (uint32_t i = 0; i < RECORDS_PER_SECTOR; i++)
+        {
+            const spool_record_t *record = &sector[i];
+            if (!is_record_valid(record))
+            {
+                continue;
+            }
+            uint32_t offset = base + i * sizeof(spool_record_t);
+            if (!found || record->sequence > newest_sequence)
+            {
+                newest_sequence = record->sequence;
+                newest_offset = offset;
+                found = true;
+            }
+            if (record->consumed == SPOOL_FLAG_PENDING)
+            {
+                pending++;
+                if (record->sequence < oldest_sequence)
+                {
+                    oldest_sequence = record->sequence;
+                    oldest_offset = offset;
+                }
+            }
+        }
+    }
+
+    cursor.data.partition_size = partition->size;
+    cursor.data.write_offset = found ? next_offset(newest_offset) : 0;
+    cursor.data.next_sequence = found ? newest_sequence + 1 : 0;
+    cursor.data.read_offset = pending > 0 ? oldest_offset : cursor.data.write_offset;
+    cursor.data.pending = pending;
+    save_cursor();
+}
+
+esp_err_t init_spool(void)
+{
+    partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, SPOOL_PARTITION_SUBTYPE, SPOOL_PARTITION_LABEL);
+    if (partition == NULL)
+    {
+        ESP_LOGE(TAG_SPOOL, "No spool partition, failed uplinks keep readings in RTC memory only");
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    if (cursor.crc != calculate_cursor_crc() || cursor.data.partition_size != partition->size)
+    {
+        scan_partition();
+        EVENT_LOG(EVENT_SPOOL_SCANNED, cursor.data.pending);
+    }
+    return ESP_OK;
+}
+
+// Called when the log enters a sector. If it still holds pending readings the
+// spool is full and they are the oldest ones, so they are given up.
+static esp_err_t erase_sector(uint32_t base)
+{
+    static spool_record_t sector[RECORDS_PER_SECTOR];
+    uint32_t dropped = 0;
+
+    if (esp_partition_read(partition, base, sector, sizeof(sector)) == ESP_OK)
+    {
+        for (uint32_t i = 0; i < RECORDS_PER_SECTOR; i++)
+        {
+            dropped += is_record_pending(&sector[i]);
+        }
+    }
+    if (dropped > 0)
+    {
+        ESP_LOGW(TAG_SPOOL, "Spool full, dropping %lu oldest readings", (unsigned long)dropped);
+        cursor.data.pending -= dropped < cursor.data.pending ? dropped : cursor.data.pending;
+        cursor.data.read_offset = (base + SPI_FLASH_SEC_SIZE) % cursor.data.partition_size;
+    }
+    save_cursor();
+
+    return esp_partition_erase_range(partition, base, SPI_FLASH_SEC_SIZE);
+}
+
+esp_err_t spool_append(const batch_record_t *record)
+{
+    if (partition == NULL)
+    {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    spool_record_t entry = {
+        .magic = SPOOL_RECORD_MAGIC,
+        .consumed = SPOOL_FLAG_PENDING,
+        .raw = record->raw,
+        .timestamp = record->timestamp,
+        .sequence = cursor.data.next_sequence,
+    };
+    entry.crc = record_crc(&entry);
+
+    // A slot left dirty by an interrupted write is skipped rather than programmed over
+    for (uint32_t attempt = 0; attempt < RECORDS_PER_SECTOR; attempt++)
+    {
+        uint32_t offset = cursor.data.write_offset;
+        if (offset % SPI_FLASH_SEC_SIZE == 0)
+        {
+            esp_err_t err = erase_sector(offset);
+            if (err != ESP_OK)
+            {
+                ESP_LOGE(TAG_SPOOL, "Erase at 0x%lx failed: %s", (unsigned long)offset, esp_err_to_name(err));
+                return err;
+            }
+        }
+
+        spool_record_t slot;
+        esp_err_t err = esp_partition_read(partition, offset, &slot, sizeof(slot));
+        cursor.data.write_offset = next_offset(offset);
+        if (err != ESP_OK || !is_slot_blank(&slot))
+        {
+            save_cursor();
+            continue;
+        }
+
+        err = esp_partition_write(partition, offset, &entry, sizeof(entry));
+        if (err != ESP_OK)
+        {
+            save_cursor();
+            return err;
+        }
+        if (cursor.data.pending == 0)
+        {
+            cursor.data.read_offset = offset;
+        }
+        cursor.data.next_sequence++;
+        cursor.data.pending++;
+        save_cursor();
+        return ESP_OK;
+    }
+    return ESP_ERR_INVALID_STATE;
+}
+
+// Move the RTC batch into flash so a long outage cannot overwrite it
+esp_err_t spool_store_batch(void)
+{
+    int count = rtc_batch_pending();
+    for (int i = 0; i < count; i++)
+    {
+        // Timestamps from before the first sync are rebased in RTC memory, not in flash
+        if (rtc_batch_get(i)->timestamp < MIN_VALID_EPOCH)
+        {
+            return ESP_ERR_INVALID_STATE;
+        }
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        esp_err_t err = spool_append(rtc_batch_get(i));
+        if (err != ESP_OK)
+        {
+            rtc_batch_drop(i);
+            return err;
+        }
+    }
+    rtc_batch_drop(count);
+    EVENT_LOG(EVENT_SPOOLED, count, cursor.data.pending);
+    return ESP_OK;
+}
+
+uint32_t spool_pending(void)
+{
+    return partition != NULL ? cursor.data.pending : 0;
+}
+
+// Copy up to max of the oldest pending readings without consuming them
+int spool_peek(batch_record_t *records, int max)
+{
+    if (partition == NULL)
+    {
+        return 0;
+    }
+
+    int count = 0;
+    uint32_t offset = cursor.data.read_offset;
+    uint32_t remaining = cursor.data.pending;
+    while (count < max && remaining > 0)
+    {
+        spool_record_t record;
+        if (esp_partition_read(partition, offset, &record, sizeof(record)) == ESP_OK && is_record_pending(&record))
+        {
+            records[count].timestamp = record.timestamp;
+            records[count].raw = record.raw;
+            count++;
+            remaining--;
+        }
+        offset = next_offset(offset);
+        if (offset == cursor.data.write_offset)
+        {
+            // Reached the end of the log, the pending count was stale
+            cursor.data.pending = count;
+            save_cursor();
+            break;
+        }
+    }
+    return count;
+}
+
+// Mark the readings returned by spool_peek() as delivered. Each flag is
+// programmed as it goes, so an interrupted drain resumes after the last one.
+// A flag that does not program stops at its record, which stays pending.
+esp_err_t spool_consume(int count)
+{
+    static const uint8_t consumed = SPOOL_FLAG_CONSUMED;
+
+    while (count > 0 && cursor.data.pending > 0)
+    {
+        uint32_t offset = cursor.data.read_offset;
+        spool_record_t record;
+        if (esp_partition_read(partition, offset, &record, sizeof(record)) == ESP_OK && is_record_pending(&record))
+        {
+            esp_err_t err = esp_partition_write(partition, offset + offsetof(spool_record_t, consumed), &consumed,
+                                                sizeof(consumed));
+            if (err != ESP_OK)
+            {
+                ESP_LOGE(TAG_SPOOL, "Marking 0x%lx consumed failed: %s", (unsigned long)offset, esp_err_to_name(err));
+                return err;
+            }
+            cursor.data.pending--;
+            count--;
+        }
+        cursor.data.read_offset = next_offset(offset);
+        save_cursor();
+    }
+    if (cursor.data.pending == 0)
+    {
+        cursor.data.read_offset = cursor.data.write_offset;
+        save_cursor();
+    }
+    return ESP_OK;
+}
@@ -0,0 +1,19 @@
+#ifndef SPOOL_H
+#define SPOOL_H
+
+#include <esp_err.h>
+#include <stdint.h>
+#include "rtc_store.h"
+
+// Append-only log of readings in the "spool" partition. Records are 16 bytes
+// with their own CRC; delivered records are marked by programming a flag byte
+// from 0xFF to 0x00, so a sector is only erased when the log wraps onto it.
+
+esp_err_t init_spool(void);
+esp_err_t spool_append(const batch_record_t *record);
+esp_err_t spool_store_batch(void);
+uint32_t spool_pending(void);
+int spool_peek(batch_record_t *records, int max);
+esp_err_t spool_consume(int count);
+
+#endif // SPOOL_H
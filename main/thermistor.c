@@ -0,0 +1,54 @@
+#include "thermistor.h"
+#include "thermistor_table.h"
+#include <math.h>
+
+_Static_assert(sizeof(thermistor_default_table) / sizeof(thermistor_default_table[0]) == THERMISTOR_TABLE_SIZE,
+               "thermistor_table.h is out of date with config.h");
+
+// Same model as tools/gen_thermistor_table.py, only needed after a calibration
+void thermistor_build_table(thermistor_table_t *table, float series_resistor)
+{
+    table->series_resistor = series_resistor;
+    for (int i = 0; i < THERMISTOR_TABLE_SIZE; i++)
+    {
+        // The divider is singular at both rails, stay one code inside them
+        int code = i << THERMISTOR_SEGMENT_BITS;
+        if (code < 1)
+        {
+            code = 1;
+        }
+        if (code > ADC_MAX_VALUE - 1)
+        {
+            code = ADC_MAX_VALUE - 1;
+        }
+
+        double v_out = (double)code / ADC_MAX_VALUE * VREF;
+        double resistance = series_resistor * v_out / (VREF - v_out);
+        double kelvin = BETA / (log(resistance / R2) + (BETA / T2));
+        long centi = lround((kelvin - KELVIN_TO_CELSIUS) * 100.0);
+        // Entries are int16, which still covers -273 to +327 °C
+        table->centi_celsius[i] = (int16_t)(centi < INT16_MIN ? INT16_MIN : centi > INT16_MAX ? INT16_MAX : centi);
+    }
+}
+
+const int16_t *thermistor_default_table_get(void)
+{
+    return thermistor_default_table;
+}
+
+// Linear interpolation between table entries, integer only
+int32_t thermistor_lookup(const int16_t *table, uint32_t code_q4)
+{
+    const uint32_t shift = THERMISTOR_SEGMENT_BITS + ADC_CODE_FRACTION_BITS;
+    const uint32_t max_code_q4 = (uint32_t)ADC_MAX_VALUE << ADC_CODE_FRACTION_BITS;
+
+    if (code_q4 > max_code_q4)
+    {
+        code_q4 = max_code_q4;
+    }
+    uint32_t index = code_q4 >> shift;
+    int32_t fraction = (int32_t)(code_q4 & ((1u << shift) - 1));
+    int32_t low = table[index];
+    int32_t high = table[index + 1];
+    return low + (((high - low) * fraction + (1 << (shift - 1))) >> shift);
+}
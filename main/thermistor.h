@@ -0,0 +1,20 @@
+#ifndef THERMISTOR_H
+#define THERMISTOR_H
+
+#include <stdint.h>
+#include "config.h"
+
+// ADC codes are carried with 4 fractional bits so averaged bursts keep their resolution
+#define ADC_CODE_FRACTION_BITS 4
+#define THERMISTOR_TABLE_SIZE (((ADC_MAX_VALUE + 1) >> THERMISTOR_SEGMENT_BITS) + 1)
+
+typedef struct {
+    float series_resistor; // Divider resistor the table was built for
+    int16_t centi_celsius[THERMISTOR_TABLE_SIZE];
+} thermistor_table_t;
+
+void thermistor_build_table(thermistor_table_t *table, float series_resistor);
+const int16_t *thermistor_default_table_get(void);
+int32_t thermistor_lookup(const int16_t *table, uint32_t code_q4);
+
+#endif // THERMISTOR_H
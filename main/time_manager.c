@@ -0,0 +1,168 @@
+#include "time_manager.h"
+#include "config.h"
+#include "event_log.h"
+#include "rtc_store.h"
+#include "trace.h"
+#include <esp_sntp.h>
+#include <esp_rtc_time.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <stdlib.h>
+#include <time.h>
+
+static bool sntp_started = false;
+static volatile bool sync_pending = false;
+static int64_t pending_epoch_us;
+static uint64_t pending_rtc_us;
+
+// A time sample from another source than SNTP, e.g. the ESP-NOW gateway. Like
+// the SNTP one it is applied later from the main task.
+void time_sync_sample(int64_t epoch_us, uint64_t rtc_us)
+{
+    pending_rtc_us = rtc_us;
+    pending_epoch_us = epoch_us;
+    sync_pending = true;
+}
+
+// Runs in the SNTP task
+static void time_sync_notification(struct timeval *tv)
+{
+    time_sync_sample((int64_t)tv->tv_sec * 1000000 + tv->tv_usec, esp_rtc_get_time_us());
+}
+
+static bool is_clock_usable(void)
+{
+    return rtc_store.hot.data.clock.synced &&
+           esp_rtc_get_time_us() >= rtc_store.hot.data.clock.sync_rtc_us;
+}
+
+// Before the first sync this is the RTC clock since power-on
+static int64_t time_now_us(void)
+{
+    const clock_sync_t *clock = &rtc_store.hot.data.clock;
+    uint64_t rtc_now = esp_rtc_get_time_us();
+    if (!is_clock_usable())
+    {
+        return (int64_t)rtc_now;
+    }
+
+    int64_t elapsed_us = (int64_t)(rtc_now - clock->sync_rtc_us);
+    int64_t correction_us = clock->drift_valid ? (elapsed_us / 1000) * clock->drift_ppb / 1000000 : 0;
+    return clock->sync_epoch_us + elapsed_us - correction_us;
+}
+
+void init_time(void)
+{
+    setenv("TZ", TIME_ZONE, 1);
+    tzset();
+}
+
+bool time_is_valid(void)
+{
+    return is_clock_usable();
+}
+
+uint32_t time_now(void)
+{
+    return (uint32_t)(time_now_us() / 1000000);
+}
+
+// Worst case error of time_now() given how long the RTC clock has run on its own
+uint32_t time_error_ms(void)
+{
+    if (!is_clock_usable())
+    {
+        return UINT32_MAX;
+    }
+
+    const clock_sync_t *clock = &rtc_store.hot.data.clock;
+    uint64_t elapsed_ms = (esp_rtc_get_time_us() - clock->sync_rtc_us) / 1000;
+    uint64_t ppm = clock->drift_valid ? TIME_DRIFT_RESIDUAL_PPM : TIME_DRIFT_UNCALIBRATED_PPM;
+    uint64_t error_ms = elapsed_ms * ppm / 1000000;
+    return error_ms > UINT32_MAX ? UINT32_MAX : (uint32_t)error_ms;
+}
+
+bool time_needs_sync(void)
+{
+    return time_error_ms() > TIME_MAX_ERROR_MS;
+}
+
+// Starts an SNTP request in the background, the result arrives via time_sync_apply()
+void time_sync_start(void)
+{
+    if (sntp_started)
+    {
+        return;
+    }
+
+    EVENT_LOG(EVENT_SNTP_START, time_error_ms());
+    esp_sntp_stop();
+    esp_sntp_setoperatingmode(SNTP_OPMODE_POLL);
+    esp_sntp_setservername(0, SNTP_SERVER);
+    sntp_set_time_sync_notification_cb(time_sync_notification);
+    esp_sntp_init();
+    sntp_started = true;
+}
+
+bool time_sync_wait(uint32_t timeout_ms)
+{
+    if (!sntp_started)
+    {
+        return false;
+    }
+
+    trace_begin(TRACE_TIME_SYNC);
+    uint32_t start_time = xTaskGetTickCount() * portTICK_PERIOD_MS;
+    while (!sync_pending &&
+           ((xTaskGetTickCount() * portTICK_PERIOD_MS) - start_time) < timeout_ms)
+    {
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+    trace_end(TRACE_TIME_SYNC);
+    time_sync_apply();
+    return time_is_valid();
+}
+
+// Re-anchor the RTC clock on the latest time sample and refine the drift estimate
+void time_sync_apply(void)
+{
+    if (!sync_pending)
+    {
+        return;
+    }
+    sync_pending = false;
+
+    clock_sync_t clock = rtc_store.hot.data.clock;
+    if (is_clock_usable())
+    {
+        int64_t rtc_elapsed_us = (int64_t)(pending_rtc_us - clock.sync_rtc_us);
+        int64_t true_elapsed_us = pending_epoch_us - clock.sync_epoch_us;
+        int64_t offset_ms = (time_now_us() - pending_epoch_us) / 1000;
+        EVENT_LOG(EVENT_CLOCK_OFF, offset_ms < INT32_MIN ? INT32_MIN : offset_ms > INT32_MAX ? INT32_MAX : offset_ms,
+                  rtc_elapsed_us / 1000000);
+
+        // Short intervals are dominated by SNTP jitter, not by drift
+        if (rtc_elapsed_us >= TIME_DRIFT_MIN_INTERVAL_SEC * 1000000LL)
+        {
+            int64_t measured_ppb = (rtc_elapsed_us - true_elapsed_us) * 1000 / (rtc_elapsed_us / 1000000);
+            if (llabs(measured_ppb) < 50000000)
+            {
+                clock.drift_ppb = clock.drift_valid ? (int32_t)((clock.drift_ppb + measured_ppb) / 2)
+                                                    : (int32_t)measured_ppb;
+                clock.drift_valid = true;
+                EVENT_LOG(EVENT_DRIFT, clock.drift_ppb);
+            }
+        }
+    }
+    else
+    {
+        // Readings taken before the first sync still carry RTC-since-power-on stamps
+        rtc_batch_rebase((uint32_t)(pending_epoch_us / 1000000 - (int64_t)(pending_rtc_us / 1000000)));
+    }
+
+    clock.synced = true;
+    clock.sync_epoch_us = pending_epoch_us;
+    clock.sync_rtc_us = pending_rtc_us;
+    update_clock_sync(&clock);
+    EVENT_LOG(EVENT_TIME_SYNCED, time_now());
+}
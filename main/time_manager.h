@@ -0,0 +1,17 @@
+#ifndef TIME_MANAGER_H
+#define TIME_MANAGER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+void init_time(void);
+bool time_is_valid(void);
+uint32_t time_now(void);
+uint32_t time_error_ms(void);
+bool time_needs_sync(void);
+void time_sync_start(void);
+bool time_sync_wait(uint32_t timeout_ms);
+void time_sync_apply(void);
+void time_sync_sample(int64_t epoch_us, uint64_t rtc_us);
+
+#endif // TIME_MANAGER_H
@@ -0,0 +1,283 @@
+#include "tls_link.h"
+#include "config.h"
+#include "event_log.h"
+#include "trace.h"
+#include <esp_attr.h>
+#include <esp_crc.h>
+#include <esp_log.h>
+#include <esp_random.h>
+#include <esp_timer.h>
+#include <mbedtls/net_sockets.h>
+#include <mbedtls/ssl.h>
+#ifdef TLS_CA_PEM
+#include <mbedtls/x509_crt.h>
+#else
+#include <esp_crt_bundle.h>
+#endif
+#include <stdbool.h>
+#include <string.h>
+
+// Serialized mbedtls session with its ticket, sealed with a CRC like the
+// regions of rtc_store. Needs CONFIG_MBEDTLS_SSL_KEEP_PEER_CERTIFICATE off,
+// the session then holds a digest of the server certificate instead of a copy.
+typedef struct {
+    uint32_t crc;
+    struct {
+        uint16_t length;     // 0 until a handshake succeeded
+        uint32_t master_crc; // Of the session's master secret, which a resumption keeps
+        uint8_t session[TLS_SESSION_MAX_SIZE];
+    } data;
+} tls_session_store_t;
+
+RTC_DATA_ATTR static tls_session_store_t session_store;
+
+// A short ClientHello, and suites the C6's AES, SHA and ECC accelerators cover
+static const int ciphersuites[] = {
+    MBEDTLS_TLS_ECDHE_ECDSA_WITH_AES_128_GCM_SHA256,
+    MBEDTLS_TLS_ECDHE_RSA_WITH_AES_128_GCM_SHA256,
+    0};
+static const uint16_t groups[] = {
+    MBEDTLS_SSL_IANA_TLS_GROUP_SECP256R1,
+    MBEDTLS_SSL_IANA_TLS_GROUP_NONE};
+
+static mbedtls_ssl_config conf;
+static mbedtls_ssl_context ssl;
+static mbedtls_net_context net;
+#ifdef TLS_CA_PEM
+static mbedtls_x509_crt ca_chain;
+#endif
+static bool configured = false;
+static size_t bytes_out = 0; // Of the current handshake, counted below the TLS layer
+static size_t bytes_in = 0;
+static uint32_t master_crc = 0; // Of the current handshake, see export_keys()
+
+static uint32_t session_crc(void)
+{
+    return esp_crc32_le(0, (const uint8_t *)&session_store.data, sizeof(session_store.data));
+}
+
+static bool session_valid(void)
+{
+    return session_store.data.length > 0 && session_store.data.length <= TLS_SESSION_MAX_SIZE &&
+           session_store.crc == session_crc();
+}
+
+static void session_forget(void)
+{
+    session_store.data.length = 0;
+    session_store.crc = session_crc();
+}
+
+// The handshake runs with the radio on, so the hardware RNG draws on RF noise.
+// Saves seeding a CTR-DRBG from the entropy pool on every wake.
+static int random_bytes(void *context, unsigned char *output, size_t length)
+{
+    (void)context;
+    esp_fill_random(output, length);
+    return 0;
+}
+
+static int counted_send(void *context, const unsigned char *buffer, size_t length)
+{
+    int sent = mbedtls_net_send(context, buffer, length);
+    if (sent > 0)
+    {
+        bytes_out += sent;
+    }
+    return sent;
+}
+
+static int counted_recv(void *context, unsigned char *buffer, size_t length)
+{
+    int received = mbedtls_net_recv(context, buffer, length);
+    if (received > 0)
+    {
+        bytes_in += received;
+    }
+    return received;
+}
+
+// A resumed handshake derives its keys from the master secret of the offered
+// session, a full one from a new one. Only its CRC is kept, the session
+// itself holds the secret.
+static void export_keys(void *context, mbedtls_ssl_key_export_type type, const unsigned char *secret,
+                        size_t secret_len, const unsigned char client_random[32],
+                        const unsigned char server_random[32], mbedtls_tls_prf_types tls_prf_type)
+{
+    (void)context;
+    (void)client_random;
+    (void)server_random;
+    (void)tls_prf_type;
+    if (type == MBEDTLS_SSL_KEY_EXPORT_TLS12_MASTER_SECRET)
+    {
+        master_crc = esp_crc32_le(0, secret, secret_len);
+    }
+}
+
+// TLS 1.2 only: its abbreviated handshake skips the key exchange, a TLS 1.3
+// resumption still runs an ECDHE unless the server allows psk_ke
+static esp_err_t configure(void)
+{
+    if (configured)
+    {
+        return ESP_OK;
+    }
+
+    mbedtls_ssl_config_init(&conf);
+    int ret = mbedtls_ssl_config_defaults(&conf, MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_STREAM,
+                                          MBEDTLS_SSL_PRESET_DEFAULT);
+    if (ret != 0)
+    {
+        ESP_LOGE(TAG_WIFI, "TLS configuration failed: -0x%04x", -ret);
+        return ESP_FAIL;
+    }
+    mbedtls_ssl_conf_min_tls_version(&conf, MBEDTLS_SSL_VERSION_TLS1_2);
+    mbedtls_ssl_conf_max_tls_version(&conf, MBEDTLS_SSL_VERSION_TLS1_2);
+    mbedtls_ssl_conf_ciphersuites(&conf, ciphersuites);
+    mbedtls_ssl_conf_groups(&conf, groups);
+    mbedtls_ssl_conf_rng(&conf, random_bytes, NULL);
+    mbedtls_ssl_conf_session_tickets(&conf, MBEDTLS_SSL_SESSION_TICKETS_ENABLED);
+    mbedtls_ssl_conf_authmode(&conf, MBEDTLS_SSL_VERIFY_REQUIRED);
+#ifdef TLS_CA_PEM
+    mbedtls_x509_crt_init(&ca_chain);
+    ret = mbedtls_x509_crt_parse(&ca_chain, (const unsigned char *)TLS_CA_PEM, sizeof(TLS_CA_PEM));
+    if (ret != 0)
+    {
+        ESP_LOGE(TAG_WIFI, "TLS_CA_PEM does not parse: -0x%04x", -ret);
+        return ESP_FAIL;
+    }
+    mbedtls_ssl_conf_ca_chain(&conf, &ca_chain, NULL);
+#else
+    esp_crt_bundle_attach(&conf);
+#endif
+    configured = true;
+    return ESP_OK;
+}
+
+// Offers the cached session, the server either takes its ticket or falls back
+// to a full handshake on its own
+static bool offer_session(void)
+{
+    if (!session_valid())
+    {
+        return false;
+    }
+    mbedtls_ssl_session session;
+    mbedtls_ssl_session_init(&session);
+    if (mbedtls_ssl_session_load(&session, session_store.data.session, session_store.data.length) != 0 ||
+        mbedtls_ssl_set_session(&ssl, &session) != 0)
+    {
+        // Saved by another mbedtls build
+        session_forget();
+    }
+    mbedtls_ssl_session_free(&session);
+    return session_valid();
+}
+
+// Kept after every handshake, the server may have issued a new ticket
+static void save_session(void)
+{
+    mbedtls_ssl_session session;
+    mbedtls_ssl_session_init(&session);
+    size_t length = 0;
+    int ret = mbedtls_ssl_get_session(&ssl, &session);
+    if (ret == 0)
+    {
+        ret = mbedtls_ssl_session_save(&session, session_store.data.session, TLS_SESSION_MAX_SIZE, &length);
+    }
+    mbedtls_ssl_session_free(&session);
+
+    if (ret != 0)
+    {
+        ESP_LOGW(TAG_WIFI, "TLS session not kept (-0x%04x), raise TLS_SESSION_MAX_SIZE", -ret);
+        session_forget();
+        return;
+    }
+    session_store.data.length = (uint16_t)length;
+    session_store.data.master_crc = master_crc;
+    session_store.crc = session_crc();
+}
+
+// Socket errors keep the session for the next wake. Anything the server said
+// or sent would happen again, the next wake starts over with a full handshake.
+static bool is_network_error(int ret)
+{
+    return ret == MBEDTLS_ERR_NET_SEND_FAILED || ret == MBEDTLS_ERR_NET_RECV_FAILED ||
+           ret == MBEDTLS_ERR_NET_CONN_RESET || ret == MBEDTLS_ERR_SSL_CONN_EOF;
+}
+
+esp_err_t tls_link_open(int sock)
+{
+    if (configure() != ESP_OK)
+    {
+        return ESP_FAIL;
+    }
+
+    trace_begin(TRACE_HANDSHAKE);
+    int64_t start_us = esp_timer_get_time();
+    bytes_out = 0;
+    bytes_in = 0;
+    master_crc = 0;
+    bool offered = false;
+    mbedtls_ssl_init(&ssl);
+    int ret = mbedtls_ssl_setup(&ssl, &conf);
+    if (ret == 0)
+    {
+        ret = mbedtls_ssl_set_hostname(&ssl, TLS_SERVER_NAME);
+    }
+    if (ret == 0)
+    {
+        net.fd = sock;
+        mbedtls_ssl_set_bio(&ssl, &net, counted_send, counted_recv, NULL);
+        mbedtls_ssl_set_export_keys_cb(&ssl, export_keys, NULL);
+        offered = offer_session();
+    }
+    if (ret == 0)
+    {
+        ret = mbedtls_ssl_handshake(&ssl);
+    }
+    trace_end(TRACE_HANDSHAKE);
+
+    if (ret != 0)
+    {
+        ESP_LOGE(TAG_WIFI, "TLS handshake failed: -0x%04x", -ret);
+        if (!is_network_error(ret))
+        {
+            session_forget();
+        }
+        mbedtls_ssl_free(&ssl);
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+
+    // The session ID cannot tell: with a ticket, mbedtls offers a random one.
+    // The server took the ticket when the master secret is still the same.
+    bool full = !offered || master_crc != session_store.data.master_crc;
+    save_session();
+    EVENT_LOG(full ? EVENT_TLS_FULL : EVENT_TLS_RESUMED, (esp_timer_get_time() - start_us) / 1000, bytes_out,
+              bytes_in, session_store.data.length);
+    return ESP_OK;
+}
+
+int tls_link_send(const void *data, size_t length)
+{
+    size_t written = 0;
+    while (written < length)
+    {
+        // Blocking socket, so no WANT_WRITE
+        int ret = mbedtls_ssl_write(&ssl, (const unsigned char *)data + written, length - written);
+        if (ret <= 0)
+        {
+            return -1;
+        }
+        written += ret;
+    }
+    return (int)written;
+}
+
+// close_notify leaves in the same flight as the FIN and tells the terminator
+// that the lines before it were not cut off
+void tls_link_close(void)
+{
+    mbedtls_ssl_close_notify(&ssl);
+    mbedtls_ssl_free(&ssl);
+}
@@ -0,0 +1,16 @@
+#ifndef TLS_LINK_H
+#define TLS_LINK_H
+
+#include <esp_err.h>
+#include <stddef.h>
+
+// TLS 1.2 over an open uplink socket. The session of the last handshake,
+// ticket included, survives deep sleep in RTC memory, so most wakes resume
+// it in one round trip without certificate verification or key exchange.
+esp_err_t tls_link_open(int sock);
+// Returns length once all of it is written, -1 on failure
+int tls_link_send(const void *data, size_t length);
+// Sends close_notify, the socket itself stays with the caller
+void tls_link_close(void);
+
+#endif // TLS_LINK_H
@@ -0,0 +1,194 @@
+#include "trace.h"
+
+#ifdef TRACE_ENABLE
+#include <esp_attr.h>
+#include <esp_cpu.h>
+#include <esp_log.h>
+#include <esp_rtc_time.h>
+#include <esp_sleep.h>
+#include <esp_system.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <stdio.h>
+#include <string.h>
+
+#define TRACE_MAGIC 0x54524304 // Changes with the layout of trace_store_t
+
+static const char *const phase_names[TRACE_PHASE_COUNT] = {
+    "boot", "init", "acquire", "rf", "associate", "dhcp", "time", "connect", "tls", "send", "wake",
+    "cpu_max", "cpu_dfs", "light_sleep"};
+
+// Diagnostics only, so a magic number instead of a CRC: phases end in
+// different tasks and must not contend for a checksum over the whole store
+typedef struct {
+    uint32_t magic;
+    uint32_t wakes;
+    uint64_t sleep_start_rtc_us; // Where the previous wake ended
+    uint64_t sleep_us;           // How long it meant to sleep
+    trace_phase_stats_t phases[TRACE_PHASE_COUNT];
+} trace_store_t;
+
+RTC_DATA_ATTR static trace_store_t trace_store;
+
+static int64_t start_us[TRACE_PHASE_COUNT];
+static uint32_t start_cycles[TRACE_PHASE_COUNT];
+static uint32_t wake_phases; // Phases recorded in this wake, for the summary line
+static portMUX_TYPE trace_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static void record_cycles(trace_phase_t phase, uint32_t duration_us, uint32_t cycles)
+{
+    trace_phase_stats_t *stats = &trace_store.phases[phase];
+    uint32_t free_heap = esp_get_minimum_free_heap_size();
+    uint32_t free_stack = uxTaskGetStackHighWaterMark(NULL);
+
+    int bucket = 0;
+    while (bucket < TRACE_BUCKETS - 1 && (1u << bucket) < duration_us)
+    {
+        bucket++;
+    }
+
+    portENTER_CRITICAL(&trace_lock);
+    if (stats->count == 0 || free_heap < stats->min_free_heap)
+    {
+        stats->min_free_heap = free_heap;
+    }
+    if (stats->count == 0 || free_stack < stats->min_free_stack)
+    {
+        stats->min_free_stack = free_stack;
+    }
+    stats->count++;
+    stats->sum_us += duration_us;
+    if (duration_us > stats->max_us)
+    {
+        stats->max_us = duration_us;
+    }
+    stats->last_us = duration_us;
+    stats->last_cycles = cycles;
+    wake_phases |= 1u << phase;
+    if (stats->histogram[bucket] < UINT16_MAX)
+    {
+        stats->histogram[bucket]++;
+    }
+    portEXIT_CRITICAL(&trace_lock);
+}
+
+// Boot time is the gap between the planned end of the last sleep and now on the RTC clock
+void init_trace(void)
+{
+    if (trace_store.magic != TRACE_MAGIC)
+    {
+        memset(&trace_store, 0, sizeof(trace_store));
+        trace_store.magic = TRACE_MAGIC;
+    }
+    trace_store.wakes++;
+
+    if (esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_TIMER && trace_store.sleep_us > 0)
+    {
+        uint64_t woke_at = trace_store.sleep_start_rtc_us + trace_store.sleep_us;
+        uint64_t now = esp_rtc_get_time_us();
+        if (now > woke_at)
+        {
+            record_cycles(TRACE_BOOT, (uint32_t)(now - woke_at), 0);
+        }
+    }
+    trace_store.sleep_us = 0;
+}
+
+// A phase that is already running keeps its start, so retries count in full
+void trace_begin(trace_phase_t phase)
+{
+    if (start_us[phase] == 0)
+    {
+        start_cycles[phase] = esp_cpu_get_cycle_count();
+        start_us[phase] = esp_timer_get_time();
+    }
+}
+
+void trace_end(trace_phase_t phase)
+{
+    if (start_us[phase] == 0)
+    {
+        return;
+    }
+    uint32_t cycles = esp_cpu_get_cycle_count() - start_cycles[phase];
+    int64_t duration_us = esp_timer_get_time() - start_us[phase];
+    start_us[phase] = 0;
+    record_cycles(phase, duration_us > UINT32_MAX ? UINT32_MAX : (uint32_t)duration_us, cycles);
+}
+
+// For durations measured elsewhere
+void trace_record(trace_phase_t phase, uint32_t duration_us)
+{
+    record_cycles(phase, duration_us, 0);
+}
+
+// The whole active period is esp_timer time since boot
+void trace_sleep(uint64_t sleep_us)
+{
+    int64_t awake_us = esp_timer_get_time();
+    record_cycles(TRACE_WAKE, awake_us > UINT32_MAX ? UINT32_MAX : (uint32_t)awake_us, 0);
+
+#ifndef LOG_DEFERRED
+    // The same figures stay in trace_store for TRACE_UPLINK
+    char line[224];
+    int used = 0;
+    for (int i = 0; i < TRACE_PHASE_COUNT && used < (int)sizeof(line); i++)
+    {
+        if (wake_phases & (1u << i))
+        {
+            used += snprintf(line + used, sizeof(line) - used, " %s=%lu", phase_names[i],
+                             (unsigned long)trace_store.phases[i].last_us / 1000);
+        }
+    }
+    ESP_LOGI(TAG_TRACE, "Phases in ms:%s", line);
+#endif
+
+    trace_store.sleep_start_rtc_us = esp_rtc_get_time_us();
+    trace_store.sleep_us = sleep_us;
+}
+
+const trace_phase_stats_t *trace_stats(trace_phase_t phase)
+{
+    return &trace_store.phases[phase];
+}
+
+// One line per upload: "#trace,group,wakes" then per phase
+// "name:count:sum_ms:max_ms:min_free_heap:min_free_stack:histogram buckets separated by /"
+int trace_format(char *buffer, size_t size)
+{
+    int used = snprintf(buffer, size, "#trace,%d,%lu", DEVICE_GROUP_ID, (unsigned long)trace_store.wakes);
+    for (int i = 0; i < TRACE_PHASE_COUNT && used > 0 && (size_t)used < size; i++)
+    {
+        const trace_phase_stats_t *stats = &trace_store.phases[i];
+        if (stats->count == 0)
+        {
+            continue;
+        }
+        used += snprintf(buffer + used, size - used, ",%s:%lu:%lu:%lu:%lu:%lu:", phase_names[i],
+                         (unsigned long)stats->count, (unsigned long)(stats->sum_us / 1000),
+                         (unsigned long)stats->max_us / 1000, (unsigned long)stats->min_free_heap,
+                         (unsigned long)stats->min_free_stack);
+        for (int b = 0; b < TRACE_BUCKETS && (size_t)used < size; b++)
+        {
+            used += snprintf(buffer + used, size - used, b == 0 ? "%u" : "/%u", stats->histogram[b]);
+        }
+    }
+    if (used < 0 || (size_t)used + 1 >= size)
+    {
+        return -1;
+    }
+    buffer[used++] = '\n';
+    buffer[used] = '\0';
+    return used;
+}
+
+// Called once the aggregate has been delivered
+void trace_reset(void)
+{
+    portENTER_CRITICAL(&trace_lock);
+    trace_store.wakes = 0;
+    memset(trace_store.phases, 0, sizeof(trace_store.phases));
+    portEXIT_CRITICAL(&trace_lock);
+}
+#endif // TRACE_ENABLE
@@ -0,0 +1,60 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "config.h"
+
+typedef enum {
+    TRACE_BOOT,      // Wake to app_main(), ROM and bootloader included
+    TRACE_INIT,      // NVS, RTC store, spool, ADC and button setup
+    TRACE_ACQUIRE,   // ADC burst and conversion
+    TRACE_RF_START,  // esp_wifi_start() with PHY init and RF calibration, within associate
+    TRACE_ASSOCIATE, // WiFi bring-up until the AP accepted us
+    TRACE_DHCP,      // Association until an address is usable
+    TRACE_TIME_SYNC, // Waiting for SNTP
+    TRACE_CONNECT,   // TCP connect to the uplink
+    TRACE_HANDSHAKE, // TLS handshake on a new uplink connection, full or resumed
+    TRACE_SEND,      // Spool drain and batch transmission
+    TRACE_WAKE,      // Wake to deep sleep, the whole active period
+    TRACE_CPU_MAX,   // Part of the active period with a cpu_boost held
+    TRACE_CPU_DFS,   // Part at the frequency the drivers chose, PM_MIN_FREQ_MHZ when idle
+    TRACE_LIGHT_SLEEP, // Part in automatic light sleep
+    TRACE_PHASE_COUNT
+} trace_phase_t;
+
+#define TRACE_BUCKETS 24 // Powers of two in microseconds, up to ~8 s
+
+// Aggregated over all wakes since the last upload of the trace
+typedef struct {
+    uint32_t count;
+    uint64_t sum_us;
+    uint32_t max_us;
+    uint32_t last_us;     // Duration in the current or previous wake
+    uint32_t last_cycles; // CPU cycles of the same, exact for phases under one wrap
+    uint32_t min_free_heap;
+    uint32_t min_free_stack;
+    uint16_t histogram[TRACE_BUCKETS];
+} trace_phase_stats_t;
+
+#ifdef TRACE_ENABLE
+void init_trace(void);
+void trace_begin(trace_phase_t phase);
+void trace_end(trace_phase_t phase);
+void trace_record(trace_phase_t phase, uint32_t duration_us);
+void trace_sleep(uint64_t sleep_us);
+const trace_phase_stats_t *trace_stats(trace_phase_t phase);
+int trace_format(char *buffer, size_t size);
+void trace_reset(void);
+#else
+static inline void init_trace(void) {}
+static inline void trace_begin(trace_phase_t phase) { (void)phase; }
+static inline void trace_end(trace_phase_t phase) { (void)phase; }
+static inline void trace_record(trace_phase_t phase, uint32_t duration_us) { (void)phase; (void)duration_us; }
+static inline void trace_sleep(uint64_t sleep_us) { (void)sleep_us; }
+static inline const trace_phase_stats_t *trace_stats(trace_phase_t phase) { (void)phase; return NULL; }
+static inline int trace_format(char *buffer, size_t size) { (void)buffer; (void)size; return 0; }
+static inline void trace_reset(void) {}
+#endif
+
+#endif // TRACE_H
@@ -0,0 +1,34 @@
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <esp_err.h>
+#include <stdbool.h>
+#include "rtc_store.h"
+
+// The link the readings leave the device on, picked with UPLINK_TRANSPORT in
+// config.h. send_data() owns the ordering of spool and batch, a backend only
+// moves records.
+typedef struct {
+    const char *name;
+    bool has_ip; // SNTP and stay-connected mode need an IP stack
+    // Brings the link up by deadline_us, within the radio budget of the wake
+    esp_err_t (*connect)(int64_t deadline_us);
+    bool (*connected)(void);
+    // Called once per upload before the first send
+    esp_err_t (*open)(void);
+    // Returns ESP_OK only once every record is delivered
+    esp_err_t (*send)(const batch_record_t *records, int count);
+    // Ends the upload, result is what send_data() returns
+    void (*close)(esp_err_t result);
+    // Turns the radio off before deep sleep
+    void (*disconnect)(void);
+} transport_t;
+
+// wifi_manager.c: association, DHCP and TCP to UPLINK_IP_ADDR:UPLINK_PORT
+extern const transport_t transport_tcp;
+// wifi_manager.c and tls_link.c: the same in TLS 1.2 to UPLINK_IP_ADDR:TLS_PORT
+extern const transport_t transport_tls;
+// espnow_link.c: wire_format frames to GATEWAY_MAC, forwarded by gateway_role.c
+extern const transport_t transport_espnow;
+
+#endif // TRANSPORT_H
@@ -0,0 +1,127 @@
+#include "uplink.h"
+#include "config.h"
+#include "event_log.h"
+#include "power_manager.h"
+#include "rtc_store.h"
+#include "sensor.h"
+#include "spool.h"
+#include "trace.h"
+#include "wire_format.h"
+#include <esp_task_wdt.h>
+#include <esp_timer.h>
+
+// Serializes the longest run of records from the front whose timestamp deltas fit
+// one frame of the given capacity. Returns how many records it took.
+int uplink_frame(uint8_t *frame, size_t capacity, const batch_record_t *records, int count, size_t *length)
+{
+    wire_writer_t writer;
+    wire_writer_init(&writer, frame, capacity, DEVICE_GROUP_ID, count > 0 ? records[0].timestamp : 0);
+    int index = 0;
+    for (; index < count; index++)
+    {
+        int32_t centi_celsius = convert_to_centi_celsius(records[index].raw);
+        if (centi_celsius > INT16_MAX)
+        {
+            centi_celsius = INT16_MAX;
+        }
+        if (centi_celsius < INT16_MIN)
+        {
+            centi_celsius = INT16_MIN;
+        }
+        if (!wire_writer_add(&writer, records[index].timestamp, (int16_t)centi_celsius))
+        {
+            break;
+        }
+    }
+    *length = wire_writer_finish(&writer);
+    return index;
+}
+
+// The backlog goes out in large batches, each marked consumed in flash as soon
+// as it is sent so an interrupted drain resumes where it stopped. No batch is
+// started past the deadline, the rest waits for a later wake. Neither is one
+// after the flash refused a mark, the uplink itself did not fail then.
+static esp_err_t drain_spool(int64_t deadline_us)
+{
+    static batch_record_t records[SPOOL_DRAIN_BATCH];
+    int drained = 0;
+
+    while (drained < SPOOL_DRAIN_MAX_PER_WAKE && esp_timer_get_time() < deadline_us)
+    {
+        int count = spool_peek(records, SPOOL_DRAIN_BATCH);
+        if (count == 0)
+        {
+            break;
+        }
+        esp_err_t result = UPLINK_TRANSPORT.send(records, count);
+        if (result != ESP_OK)
+        {
+            return result;
+        }
+        if (spool_consume(count) != ESP_OK)
+        {
+            break;
+        }
+        drained += count;
+        esp_task_wdt_reset();
+    }
+
+    if (drained > 0)
+    {
+        EVENT_LOG(EVENT_DRAINED, drained, spool_pending());
+    }
+    return ESP_OK;
+}
+
+esp_err_t send_data(int64_t deadline_us)
+{
+    int pending = rtc_batch_pending();
+    if (pending == 0 && spool_pending() == 0)
+    {
+        return ESP_OK;
+    }
+
+    cpu_boost_begin(CPU_BOOST_SEND);
+    esp_err_t result = UPLINK_TRANSPORT.open();
+    if (result != ESP_OK)
+    {
+        cpu_boost_end(CPU_BOOST_SEND);
+        return result;
+    }
+
+    // The spool holds the oldest readings, so it goes first
+    trace_begin(TRACE_SEND);
+    result = drain_spool(deadline_us);
+    if (result == ESP_OK && pending > 0 && spool_pending() > 0)
+    {
+        // Backlog left for the next wake, queue behind it to keep the order
+        result = spool_store_batch();
+        pending = rtc_batch_pending();
+        if (result == ESP_ERR_INVALID_STATE)
+        {
+            // Stamped before the first sync, the batch waits in RTC memory until
+            // it is rebased. Not a failure of the uplink.
+            result = ESP_OK;
+            pending = 0;
+        }
+    }
+    if (result == ESP_OK && pending > 0)
+    {
+        static batch_record_t records[BATCH_CAPACITY];
+        for (int i = 0; i < pending; i++)
+        {
+            records[i] = *rtc_batch_get(i);
+        }
+
+        EVENT_LOG(EVENT_SENDING, pending);
+        result = UPLINK_TRANSPORT.send(records, pending);
+        if (result == ESP_OK)
+        {
+            rtc_batch_drop(pending);
+        }
+    }
+    UPLINK_TRANSPORT.close(result);
+    trace_end(TRACE_SEND);
+    cpu_boost_end(CPU_BOOST_SEND);
+    return result;
+}
@@ -0,0 +1,12 @@
+#ifndef UPLINK_H
+#define UPLINK_H
+
+#include <esp_err.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "transport.h"
+
+esp_err_t send_data(int64_t deadline_us);
+int uplink_frame(uint8_t *frame, size_t capacity, const batch_record_t *records, int count, size_t *length);
+
+#endif // UPLINK_H
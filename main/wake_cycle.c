@@ -0,0 +1,236 @@
+#include "wake_cycle.h"
+#include "config.h"
+#include "event_log.h"
+#include <esp_attr.h>
+#include <esp_crc.h>
+#include <esp_system.h>
+#include <esp_task_wdt.h>
+#include <esp_timer.h>
+#include <string.h>
+
+#define CYCLE_MAGIC 0x43594301 // Changes with the layout of cycle_store_t
+
+typedef struct {
+    uint32_t magic;
+    uint32_t crc;
+    struct {
+        bool measuring;  // From the start of a series until the device goes idle
+        bool active;     // A cycle started and has not finished yet
+        uint8_t current; // Phase the main task is in
+        uint8_t done;    // Bit per finished phase
+        uint8_t flags;   // See wake_cycle_set_flags()
+        uint8_t interrupts[CYCLE_PHASE_COUNT]; // Resets per phase in this cycle
+    } data;
+} cycle_store_t;
+
+// No-init like the event ring: RTC_DATA_ATTR is loaded again on every reset
+// that is not a deep sleep wake, exactly the ones a cycle has to survive
+RTC_NOINIT_ATTR static cycle_store_t store;
+static bool interrupted = false;
+static bool running = false;
+
+static uint32_t store_crc(void)
+{
+    return esp_crc32_le(0, (const uint8_t *)&store.data, sizeof(store.data));
+}
+
+static void seal(void)
+{
+    store.crc = store_crc();
+}
+
+// Power-on and the reset pin start over, crashes and brownouts resume
+void init_wake_cycle(void)
+{
+    bool valid = store.magic == CYCLE_MAGIC && store.crc == store_crc() && store.data.current < CYCLE_PHASE_COUNT;
+    if (!valid)
+    {
+        memset(&store, 0, sizeof(store));
+        store.magic = CYCLE_MAGIC;
+    }
+
+    switch (esp_reset_reason())
+    {
+    case ESP_RST_PANIC:
+    case ESP_RST_INT_WDT:
+    case ESP_RST_TASK_WDT:
+    case ESP_RST_WDT:
+    case ESP_RST_BROWNOUT:
+        interrupted = valid && store.data.measuring;
+        break;
+    default:
+        interrupted = false;
+        break;
+    }
+    if (!interrupted)
+    {
+        store.data.active = false;
+    }
+    seal();
+}
+
+bool wake_cycle_interrupted(void)
+{
+    return interrupted;
+}
+
+// The phase that was running is charged with the reset and given up for this
+// cycle after CYCLE_MAX_INTERRUPTS of them. Only durable results are kept. A
+// phase whose fallback ends the cycle gives up the whole cycle, so a reset
+// from there on starts a fresh one instead of resuming into it again.
+static cycle_phase_t resume_phase(const cycle_phase_desc_t *phases)
+{
+    cycle_phase_t current = store.data.current;
+    uint8_t interrupts = ++store.data.interrupts[current];
+    cycle_phase_t phase = phases[current].resume;
+    if (interrupts >= CYCLE_MAX_INTERRUPTS)
+    {
+        EVENT_LOG(EVENT_PHASE_DEFERRED, current, interrupts);
+        phase = phases[current].fallback;
+    }
+    if (phase >= CYCLE_PHASE_COUNT)
+    {
+        store.data.active = false;
+    }
+    for (int i = 0; i < CYCLE_PHASE_COUNT; i++)
+    {
+        if (!phases[i].durable)
+        {
+            store.data.done &= ~(1u << i);
+        }
+    }
+    EVENT_LOG(EVENT_CYCLE_RESUMED, esp_reset_reason(), phase);
+    return phase;
+}
+
+static bool overran(cycle_phase_t phase, const cycle_phase_desc_t *desc, int64_t deadline_us)
+{
+    int64_t late_us = esp_timer_get_time() - deadline_us;
+    if (late_us <= 0)
+    {
+        return false;
+    }
+    EVENT_LOG(EVENT_PHASE_OVERRUN, phase, desc->deadline_ms, (uint32_t)(late_us / 1000));
+    return true;
+}
+
+static void finish(cycle_phase_t phase)
+{
+    store.data.done |= 1u << phase;
+    seal();
+}
+
+// However long the phase it overlapped took, the join gets the full deadline
+static void join(cycle_phase_t phase, const cycle_phase_desc_t *desc)
+{
+    int64_t deadline_us = desc->deadline_ms > 0 ? esp_timer_get_time() + desc->deadline_ms * 1000LL : INT64_MAX;
+    if (desc->join(deadline_us) == PHASE_DONE)
+    {
+        finish(phase);
+    }
+    else
+    {
+        overran(phase, desc, deadline_us);
+    }
+}
+
+void wake_cycle_run(const cycle_phase_desc_t *phases)
+{
+    cycle_phase_t phase = CYCLE_ACQUIRE;
+    if (store.data.active)
+    {
+        phase = resume_phase(phases);
+    }
+    else
+    {
+        memset(&store.data, 0, sizeof(store.data));
+        store.data.active = true;
+    }
+    store.data.measuring = true;
+    seal();
+    running = true;
+
+    int pending = -1;
+    while (phase < CYCLE_PHASE_COUNT)
+    {
+        const cycle_phase_desc_t *desc = &phases[phase];
+        if (desc->durable && wake_cycle_done(phase))
+        {
+            phase++;
+            continue;
+        }
+        store.data.current = phase;
+        seal();
+        esp_task_wdt_reset();
+
+        int64_t deadline_us = desc->deadline_ms > 0 ? esp_timer_get_time() + desc->deadline_ms * 1000LL : INT64_MAX;
+        phase_result_t result = desc->run(deadline_us);
+        cycle_phase_t next = phase + 1;
+        if (result == PHASE_ABORTED || (result == PHASE_DONE && overran(phase, desc, deadline_us)))
+        {
+            next = desc->fallback;
+        }
+        if (result == PHASE_DONE)
+        {
+            finish(phase);
+        }
+
+        // A background phase only overlaps the one right after it
+        if (pending >= 0)
+        {
+            join(pending, &phases[pending]);
+            pending = -1;
+        }
+        if (result == PHASE_PENDING)
+        {
+            pending = phase;
+        }
+        phase = next;
+    }
+    if (pending >= 0)
+    {
+        join(pending, &phases[pending]);
+    }
+
+    running = false;
+    store.data.active = false;
+    seal();
+}
+
+void wake_cycle_stop(void)
+{
+    store.data.measuring = false;
+    store.data.active = false;
+    seal();
+}
+
+uint8_t wake_cycle_flags(void)
+{
+    return store.data.flags;
+}
+
+void wake_cycle_set_flags(uint8_t flags)
+{
+    store.data.flags = flags;
+    seal();
+}
+
+cycle_phase_t wake_cycle_phase(void)
+{
+    return running ? store.data.current : CYCLE_PHASE_COUNT;
+}
+
+bool wake_cycle_done(cycle_phase_t phase)
+{
+    return (store.data.done & (1u << phase)) != 0;
+}
+
+uint32_t wake_cycle_left_ms(int64_t deadline_us)
+{
+    int64_t left_us = deadline_us - esp_timer_get_time();
+    if (left_us <= 0)
+    {
+        return 0;
+    }
+    return left_us / 1000 > UINT32_MAX ? UINT32_MAX : (uint32_t)(left_us / 1000);
+}
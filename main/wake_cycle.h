@@ -0,0 +1,54 @@
+#ifndef WAKE_CYCLE_H
+#define WAKE_CYCLE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Phases of a measuring wake, in the order they run
+typedef enum {
+    CYCLE_ACQUIRE,        // Reading taken and queued
+    CYCLE_CONNECT,        // Link up
+    CYCLE_TIME_SYNC,      // Clock good enough to timestamp the upload
+    CYCLE_TRANSMIT,       // Spool and batch delivered
+    CYCLE_STAY_CONNECTED, // Associated light sleep while it pays off
+    CYCLE_PERSIST,        // Radio off, leftovers spooled, configuration committed
+    CYCLE_PHASE_COUNT
+} cycle_phase_t;
+
+typedef enum {
+    PHASE_DONE,    // Continue with the next phase
+    PHASE_PENDING, // Runs on in the background during the next phase and is joined after it
+    PHASE_ABORTED, // Continue with the fallback
+} phase_result_t;
+
+// A phase gets the time its deadline falls on, INT64_MAX when it has none,
+// and passes what is left of it to whatever it blocks on. One that still
+// overruns takes the fallback like an aborted one.
+typedef struct {
+    uint32_t deadline_ms; // From the start of the phase and again of its join, 0 for none
+    phase_result_t (*run)(int64_t deadline_us);
+    phase_result_t (*join)(int64_t deadline_us); // For phases that return PHASE_PENDING
+    bool durable;             // The result survives a reset, a resumed cycle does not repeat it
+    cycle_phase_t fallback;   // After an abort, an overrun or CYCLE_MAX_INTERRUPTS resets,
+                              // CYCLE_PHASE_COUNT ends the cycle
+    cycle_phase_t resume;     // Where a cycle reset in this phase starts over
+} cycle_phase_desc_t;
+
+// Kept in no-init RTC memory with the phase each cycle is in. A panic,
+// watchdog or brownout reset during a measuring series resumes it.
+void init_wake_cycle(void);
+bool wake_cycle_interrupted(void);
+// Runs phases[] from CYCLE_ACQUIRE, or from where an interrupted cycle stopped
+void wake_cycle_run(const cycle_phase_desc_t *phases);
+// The device left the measuring series for idle
+void wake_cycle_stop(void);
+
+// Decisions of the application that a resumed cycle has to keep
+uint8_t wake_cycle_flags(void);
+void wake_cycle_set_flags(uint8_t flags);
+bool wake_cycle_done(cycle_phase_t phase);
+// Phase wake_cycle_run() is in, CYCLE_PHASE_COUNT outside of it
+cycle_phase_t wake_cycle_phase(void);
+uint32_t wake_cycle_left_ms(int64_t deadline_us);
+
+#endif // WAKE_CYCLE_H
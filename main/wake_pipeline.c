@@ -0,0 +1,68 @@
+#include "wake_pipeline.h"
+#include "config.h"
+#include <esp_log.h>
+#include <freertos/task.h>
+
+static EventGroupHandle_t pipeline_events = NULL;
+static sensor_reading_t acquired_reading;
+static esp_err_t acquire_result = ESP_ERR_INVALID_STATE;
+static bool acquisition_started = false;
+
+void init_pipeline(void)
+{
+    if (pipeline_events == NULL)
+    {
+        pipeline_events = xEventGroupCreate();
+    }
+}
+
+void pipeline_complete(EventBits_t stages)
+{
+    xEventGroupSetBits(pipeline_events, stages);
+}
+
+bool pipeline_wait(EventBits_t stages, uint32_t timeout_ms)
+{
+    EventBits_t bits = xEventGroupWaitBits(pipeline_events, stages, pdFALSE, pdTRUE,
+                                           pdMS_TO_TICKS(timeout_ms));
+    return (bits & stages) == stages;
+}
+
+static void acquire_task(void *arg)
+{
+    (void)arg;
+    acquire_result = measure_temperature(&acquired_reading);
+    pipeline_complete(PIPELINE_SAMPLES_READY);
+    vTaskDelete(NULL);
+}
+
+// Sampling and conversion run in their own task so they overlap with WiFi association
+void pipeline_start_acquisition(void)
+{
+    xEventGroupClearBits(pipeline_events, PIPELINE_SAMPLES_READY);
+    acquisition_started = true;
+
+    if (xTaskCreate(acquire_task, "acquire", ACQUIRE_TASK_STACK_SIZE, NULL,
+                    ACQUIRE_TASK_PRIORITY, NULL) != pdPASS)
+    {
+        ESP_LOGW(TAG_ADC, "Could not start acquisition task, sampling inline");
+        acquire_result = measure_temperature(&acquired_reading);
+        pipeline_complete(PIPELINE_SAMPLES_READY);
+    }
+}
+
+esp_err_t pipeline_acquisition_result(sensor_reading_t *reading, uint32_t timeout_ms)
+{
+    if (!pipeline_wait(PIPELINE_SAMPLES_READY, timeout_ms))
+    {
+        return ESP_ERR_TIMEOUT;
+    }
+    *reading = acquired_reading;
+    return acquire_result;
+}
+
+// The task may still be inside the ADC driver after a join gave up on it
+bool pipeline_finish_acquisition(uint32_t timeout_ms)
+{
+    return !acquisition_started || pipeline_wait(PIPELINE_SAMPLES_READY, timeout_ms);
+}
@@ -0,0 +1,25 @@
+#ifndef WAKE_PIPELINE_H
+#define WAKE_PIPELINE_H
+
+#include <stdbool.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/event_groups.h>
+#include <esp_bit_defs.h>
+#include "sensor.h"
+
+// Stage completion events of a wake cycle
+#define PIPELINE_NVS_READY     BIT0
+#define PIPELINE_SAMPLES_READY BIT1
+#define PIPELINE_NETWORK_READY BIT2
+#define PIPELINE_TIME_READY    BIT3
+
+void init_pipeline(void);
+void pipeline_complete(EventBits_t stages);
+bool pipeline_wait(EventBits_t stages, uint32_t timeout_ms);
+void pipeline_start_acquisition(void);
+esp_err_t pipeline_acquisition_result(sensor_reading_t *reading, uint32_t timeout_ms);
+// Waits for a started acquisition to leave the ADC driver, before it is torn
+// down. False when it is still in there after timeout_ms.
+bool pipeline_finish_acquisition(uint32_t timeout_ms);
+
+#endif // WAKE_PIPELINE_H
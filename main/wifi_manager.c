@@ -1,54 +1,139 @@
 #include "wifi_manager.h"
 #include "wifi_config.h"
 #include "config.h"
+#include "event_log.h"
+#include "power_manager.h"
+#include "rf_cal.h"
 #include "rtc_store.h"
+#include "sensor.h"
+#include "time_manager.h"
+#include "tls_link.h"
+#include "trace.h"
+#include "transport.h"
+#include "uplink.h"
+#include "wire_format.h"
 #include <esp_wifi.h>
 #include <esp_event.h>
 #include <esp_log.h>
-#include <esp_sntp.h>
 #include <esp_netif.h>
+#include <esp_timer.h>
+#include <esp_bit_defs.h>
+#include <freertos/event_groups.h>
+#if defined(STAY_CONNECTED_TWT) && CONFIG_SOC_WIFI_HE_SUPPORT
+#include <esp_wifi_he.h>
+#define WIFI_PROTOCOLS (WIFI_PROTOCOL_11B | WIFI_PROTOCOL_11G | WIFI_PROTOCOL_11N | WIFI_PROTOCOL_11AX)
+#else
+#define WIFI_PROTOCOLS (WIFI_PROTOCOL_11B | WIFI_PROTOCOL_11G | WIFI_PROTOCOL_11N)
+#endif
 #include <sys/socket.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
 
 bool wifi_connected = false;
-bool sntp_initialized = false;
+
+static esp_netif_t *sta_netif = NULL;
+static bool using_cached_ip = false;
+static fast_connect_t connect_info = {0};
+static int uplink_sock = -1;     // Kept open between uploads in stay-connected mode
+static bool uplink_secure = false; // uplink_sock carries a TLS session, see tls_link.c
+static bool keep_uplink = false;
+
+// Set from the event handler, the connecting task blocks on them instead of polling
+#define WIFI_CONNECTED_BIT BIT0
+#define WIFI_FAIL_BIT BIT1
+static EventGroupHandle_t wifi_events = NULL;
+static int reconnect_limit = 0; // Reconnects allowed after a disconnect, per esp_wifi_start()
+static int reconnects_left = 0;
+static int64_t radio_deadline_us = 0; // End of this wake's radio budget, 0 before the radio started
+static int64_t connect_start_us = 0;  // Start of the connection attempt in progress
+static int64_t connect_deadline_us = INT64_MAX; // Of the caller of wifi_quick_connect()
 
 void wifi_event_handler(void *arg, esp_event_base_t event_base,
                         int32_t event_id, void *event_data)
 {
+    (void)arg;
     if (event_base == WIFI_EVENT)
     {
         switch (event_id)
         {
         case WIFI_EVENT_STA_START:
-            ESP_LOGI(TAG_WIFI, "WiFi station mode starting...");
+            EVENT_LOG(EVENT_WIFI_START);
+            // Events arrive in order, a disconnect from the previous start is already handled
+            reconnects_left = reconnect_limit;
+            xEventGroupClearBits(wifi_events, WIFI_FAIL_BIT);
+            esp_wifi_connect();
             break;
         case WIFI_EVENT_STA_CONNECTED:
-            ESP_LOGI(TAG_WIFI, "WiFi connected");
+        {
+            wifi_event_sta_connected_t *event = (wifi_event_sta_connected_t *)event_data;
+            EVENT_LOG(EVENT_WIFI_CONNECTED, event->channel);
+            memcpy(connect_info.bssid, event->bssid, sizeof(connect_info.bssid));
+            connect_info.channel = event->channel;
+            trace_end(TRACE_ASSOCIATE);
+            cpu_boost_end(CPU_BOOST_ASSOCIATE);
+            trace_begin(TRACE_DHCP);
             break;
+        }
         case WIFI_EVENT_STA_DISCONNECTED:
-            ESP_LOGI(TAG_WIFI, "WiFi disconnected");
+        {
+            wifi_event_sta_disconnected_t *event = (wifi_event_sta_disconnected_t *)event_data;
+            EVENT_LOG(EVENT_WIFI_DISCONNECTED, event->reason);
+            if (wifi_connected)
+            {
+                // A link that drops is a new attempt, not a retry of the one that made it
+                connect_start_us = esp_timer_get_time();
+            }
             wifi_connected = false;
+            xEventGroupClearBits(wifi_events, WIFI_CONNECTED_BIT);
+            if (reconnects_left > 0)
+            {
+                reconnects_left--;
+                esp_wifi_connect();
+            }
+            else
+            {
+                xEventGroupSetBits(wifi_events, WIFI_FAIL_BIT);
+            }
             break;
         }
+        }
     }
     else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP)
     {
         ip_event_got_ip_t *event = (ip_event_got_ip_t *)event_data;
-        ESP_LOGI(TAG_WIFI, "Got IP address: " IPSTR, IP2STR(&event->ip_info.ip));
+        EVENT_LOG(EVENT_GOT_IP, IP2STR(&event->ip_info.ip));
+        trace_end(TRACE_DHCP);
+
+        // What a reconnect costs, whenever in the wake it happens
+        connect_info.wake_to_ip_ms = (esp_timer_get_time() - connect_start_us) / 1000;
+        EVENT_LOG(using_cached_ip ? EVENT_WAKE_TO_IP_FAST : EVENT_WAKE_TO_IP_FULL, connect_info.wake_to_ip_ms);
+
+        // A cached lease keeps its original age, only DHCP starts a new one
+        if (!using_cached_ip)
+        {
+            connect_info.ip_info = event->ip_info;
+            esp_netif_get_dns_info(event->esp_netif, ESP_NETIF_DNS_MAIN, &connect_info.dns);
+            connect_info.lease_time = time_now();
+        }
+        connect_info.valid = true;
+        update_fast_connect(&connect_info);
         wifi_connected = true;
+        xEventGroupSetBits(wifi_events, WIFI_CONNECTED_BIT);
     }
 }
 
-void wifi_init(void)
+static void wifi_stack_init(void)
 {
     static bool wifi_initialized = false;
 
     if (!wifi_initialized)
     {
+        wifi_events = xEventGroupCreate();
         ESP_ERROR_CHECK(esp_netif_init());
         ESP_ERROR_CHECK(esp_event_loop_create_default());
-        esp_netif_t *netif = esp_netif_create_default_wifi_sta();
-        esp_netif_set_hostname(netif, DEVICE_NAME);
+        sta_netif = esp_netif_create_default_wifi_sta();
+        esp_netif_set_hostname(sta_netif, DEVICE_NAME);
 
         wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
         ESP_ERROR_CHECK(esp_wifi_init(&cfg));
@@ -68,8 +153,11 @@ void wifi_init(void)
         wifi_initialized = true;
         ESP_ERROR_CHECK(esp_wifi_set_ps(WIFI_PS_MIN_MODEM));
     }
+}
 
-    wifi_config_t wifi_config = {
+static void wifi_base_config(wifi_config_t *wifi_config)
+{
+    *wifi_config = (wifi_config_t){
         .sta = {
             .ssid = WIFI_SSID,
             .password = WIFI_PASS,
@@ -77,161 +165,474 @@ void wifi_init(void)
             .pmf_cfg = {
                 .capable = true,
                 .required = false},
-            .scan_method = WIFI_FAST_SCAN}};
+            .scan_method = WIFI_FAST_SCAN,
+            // Only used with WIFI_PS_MAX_MODEM, see wifi_stay_connected()
+            .listen_interval = STAY_CONNECTED_LISTEN_INTERVAL}};
+}
 
-    ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
-    ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config));
-    ESP_ERROR_CHECK(esp_wifi_set_protocol(WIFI_IF_STA, WIFI_PROTOCOL_11B | WIFI_PROTOCOL_11G | WIFI_PROTOCOL_11N));
-    ESP_ERROR_CHECK(esp_wifi_start());
-    vTaskDelay(pdMS_TO_TICKS(1000));
-    ESP_ERROR_CHECK(esp_wifi_connect());
+uint32_t wifi_budget_left_ms(void)
+{
+    if (radio_deadline_us == 0)
+    {
+        return WIFI_RADIO_BUDGET_MS;
+    }
+    int64_t left_us = radio_deadline_us - esp_timer_get_time();
+    return left_us > 0 ? (uint32_t)(left_us / 1000) : 0;
+}
 
-    // Connection attempt loop
-    int retry_count = 0;
-    uint32_t start_time = xTaskGetTickCount() * portTICK_PERIOD_MS;
+// What the radio budget and the caller's deadline leave for association and DHCP
+static uint32_t connect_left_ms(void)
+{
+    uint32_t left_ms = wifi_budget_left_ms();
+    int64_t deadline_left_us = connect_deadline_us - esp_timer_get_time();
+    if (deadline_left_us <= 0)
+    {
+        return 0;
+    }
+    return deadline_left_us / 1000 < left_ms ? (uint32_t)(deadline_left_us / 1000) : left_ms;
+}
+
+// Blocks until the station has an address, gave up, or the time is over
+static bool wait_connected(uint32_t timeout_ms)
+{
+    EventBits_t bits = xEventGroupWaitBits(wifi_events, WIFI_CONNECTED_BIT | WIFI_FAIL_BIT,
+                                           pdFALSE, pdFALSE, pdMS_TO_TICKS(timeout_ms));
+    return (bits & WIFI_CONNECTED_BIT) != 0;
+}
 
-    while (!wifi_connected)
+static bool is_fast_connect_usable(void)
+{
+    const fast_connect_t *cache = &rtc_store.hot.data.fast_connect;
+    uint32_t now = time_now();
+
+    return cache->valid &&
+           cache->channel != 0 &&
+           cache->ip_info.ip.addr != 0 &&
+           now >= cache->lease_time &&
+           (now - cache->lease_time) < DHCP_LEASE_REUSE_SEC;
+}
+
+// Connect to the cached AP on its known channel and reuse the cached lease
+static bool wifi_fast_connect(void)
+{
+    if (!is_fast_connect_usable())
     {
-        esp_task_wdt_reset();
+        return false;
+    }
 
-        if (((xTaskGetTickCount() * portTICK_PERIOD_MS) - start_time) >= WIFI_CONNECT_TIMEOUT_MS)
-        {
-            ESP_LOGE(TAG_WIFI, "WiFi connection timeout");
-            return;
-        }
+    const fast_connect_t *cache = &rtc_store.hot.data.fast_connect;
+    connect_info = *cache;
 
-        if (retry_count >= WIFI_MAXIMUM_RETRY)
-        {
-            ESP_LOGE(TAG_WIFI, "WiFi connection failed after maximum retries");
-            return;
-        }
+    wifi_config_t wifi_config;
+    wifi_base_config(&wifi_config);
+    wifi_config.sta.bssid_set = true;
+    memcpy(wifi_config.sta.bssid, cache->bssid, sizeof(cache->bssid));
+    wifi_config.sta.channel = cache->channel;
 
-        ESP_LOGI(TAG_WIFI, "Connecting to WiFi... (attempt %d/%d)",
-                 retry_count + 1, WIFI_MAXIMUM_RETRY);
+    // Static address instead of a DHCP round trip
+    esp_netif_dhcpc_stop(sta_netif);
+    esp_netif_set_ip_info(sta_netif, &cache->ip_info);
+    esp_netif_dns_info_t dns = cache->dns;
+    esp_netif_set_dns_info(sta_netif, ESP_NETIF_DNS_MAIN, &dns);
+    using_cached_ip = true;
 
-        vTaskDelay(pdMS_TO_TICKS(1000));
-        retry_count++;
-    }
+    // A cached AP that refuses us is not retried, the full connect scans instead
+    reconnect_limit = 0;
+    ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
+    ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config));
+    ESP_ERROR_CHECK(esp_wifi_set_protocol(WIFI_IF_STA, WIFI_PROTOCOLS));
+    ESP_ERROR_CHECK(rf_start());
 
-    if (wifi_connected)
+    uint32_t timeout_ms = connect_left_ms();
+    if (wait_connected(timeout_ms < FAST_CONNECT_TIMEOUT_MS ? timeout_ms : FAST_CONNECT_TIMEOUT_MS))
     {
-        // Store config only on successful connection
-        memcpy(&rtc_store.data.wifi_config, &wifi_config, sizeof(wifi_config_t));
-        rtc_store.data.boot_count++;
-        ESP_LOGI(TAG_WIFI, "WiFi connected successfully, boot_count: %d", rtc_store.data.boot_count);
+        return true;
     }
+
+    // AP moved or lease is gone, forget it and go through scan and DHCP
+    EVENT_LOG(EVENT_FAST_CONNECT_FAILED);
+    esp_wifi_disconnect();
+    esp_wifi_stop();
+    esp_netif_dhcpc_start(sta_netif);
+    using_cached_ip = false;
+    connect_info.valid = false;
+    update_fast_connect(&connect_info);
+    return false;
 }
 
-esp_err_t wifi_quick_connect(void)
+void wifi_init(void)
 {
-    if (!wifi_connected)
-    {
-        wifi_init();
-    }
+    wifi_stack_init();
+
+    wifi_config_t wifi_config;
+    wifi_base_config(&wifi_config);
 
     ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
-    ESP_ERROR_CHECK(esp_wifi_start());
+    ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config));
+    ESP_ERROR_CHECK(esp_wifi_set_protocol(WIFI_IF_STA, WIFI_PROTOCOLS));
+    // esp_wifi_connect() is issued from the STA_START event, reconnects from STA_DISCONNECTED
+    reconnect_limit = WIFI_MAXIMUM_RETRY;
+    ESP_ERROR_CHECK(rf_start());
 
-    // Wait for connection
-    int retry = 0;
-    while (!wifi_connected && retry < WIFI_CONNECT_TIMEOUT_MS)
+    if (!wait_connected(connect_left_ms()))
     {
-        vTaskDelay(pdMS_TO_TICKS(100));
-        retry++;
+        ESP_LOGE(TAG_WIFI, "WiFi connection failed within the radio budget");
+        reconnect_limit = 0;
+        reconnects_left = 0;
+        return;
     }
 
-    return wifi_connected ? ESP_OK : ESP_FAIL;
+    // Store config only on successful connection
+    update_wifi_config(&wifi_config);
+    update_rtc_data(rtc_store.hot.data.boot_count + 1,
+                    rtc_store.hot.data.measurement_count,
+                    rtc_store.hot.data.first_measurement_time,
+                    rtc_store.cold.data.calibrated_resistor);
+    EVENT_LOG(EVENT_WIFI_UP, rtc_store.hot.data.boot_count);
 }
 
-esp_err_t send_data(float temperature)
+esp_err_t wifi_quick_connect(int64_t deadline_us)
 {
-    if (!wifi_connected)
+    if (wifi_connected)
     {
-        ESP_LOGE(TAG_WIFI, "WiFi not connected");
-        wifi_connected = false;
-        return ESP_ERR_WIFI_NOT_CONNECT;
+        return ESP_OK;
     }
+    connect_start_us = esp_timer_get_time();
+    connect_deadline_us = deadline_us;
+
+    // Retries keep the first start, so failed attempts count towards association.
+    // The handshake is CPU bound, DHCP and the waits after it are not.
+    trace_begin(TRACE_ASSOCIATE);
+    cpu_boost_begin(CPU_BOOST_ASSOCIATE);
+    if (radio_deadline_us == 0)
+    {
+        radio_deadline_us = esp_timer_get_time() + WIFI_RADIO_BUDGET_MS * 1000LL;
+    }
+    wifi_stack_init();
+    if (wifi_fast_connect())
+    {
+        return ESP_OK;
+    }
+    if (connect_left_ms() > 0)
+    {
+        wifi_init();
+    }
+
+    cpu_boost_end(CPU_BOOST_ASSOCIATE);
+    return wifi_connected ? ESP_OK : ESP_FAIL;
+}
 
+int open_uplink(const char *address, uint16_t port)
+{
     int sock = socket(AF_INET, SOCK_STREAM, 0);
     if (sock < 0)
     {
-        return ESP_FAIL;
+        return -1;
     }
 
     struct timeval timeout;
-    timeout.tv_sec = 5;
+    timeout.tv_sec = UPLINK_TIMEOUT_SEC;
     timeout.tv_usec = 0;
     setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
     setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
 
-    // Format data string (simpler version)
-    char post_data[128];
-    time_t now;
-    struct tm timeinfo;
-    time(&now);
-    localtime_r(&now, &timeinfo);
-
-    // Format: YYYY-MM-DD HH:MM:SS+0000,GROUP_ID,TEMPERATURE,COMMENT
-    snprintf(post_data, sizeof(post_data),
-             "%04d-%02d-%02d %02d:%02d:%02d+0000,1,%.4f,%s\n",
-             timeinfo.tm_year + 1900, timeinfo.tm_mon + 1, timeinfo.tm_mday,
-             timeinfo.tm_hour, timeinfo.tm_min, timeinfo.tm_sec,
-             temperature, DATA_MESSAGE);
-
-    ESP_LOGI(TAG_WIFI, "Sending data: %s", post_data);
-
     struct sockaddr_in server_addr = {
         .sin_family = AF_INET,
-        .sin_port = htons(22504),
-        .sin_addr.s_addr = inet_addr(SERVER_IP_ADDR)};
+        .sin_port = htons(port),
+        .sin_addr.s_addr = inet_addr(address)};
 
     if (connect(sock, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0)
     {
         close(sock);
-        return ESP_ERR_TIMEOUT;
+        return -1;
+    }
+    return sock;
+}
+
+// A server that closed an idle connection leaves it readable with EOF. Sending
+// into it would succeed locally and lose the readings with the reset.
+bool uplink_alive(int sock)
+{
+    char byte;
+    int received = recv(sock, &byte, sizeof(byte), MSG_PEEK | MSG_DONTWAIT);
+    return received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+static void close_uplink(void)
+{
+    if (uplink_sock >= 0)
+    {
+        if (uplink_secure)
+        {
+            tls_link_close();
+        }
+        close(uplink_sock);
+        uplink_sock = -1;
+        uplink_secure = false;
     }
+}
+
+static int uplink_send(const void *data, size_t length)
+{
+    return uplink_secure ? tls_link_send(data, length) : send(uplink_sock, data, length, 0);
+}
+
+#ifdef UPLINK_BINARY
+// One frame per run of readings whose timestamp deltas fit, serialized without allocation
+static esp_err_t send_batch(const batch_record_t *records, int count)
+{
+    static uint8_t frame[WIRE_FRAME_SIZE(BATCH_CAPACITY)];
+    int index = 0;
+
+    while (index < count)
+    {
+        size_t length;
+        index += uplink_frame(frame, sizeof(frame), records + index, count - index, &length);
+        if (uplink_send(frame, length) != (int)length)
+        {
+            return ESP_ERR_INVALID_RESPONSE;
+        }
+    }
+    return ESP_OK;
+}
+#else
+// Lines are collected into one buffer so the batch leaves in as few segments as possible
+static esp_err_t send_batch(const batch_record_t *records, int count)
+{
+    static char post_data[1024];
+    size_t used = 0;
 
-    int sent = send(sock, post_data, strlen(post_data), 0);
-    close(sock);
+    for (int i = 0; i < count; i++)
+    {
+        const batch_record_t *record = &records[i];
+        time_t stamp = (time_t)record->timestamp;
+        struct tm timeinfo;
+        localtime_r(&stamp, &timeinfo);
+
+        // Format: YYYY-MM-DD HH:MM:SS+0000,GROUP_ID,TEMPERATURE,COMMENT
+        int len = snprintf(post_data + used, sizeof(post_data) - used,
+                           "%04d-%02d-%02d %02d:%02d:%02d+0000,%d,%.4f,%s\n",
+                           timeinfo.tm_year + 1900, timeinfo.tm_mon + 1, timeinfo.tm_mday,
+                           timeinfo.tm_hour, timeinfo.tm_min, timeinfo.tm_sec,
+                           DEVICE_GROUP_ID, convert_to_centi_celsius(record->raw) / 100.0f, DATA_MESSAGE);
+        if (len < 0 || (size_t)len >= sizeof(post_data) - used)
+        {
+            // Buffer full, flush what we have and format this line again
+            if (used == 0 || uplink_send(post_data, used) != (int)used)
+            {
+                return ESP_ERR_INVALID_RESPONSE;
+            }
+            used = 0;
+            i--;
+            continue;
+        }
+        used += len;
+    }
 
-    return (sent > 0) ? ESP_OK : ESP_ERR_INVALID_RESPONSE;
+    int sent = uplink_send(post_data, used);
+    return (sent == (int)used) ? ESP_OK : ESP_ERR_INVALID_RESPONSE;
 }
+#endif
 
-bool initialize_sntp(void)
+#if defined(TRACE_UPLINK) && !defined(UPLINK_BINARY)
+// The aggregate rides along with the readings, a failed send keeps it for the next upload
+static void send_trace(void)
 {
-    if (!sntp_initialized)
+    static char line[TRACE_PHASE_COUNT * (48 + TRACE_BUCKETS * 6)];
+    int length = trace_format(line, sizeof(line));
+    if (length > 0 && uplink_send(line, length) == length)
     {
-        ESP_LOGI(TAG_SNTP, "Initializing SNTP");
-        esp_sntp_stop();
-        esp_sntp_setoperatingmode(SNTP_OPMODE_POLL);
-        esp_sntp_setservername(0, SNTP_SERVER);
-        esp_sntp_init();
-        sntp_initialized = true;
+        trace_reset();
     }
+}
+#endif
 
-    // Wait for time to be set
-    time_t now = 0;
-    struct tm timeinfo = {0};
-    int retry = 0;
-    const int retry_count = 15;
+#if defined(LOG_UPLINK) && !defined(UPLINK_BINARY)
+// The entries the endpoint got are dropped, a failed send keeps all of them
+static void send_log(void)
+{
+    static char buffer[1024];
+    char line[EVENT_LINE_MAX];
+    event_cursor_t cursor = event_log_begin();
+    size_t used = 0;
+    int length;
+    while ((length = event_log_next_line(&cursor, line, sizeof(line))) > 0)
+    {
+        if (used + length > sizeof(buffer))
+        {
+            if (uplink_send(buffer, used) != (int)used)
+            {
+                return;
+            }
+            used = 0;
+        }
+        memcpy(buffer + used, line, length);
+        used += length;
+    }
+    if (used > 0 && uplink_send(buffer, used) != (int)used)
+    {
+        return;
+    }
+    event_log_consume(&cursor);
+}
+#endif
 
-    while (timeinfo.tm_year < (2024 - 1900) && retry < retry_count)
+static bool tcp_connected(void)
+{
+    return wifi_connected;
+}
+
+// Reuses the socket kept open in stay-connected mode while the server still
+// has it. TLS only handshakes on a new connection.
+static esp_err_t open_stream(uint16_t port, bool secure)
+{
+    if (!wifi_connected)
     {
-        ESP_LOGI(TAG_SNTP, "Waiting for system time to be set... (%d/%d)", retry + 1, retry_count);
-        vTaskDelay(2000 / portTICK_PERIOD_MS);
-        time(&now);
-        localtime_r(&now, &timeinfo);
-        retry++;
+        ESP_LOGE(TAG_WIFI, "WiFi not connected");
+        return ESP_ERR_WIFI_NOT_CONNECT;
     }
 
-    if (timeinfo.tm_year >= (2024 - 1900))
+    if (uplink_sock >= 0 && !uplink_alive(uplink_sock))
     {
-        ESP_LOGI(TAG_SNTP, "Time synchronized successfully");
-        setenv("TZ", "CET-1CEST,M3.5.0,M10.5.0/3", 1);
-        tzset();
-        return true;
+        EVENT_LOG(EVENT_UPLINK_CLOSED);
+        close_uplink();
+    }
+    if (uplink_sock < 0)
+    {
+        trace_begin(TRACE_CONNECT);
+        uplink_sock = open_uplink(UPLINK_IP_ADDR, port);
+        trace_end(TRACE_CONNECT);
+        if (uplink_sock < 0)
+        {
+            return ESP_ERR_TIMEOUT;
+        }
+        if (secure && tls_link_open(uplink_sock) != ESP_OK)
+        {
+            close_uplink();
+            return ESP_ERR_INVALID_RESPONSE;
+        }
+        uplink_secure = secure;
     }
+    return ESP_OK;
+}
 
-    ESP_LOGE(TAG_SNTP, "Failed to get time from SNTP server");
-    return false;
+static esp_err_t tcp_open(void)
+{
+    return open_stream(UPLINK_PORT, false);
+}
+
+static esp_err_t tls_open(void)
+{
+    return open_stream(TLS_PORT, true);
+}
+
+static esp_err_t tcp_send(const batch_record_t *records, int count)
+{
+    return send_batch(records, count);
+}
+
+static void tcp_close(esp_err_t result)
+{
+#if defined(TRACE_UPLINK) && !defined(UPLINK_BINARY)
+    if (result == ESP_OK)
+    {
+        send_trace();
+    }
+#endif
+#if defined(LOG_UPLINK) && !defined(UPLINK_BINARY)
+    if (result == ESP_OK)
+    {
+        send_log();
+    }
+#endif
+    if (result != ESP_OK || !keep_uplink)
+    {
+        close_uplink();
+    }
+}
+
+static void tcp_disconnect(void)
+{
+    close_uplink();
+    esp_wifi_disconnect();
+    esp_wifi_stop();
+    esp_wifi_deinit();
+}
+
+const transport_t transport_tcp = {
+    .name = "tcp",
+    .has_ip = true,
+    .connect = wifi_quick_connect,
+    .connected = tcp_connected,
+    .open = tcp_open,
+    .send = tcp_send,
+    .close = tcp_close,
+    .disconnect = tcp_disconnect};
+
+// The same uplink wrapped in TLS, to a terminator on TLS_PORT in front of the endpoint
+const transport_t transport_tls = {
+    .name = "tls",
+    .has_ip = true,
+    .connect = wifi_quick_connect,
+    .connected = tcp_connected,
+    .open = tls_open,
+    .send = tcp_send,
+    .close = tcp_close,
+    .disconnect = tcp_disconnect};
+
+#if defined(STAY_CONNECTED_TWT) && CONFIG_SOC_WIFI_HE_SUPPORT
+// Individual TWT: the AP buffers our frames and we only wake once per sample
+// interval, instead of every listen interval. Interval is mantissa << exponent us.
+static void twt_setup(uint32_t interval_sec)
+{
+    wifi_phy_mode_t phy_mode;
+    if (esp_wifi_sta_get_negotiated_phymode(&phy_mode) != ESP_OK || phy_mode != WIFI_PHY_MODE_HE20)
+    {
+        ESP_LOGI(TAG_WIFI, "AP is not Wi-Fi 6, staying on the listen interval");
+        return;
+    }
+
+    uint64_t interval_us = interval_sec * 1000000ULL;
+    uint8_t exponent = 10;
+    while ((interval_us >> exponent) > UINT16_MAX)
+    {
+        exponent++;
+    }
+    wifi_twt_setup_config_t setup_config = {
+        .setup_cmd = TWT_REQUEST,
+        .flow_id = 0,
+        .twt_id = 0,
+        .flow_type = 0,          // Announced
+        .min_wake_dura = 255,    // 255 * 256 us
+        .wake_duration_unit = 0, // 256 us
+        .wake_invl_expn = exponent,
+        .wake_invl_mant = (uint16_t)(interval_us >> exponent),
+        .trigger = 1,
+        .timeout_time_ms = 5000};
+    esp_err_t err = esp_wifi_sta_itwt_setup(&setup_config);
+    ESP_LOGI(TAG_WIFI, "TWT setup for %lu s: %s", (unsigned long)interval_sec, esp_err_to_name(err));
+}
+#endif
+
+// Between samples the station stays associated and only wakes for beacons,
+// or for its TWT service period, and the uplink socket stays open
+void wifi_stay_connected(bool enable, uint32_t interval_sec)
+{
+    (void)interval_sec; // Only used for TWT
+    keep_uplink = enable;
+    esp_wifi_set_ps(enable ? WIFI_PS_MAX_MODEM : WIFI_PS_MIN_MODEM);
+#if defined(STAY_CONNECTED_TWT) && CONFIG_SOC_WIFI_HE_SUPPORT
+    if (enable)
+    {
+        twt_setup(interval_sec);
+    }
+    else
+    {
+        esp_wifi_sta_itwt_teardown(0);
+    }
+#endif
+    if (!enable)
+    {
+        close_uplink();
+    }
 }
@@ -3,15 +3,17 @@
 
 #include <esp_err.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include "esp_task_wdt.h"
 #include "power_manager.h"
 
 void wifi_init(void);
-esp_err_t wifi_quick_connect(void);
-esp_err_t send_data(float temperature);
-bool initialize_sntp(void);
+esp_err_t wifi_quick_connect(int64_t deadline_us);
+uint32_t wifi_budget_left_ms(void);
+void wifi_stay_connected(bool enable, uint32_t interval_sec);
+int open_uplink(const char *address, uint16_t port);
+bool uplink_alive(int sock);
 
 extern bool wifi_connected;
-extern bool sntp_initialized;
 
 #endif // WIFI_MANAGER_H
\ No newline at end of file
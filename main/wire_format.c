@@ -0,0 +1,135 @@
+#include "wire_format.h"
+
+static void put_u16(uint8_t *p, uint16_t value)
+{
+    p[0] = value & 0xff;
+    p[1] = value >> 8;
+}
+
+static void put_u32(uint8_t *p, uint32_t value)
+{
+    put_u16(p, value & 0xffff);
+    put_u16(p + 2, value >> 16);
+}
+
+static uint16_t get_u16(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t get_u32(const uint8_t *p)
+{
+    return get_u16(p) | ((uint32_t)get_u16(p + 2) << 16);
+}
+
+// Standard CRC-32 (zlib), nibble table keeps it small and host-portable
+uint32_t wire_crc32(uint32_t crc, const uint8_t *data, size_t length)
+{
+    static const uint32_t table[16] = {
+        0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+        0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c, 0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c};
+
+    crc = ~crc;
+    for (size_t i = 0; i < length; i++)
+    {
+        crc ^= data[i];
+        crc = (crc >> 4) ^ table[crc & 0x0f];
+        crc = (crc >> 4) ^ table[crc & 0x0f];
+    }
+    return ~crc;
+}
+
+void wire_writer_init(wire_writer_t *writer, uint8_t *buffer, size_t capacity,
+                      uint16_t device_id, uint32_t base_epoch)
+{
+    writer->buffer = buffer;
+    writer->capacity = capacity;
+    writer->length = WIRE_HEADER_SIZE;
+    writer->last_timestamp = base_epoch;
+    writer->count = 0;
+
+    buffer[0] = 'I';
+    buffer[1] = 'S';
+    buffer[2] = WIRE_VERSION;
+    buffer[3] = 0;
+    put_u16(buffer + 4, device_id);
+    put_u32(buffer + 6, base_epoch);
+}
+
+// Returns false when the reading does not fit this frame and needs a new one
+bool wire_writer_add(wire_writer_t *writer, uint32_t timestamp, int16_t centi_celsius)
+{
+    if (writer->count >= WIRE_MAX_RECORDS ||
+        writer->length + WIRE_RECORD_SIZE + WIRE_CRC_SIZE > writer->capacity ||
+        timestamp < writer->last_timestamp ||
+        timestamp - writer->last_timestamp > UINT16_MAX)
+    {
+        return false;
+    }
+
+    put_u16(writer->buffer + writer->length, timestamp - writer->last_timestamp);
+    put_u16(writer->buffer + writer->length + 2, (uint16_t)centi_celsius);
+    writer->length += WIRE_RECORD_SIZE;
+    writer->last_timestamp = timestamp;
+    writer->count++;
+    return true;
+}
+
+size_t wire_writer_finish(wire_writer_t *writer)
+{
+    writer->buffer[3] = writer->count;
+    put_u32(writer->buffer + writer->length, wire_crc32(0, writer->buffer, writer->length));
+    writer->length += WIRE_CRC_SIZE;
+    return writer->length;
+}
+
+// Total length of the frame at data, 0 if more bytes are needed, -1 if it is not a frame
+int wire_frame_length(const uint8_t *data, size_t available)
+{
+    if (available >= 1 && data[0] != 'I')
+    {
+        return -1;
+    }
+    if (available >= 2 && data[1] != 'S')
+    {
+        return -1;
+    }
+    if (available < WIRE_HEADER_SIZE)
+    {
+        return 0;
+    }
+    if (data[2] != WIRE_VERSION)
+    {
+        return -1;
+    }
+    return WIRE_FRAME_SIZE(data[3]);
+}
+
+bool wire_decode(const uint8_t *frame, size_t length, wire_header_t *header,
+                 wire_reading_t *readings, size_t max_readings)
+{
+    int expected = wire_frame_length(frame, length);
+    if (expected <= 0 || (size_t)expected != length || frame[3] > max_readings)
+    {
+        return false;
+    }
+    if (get_u32(frame + length - WIRE_CRC_SIZE) != wire_crc32(0, frame, length - WIRE_CRC_SIZE))
+    {
+        return false;
+    }
+
+    header->version = frame[2];
+    header->count = frame[3];
+    header->device_id = get_u16(frame + 4);
+    header->base_epoch = get_u32(frame + 6);
+
+    uint32_t timestamp = header->base_epoch;
+    const uint8_t *record = frame + WIRE_HEADER_SIZE;
+    for (int i = 0; i < header->count; i++, record += WIRE_RECORD_SIZE)
+    {
+        timestamp += get_u16(record);
+        readings[i].timestamp = timestamp;
+        readings[i].centi_celsius = (int16_t)get_u16(record + 2);
+    }
+    return true;
+}
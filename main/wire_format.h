@@ -0,0 +1,51 @@
+#ifndef WIRE_FORMAT_H
+#define WIRE_FORMAT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Frame layout, all fields little-endian:
+//   magic "IS" | version u8 | count u8 | device_id u16 | base_epoch u32
+//   count x (delta_sec u16 | centi_celsius i16)
+//   crc32 over everything before it
+// Each delta is relative to the previous reading, the first one to base_epoch.
+#define WIRE_VERSION 1
+#define WIRE_HEADER_SIZE 10
+#define WIRE_RECORD_SIZE 4
+#define WIRE_CRC_SIZE 4
+#define WIRE_MAX_RECORDS 255
+#define WIRE_FRAME_SIZE(records) (WIRE_HEADER_SIZE + (records) * WIRE_RECORD_SIZE + WIRE_CRC_SIZE)
+
+typedef struct {
+    uint32_t timestamp;
+    int16_t centi_celsius;
+} wire_reading_t;
+
+typedef struct {
+    uint8_t version;
+    uint8_t count;
+    uint16_t device_id;
+    uint32_t base_epoch;
+} wire_header_t;
+
+typedef struct {
+    uint8_t *buffer;
+    size_t capacity;
+    size_t length;
+    uint32_t last_timestamp;
+    uint8_t count;
+} wire_writer_t;
+
+uint32_t wire_crc32(uint32_t crc, const uint8_t *data, size_t length);
+
+void wire_writer_init(wire_writer_t *writer, uint8_t *buffer, size_t capacity,
+                      uint16_t device_id, uint32_t base_epoch);
+bool wire_writer_add(wire_writer_t *writer, uint32_t timestamp, int16_t centi_celsius);
+size_t wire_writer_finish(wire_writer_t *writer);
+
+int wire_frame_length(const uint8_t *data, size_t available);
+bool wire_decode(const uint8_t *frame, size_t length, wire_header_t *header,
+                 wire_reading_t *readings, size_t max_readings);
+
+#endif // WIRE_FORMAT_H
@@ -0,0 +1,279 @@
+// Local stand-in for the permasense collector on SERVER_PORT.
+//
+// Accepts the same connect/send/close line protocol as send_data() on an
+// epoll loop and records per-connection latency and throughput.
+//
+//   collector [-l addr] [-p port] [-d ms] [-b backlog] [-R bytes] [-s sec] [-o file]
+//     -l  listen address (default 127.0.0.1)
+//     -p  port (default SERVER_PORT)
+//     -d  wait this long after accept before reading, to model a slow collector
+//     -b  listen backlog, small values make synchronized wakes hit SYN drops
+//     -R  receive buffer size, small values make device sends block
+//     -s  print statistics every sec seconds (default 5)
+//     -o  append every received line to file
+#define _GNU_SOURCE // accept4
+#include "config.h"
+#include "latency_histogram.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_EVENTS 256
+
+typedef struct connection {
+    int fd;
+    double accepted_at;
+    double ready_at; // Reading starts here when -d is set
+    uint64_t bytes;
+    uint32_t lines;
+    struct connection *next_pending;
+} connection_t;
+
+typedef struct {
+    uint64_t bytes;
+    uint64_t lines;
+    latency_histogram_t latency;
+} stats_t;
+
+static volatile sig_atomic_t running = 1;
+static stats_t interval_stats, total_stats;
+static connection_t *pending_head = NULL;
+static FILE *line_log = NULL;
+static uint64_t open_connections = 0;
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void on_signal(int sig)
+{
+    (void)sig;
+    running = 0;
+}
+
+static void record(stats_t *stats, const connection_t *conn, uint64_t latency_us)
+{
+    stats->bytes += conn->bytes;
+    stats->lines += conn->lines;
+    latency_record(&stats->latency, latency_us);
+}
+
+static void print_stats(const char *label, const stats_t *stats, double seconds)
+{
+    uint64_t connections = stats->latency.count;
+    fprintf(stderr, "%s: %llu conn (%.1f/s), %llu lines, %.1f kB/s, ", label,
+            (unsigned long long)connections, connections / seconds,
+            (unsigned long long)stats->lines, stats->bytes / seconds / 1000);
+    latency_print(stderr, "latency", &stats->latency);
+    fprintf(stderr, ", %llu open\n", (unsigned long long)open_connections);
+}
+
+static void close_connection(int epoll_fd, connection_t *conn)
+{
+    // Latency is accept to EOF, i.e. how long the device had to keep its socket open
+    uint64_t latency_us = (uint64_t)((now_s() - conn->accepted_at) * 1e6);
+    record(&interval_stats, conn, latency_us);
+    record(&total_stats, conn, latency_us);
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+    close(conn->fd);
+    open_connections--;
+    free(conn);
+}
+
+static void arm(int epoll_fd, connection_t *conn)
+{
+    struct epoll_event event = {.events = EPOLLIN | EPOLLRDHUP, .data.ptr = conn};
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, conn->fd, &event);
+}
+
+static void read_connection(int epoll_fd, connection_t *conn)
+{
+    char buffer[4096];
+    for (;;)
+    {
+        ssize_t received = recv(conn->fd, buffer, sizeof(buffer), 0);
+        if (received > 0)
+        {
+            conn->bytes += received;
+            for (ssize_t i = 0; i < received; i++)
+            {
+                conn->lines += buffer[i] == '\n';
+            }
+            if (line_log != NULL)
+            {
+                fwrite(buffer, 1, received, line_log);
+            }
+            continue;
+        }
+        if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            return;
+        }
+        close_connection(epoll_fd, conn);
+        return;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    const char *address = "127.0.0.1";
+    int port = SERVER_PORT;
+    double read_delay = 0;
+    int backlog = 1024;
+    int rcvbuf = 0;
+    double stats_interval = 5;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "l:p:d:b:R:s:o:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'l': address = optarg; break;
+        case 'p': port = atoi(optarg); break;
+        case 'd': read_delay = atof(optarg) / 1000; break;
+        case 'b': backlog = atoi(optarg); break;
+        case 'R': rcvbuf = atoi(optarg); break;
+        case 's': stats_interval = atof(optarg); break;
+        case 'o':
+            line_log = fopen(optarg, "a");
+            if (line_log == NULL)
+            {
+                perror(optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-l addr] [-p port] [-d ms] [-b backlog] [-R bytes] [-s sec] [-o file]\n",
+                    argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0)
+    {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    int listener = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    int yes = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    if (rcvbuf > 0)
+    {
+        // Inherited by accepted sockets
+        setsockopt(listener, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    }
+    struct sockaddr_in bind_address = {.sin_family = AF_INET, .sin_port = htons(port)};
+    inet_pton(AF_INET, address, &bind_address.sin_addr);
+    if (bind(listener, (struct sockaddr *)&bind_address, sizeof(bind_address)) < 0 ||
+        listen(listener, backlog) < 0)
+    {
+        perror("collector: listen");
+        return EXIT_FAILURE;
+    }
+
+    int epoll_fd = epoll_create1(0);
+    struct epoll_event listen_event = {.events = EPOLLIN, .data.ptr = NULL};
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listener, &listen_event);
+    fprintf(stderr, "collector: listening on %s:%d\n", address, port);
+
+    double started = now_s();
+    double interval_start = started;
+    struct epoll_event events[MAX_EVENTS];
+
+    while (running)
+    {
+        // Wake up for the next delayed connection or the next stats line
+        double now = now_s();
+        double next = interval_start + stats_interval;
+        for (connection_t *conn = pending_head; conn != NULL; conn = conn->next_pending)
+        {
+            if (conn->ready_at < next)
+            {
+                next = conn->ready_at;
+            }
+        }
+        int timeout_ms = next > now ? (int)((next - now) * 1000) + 1 : 0;
+        int count = epoll_wait(epoll_fd, events, MAX_EVENTS, timeout_ms);
+
+        for (int i = 0; i < count; i++)
+        {
+            connection_t *conn = events[i].data.ptr;
+            if (conn != NULL)
+            {
+                read_connection(epoll_fd, conn);
+                continue;
+            }
+
+            int fd;
+            while ((fd = accept4(listener, NULL, NULL, SOCK_NONBLOCK)) >= 0)
+            {
+                connection_t *accepted = calloc(1, sizeof(connection_t));
+                accepted->fd = fd;
+                accepted->accepted_at = now_s();
+                accepted->ready_at = accepted->accepted_at + read_delay;
+                open_connections++;
+                if (read_delay > 0)
+                {
+                    accepted->next_pending = pending_head;
+                    pending_head = accepted;
+                }
+                else
+                {
+                    arm(epoll_fd, accepted);
+                }
+            }
+        }
+
+        // Start reading connections whose delay has expired
+        now = now_s();
+        for (connection_t **link = &pending_head; *link != NULL;)
+        {
+            connection_t *conn = *link;
+            if (conn->ready_at <= now)
+            {
+                *link = conn->next_pending;
+                arm(epoll_fd, conn);
+            }
+            else
+            {
+                link = &conn->next_pending;
+            }
+        }
+
+        if (now - interval_start >= stats_interval)
+        {
+            print_stats("interval", &interval_stats, now - interval_start);
+            memset(&interval_stats, 0, sizeof(interval_stats));
+            interval_start = now;
+            if (line_log != NULL)
+            {
+                fflush(line_log);
+            }
+        }
+    }
+
+    print_stats("total", &total_stats, now_s() - started);
+    if (line_log != NULL)
+    {
+        fclose(line_log);
+    }
+    return EXIT_SUCCESS;
+}
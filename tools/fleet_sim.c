@@ -0,0 +1,432 @@
+// Fleet traffic simulator for load testing the uplink path.
+//
+// Every virtual device follows the firmware's duty cycle: wake every
+// DEEP_SLEEP_TIME_SEC, take one reading, and once BATCH_SEND_THRESHOLD
+// readings are queued connect, send the batch, close. A failed upload keeps
+// the readings (the oldest are overwritten past BATCH_CAPACITY) and is retried
+// on the next wake, and connect and send give up after UPLINK_TIMEOUT_SEC like
+// open_uplink() does. All devices share one epoll loop.
+//
+//   fleet_sim [-n devices] [-a addr] [-p port] [-t sec] [-x scale] [-w sec]
+//             [-k threshold] [-S] [-j ms] [-b] [-s sec]
+//     -n  number of devices (default 1000)
+//     -a  collector address (default 127.0.0.1)
+//     -p  collector port (default SERVER_PORT)
+//     -t  wall-clock run time (default 60)
+//     -x  run the sleep schedule this many times faster than real time (default 1);
+//         network timeouts are not scaled
+//     -w  sleep interval in seconds (default DEEP_SLEEP_TIME_SEC)
+//     -k  readings per upload (default BATCH_SEND_THRESHOLD)
+//     -S  synchronized fleet: every device wakes at t=0 instead of at a random phase,
+//         like after a shared power cut
+//     -j  random per-wake jitter of up to ms, e.g. RTC drift in synchronized mode
+//     -b  send wire_format frames as UPLINK_BINARY devices do (point -p at the gateway)
+//     -s  print statistics every sec seconds (default 5)
+#include "config.h"
+#include "latency_histogram.h"
+#include "wire_format.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_EVENTS 256
+#define CSV_LINE_SIZE 96
+#define PAYLOAD_SIZE (BATCH_CAPACITY * CSV_LINE_SIZE)
+
+typedef enum {
+    DEVICE_SLEEPING,
+    DEVICE_CONNECTING,
+    DEVICE_SENDING
+} device_state_t;
+
+typedef struct {
+    int fd;
+    device_state_t state;
+    double next_wake;  // Wall clock
+    double deadline;   // Timeout of the current connect or send
+    double started_at; // Wake that triggered the upload
+    double connect_at;
+    uint32_t pending;  // Queued readings
+    uint32_t oldest_epoch;
+    size_t length;
+    size_t sent;
+    char payload[PAYLOAD_SIZE];
+} device_t;
+
+typedef struct {
+    uint64_t uploads;
+    uint64_t readings;
+    uint64_t bytes;
+    uint64_t refused;
+    uint64_t connect_timeouts;
+    uint64_t send_failures;
+    uint64_t lost_readings;
+    latency_histogram_t connect;
+    latency_histogram_t upload;
+} fleet_stats_t;
+
+static volatile sig_atomic_t running = 1;
+static fleet_stats_t interval_stats, total_stats;
+static struct sockaddr_in collector_address;
+static double wake_interval;
+static uint32_t reading_spacing = DEEP_SLEEP_TIME_SEC; // Simulated seconds between readings
+static double jitter;
+static uint32_t threshold = BATCH_SEND_THRESHOLD;
+static bool binary = false;
+static uint64_t active_uploads = 0, peak_uploads = 0;
+
+#define COUNT(field) (interval_stats.field++, total_stats.field++)
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void on_signal(int sig)
+{
+    (void)sig;
+    running = 0;
+}
+
+static double random_unit(void)
+{
+    return rand() / (RAND_MAX + 1.0);
+}
+
+static void schedule_next_wake(device_t *device, double now)
+{
+    device->next_wake = now + wake_interval + jitter * random_unit();
+}
+
+// Batch contents mirror send_batch(): one reading per wake, device index as group id
+static void build_payload(device_t *device, int index)
+{
+    uint32_t base = device->oldest_epoch;
+    device->length = 0;
+    device->sent = 0;
+
+    if (binary)
+    {
+        wire_writer_t writer;
+        wire_writer_init(&writer, (uint8_t *)device->payload, sizeof(device->payload), (uint16_t)(index + 1), base);
+        for (uint32_t i = 0; i < device->pending; i++)
+        {
+            wire_writer_add(&writer, base + i * reading_spacing, (int16_t)(1800 + rand() % 400));
+        }
+        device->length = wire_writer_finish(&writer);
+        return;
+    }
+
+    for (uint32_t i = 0; i < device->pending; i++)
+    {
+        time_t stamp = (time_t)(base + i * reading_spacing);
+        struct tm timeinfo;
+        localtime_r(&stamp, &timeinfo);
+        device->length += snprintf(device->payload + device->length, sizeof(device->payload) - device->length,
+                                   "%04d-%02d-%02d %02d:%02d:%02d+0000,%d,%.4f,%s\n",
+                                   timeinfo.tm_year + 1900, timeinfo.tm_mon + 1, timeinfo.tm_mday,
+                                   timeinfo.tm_hour, timeinfo.tm_min, timeinfo.tm_sec,
+                                   index + 1, (1800 + rand() % 400) / 100.0f, DATA_MESSAGE);
+    }
+}
+
+// Upload ends either way; only a fully sent batch clears the device's queue
+static void finish_upload(int epoll_fd, device_t *device, double now, bool success)
+{
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, device->fd, NULL);
+    close(device->fd);
+    device->fd = -1;
+    device->state = DEVICE_SLEEPING;
+    active_uploads--;
+
+    if (success)
+    {
+        uint64_t latency_us = (uint64_t)((now - device->started_at) * 1e6);
+        COUNT(uploads);
+        interval_stats.readings += device->pending;
+        total_stats.readings += device->pending;
+        interval_stats.bytes += device->length;
+        total_stats.bytes += device->length;
+        latency_record(&interval_stats.upload, latency_us);
+        latency_record(&total_stats.upload, latency_us);
+        device->pending = 0;
+    }
+    schedule_next_wake(device, now);
+}
+
+static void start_upload(int epoll_fd, device_t *device, int index, double now)
+{
+    build_payload(device, index);
+    device->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (device->fd < 0)
+    {
+        perror("fleet_sim: socket");
+        running = 0;
+        return;
+    }
+
+    device->started_at = now;
+    device->deadline = now + UPLINK_TIMEOUT_SEC;
+    device->state = DEVICE_CONNECTING;
+    active_uploads++;
+    if (active_uploads > peak_uploads)
+    {
+        peak_uploads = active_uploads;
+    }
+
+    struct epoll_event event = {.events = EPOLLOUT, .data.u32 = (uint32_t)index};
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, device->fd, &event);
+    if (connect(device->fd, (struct sockaddr *)&collector_address, sizeof(collector_address)) < 0 &&
+        errno != EINPROGRESS)
+    {
+        COUNT(refused);
+        finish_upload(epoll_fd, device, now, false);
+    }
+}
+
+// One wake of the firmware: queue a reading, upload when the batch is due
+static void wake(int epoll_fd, device_t *device, int index, double now)
+{
+    uint32_t epoch = (uint32_t)time(NULL);
+    if (device->pending == 0)
+    {
+        device->oldest_epoch = epoch;
+    }
+    if (device->pending == BATCH_CAPACITY)
+    {
+        // rtc_batch_append() overwrites the oldest reading
+        COUNT(lost_readings);
+        device->oldest_epoch += reading_spacing;
+    }
+    else
+    {
+        device->pending++;
+    }
+
+    if (device->pending >= threshold)
+    {
+        start_upload(epoll_fd, device, index, now);
+    }
+    else
+    {
+        schedule_next_wake(device, now);
+    }
+}
+
+static void on_writable(int epoll_fd, device_t *device, double now)
+{
+    if (device->state == DEVICE_CONNECTING)
+    {
+        int error = 0;
+        socklen_t length = sizeof(error);
+        getsockopt(device->fd, SOL_SOCKET, SO_ERROR, &error, &length);
+        if (error != 0)
+        {
+            COUNT(refused);
+            finish_upload(epoll_fd, device, now, false);
+            return;
+        }
+        latency_record(&interval_stats.connect, (uint64_t)((now - device->started_at) * 1e6));
+        latency_record(&total_stats.connect, (uint64_t)((now - device->started_at) * 1e6));
+        device->state = DEVICE_SENDING;
+        device->deadline = now + UPLINK_TIMEOUT_SEC;
+    }
+
+    while (device->sent < device->length)
+    {
+        ssize_t sent = send(device->fd, device->payload + device->sent, device->length - device->sent, MSG_NOSIGNAL);
+        if (sent < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                return;
+            }
+            COUNT(send_failures);
+            finish_upload(epoll_fd, device, now, false);
+            return;
+        }
+        // SO_SNDTIMEO applies per send() call, so progress restarts the timeout
+        device->sent += sent;
+        device->deadline = now + UPLINK_TIMEOUT_SEC;
+    }
+    finish_upload(epoll_fd, device, now, true);
+}
+
+static void print_stats(const char *label, const fleet_stats_t *stats, double seconds)
+{
+    fprintf(stderr, "%s: %llu uploads (%.1f/s), %llu readings, %.1f kB/s, failed %llu refused %llu connect timeout "
+                    "%llu send, %llu lost, ",
+            label, (unsigned long long)stats->uploads, stats->uploads / seconds,
+            (unsigned long long)stats->readings, stats->bytes / seconds / 1000,
+            (unsigned long long)stats->refused, (unsigned long long)stats->connect_timeouts,
+            (unsigned long long)stats->send_failures, (unsigned long long)stats->lost_readings);
+    latency_print(stderr, "connect", &stats->connect);
+    fprintf(stderr, ", ");
+    latency_print(stderr, "upload", &stats->upload);
+    fprintf(stderr, ", %llu active (peak %llu)\n", (unsigned long long)active_uploads,
+            (unsigned long long)peak_uploads);
+}
+
+int main(int argc, char **argv)
+{
+    int device_count = 1000;
+    const char *address = "127.0.0.1";
+    int port = SERVER_PORT;
+    double run_time = 60;
+    double scale = 1;
+    double sleep_sec = DEEP_SLEEP_TIME_SEC;
+    bool synchronized = false;
+    double stats_interval = 5;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:a:p:t:x:w:k:Sj:bs:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n': device_count = atoi(optarg); break;
+        case 'a': address = optarg; break;
+        case 'p': port = atoi(optarg); break;
+        case 't': run_time = atof(optarg); break;
+        case 'x': scale = atof(optarg); break;
+        case 'w': sleep_sec = atof(optarg); break;
+        case 'k': threshold = (uint32_t)atoi(optarg); break;
+        case 'S': synchronized = true; break;
+        case 'j': jitter = atof(optarg) / 1000; break;
+        case 'b': binary = true; break;
+        case 's': stats_interval = atof(optarg); break;
+        default:
+            fprintf(stderr, "usage: %s [-n devices] [-a addr] [-p port] [-t sec] [-x scale] [-w sec] "
+                            "[-k threshold] [-S] [-j ms] [-b] [-s sec]\n",
+                    argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (device_count <= 0 || scale <= 0 || threshold == 0 || threshold > BATCH_CAPACITY ||
+        (binary && threshold > WIRE_MAX_RECORDS))
+    {
+        fprintf(stderr, "fleet_sim: invalid arguments\n");
+        return EXIT_FAILURE;
+    }
+    wake_interval = sleep_sec / scale;
+    reading_spacing = (uint32_t)sleep_sec;
+
+    if (getenv("TZ") == NULL)
+    {
+        setenv("TZ", TIME_ZONE, 1);
+    }
+    tzset();
+
+    // Each uploading device holds one socket
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0)
+    {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+        if (limit.rlim_cur < (rlim_t)device_count + 16)
+        {
+            fprintf(stderr, "fleet_sim: only %llu descriptors, uploads may fail with EMFILE\n",
+                    (unsigned long long)limit.rlim_cur);
+        }
+    }
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    collector_address.sin_family = AF_INET;
+    collector_address.sin_port = htons(port);
+    if (inet_pton(AF_INET, address, &collector_address.sin_addr) != 1)
+    {
+        fprintf(stderr, "fleet_sim: bad address %s\n", address);
+        return EXIT_FAILURE;
+    }
+
+    device_t *devices = calloc(device_count, sizeof(device_t));
+    if (devices == NULL)
+    {
+        perror("fleet_sim");
+        return EXIT_FAILURE;
+    }
+    double started = now_s();
+    srand((unsigned)started);
+    for (int i = 0; i < device_count; i++)
+    {
+        devices[i].fd = -1;
+        devices[i].next_wake = started + (synchronized ? jitter * random_unit() : wake_interval * random_unit());
+    }
+
+    int epoll_fd = epoll_create1(0);
+    struct epoll_event events[MAX_EVENTS];
+    double interval_start = started;
+    fprintf(stderr, "fleet_sim: %d devices -> %s:%d, %s, wake every %.3f s wall, upload every %u wakes\n",
+            device_count, address, port, synchronized ? "synchronized" : "random phase", wake_interval, threshold);
+
+    while (running && now_s() - started < run_time)
+    {
+        double now = now_s();
+        double next = interval_start + stats_interval;
+        for (int i = 0; i < device_count; i++)
+        {
+            double due = devices[i].state == DEVICE_SLEEPING ? devices[i].next_wake : devices[i].deadline;
+            if (due < next)
+            {
+                next = due;
+            }
+        }
+        int timeout_ms = next > now ? (int)((next - now) * 1000) + 1 : 0;
+        int count = epoll_wait(epoll_fd, events, MAX_EVENTS, timeout_ms);
+
+        now = now_s();
+        for (int i = 0; i < count; i++)
+        {
+            device_t *device = &devices[events[i].data.u32];
+            if (device->state != DEVICE_SLEEPING)
+            {
+                on_writable(epoll_fd, device, now);
+            }
+        }
+
+        for (int i = 0; i < device_count && running; i++)
+        {
+            device_t *device = &devices[i];
+            if (device->state == DEVICE_SLEEPING && device->next_wake <= now)
+            {
+                wake(epoll_fd, device, i, now);
+            }
+            else if (device->state != DEVICE_SLEEPING && device->deadline <= now)
+            {
+                if (device->state == DEVICE_CONNECTING)
+                {
+                    COUNT(connect_timeouts);
+                }
+                else
+                {
+                    COUNT(send_failures);
+                }
+                finish_upload(epoll_fd, device, now, false);
+            }
+        }
+
+        if (now - interval_start >= stats_interval)
+        {
+            print_stats("interval", &interval_stats, now - interval_start);
+            memset(&interval_stats, 0, sizeof(interval_stats));
+            interval_start = now;
+        }
+    }
+
+    print_stats("total", &total_stats, now_s() - started);
+    free(devices);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,237 @@
+// Gateway for UPLINK_BINARY devices: decodes wire_format frames and emits
+// the same "timestamp,group,temp,comment" lines send_data() would have sent
+// to the permasense endpoint in CSV mode.
+//
+//   gateway [-p port] [-f host:port] [-m comment] [-i file]
+//     -p  port to accept devices on (default GATEWAY_PORT)
+//     -f  forward the lines to host:port, one connection per frame (default: stdout)
+//     -m  comment field (default DATA_MESSAGE)
+//     -i  decode a captured stream from a file ('-' for stdin) and exit
+//
+// Timestamps are formatted in local time like the firmware does, with TZ
+// defaulting to the firmware's TIME_ZONE so the lines are byte-identical.
+#include "config.h"
+#include "wire_format.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define STREAM_BUFFER_SIZE 4096
+
+static const char *comment = DATA_MESSAGE;
+static const char *forward_host = NULL;
+static const char *forward_port = NULL;
+static unsigned long frames_ok, frames_bad, readings_out;
+
+static int forward_lines(const char *lines, size_t length)
+{
+    struct addrinfo hints = {.ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM};
+    struct addrinfo *result;
+    if (getaddrinfo(forward_host, forward_port, &hints, &result) != 0)
+    {
+        fprintf(stderr, "gateway: cannot resolve %s\n", forward_host);
+        return -1;
+    }
+
+    int sock = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
+    int rc = -1;
+    if (sock >= 0 && connect(sock, result->ai_addr, result->ai_addrlen) == 0 &&
+        send(sock, lines, length, 0) == (ssize_t)length)
+    {
+        rc = 0;
+    }
+    else
+    {
+        fprintf(stderr, "gateway: forwarding failed: %s\n", strerror(errno));
+    }
+    if (sock >= 0)
+    {
+        close(sock);
+    }
+    freeaddrinfo(result);
+    return rc;
+}
+
+static void emit_frame(const wire_header_t *header, const wire_reading_t *readings)
+{
+    static char lines[WIRE_MAX_RECORDS * 96];
+    size_t used = 0;
+
+    for (int i = 0; i < header->count; i++)
+    {
+        time_t stamp = (time_t)readings[i].timestamp;
+        struct tm timeinfo;
+        localtime_r(&stamp, &timeinfo);
+        used += snprintf(lines + used, sizeof(lines) - used,
+                         "%04d-%02d-%02d %02d:%02d:%02d+0000,%d,%.4f,%s\n",
+                         timeinfo.tm_year + 1900, timeinfo.tm_mon + 1, timeinfo.tm_mday,
+                         timeinfo.tm_hour, timeinfo.tm_min, timeinfo.tm_sec,
+                         header->device_id, readings[i].centi_celsius / 100.0f, comment);
+    }
+    readings_out += header->count;
+
+    if (forward_host != NULL)
+    {
+        forward_lines(lines, used);
+    }
+    else
+    {
+        fwrite(lines, 1, used, stdout);
+        fflush(stdout);
+    }
+}
+
+// Consumes whole frames from the front of buffer, returns the bytes left over
+static size_t decode_buffer(uint8_t *buffer, size_t length)
+{
+    static wire_reading_t readings[WIRE_MAX_RECORDS];
+    size_t offset = 0;
+
+    while (offset < length)
+    {
+        int frame_length = wire_frame_length(buffer + offset, length - offset);
+        if (frame_length < 0)
+        {
+            // Not a frame start, resynchronize on the next byte
+            offset++;
+            continue;
+        }
+        if (frame_length == 0 || (size_t)frame_length > length - offset)
+        {
+            break;
+        }
+
+        wire_header_t header;
+        if (wire_decode(buffer + offset, frame_length, &header, readings, WIRE_MAX_RECORDS))
+        {
+            frames_ok++;
+            emit_frame(&header, readings);
+            offset += frame_length;
+        }
+        else
+        {
+            frames_bad++;
+            offset++;
+        }
+    }
+
+    memmove(buffer, buffer + offset, length - offset);
+    return length - offset;
+}
+
+static void decode_fd(int fd)
+{
+    static uint8_t buffer[STREAM_BUFFER_SIZE];
+    size_t length = 0;
+    ssize_t received;
+
+    while ((received = read(fd, buffer + length, sizeof(buffer) - length)) > 0)
+    {
+        length = decode_buffer(buffer, length + received);
+        if (length == sizeof(buffer))
+        {
+            // Cannot be a valid frame, drop it
+            frames_bad++;
+            length = 0;
+        }
+    }
+    if (length > 0)
+    {
+        fprintf(stderr, "gateway: %zu trailing bytes dropped\n", length);
+    }
+}
+
+static int serve(int port)
+{
+    int listener = socket(AF_INET6, SOCK_STREAM, 0);
+    int yes = 1, no = 0;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    setsockopt(listener, IPPROTO_IPV6, IPV6_V6ONLY, &no, sizeof(no));
+
+    struct sockaddr_in6 address = {.sin6_family = AF_INET6, .sin6_port = htons(port), .sin6_addr = in6addr_any};
+    if (bind(listener, (struct sockaddr *)&address, sizeof(address)) < 0 || listen(listener, 64) < 0)
+    {
+        perror("gateway: listen");
+        return EXIT_FAILURE;
+    }
+    fprintf(stderr, "gateway: listening on port %d\n", port);
+
+    for (;;)
+    {
+        int client = accept(listener, NULL, NULL);
+        if (client < 0)
+        {
+            continue;
+        }
+        // Devices send a batch and close, a stalled one must not block the others for long
+        struct timeval timeout = {.tv_sec = 10};
+        setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        decode_fd(client);
+        close(client);
+        fprintf(stderr, "gateway: %lu frames ok, %lu bad, %lu readings\n", frames_ok, frames_bad, readings_out);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int port = GATEWAY_PORT;
+    const char *input = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "p:f:m:i:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'p':
+            port = atoi(optarg);
+            break;
+        case 'f':
+        {
+            static char host[256];
+            char *colon = strrchr(optarg, ':');
+            if (colon == NULL || (size_t)(colon - optarg) >= sizeof(host))
+            {
+                fprintf(stderr, "gateway: -f expects host:port\n");
+                return EXIT_FAILURE;
+            }
+            memcpy(host, optarg, colon - optarg);
+            forward_host = host;
+            forward_port = colon + 1;
+            break;
+        }
+        case 'm':
+            comment = optarg;
+            break;
+        case 'i':
+            input = optarg;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-p port] [-f host:port] [-m comment] [-i file]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    setenv("TZ", getenv("TZ") ? getenv("TZ") : TIME_ZONE, 1);
+    tzset();
+
+    if (input != NULL)
+    {
+        FILE *file = strcmp(input, "-") == 0 ? stdin : fopen(input, "rb");
+        if (file == NULL)
+        {
+            perror(input);
+            return EXIT_FAILURE;
+        }
+        decode_fd(fileno(file));
+        fprintf(stderr, "gateway: %lu frames ok, %lu bad, %lu readings\n", frames_ok, frames_bad, readings_out);
+        return frames_bad ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+    return serve(port);
+}
@@ -0,0 +1,336 @@
+// Runs the gateway's aggregation and forwarding (main/aggregator.c) against a
+// loopback link: simulated sensors frame their readings the way espnow_link.c
+// does, a lossy link drops frames and replies, and the endpoint behind the sink
+// fails now and then, which fills the gateway until it turns sensors away.
+// Every reading must arrive exactly once, in order per sensor.
+//
+//   gateway_loopback [-n sensors] [-r readings] [-l loss] [-a replyloss] [-u upfail] [-s seed] [-v]
+//     -n  sensors sharing the gateway (default 50), beyond GATEWAY_MAX_PEERS the
+//         evictions from the peer table let repeats through and the check fails
+//     -r  readings per sensor (default 500)
+//     -l  percentage of frames lost on the way to the gateway (default 10)
+//     -a  percentage of gateway replies lost, the sensor then sends again (default 10)
+//     -u  percentage of flushes the endpoint refuses (default 10)
+//     -s  random seed
+//     -v  print the forwarded lines
+//
+// Lines are formatted in UTC here so they parse back without the zone rules.
+#include "aggregator.h"
+#include "config.h"
+#include "wire_format.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BASE_EPOCH 1767225600UL // 2026-01-01
+#define SENSOR_INTERVAL_SEC 30
+#define SENSOR_BACKLOG 4096   // Stands in for RTC batch and spool together
+#define SETTLE_ROUNDS 1000    // Upload rounds after the last reading to empty the backlogs
+
+typedef struct {
+    uint8_t mac[6];
+    uint16_t device_id;
+    wire_reading_t backlog[SENSOR_BACKLOG];
+    int pending;
+    int generated;
+} sensor_t;
+
+typedef struct {
+    char *data;
+    size_t length;
+    size_t capacity;
+    unsigned long flushes;
+    unsigned long refused;
+} loopback_t;
+
+static int frame_loss_percent = 10;
+static int reply_loss_percent = 10;
+static int upstream_fail_percent = 10;
+static bool verbose = false;
+static aggregator_t aggregator;
+static unsigned long frames_sent, attempts, probes, refusals;
+
+static bool chance(int percent)
+{
+    return rand() % 100 < percent;
+}
+
+static int16_t reading_value(int sensor, int index)
+{
+    return (int16_t)((sensor * 37 + index * 11) % 4000 - 2000);
+}
+
+// The endpoint: keeps everything it accepts, refuses some flushes outright
+static bool loopback_sink(void *context, const char *data, size_t length)
+{
+    loopback_t *loopback = context;
+    loopback->flushes++;
+    if (chance(upstream_fail_percent))
+    {
+        loopback->refused++;
+        return false;
+    }
+    if (loopback->length + length > loopback->capacity)
+    {
+        loopback->capacity = (loopback->length + length) * 2;
+        loopback->data = realloc(loopback->data, loopback->capacity);
+        if (loopback->data == NULL)
+        {
+            perror("gateway_loopback");
+            exit(EXIT_FAILURE);
+        }
+    }
+    memcpy(loopback->data + loopback->length, data, length);
+    loopback->length += length;
+    return true;
+}
+
+// One frame with the retries of send_frame() in espnow_link.c, true once the
+// gateway replied that it stored the readings
+static bool send_frame(const sensor_t *sensor, const uint8_t *frame, size_t length)
+{
+    for (int attempt = 0; attempt < ESPNOW_SEND_RETRIES; attempt++)
+    {
+        attempts++;
+        if (chance(frame_loss_percent))
+        {
+            continue;
+        }
+        frames_sent++;
+        aggregator_result_t result = aggregator_receive(&aggregator, sensor->mac, frame, length);
+
+        // What gateway_role.c answers, through encode and decode
+        aggregator_reply_t answer = {
+            .flags = AGGREGATOR_REPLY_TIME_VALID | (result != AGGREGATOR_FULL ? AGGREGATOR_REPLY_STORED : 0),
+            .epoch_us = (int64_t)BASE_EPOCH * 1000000,
+            .frame_crc = aggregator_frame_crc(frame, length)};
+        uint8_t buffer[AGGREGATOR_REPLY_SIZE];
+        aggregator_reply_t reply;
+        if (result == AGGREGATOR_BAD_FRAME ||
+            !aggregator_reply_decode(buffer, aggregator_reply_encode(buffer, &answer), &reply) ||
+            reply.frame_crc != answer.frame_crc || reply.epoch_us != answer.epoch_us)
+        {
+            fprintf(stderr, "gateway_loopback: frame or reply does not round-trip\n");
+            exit(EXIT_FAILURE);
+        }
+        if (chance(reply_loss_percent))
+        {
+            continue;
+        }
+        if (!(reply.flags & AGGREGATOR_REPLY_STORED))
+        {
+            refusals++;
+            return false;
+        }
+        return true;
+    }
+    return false;
+}
+
+// Probe, then the backlog in chunks of SPOOL_DRAIN_BATCH, each consumed only
+// when all its frames were acked, like send_data() with the ESP-NOW transport
+static void upload(sensor_t *sensor)
+{
+    static uint8_t frame[WIRE_FRAME_SIZE(ESPNOW_MAX_RECORDS)];
+    wire_writer_t writer;
+    wire_writer_init(&writer, frame, sizeof(frame), sensor->device_id, 0);
+    probes++;
+    if (!send_frame(sensor, frame, wire_writer_finish(&writer)))
+    {
+        return;
+    }
+
+    while (sensor->pending > 0)
+    {
+        int chunk = sensor->pending < SPOOL_DRAIN_BATCH ? sensor->pending : SPOOL_DRAIN_BATCH;
+        for (int index = 0; index < chunk;)
+        {
+            wire_writer_init(&writer, frame, sizeof(frame), sensor->device_id, sensor->backlog[index].timestamp);
+            while (index < chunk && wire_writer_add(&writer, sensor->backlog[index].timestamp,
+                                                    sensor->backlog[index].centi_celsius))
+            {
+                index++;
+            }
+            if (!send_frame(sensor, frame, wire_writer_finish(&writer)))
+            {
+                return;
+            }
+        }
+        sensor->pending -= chunk;
+        memmove(sensor->backlog, sensor->backlog + chunk, sensor->pending * sizeof(wire_reading_t));
+    }
+}
+
+// Every expected reading must appear once, and each sensor's lines in time order
+static bool verify(const loopback_t *loopback, const sensor_t *sensors, int count, int readings)
+{
+    unsigned char *seen = calloc((size_t)count * readings, 1);
+    uint32_t *last = calloc(count, sizeof(uint32_t));
+    unsigned long lines = 0, bad = 0, repeated = 0, unordered = 0, missing = 0;
+
+    const char *end = loopback->data + loopback->length;
+    for (const char *cursor = loopback->data; cursor < end;)
+    {
+        const char *next = memchr(cursor, '\n', end - cursor);
+        next = next ? next + 1 : end;
+        if (verbose)
+        {
+            fwrite(cursor, 1, next - cursor, stdout);
+        }
+
+        struct tm timeinfo = {0};
+        int device_id;
+        double celsius;
+        lines++;
+        if (sscanf(cursor, "%d-%d-%d %d:%d:%d+0000,%d,%lf,", &timeinfo.tm_year, &timeinfo.tm_mon,
+                   &timeinfo.tm_mday, &timeinfo.tm_hour, &timeinfo.tm_min, &timeinfo.tm_sec,
+                   &device_id, &celsius) != 8)
+        {
+            bad++;
+            cursor = next;
+            continue;
+        }
+        cursor = next;
+        timeinfo.tm_year -= 1900;
+        timeinfo.tm_mon -= 1;
+        uint32_t timestamp = (uint32_t)timegm(&timeinfo);
+
+        int sensor = device_id - sensors[0].device_id;
+        long index = ((long)timestamp - BASE_EPOCH - sensor) / SENSOR_INTERVAL_SEC;
+        if (sensor < 0 || sensor >= count || index < 0 || index >= readings ||
+            (int)(celsius * 100 + (celsius < 0 ? -0.5 : 0.5)) != reading_value(sensor, index))
+        {
+            bad++;
+            continue;
+        }
+        if (seen[(size_t)sensor * readings + index]++)
+        {
+            repeated++;
+        }
+        if (timestamp <= last[sensor])
+        {
+            unordered++;
+        }
+        last[sensor] = timestamp;
+    }
+    for (size_t i = 0; i < (size_t)count * readings; i++)
+    {
+        missing += !seen[i];
+    }
+    free(seen);
+    free(last);
+
+    printf("endpoint: %lu lines, %lu bad, %lu repeated, %lu out of order, %lu missing\n",
+           lines, bad, repeated, unordered, missing);
+    return bad == 0 && repeated == 0 && unordered == 0 && missing == 0;
+}
+
+int main(int argc, char **argv)
+{
+    int sensor_count = 50;
+    int readings = 500;
+    unsigned seed = (unsigned)time(NULL);
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:r:l:a:u:s:v")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n': sensor_count = atoi(optarg); break;
+        case 'r': readings = atoi(optarg); break;
+        case 'l': frame_loss_percent = atoi(optarg); break;
+        case 'a': reply_loss_percent = atoi(optarg); break;
+        case 'u': upstream_fail_percent = atoi(optarg); break;
+        case 's': seed = (unsigned)strtoul(optarg, NULL, 0); break;
+        case 'v': verbose = true; break;
+        default:
+            fprintf(stderr, "usage: %s [-n sensors] [-r readings] [-l loss] [-a replyloss] [-u upfail] [-s seed] [-v]\n",
+                    argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (sensor_count < 1 || readings < 1 || frame_loss_percent >= 100)
+    {
+        fprintf(stderr, "gateway_loopback: need sensors, readings and a link that delivers\n");
+        return EXIT_FAILURE;
+    }
+    srand(seed);
+    setenv("TZ", "UTC0", 1);
+    tzset();
+
+    sensor_t *sensors = calloc(sensor_count, sizeof(sensor_t));
+    for (int i = 0; i < sensor_count; i++)
+    {
+        sensors[i] = (sensor_t){.mac = {0x02, 0x00, 0x00, 0x00, (uint8_t)(i >> 8), (uint8_t)i},
+                                .device_id = (uint16_t)(1000 + i)};
+    }
+    aggregator_init(&aggregator, DATA_MESSAGE);
+    loopback_t loopback = {0};
+
+    // One round is one sample interval: each sensor takes a reading and uploads
+    // once its batch is full, then the gateway flushes what it collected
+    bool overflow = false;
+    for (int round = 0; round < readings + SETTLE_ROUNDS; round++)
+    {
+        bool busy = false;
+        for (int i = 0; i < sensor_count; i++)
+        {
+            sensor_t *sensor = &sensors[i];
+            if (sensor->generated < readings)
+            {
+                if (sensor->pending == SENSOR_BACKLOG)
+                {
+                    overflow = true;
+                    continue;
+                }
+                sensor->backlog[sensor->pending++] = (wire_reading_t){
+                    .timestamp = BASE_EPOCH + i + sensor->generated * SENSOR_INTERVAL_SEC,
+                    .centi_celsius = reading_value(i, sensor->generated)};
+                sensor->generated++;
+            }
+            if (sensor->pending >= BATCH_SEND_THRESHOLD ||
+                (sensor->pending > 0 && sensor->generated == readings))
+            {
+                upload(sensor);
+            }
+            // gateway_role.c flushes early once half the buffer is used
+            if (aggregator.length >= sizeof(aggregator.lines) / 2)
+            {
+                aggregator_flush(&aggregator, loopback_sink, &loopback);
+            }
+            busy |= sensor->pending > 0;
+        }
+        aggregator_flush(&aggregator, loopback_sink, &loopback);
+        if (!busy && aggregator.length == 0 && round >= readings)
+        {
+            break;
+        }
+    }
+    // The endpoint comes back for good
+    int refusal_percent = upstream_fail_percent;
+    upstream_fail_percent = 0;
+    aggregator_flush(&aggregator, loopback_sink, &loopback);
+
+    printf("%d sensors x %d readings, seed %u, %d%% frame loss, %d%% reply loss, %d%% endpoint refusals\n",
+           sensor_count, readings, seed, frame_loss_percent, reply_loss_percent, refusal_percent);
+    printf("sensors: %lu attempts, %lu frames received, %lu probes, %lu uploads turned away\n",
+           attempts, frames_sent, probes, refusals);
+    printf("gateway: %lu frames ok, %lu bad, %lu duplicates dropped, %lu readings forwarded, %lu frames refused, "
+           "%d peers\n",
+           (unsigned long)aggregator.frames_ok, (unsigned long)aggregator.frames_bad,
+           (unsigned long)aggregator.duplicates, (unsigned long)aggregator.readings_out,
+           (unsigned long)aggregator.refused, aggregator.peer_count);
+    printf("sink: %lu flushes, %lu refused\n", loopback.flushes, loopback.refused);
+    if (overflow)
+    {
+        printf("a sensor backlog overflowed, the link loses too much\n");
+    }
+
+    bool ok = !overflow && verify(&loopback, sensors, sensor_count, readings);
+    printf("%s\n", ok ? "PASS" : "FAIL");
+    free(sensors);
+    free(loopback.data);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,62 @@
+#!/usr/bin/env python3
+"""Generate the default thermistor conversion table from main/config.h.
+
+Usage: gen_thermistor_table.py <config.h> <output.h>
+
+Entry i holds the temperature in centi-degrees Celsius for the ADC code
+i << THERMISTOR_SEGMENT_BITS, using the same beta model and divider as
+thermistor_build_table() in main/thermistor.c.
+"""
+import math
+import re
+import sys
+
+
+def read_defines(path):
+    defines = {}
+    pattern = re.compile(r'^\s*#define\s+(\w+)\s+([-+0-9.eE]+)[fFuUlL]*\b')
+    with open(path) as f:
+        for line in f:
+            match = pattern.match(line)
+            if match:
+                defines[match.group(1)] = float(match.group(2))
+    return defines
+
+
+def centi_celsius(code, cfg, series_resistor):
+    adc_max = cfg['ADC_MAX_VALUE']
+    # The divider is singular at both rails, stay one code inside them
+    code = min(max(code, 1), adc_max - 1)
+    v_out = code / adc_max * cfg['VREF']
+    resistance = series_resistor * v_out / (cfg['VREF'] - v_out)
+    kelvin = cfg['BETA'] / (math.log(resistance / cfg['R2']) + cfg['BETA'] / cfg['T2'])
+    centi = int(round((kelvin - cfg['KELVIN_TO_CELSIUS']) * 100))
+    # Entries are int16, which still covers -273 to +327 °C
+    return min(max(centi, -32768), 32767)
+
+
+def main():
+    if len(sys.argv) != 3:
+        sys.exit(__doc__)
+    cfg = read_defines(sys.argv[1])
+    bits = int(cfg['THERMISTOR_SEGMENT_BITS'])
+    size = (int(cfg['ADC_MAX_VALUE']) + 1 >> bits) + 1
+    entries = [centi_celsius(i << bits, cfg, cfg['SERIES_RESISTOR']) for i in range(size)]
+
+    lines = ['// Generated by tools/gen_thermistor_table.py from config.h, do not edit',
+             '#ifndef THERMISTOR_TABLE_H',
+             '#define THERMISTOR_TABLE_H',
+             '',
+             '#include <stdint.h>',
+             '',
+             'static const int16_t thermistor_default_table[%d] = {' % size]
+    for start in range(0, size, 8):
+        lines.append('    ' + ', '.join(str(v) for v in entries[start:start + 8]) + ',')
+    lines += ['};', '', '#endif // THERMISTOR_TABLE_H', '']
+
+    with open(sys.argv[2], 'w') as f:
+        f.write('\n'.join(lines))
+
+
+if __name__ == '__main__':
+    main()
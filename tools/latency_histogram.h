@@ -0,0 +1,62 @@
+// Log2 latency histogram shared by the load-testing tools.
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define LATENCY_BUCKETS 24 // Powers of two in microseconds, up to ~8 s
+
+typedef struct {
+    uint64_t count;
+    uint64_t sum_us;
+    uint64_t max_us;
+    uint64_t buckets[LATENCY_BUCKETS];
+} latency_histogram_t;
+
+static inline void latency_record(latency_histogram_t *hist, uint64_t latency_us)
+{
+    int bucket = 0;
+    while (bucket < LATENCY_BUCKETS - 1 && (1ull << bucket) < latency_us)
+    {
+        bucket++;
+    }
+    hist->count++;
+    hist->sum_us += latency_us;
+    if (latency_us > hist->max_us)
+    {
+        hist->max_us = latency_us;
+    }
+    hist->buckets[bucket]++;
+}
+
+// Upper bound of the bucket holding the given fraction of samples
+static inline double latency_percentile_ms(const latency_histogram_t *hist, double fraction)
+{
+    uint64_t target = (uint64_t)(hist->count * fraction);
+    uint64_t seen = 0;
+    for (int i = 0; i < LATENCY_BUCKETS; i++)
+    {
+        seen += hist->buckets[i];
+        if (seen > target)
+        {
+            return (1ull << i) / 1000.0;
+        }
+    }
+    return (1ull << (LATENCY_BUCKETS - 1)) / 1000.0;
+}
+
+static inline void latency_print(FILE *out, const char *name, const latency_histogram_t *hist)
+{
+    if (hist->count == 0)
+    {
+        fprintf(out, "%s -", name);
+        return;
+    }
+    fprintf(out, "%s mean %.2f ms p50<%.2f p99<%.2f max %.2f ms", name,
+            hist->sum_us / 1000.0 / hist->count, latency_percentile_ms(hist, 0.5),
+            latency_percentile_ms(hist, 0.99), hist->max_us / 1000.0);
+}
+
+#endif // LATENCY_HISTOGRAM_H
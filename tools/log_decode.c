@@ -0,0 +1,229 @@
+// Formats the "#log" lines of main/event_log.c: the console dump after a
+// button press or a reset, or a collector log of LOG_UPLINK uploads.
+//
+//   log_decode [-t] [file...]
+//     -t  push entries through a small ring, across overflows, and fail unless
+//         every line that comes out decodes to what went in
+//
+// Reads stdin without files. Entries carry the RTC time of the device in ms,
+// the wake entry and the time sync entry also the wall clock. Later entries of
+// the same device are shown in UTC from the last of those, earlier ones as RTC
+// seconds. A gap in the sequence numbers is entries the ring dropped unread.
+#include "config.h"
+#include "event_ring.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_DEVICES 256
+
+typedef struct {
+    bool seen;
+    uint32_t next_seq;
+    bool anchored;
+    uint32_t anchor_ms; // RTC time of the entry that carried the wall clock
+    uint32_t anchor_epoch;
+} device_t;
+
+static device_t devices[MAX_DEVICES];
+
+static void print_time(const device_t *device, uint32_t time_ms)
+{
+    if (!device->anchored)
+    {
+        printf("rtc %11.3f", time_ms / 1000.0);
+        return;
+    }
+    int64_t offset_ms = (int32_t)(time_ms - device->anchor_ms);
+    int64_t ms = (int64_t)device->anchor_epoch * 1000 + offset_ms;
+    time_t stamp = (time_t)(ms / 1000);
+    struct tm timeinfo;
+    gmtime_r(&stamp, &timeinfo);
+    printf("%04d-%02d-%02d %02d:%02d:%02d.%03d", timeinfo.tm_year + 1900, timeinfo.tm_mon + 1,
+           timeinfo.tm_mday, timeinfo.tm_hour, timeinfo.tm_min, timeinfo.tm_sec, (int)(ms % 1000));
+}
+
+static void decode_entry(int group, const event_entry_t *entry)
+{
+    device_t *device = &devices[(unsigned)group % MAX_DEVICES];
+    // Sequence numbers start over with a new ring, anything else below the
+    // expected one was already shown by an earlier dump
+    if (device->seen && entry->seq != 0 && entry->seq < device->next_seq)
+    {
+        return;
+    }
+    if (entry->seq == 0)
+    {
+        device->next_seq = 0;
+    }
+    if (device->seen && entry->seq > device->next_seq)
+    {
+        printf("%d: %lu entries lost\n", group, (unsigned long)(entry->seq - device->next_seq));
+    }
+    device->seen = true;
+    device->next_seq = entry->seq + 1;
+
+    uint32_t epoch = 0;
+    if (entry->id == EVENT_WAKE && entry->argc > 2)
+    {
+        epoch = entry->args[2];
+    }
+    else if (entry->id == EVENT_TIME_SYNCED && entry->argc > 0)
+    {
+        epoch = entry->args[0];
+    }
+    if (epoch != 0)
+    {
+        device->anchored = true;
+        device->anchor_ms = entry->time_ms;
+        device->anchor_epoch = epoch;
+    }
+
+    char message[256];
+    event_format(entry, message, sizeof(message));
+    print_time(device, entry->time_ms);
+    printf(" %d %s: %s\n", group, event_tag(entry->id), message);
+}
+
+static void decode_file(FILE *file)
+{
+    char line[512];
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        int group;
+        event_entry_t entry;
+        if (event_entry_parse(line, &group, &entry))
+        {
+            decode_entry(group, &entry);
+        }
+    }
+}
+
+// Bursts of entries overflow the ring again and again. Reading from a stale
+// cursor has to resume at the oldest entry, consuming must only drop what was
+// read, and RTC memory after power-on must not pass for a ring.
+static int self_test(void)
+{
+    static event_ring_t ring;
+    event_ring_reset(&ring);
+    event_cursor_t cursor = event_ring_begin(&ring);
+    uint32_t pushed = 0;
+    uint32_t expected_seq = 0;
+    int failures = 0;
+    srand(1);
+
+    for (int round = 0; round < 2000; round++)
+    {
+        int burst = rand() % 40;
+        for (int i = 0; i < burst; i++, pushed++)
+        {
+            uint32_t args[EVENT_MAX_ARGS];
+            int argc = pushed % (EVENT_MAX_ARGS + 1);
+            for (int a = 0; a < argc; a++)
+            {
+                args[a] = pushed * 31 + a;
+            }
+            event_ring_push(&ring, pushed % EVENT_COUNT, pushed * 7, args, argc);
+        }
+        if (!event_ring_valid(&ring))
+        {
+            fprintf(stderr, "log_decode: ring invalid after %lu entries\n", (unsigned long)pushed);
+            return EXIT_FAILURE;
+        }
+
+        event_entry_t entry;
+        int reads = rand() % 30;
+        while (reads-- > 0 && event_ring_read(&ring, &cursor, &entry))
+        {
+            if (entry.seq < expected_seq || entry.seq >= pushed)
+            {
+                failures++;
+            }
+            expected_seq = entry.seq + 1;
+
+            char line[EVENT_LINE_MAX];
+            int group;
+            event_entry_t parsed;
+            uint32_t n = entry.seq;
+            if (event_entry_line(&entry, DEVICE_GROUP_ID, line, sizeof(line)) < 0 ||
+                !event_entry_parse(line, &group, &parsed) || group != DEVICE_GROUP_ID ||
+                parsed.seq != n || parsed.id != n % EVENT_COUNT || parsed.time_ms != n * 7 ||
+                parsed.argc != n % (EVENT_MAX_ARGS + 1) ||
+                (parsed.argc > 0 && parsed.args[parsed.argc - 1] != n * 31 + parsed.argc - 1))
+            {
+                fprintf(stderr, "log_decode: entry %lu does not survive %s", (unsigned long)n, line);
+                failures++;
+            }
+        }
+        if (rand() % 4 == 0)
+        {
+            event_ring_consume(&ring, cursor.seq);
+            if (ring.count > 0 && ring.first_seq < cursor.seq)
+            {
+                failures++;
+            }
+        }
+    }
+
+    memset(&ring, 0x5a, sizeof(ring));
+    if (event_ring_valid(&ring))
+    {
+        fprintf(stderr, "log_decode: garbage passes for a ring\n");
+        failures++;
+    }
+
+    // Floats go through as their bits, formats keep width and precision
+    event_entry_t entry = {.id = EVENT_TEMPERATURE, .argc = 1, .args = {event_float(-18.25f)}};
+    char message[64];
+    event_format(&entry, message, sizeof(message));
+    if (strcmp(message, "Temperature: -18.25°C") != 0)
+    {
+        fprintf(stderr, "log_decode: formatted \"%s\"\n", message);
+        failures++;
+    }
+    entry = (event_entry_t){.id = EVENT_CLOCK_OFF, .argc = 2, .args = {(uint32_t)-1500, 600}};
+    event_format(&entry, message, sizeof(message));
+    if (strcmp(message, "Clock was off by -1500 ms after 600 s") != 0)
+    {
+        fprintf(stderr, "log_decode: formatted \"%s\"\n", message);
+        failures++;
+    }
+
+    printf("%lu entries through a %d word ring, %d failures\n", (unsigned long)pushed, LOG_RING_WORDS, failures);
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int main(int argc, char **argv)
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "t")) != -1)
+    {
+        switch (opt)
+        {
+        case 't':
+            return self_test();
+        default:
+            fprintf(stderr, "usage: %s [-t] [file...]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (optind == argc)
+    {
+        decode_file(stdin);
+    }
+    for (int i = optind; i < argc; i++)
+    {
+        FILE *file = fopen(argv[i], "r");
+        if (file == NULL)
+        {
+            perror(argv[i]);
+            return EXIT_FAILURE;
+        }
+        decode_file(file);
+        fclose(file);
+    }
+    return EXIT_SUCCESS;
+}
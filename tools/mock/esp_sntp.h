@@ -0,0 +1 @@
+#include "idf.h"
@@ -0,0 +1,396 @@
+// Stand-ins for the firmware modules that drive hardware: the ADC engine, the
+// WiFi manager, the uplink transports and the buttons. The rest of main/ is built unchanged.
+#include "sim.h"
+#include "config.h"
+#include "adc_engine.h"
+#include "buttons.h"
+#include "event_log.h"
+#include "rf_cal.h"
+#include "rtc_store.h"
+#include "sensor.h"
+#include "spool.h"
+#include "thermistor.h"
+#include "time_manager.h"
+#include "trace.h"
+#include "transport.h"
+#include "uplink.h"
+#include "wifi_manager.h"
+#include "wire_format.h"
+#include <math.h>
+#include <string.h>
+#include <time.h>
+
+bool wifi_connected = false;
+
+esp_err_t init_adc_engine(void)
+{
+    return ESP_OK;
+}
+
+void deinit_adc_engine(void)
+{
+}
+
+// Divider with the thermistor on the low side, the inverse of the conversion table
+static double thermistor_code(double celsius)
+{
+    double resistance = R2 * exp(BETA / (celsius + KELVIN_TO_CELSIUS) - BETA / T2);
+    return ADC_MAX_VALUE * resistance / (resistance + SERIES_RESISTOR);
+}
+
+// A burst takes as long as the configured sample rate says, the result is the
+// true value plus a little noise so the deadband has something to do
+esp_err_t adc_engine_sample(adc_channel_t channel, uint32_t samples, uint32_t *mean_q4)
+{
+    sim_spend(SIM_ADC, samples * 1e6 / ADC_BURST_FREQ_HZ);
+
+    double code = 0;
+    if (channel == THERMISTOR_ADC_CHANNEL)
+    {
+        code = thermistor_code(sim_environment_celsius(sim->now_us / 1e6));
+    }
+#ifdef THERMISTOR_EXCITATION_ADC_CHANNEL
+    else if (channel == THERMISTOR_EXCITATION_ADC_CHANNEL)
+    {
+        code = (double)ADC_MAX_VALUE / EXCITATION_SENSE_DIVIDER;
+    }
+#endif
+#ifdef BATTERY_ADC_CHANNEL
+    else if (channel == BATTERY_ADC_CHANNEL)
+    {
+        code = sim_battery_mv() / BATTERY_DIVIDER_RATIO / (VREF * 1000) * ADC_MAX_VALUE;
+    }
+#endif
+    double noise = (double)((sim->now_us / 1000) % 9) / 8.0 - 0.5;
+    *mean_q4 = (uint32_t)lround((code + noise) * (1 << ADC_CODE_FRACTION_BITS));
+    return ESP_OK;
+}
+
+uint32_t adc_engine_linearize(uint32_t raw_q4)
+{
+    return raw_q4;
+}
+
+// Radio time of a failed attempt, up to the radio budget and the caller's deadline
+static double failed_attempt_us(double attempt_ms, int64_t deadline_us)
+{
+    double us = (attempt_ms < WIFI_RADIO_BUDGET_MS ? attempt_ms : WIFI_RADIO_BUDGET_MS) * 1000;
+    double left_us = (double)(deadline_us - esp_timer_get_time());
+    return left_us < 0 ? 0 : us < left_us ? us : left_us;
+}
+
+// A cached association skips the scan, a lease that is still fresh skips DHCP
+esp_err_t wifi_quick_connect(int64_t deadline_us)
+{
+    if (wifi_connected)
+    {
+        return ESP_OK;
+    }
+    int64_t connect_start_us = esp_timer_get_time();
+
+    const fast_connect_t *cached = &rtc_store.hot.data.fast_connect;
+    bool fast = cached->valid;
+    bool lease_fresh = fast && time_is_valid() && time_now() - cached->lease_time < DHCP_LEASE_REUSE_SEC;
+
+    sim->counters.connect_attempts++;
+    trace_begin(TRACE_ASSOCIATE);
+    ESP_ERROR_CHECK(rf_start());
+    if (sim_connect_fails())
+    {
+        sim->counters.connect_failures++;
+        sim_idle(failed_attempt_us(sim_model.connect_fail_ms, deadline_us));
+        return ESP_FAIL;
+    }
+    sim_idle((fast ? sim_model.associate_fast_ms : sim_model.associate_ms) * 1000);
+    trace_end(TRACE_ASSOCIATE);
+    trace_begin(TRACE_DHCP);
+    if (!lease_fresh)
+    {
+        sim_idle(sim_model.dhcp_ms * 1000);
+    }
+    trace_end(TRACE_DHCP);
+
+    fast_connect_t connect_info = *cached;
+    connect_info.valid = true;
+    connect_info.wake_to_ip_ms = (esp_timer_get_time() - connect_start_us) / 1000;
+    if (!lease_fresh)
+    {
+        connect_info.lease_time = time_now();
+    }
+    update_fast_connect(&connect_info);
+    wifi_connected = true;
+    return ESP_OK;
+}
+
+// The radio is only on for the connection attempt, which the budget already bounds
+uint32_t wifi_budget_left_ms(void)
+{
+    return WIFI_RADIO_BUDGET_MS;
+}
+
+void wifi_init(void)
+{
+    wifi_quick_connect(INT64_MAX);
+}
+
+// Bytes on the wire in wire_format frames of at most max_records readings
+static size_t frames_size(const batch_record_t *records, int count, int max_records, int *frames)
+{
+    static uint8_t frame[WIRE_FRAME_SIZE(WIRE_MAX_RECORDS)];
+    size_t size = 0;
+    int index = 0;
+    *frames = 0;
+    while (index < count)
+    {
+        size_t length;
+        int remaining = count - index;
+        index += uplink_frame(frame, WIRE_FRAME_SIZE(max_records), records + index,
+                              remaining, &length);
+        size += length;
+        (*frames)++;
+    }
+    return size;
+}
+
+// Bytes on the wire for the TCP uplink format selected in config.h
+static size_t payload_size(const batch_record_t *records, int count)
+{
+#ifdef UPLINK_BINARY
+    int frames;
+    return frames_size(records, count, BATCH_CAPACITY, &frames);
+#else
+    size_t size = 0;
+    for (int i = 0; i < count; i++)
+    {
+        time_t stamp = (time_t)records[i].timestamp;
+        struct tm timeinfo;
+        localtime_r(&stamp, &timeinfo);
+        size += snprintf(NULL, 0, "%04d-%02d-%02d %02d:%02d:%02d+0000,%d,%.4f,%s\n",
+                         timeinfo.tm_year + 1900, timeinfo.tm_mon + 1, timeinfo.tm_mday,
+                         timeinfo.tm_hour, timeinfo.tm_min, timeinfo.tm_sec,
+                         DEVICE_GROUP_ID, convert_to_centi_celsius(records[i].raw) / 100.0f, DATA_MESSAGE);
+    }
+    return size;
+#endif
+}
+
+static bool tcp_connected(void)
+{
+    return wifi_connected;
+}
+
+// The handshake, send_data() in uplink.c does the ordering of spool and batch
+static esp_err_t tcp_open(void)
+{
+    if (!wifi_connected)
+    {
+        return ESP_ERR_WIFI_NOT_CONNECT;
+    }
+    trace_begin(TRACE_CONNECT);
+    sim_idle(sim_model.rtt_ms * 1000);
+    trace_end(TRACE_CONNECT);
+    return sim->network_up ? ESP_OK : ESP_ERR_TIMEOUT;
+}
+
+// The supply dips under the current of a transmission on a weak battery
+static void transmit_start(void)
+{
+    if (sim_brownout())
+    {
+        sim_reset(ESP_RST_BROWNOUT);
+    }
+}
+
+static esp_err_t tcp_send(const batch_record_t *records, int count)
+{
+    transmit_start();
+    size_t size = payload_size(records, count);
+    sim->counters.readings_sent += count;
+    sim->counters.bytes_sent += size;
+    sim_spend(SIM_TX, size * 8 * 1000.0 / sim_model.tx_kbps);
+    return ESP_OK;
+}
+
+// Wait for the server to acknowledge and close, the lines of LOG_UPLINK go first
+static void tcp_close(esp_err_t result)
+{
+    (void)result;
+#if defined(LOG_UPLINK) && !defined(UPLINK_BINARY)
+    if (result == ESP_OK)
+    {
+        char line[EVENT_LINE_MAX];
+        event_cursor_t cursor = event_log_begin();
+        size_t size = 0;
+        int length;
+        while ((length = event_log_next_line(&cursor, line, sizeof(line))) > 0)
+        {
+            size += length;
+        }
+        sim->counters.bytes_sent += size;
+        sim_spend(SIM_TX, size * 8 * 1000.0 / sim_model.tx_kbps);
+        event_log_consume(&cursor);
+    }
+#endif
+    sim_idle(sim_model.rtt_ms * 1000);
+    sim->counters.uplinks++;
+}
+
+static void radio_off(void)
+{
+    esp_wifi_stop();
+}
+
+const transport_t transport_tcp = {
+    .name = "tcp",
+    .has_ip = true,
+    .connect = wifi_quick_connect,
+    .connected = tcp_connected,
+    .open = tcp_open,
+    .send = tcp_send,
+    .close = tcp_close,
+    .disconnect = radio_off};
+
+// When the ticket of the last full handshake was issued, kept over deep sleep
+// like the session in tls_link.c. A resumption gets no new ticket.
+RTC_DATA_ATTR static uint32_t tls_ticket_time = 0;
+
+// A full handshake takes two round trips and the key exchange, a resumed one
+// a single round trip with a larger ClientHello
+static esp_err_t tls_open(void)
+{
+    esp_err_t result = tcp_open();
+    if (result != ESP_OK)
+    {
+        return result;
+    }
+    bool resumed = tls_ticket_time != 0 && time_now() - tls_ticket_time < sim_model.tls_ticket_hours * 3600;
+    trace_begin(TRACE_HANDSHAKE);
+    sim_spend(SIM_TX, (resumed ? sim_model.tls_resumed_tx_bytes : sim_model.tls_full_tx_bytes) * 8 * 1000.0 /
+                          sim_model.tx_kbps);
+    sim_idle(((resumed ? 1 : 2) * sim_model.rtt_ms + (resumed ? sim_model.tls_resumed_ms : sim_model.tls_full_ms)) *
+             1000);
+    trace_end(TRACE_HANDSHAKE);
+    if (!resumed)
+    {
+        tls_ticket_time = time_now();
+    }
+    return ESP_OK;
+}
+
+// AES-GCM adds a header, nonce and tag to every record of up to 1 kB, see send_batch()
+static esp_err_t tls_send(const batch_record_t *records, int count)
+{
+    size_t records_out = payload_size(records, count) / 1024 + 1;
+    sim_spend(SIM_TX, records_out * 29 * 8 * 1000.0 / sim_model.tx_kbps);
+    return tcp_send(records, count);
+}
+
+const transport_t transport_tls = {
+    .name = "tls",
+    .has_ip = true,
+    .connect = wifi_quick_connect,
+    .connected = tcp_connected,
+    .open = tls_open,
+    .send = tls_send,
+    .close = tcp_close,
+    .disconnect = radio_off};
+
+static bool espnow_up = false;
+
+static double espnow_airtime_us(size_t bytes)
+{
+    return bytes * 8 * 1000.0 / sim_model.espnow_kbps + sim_model.espnow_ack_ms * 1000;
+}
+
+// Radio start and one acked probe on the cached channel. An unreachable gateway
+// costs the whole channel sweep with every probe timing out.
+static esp_err_t espnow_connect(int64_t deadline_us)
+{
+    if (espnow_up)
+    {
+        return ESP_OK;
+    }
+
+    sim->counters.connect_attempts++;
+    trace_begin(TRACE_ASSOCIATE);
+    ESP_ERROR_CHECK(rf_start());
+    sim_idle(sim_model.espnow_start_ms * 1000);
+    if (sim_connect_fails())
+    {
+        sim->counters.connect_failures++;
+        sim_idle(failed_attempt_us((ESPNOW_CHANNEL_MAX + 1) * ESPNOW_SEND_RETRIES * ESPNOW_ACK_TIMEOUT_MS,
+                                   deadline_us));
+        trace_end(TRACE_ASSOCIATE);
+        return ESP_FAIL;
+    }
+    sim_spend(SIM_TX, espnow_airtime_us(WIRE_FRAME_SIZE(0)));
+    if (time_needs_sync())
+    {
+        sim_idle(sim_model.espnow_ack_ms * 1000);
+        time_sync_sample((int64_t)sim_epoch() * 1000000 + sim->now_us % 1000000, esp_rtc_get_time_us());
+    }
+    trace_end(TRACE_ASSOCIATE);
+    espnow_up = true;
+    return ESP_OK;
+}
+
+static bool espnow_connected(void)
+{
+    return espnow_up;
+}
+
+static esp_err_t espnow_open(void)
+{
+    return espnow_up ? ESP_OK : ESP_ERR_INVALID_STATE;
+}
+
+static esp_err_t espnow_send(const batch_record_t *records, int count)
+{
+    transmit_start();
+    int frames;
+    size_t size = frames_size(records, count, ESPNOW_MAX_RECORDS, &frames);
+    sim->counters.readings_sent += count;
+    sim->counters.bytes_sent += size;
+    sim_spend(SIM_TX, espnow_airtime_us(size) + (frames - 1) * sim_model.espnow_ack_ms * 1000);
+    return ESP_OK;
+}
+
+static void espnow_close(esp_err_t result)
+{
+    (void)result;
+    sim->counters.uplinks++;
+}
+
+static void espnow_disconnect(void)
+{
+    espnow_up = false;
+    esp_wifi_stop();
+}
+
+const transport_t transport_espnow = {
+    .name = "espnow",
+    .has_ip = false,
+    .connect = espnow_connect,
+    .connected = espnow_connected,
+    .open = espnow_open,
+    .send = espnow_send,
+    .close = espnow_close,
+    .disconnect = espnow_disconnect};
+
+// The host has no light sleep, stay_connected_pays_off() never picks this mode
+void wifi_stay_connected(bool enable, uint32_t interval_sec)
+{
+    (void)enable;
+    (void)interval_sec;
+}
+
+esp_err_t init_buttons(void)
+{
+    return ESP_OK;
+}
+
+// Whoever installs the device presses start once it is powered
+button_event_t buttons_wait_press(void)
+{
+    return BUTTON_EVENT_START;
+}
@@ -0,0 +1,261 @@
+// The slice of the ESP-IDF API that the firmware in main/ uses, enough to build
+// it on the host for tools/wake_sim. Behaviour lives in idf_mock.c.
+#ifndef MOCK_IDF_H
+#define MOCK_IDF_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/time.h>
+
+// esp_err.h
+typedef int esp_err_t;
+#define ESP_OK 0
+#define ESP_FAIL -1
+#define ESP_ERR_NO_MEM 0x101
+#define ESP_ERR_INVALID_ARG 0x102
+#define ESP_ERR_INVALID_STATE 0x103
+#define ESP_ERR_INVALID_SIZE 0x104
+#define ESP_ERR_NOT_FOUND 0x105
+#define ESP_ERR_TIMEOUT 0x107
+#define ESP_ERR_INVALID_RESPONSE 0x108
+#define ESP_ERR_INVALID_CRC 0x109
+#define ESP_ERR_NVS_NOT_FOUND 0x1102
+#define ESP_ERR_NVS_NO_FREE_PAGES 0x110d
+#define ESP_ERR_NVS_NEW_VERSION_FOUND 0x1110
+#define ESP_ERR_WIFI_NOT_CONNECT 0x300f
+void mock_error_check(esp_err_t result, const char *expression, const char *file, int line);
+#define ESP_ERROR_CHECK(x) mock_error_check((x), #x, __FILE__, __LINE__)
+const char *esp_err_to_name(esp_err_t code);
+
+// esp_log.h, quiet unless wake_sim runs with -v. Lines at the default level
+// and above take their time on the console UART like on the device.
+extern bool mock_log_enabled;
+void mock_log(bool console, const char *level, const char *tag, const char *format, ...)
+    __attribute__((format(printf, 4, 5)));
+#define ESP_LOGE(tag, format, ...) mock_log(true, "E", tag, format, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) mock_log(true, "W", tag, format, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) mock_log(true, "I", tag, format, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) mock_log(false, "D", tag, format, ##__VA_ARGS__)
+
+// esp_attr.h, RTC memory is a pair of linker sections that wake_sim carries
+// across wakes. Other resets than deep sleep wakes reload the first one.
+#define RTC_DATA_ATTR __attribute__((section("mock_rtc_data")))
+#define RTC_NOINIT_ATTR __attribute__((section("mock_rtc_noinit")))
+
+// esp_bit_defs.h
+#define BIT0 0x00000001
+#define BIT1 0x00000002
+#define BIT2 0x00000004
+#define BIT3 0x00000008
+#define BIT4 0x00000010
+
+// esp_crc.h
+uint32_t esp_crc32_le(uint32_t crc, const uint8_t *buf, uint32_t len);
+
+// esp_timer.h, esp_cpu.h, esp_rtc_time.h, esp_system.h, esp_random.h
+int64_t esp_timer_get_time(void);
+uint32_t esp_random(void);
+uint32_t esp_cpu_get_cycle_count(void);
+uint64_t esp_rtc_get_time_us(void);
+uint32_t esp_get_free_heap_size(void);
+uint32_t esp_get_minimum_free_heap_size(void);
+void esp_restart(void);
+typedef enum {
+    ESP_RST_UNKNOWN,
+    ESP_RST_POWERON,
+    ESP_RST_EXT,
+    ESP_RST_SW,
+    ESP_RST_PANIC,
+    ESP_RST_INT_WDT,
+    ESP_RST_TASK_WDT,
+    ESP_RST_WDT,
+    ESP_RST_DEEPSLEEP,
+    ESP_RST_BROWNOUT,
+} esp_reset_reason_t;
+esp_reset_reason_t esp_reset_reason(void);
+
+// esp_sleep.h
+typedef enum {
+    ESP_SLEEP_WAKEUP_UNDEFINED,
+    ESP_SLEEP_WAKEUP_TIMER = 4,
+    ESP_SLEEP_WAKEUP_GPIO = 7,
+} esp_sleep_wakeup_cause_t;
+typedef enum {
+    ESP_GPIO_WAKEUP_GPIO_LOW,
+    ESP_GPIO_WAKEUP_GPIO_HIGH
+} esp_deepsleep_gpio_wake_up_mode_t;
+esp_sleep_wakeup_cause_t esp_sleep_get_wakeup_cause(void);
+uint64_t esp_sleep_get_gpio_wakeup_status(void);
+esp_err_t esp_deep_sleep_enable_gpio_wakeup(uint64_t mask, esp_deepsleep_gpio_wake_up_mode_t mode);
+void esp_deep_sleep(uint64_t time_in_us) __attribute__((noreturn));
+void esp_deep_sleep_start(void) __attribute__((noreturn));
+
+// driver/gpio.h
+typedef enum {
+    GPIO_NUM_2 = 2,
+    GPIO_NUM_3 = 3,
+    GPIO_NUM_18 = 18,
+    GPIO_NUM_19 = 19,
+    GPIO_NUM_23 = 23,
+} gpio_num_t;
+typedef enum {
+    GPIO_MODE_INPUT = 1,
+    GPIO_MODE_OUTPUT = 2,
+} gpio_mode_t;
+typedef struct {
+    uint64_t pin_bit_mask;
+    gpio_mode_t mode;
+    int pull_up_en;
+    int pull_down_en;
+    int intr_type;
+} gpio_config_t;
+esp_err_t gpio_config(const gpio_config_t *config);
+esp_err_t gpio_set_level(gpio_num_t gpio, uint32_t level);
+
+// esp_rom_sys.h
+void esp_rom_delay_us(uint32_t us);
+int esp_rom_printf(const char *format, ...) __attribute__((format(printf, 1, 2)));
+
+// esp_adc/adc_continuous.h
+typedef enum {
+    ADC_CHANNEL_0,
+    ADC_CHANNEL_1,
+    ADC_CHANNEL_2,
+    ADC_CHANNEL_3,
+    ADC_CHANNEL_4,
+} adc_channel_t;
+
+// esp_task_wdt.h
+typedef void *TaskHandle_t;
+typedef struct {
+    uint32_t timeout_ms;
+    uint32_t idle_core_mask;
+    bool trigger_panic;
+} esp_task_wdt_config_t;
+esp_err_t esp_task_wdt_init(const esp_task_wdt_config_t *config);
+esp_err_t esp_task_wdt_deinit(void);
+esp_err_t esp_task_wdt_add(TaskHandle_t task);
+esp_err_t esp_task_wdt_delete(TaskHandle_t task);
+esp_err_t esp_task_wdt_reset(void);
+
+// freertos/FreeRTOS.h, task.h, event_groups.h
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t EventBits_t;
+typedef struct mock_event_group *EventGroupHandle_t;
+typedef int portMUX_TYPE;
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+#define portMAX_DELAY 0xffffffffu
+#define portTICK_PERIOD_MS 10
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms) / portTICK_PERIOD_MS)
+#define portMUX_INITIALIZER_UNLOCKED 0
+#define portENTER_CRITICAL(mux) ((void)(mux))
+#define portEXIT_CRITICAL(mux) ((void)(mux))
+void vTaskDelay(TickType_t ticks);
+TickType_t xTaskGetTickCount(void);
+BaseType_t xTaskCreate(void (*task)(void *), const char *name, uint32_t stack, void *arg,
+                       UBaseType_t priority, TaskHandle_t *handle);
+void vTaskDelete(TaskHandle_t task);
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task);
+EventGroupHandle_t xEventGroupCreate(void);
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits);
+EventBits_t xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits);
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits, BaseType_t clear,
+                                BaseType_t all, TickType_t ticks);
+
+// nvs.h, nvs_flash.h
+typedef uint32_t nvs_handle_t;
+typedef enum {
+    NVS_READONLY,
+    NVS_READWRITE
+} nvs_open_mode_t;
+esp_err_t nvs_flash_init(void);
+esp_err_t nvs_flash_erase(void);
+esp_err_t nvs_open(const char *name, nvs_open_mode_t mode, nvs_handle_t *handle);
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value, size_t length);
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *value, size_t *length);
+esp_err_t nvs_set_u32(nvs_handle_t handle, const char *key, uint32_t value);
+esp_err_t nvs_get_u32(nvs_handle_t handle, const char *key, uint32_t *value);
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char *key);
+esp_err_t nvs_commit(nvs_handle_t handle);
+void nvs_close(nvs_handle_t handle);
+
+// esp_partition.h
+typedef enum {
+    ESP_PARTITION_TYPE_APP,
+    ESP_PARTITION_TYPE_DATA
+} esp_partition_type_t;
+typedef int esp_partition_subtype_t;
+typedef struct {
+    esp_partition_type_t type;
+    esp_partition_subtype_t subtype;
+    uint32_t address;
+    uint32_t size;
+    uint32_t erase_size;
+    char label[17];
+} esp_partition_t;
+#define SPI_FLASH_SEC_SIZE 4096
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype,
+                                                const char *label);
+esp_err_t esp_partition_read(const esp_partition_t *partition, size_t offset, void *dst, size_t size);
+esp_err_t esp_partition_write(const esp_partition_t *partition, size_t offset, const void *src, size_t size);
+esp_err_t esp_partition_erase_range(const esp_partition_t *partition, size_t offset, size_t size);
+
+// esp_netif.h
+typedef struct {
+    uint32_t addr;
+} esp_ip4_addr_t;
+typedef struct {
+    esp_ip4_addr_t ip;
+    esp_ip4_addr_t netmask;
+    esp_ip4_addr_t gw;
+} esp_netif_ip_info_t;
+typedef struct {
+    struct {
+        uint32_t addr[4];
+    } ip;
+} esp_netif_dns_info_t;
+
+// esp_wifi.h
+typedef struct {
+    uint8_t ssid[32];
+    uint8_t password[64];
+    bool bssid_set;
+    uint8_t bssid[6];
+    uint8_t channel;
+} wifi_sta_config_t;
+typedef union {
+    wifi_sta_config_t sta;
+} wifi_config_t;
+esp_err_t esp_wifi_start(void);
+esp_err_t esp_wifi_disconnect(void);
+esp_err_t esp_wifi_stop(void);
+esp_err_t esp_wifi_deinit(void);
+
+// esp_phy_init.h, the ESP32-C6 size
+typedef struct {
+    uint8_t version[4];
+    uint8_t mac[6];
+    uint8_t opaque[1894];
+} esp_phy_calibration_data_t;
+esp_err_t esp_phy_load_cal_data_from_nvs(esp_phy_calibration_data_t *out_cal_data);
+esp_err_t esp_phy_store_cal_data_to_nvs(const esp_phy_calibration_data_t *cal_data);
+esp_err_t esp_phy_erase_cal_data_in_nvs(void);
+
+// esp_sntp.h
+typedef enum {
+    SNTP_OPMODE_POLL
+} esp_sntp_operatingmode_t;
+typedef void (*sntp_sync_time_cb_t)(struct timeval *tv);
+void esp_sntp_stop(void);
+void esp_sntp_init(void);
+void esp_sntp_setoperatingmode(esp_sntp_operatingmode_t mode);
+void esp_sntp_setservername(uint8_t index, const char *server);
+void sntp_set_time_sync_notification_cb(sntp_sync_time_cb_t callback);
+
+#endif // MOCK_IDF_H
@@ -0,0 +1,580 @@
+// Host behaviour of the ESP-IDF calls the firmware makes. Anything that takes
+// time on the device advances the simulated clock and books the time to a phase
+// of the energy model.
+#include "idf.h"
+#include "sim.h"
+#include "wifi_manager.h"
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+sim_shared_t *sim = NULL;
+sim_model_t sim_model;
+bool mock_log_enabled = false;
+
+static void sntp_deliver(void);
+
+void sim_spend(sim_phase_t phase, double us)
+{
+    sim->now_us += (uint64_t)us;
+    sim->phase_us[phase] += us;
+}
+
+// Waiting costs whatever is powered at the time
+void sim_idle(double us)
+{
+    sim_spend(sim->radio_on ? SIM_RADIO : SIM_CPU, us);
+}
+
+double sim_charge_mah(void)
+{
+    double charge = 0;
+    for (int i = 0; i < SIM_PHASE_COUNT; i++)
+    {
+        charge += sim->phase_us[i] * sim_model.current_ma[i];
+    }
+    return charge / 3.6e9;
+}
+
+// Blocking writes, once the FIFO is full every character waits for the line
+static void console_write(size_t characters)
+{
+    sim_spend(SIM_CPU, characters * sim_model.uart_us_per_char);
+}
+
+void mock_log(bool console, const char *level, const char *tag, const char *format, ...)
+{
+    char message[256];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+    if (console)
+    {
+        // "I (12345) tag: " in front and the line end
+        console_write(length + strlen(tag) + 12);
+    }
+    if (mock_log_enabled)
+    {
+        printf("%s (%s) %s\n", level, tag, message);
+    }
+}
+
+void mock_error_check(esp_err_t result, const char *expression, const char *file, int line)
+{
+    if (result != ESP_OK)
+    {
+        fprintf(stderr, "%s:%d: %s failed with 0x%x\n", file, line, expression, result);
+        abort();
+    }
+}
+
+const char *esp_err_to_name(esp_err_t code)
+{
+    static char name[16];
+    snprintf(name, sizeof(name), "0x%x", code);
+    return name;
+}
+
+// Same polynomial and conditioning as the ROM routine behind esp_crc32_le()
+uint32_t esp_crc32_le(uint32_t crc, const uint8_t *buf, uint32_t len)
+{
+    crc = ~crc;
+    while (len--)
+    {
+        crc ^= *buf++;
+        for (int bit = 0; bit < 8; bit++)
+        {
+            crc = (crc >> 1) ^ (0xEDB88320u & -(crc & 1));
+        }
+    }
+    return ~crc;
+}
+
+int64_t esp_timer_get_time(void)
+{
+    return (int64_t)(sim->now_us - sim->wake_us);
+}
+
+// Seeded by wake_sim, so runs are repeatable
+uint32_t esp_random(void)
+{
+    return (uint32_t)rand();
+}
+
+uint32_t esp_cpu_get_cycle_count(void)
+{
+    return (uint32_t)(esp_timer_get_time() * 160);
+}
+
+// The slow clock runs off by drift_ppm, SNTP reports the true time
+uint64_t esp_rtc_get_time_us(void)
+{
+    return sim->now_us + (uint64_t)(sim->now_us * sim_model.drift_ppm / 1e6);
+}
+
+uint32_t esp_get_free_heap_size(void)
+{
+    return 300 * 1024;
+}
+
+uint32_t esp_get_minimum_free_heap_size(void)
+{
+    return 300 * 1024;
+}
+
+void esp_restart(void)
+{
+    fprintf(stderr, "esp_restart() at %.0f s\n", sim->now_us / 1e6);
+    abort();
+}
+
+esp_reset_reason_t esp_reset_reason(void)
+{
+    return sim->reset_reason;
+}
+
+esp_sleep_wakeup_cause_t esp_sleep_get_wakeup_cause(void)
+{
+    return sim->wake_cause;
+}
+
+uint64_t esp_sleep_get_gpio_wakeup_status(void)
+{
+    return 0;
+}
+
+esp_err_t esp_deep_sleep_enable_gpio_wakeup(uint64_t mask, esp_deepsleep_gpio_wake_up_mode_t mode)
+{
+    (void)mask;
+    (void)mode;
+    return ESP_OK;
+}
+
+esp_err_t gpio_config(const gpio_config_t *config)
+{
+    (void)config;
+    return ESP_OK;
+}
+
+esp_err_t gpio_set_level(gpio_num_t gpio, uint32_t level)
+{
+    (void)gpio;
+    (void)level;
+    return ESP_OK;
+}
+
+void esp_rom_delay_us(uint32_t us)
+{
+    sim_idle(us);
+}
+
+int esp_rom_printf(const char *format, ...)
+{
+    char line[256];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    console_write(length);
+    if (mock_log_enabled)
+    {
+        fputs(line, stdout);
+    }
+    return length;
+}
+
+void esp_deep_sleep(uint64_t time_in_us)
+{
+    sim->sleep_us = time_in_us;
+    sim_sleep();
+}
+
+void esp_deep_sleep_start(void)
+{
+    sim->sleep_us = 0;
+    sim_sleep();
+}
+
+esp_err_t esp_task_wdt_init(const esp_task_wdt_config_t *config)
+{
+    (void)config;
+    return ESP_OK;
+}
+
+esp_err_t esp_task_wdt_deinit(void)
+{
+    return ESP_ERR_INVALID_STATE;
+}
+
+esp_err_t esp_task_wdt_add(TaskHandle_t task)
+{
+    (void)task;
+    return ESP_OK;
+}
+
+esp_err_t esp_task_wdt_delete(TaskHandle_t task)
+{
+    (void)task;
+    return ESP_OK;
+}
+
+esp_err_t esp_task_wdt_reset(void)
+{
+    sim_watchdog_fed();
+    return ESP_OK;
+}
+
+// There is a single thread, so a wait only passes time and lets SNTP answer
+void vTaskDelay(TickType_t ticks)
+{
+    uint64_t until = sim->now_us + (uint64_t)ticks * portTICK_PERIOD_MS * 1000;
+    if (sim->sntp_running && sim->sntp_due_us <= until)
+    {
+        sim_idle(sim->sntp_due_us > sim->now_us ? sim->sntp_due_us - sim->now_us : 0);
+        sntp_deliver();
+    }
+    if (until > sim->now_us)
+    {
+        sim_idle(until - sim->now_us);
+    }
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    return (TickType_t)(esp_timer_get_time() / 1000 / portTICK_PERIOD_MS);
+}
+
+// Tasks run to completion inside xTaskCreate(), overlap with the caller is not modelled
+BaseType_t xTaskCreate(void (*task)(void *), const char *name, uint32_t stack, void *arg,
+                       UBaseType_t priority, TaskHandle_t *handle)
+{
+    (void)name;
+    (void)stack;
+    (void)priority;
+    (void)handle;
+    task(arg);
+    return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+    (void)task;
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task)
+{
+    (void)task;
+    return 2048;
+}
+
+struct mock_event_group {
+    EventBits_t bits;
+};
+
+EventGroupHandle_t xEventGroupCreate(void)
+{
+    return calloc(1, sizeof(struct mock_event_group));
+}
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits)
+{
+    group->bits |= bits;
+    return group->bits;
+}
+
+EventBits_t xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits)
+{
+    EventBits_t previous = group->bits;
+    group->bits &= ~bits;
+    return previous;
+}
+
+// Nothing else runs, bits that are not set now never will be
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits, BaseType_t clear,
+                                BaseType_t all, TickType_t ticks)
+{
+    EventBits_t current = group->bits;
+    bool satisfied = all ? (current & bits) == bits : (current & bits) != 0;
+    if (!satisfied)
+    {
+        vTaskDelay(ticks);
+    }
+    else if (clear)
+    {
+        group->bits &= ~bits;
+    }
+    return current;
+}
+
+// NVS keeps one flat namespace, the firmware only ever opens one
+static sim_nvs_entry_t *nvs_find(const char *key, bool create)
+{
+    sim_nvs_entry_t *free_entry = NULL;
+    for (int i = 0; i < SIM_NVS_ENTRIES; i++)
+    {
+        sim_nvs_entry_t *entry = &sim->nvs[i];
+        if (entry->key[0] != '\0' && strcmp(entry->key, key) == 0)
+        {
+            return entry;
+        }
+        if (entry->key[0] == '\0' && free_entry == NULL)
+        {
+            free_entry = entry;
+        }
+    }
+    if (create && free_entry != NULL)
+    {
+        snprintf(free_entry->key, sizeof(free_entry->key), "%s", key);
+        return free_entry;
+    }
+    return NULL;
+}
+
+esp_err_t nvs_flash_init(void)
+{
+    return ESP_OK;
+}
+
+esp_err_t nvs_flash_erase(void)
+{
+    memset(sim->nvs, 0, sizeof(sim->nvs));
+    return ESP_OK;
+}
+
+esp_err_t nvs_open(const char *name, nvs_open_mode_t mode, nvs_handle_t *handle)
+{
+    (void)name;
+    (void)mode;
+    *handle = 1;
+    return ESP_OK;
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value, size_t length)
+{
+    (void)handle;
+    sim_nvs_entry_t *entry = nvs_find(key, true);
+    if (entry == NULL || length > SIM_NVS_VALUE_SIZE)
+    {
+        return ESP_ERR_NVS_NO_FREE_PAGES;
+    }
+    memcpy(entry->value, value, length);
+    entry->length = length;
+    sim_spend(SIM_FLASH, length * sim_model.flash_write_us_per_byte);
+    return ESP_OK;
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *value, size_t *length)
+{
+    (void)handle;
+    sim_nvs_entry_t *entry = nvs_find(key, false);
+    if (entry == NULL)
+    {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    if (value == NULL)
+    {
+        *length = entry->length;
+        return ESP_OK;
+    }
+    if (*length < entry->length)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy(value, entry->value, entry->length);
+    *length = entry->length;
+    return ESP_OK;
+}
+
+esp_err_t nvs_set_u32(nvs_handle_t handle, const char *key, uint32_t value)
+{
+    return nvs_set_blob(handle, key, &value, sizeof(value));
+}
+
+esp_err_t nvs_get_u32(nvs_handle_t handle, const char *key, uint32_t *value)
+{
+    size_t length = sizeof(*value);
+    return nvs_get_blob(handle, key, value, &length);
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char *key)
+{
+    (void)handle;
+    sim_nvs_entry_t *entry = nvs_find(key, false);
+    if (entry == NULL)
+    {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    memset(entry, 0, sizeof(*entry));
+    return ESP_OK;
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle)
+{
+    (void)handle;
+    sim->counters.nvs_commits++;
+    sim_spend(SIM_FLASH, sim_model.nvs_commit_ms * 1000);
+    return ESP_OK;
+}
+
+void nvs_close(nvs_handle_t handle)
+{
+    (void)handle;
+}
+
+static const esp_partition_t spool_partition = {
+    .type = ESP_PARTITION_TYPE_DATA,
+    .subtype = 0x40,
+    .size = SIM_SPOOL_SIZE,
+    .erase_size = SPI_FLASH_SEC_SIZE,
+    .label = "spool"};
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype,
+                                                const char *label)
+{
+    if (type != spool_partition.type || subtype != spool_partition.subtype ||
+        (label != NULL && strcmp(label, spool_partition.label) != 0))
+    {
+        return NULL;
+    }
+    return &spool_partition;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *partition, size_t offset, void *dst, size_t size)
+{
+    if (offset + size > partition->size)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy(dst, sim->spool + offset, size);
+    return ESP_OK;
+}
+
+// NOR flash, programming only clears bits
+esp_err_t esp_partition_write(const esp_partition_t *partition, size_t offset, const void *src, size_t size)
+{
+    if (offset + size > partition->size)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    const uint8_t *bytes = src;
+    for (size_t i = 0; i < size; i++)
+    {
+        sim->spool[offset + i] &= bytes[i];
+    }
+    sim_spend(SIM_FLASH, size * sim_model.flash_write_us_per_byte);
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *partition, size_t offset, size_t size)
+{
+    if (offset % SPI_FLASH_SEC_SIZE != 0 || size % SPI_FLASH_SEC_SIZE != 0 || offset + size > partition->size)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    memset(sim->spool + offset, 0xFF, size);
+    sim->counters.flash_erases += size / SPI_FLASH_SEC_SIZE;
+    sim_spend(SIM_FLASH, size / SPI_FLASH_SEC_SIZE * sim_model.flash_erase_ms * 1000);
+    return ESP_OK;
+}
+
+esp_err_t esp_phy_load_cal_data_from_nvs(esp_phy_calibration_data_t *out_cal_data)
+{
+    if (!sim->phy_cal_stored)
+    {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    memset(out_cal_data, 0x5a, sizeof(*out_cal_data));
+    return ESP_OK;
+}
+
+esp_err_t esp_phy_store_cal_data_to_nvs(const esp_phy_calibration_data_t *cal_data)
+{
+    sim->phy_cal_stored = true;
+    sim_spend(SIM_FLASH, sizeof(*cal_data) * sim_model.flash_write_us_per_byte);
+    return nvs_commit(0);
+}
+
+esp_err_t esp_phy_erase_cal_data_in_nvs(void)
+{
+    sim->phy_cal_stored = false;
+    return nvs_commit(0);
+}
+
+// The PHY initializes on the first start after boot, from the stored data or
+// with a full calibration that is then stored
+esp_err_t esp_wifi_start(void)
+{
+    static bool phy_initialized = false;
+    sim->radio_on = true;
+    if (!phy_initialized && !sim->phy_cal_stored)
+    {
+        sim->counters.rf_calibrations++;
+        sim_idle(sim_model.rf_cal_full_ms * 1000);
+        esp_phy_calibration_data_t cal_data = {0};
+        esp_phy_store_cal_data_to_nvs(&cal_data);
+    }
+    phy_initialized = true;
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_disconnect(void)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_stop(void)
+{
+    wifi_connected = false;
+    sim->radio_on = false;
+    sim->sntp_running = false;
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_deinit(void)
+{
+    return ESP_OK;
+}
+
+static sntp_sync_time_cb_t sntp_callback = NULL;
+
+// The request needs the radio, the reply comes one round trip later
+void esp_sntp_init(void)
+{
+    if (sim->radio_on && sim->network_up)
+    {
+        sim->sntp_running = true;
+        sim->sntp_due_us = sim->now_us + (uint64_t)(sim_model.rtt_ms * 1000);
+    }
+}
+
+void esp_sntp_stop(void)
+{
+    sim->sntp_running = false;
+}
+
+void esp_sntp_setoperatingmode(esp_sntp_operatingmode_t mode)
+{
+    (void)mode;
+}
+
+void esp_sntp_setservername(uint8_t index, const char *server)
+{
+    (void)index;
+    (void)server;
+}
+
+void sntp_set_time_sync_notification_cb(sntp_sync_time_cb_t callback)
+{
+    sntp_callback = callback;
+}
+
+static void sntp_deliver(void)
+{
+    sim->sntp_running = false;
+    if (sntp_callback != NULL)
+    {
+        struct timeval tv = {.tv_sec = sim_epoch(), .tv_usec = sim->now_us % 1000000};
+        sntp_callback(&tv);
+    }
+}
@@ -0,0 +1,115 @@
+// State that tools/wake_sim shares with the mocks. Every wake runs in a forked
+// child so the firmware starts from clean statics; whatever has to survive the
+// child (clock, RTC memory, flash, counters) lives in this shared mapping.
+#ifndef MOCK_SIM_H
+#define MOCK_SIM_H
+
+#include "idf.h"
+
+typedef enum {
+    SIM_BOOT,  // ROM, bootloader and app startup
+    SIM_CPU,   // Firmware running with the radio off
+    SIM_ADC,   // ADC bursts
+    SIM_FLASH, // NVS commits, spool programs and erases
+    SIM_RADIO, // Radio on and listening: association, DHCP, waiting for replies
+    SIM_TX,    // Radio transmitting
+    SIM_SLEEP, // Deep sleep
+    SIM_PHASE_COUNT
+} sim_phase_t;
+
+// Durations in milliseconds unless noted, currents in mA
+typedef struct {
+    double boot_ms;
+    double app_ms;            // Firmware code between app_main() and deep sleep
+    double associate_ms;      // Scan, authentication and association
+    double associate_fast_ms; // Same with a cached BSSID and channel
+    double dhcp_ms;
+    double connect_fail_ms;   // Radio time a failed connection attempt costs
+    double rtt_ms;            // TCP handshake and SNTP round trip
+    double tx_kbps;           // Effective payload throughput
+    double espnow_start_ms;   // WiFi driver start and channel setup without association
+    double rf_cal_full_ms;    // Full RF calibration, on top of loading the stored data
+    double espnow_kbps;       // ESP-NOW PHY rate
+    double espnow_ack_ms;     // Link-layer ack of one frame, and the gateway's time reply
+    double tls_full_ms;       // CPU time of a full TLS handshake, key exchange and certificate chain
+    double tls_resumed_ms;    // Same for a session resumed from its ticket
+    double tls_full_tx_bytes; // Sent by the device in either, see tools/tls_bench
+    double tls_resumed_tx_bytes;
+    double tls_ticket_hours;  // Until the terminator no longer takes a ticket
+    double nvs_commit_ms;
+    double flash_write_us_per_byte;
+    double flash_erase_ms;    // One sector
+    double uart_us_per_char;  // Console output
+    double current_ma[SIM_PHASE_COUNT];
+    double drift_ppm;         // RTC slow clock error
+    double battery_mah;
+} sim_model_t;
+
+#define SIM_RTC_SIZE 16384
+#define SIM_NVS_ENTRIES 8
+#define SIM_NVS_VALUE_SIZE 2048
+#define SIM_SPOOL_SIZE (1024 * 1024)
+
+typedef struct {
+    char key[16];
+    size_t length;
+    uint8_t value[SIM_NVS_VALUE_SIZE];
+} sim_nvs_entry_t;
+
+typedef struct {
+    unsigned long wakes;
+    unsigned long radio_wakes;
+    unsigned long connect_attempts;
+    unsigned long connect_failures;
+    unsigned long uplinks;
+    unsigned long readings_sent;
+    unsigned long bytes_sent;
+    unsigned long nvs_commits;
+    unsigned long flash_erases;
+    unsigned long rf_calibrations;
+    unsigned long resets;
+} sim_counters_t;
+
+typedef struct {
+    uint64_t now_us;  // True time since power-on
+    uint64_t wake_us; // When the current wake started
+    esp_sleep_wakeup_cause_t wake_cause;
+    esp_reset_reason_t reset_reason;
+    uint64_t sleep_us; // Requested by the firmware, 0 for an indefinite sleep
+    bool slept;
+    bool reset; // The wake ended in a reset instead of deep sleep
+    bool radio_on;
+    bool network_up;
+    bool phy_cal_stored; // ESP-IDF's RF calibration data in NVS
+    bool sntp_running;
+    uint64_t sntp_due_us;
+    double phase_us[SIM_PHASE_COUNT];
+    sim_counters_t counters;
+    sim_nvs_entry_t nvs[SIM_NVS_ENTRIES];
+    uint8_t rtc_memory[SIM_RTC_SIZE];
+    uint8_t rtc_noinit[SIM_RTC_SIZE];
+    uint8_t spool[SIM_SPOOL_SIZE];
+} sim_shared_t;
+
+extern sim_shared_t *sim;
+extern sim_model_t sim_model;
+
+// Advances the clock and books the time, and its charge, to a phase
+void sim_spend(sim_phase_t phase, double us);
+// Waiting inside the firmware, with or without the radio
+void sim_idle(double us);
+double sim_charge_mah(void);
+
+// Provided by the simulator driver
+double sim_environment_celsius(double seconds);
+double sim_battery_mv(void);
+uint32_t sim_epoch(void);
+bool sim_connect_fails(void);
+bool sim_brownout(void);
+// Called wherever the firmware feeds the task watchdog
+void sim_watchdog_fed(void);
+void sim_sleep(void) __attribute__((noreturn));
+// Ends the wake like a chip reset, only no-init RTC memory survives
+void sim_reset(esp_reset_reason_t reason) __attribute__((noreturn));
+
+#endif // MOCK_SIM_H
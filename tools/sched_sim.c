@@ -0,0 +1,228 @@
+// Replays a temperature trace through the sampling scheduler policies and
+// compares wakes, reported readings and uplinks with the fixed schedule.
+//
+//   sched_sim [-i trace.csv] [-d days] [-b]
+//     -i  trace with "seconds,celsius[,battery_mv]" lines, '#' starts a comment
+//     -d  without -i, synthesize a freezer with a defrost every 6 h for this many days (default 7)
+//     -b  with the synthetic trace, let the supply sag from 3.7 V to 3.2 V over the run
+//
+// Tracking error is the difference between the true temperature and the last
+// reported reading, evaluated every second.
+#include "config.h"
+#include "scheduler.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+typedef struct {
+    double seconds;
+    double celsius;
+    double battery_mv;
+} trace_point_t;
+
+static trace_point_t *trace = NULL;
+static size_t trace_length = 0;
+
+static void trace_add(double seconds, double celsius, double battery_mv)
+{
+    static size_t capacity = 0;
+    if (trace_length == capacity)
+    {
+        capacity = capacity ? capacity * 2 : 1024;
+        trace = realloc(trace, capacity * sizeof(trace_point_t));
+        if (trace == NULL)
+        {
+            perror("sched_sim");
+            exit(EXIT_FAILURE);
+        }
+    }
+    trace[trace_length++] = (trace_point_t){seconds, celsius, battery_mv};
+}
+
+static int load_trace(const char *path)
+{
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+    {
+        perror(path);
+        return -1;
+    }
+    char line[256];
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        double seconds, celsius, battery_mv = 0;
+        if (line[0] == '#' || sscanf(line, "%lf,%lf,%lf", &seconds, &celsius, &battery_mv) < 2)
+        {
+            continue;
+        }
+        if (trace_length > 0 && seconds <= trace[trace_length - 1].seconds)
+        {
+            fprintf(stderr, "%s: timestamps must increase (%.0f)\n", path, seconds);
+            fclose(file);
+            return -1;
+        }
+        trace_add(seconds, celsius, battery_mv);
+    }
+    fclose(file);
+    return trace_length >= 2 ? 0 : -1;
+}
+
+// Freezer at -18 °C with sensor noise, heater on for 15 min every 6 h,
+// then an exponential pull-down
+static void synthesize_trace(double days, int battery_sag)
+{
+    const double defrost_period = 6 * 3600;
+    const double heat_time = 15 * 60;
+    double end = days * 86400;
+    srand(1);
+    for (double t = 0; t <= end; t += 10)
+    {
+        double phase = fmod(t, defrost_period);
+        double celsius = -18.0;
+        if (phase < heat_time)
+        {
+            celsius += 22.0 * phase / heat_time;
+        }
+        else
+        {
+            celsius += 22.0 * exp(-(phase - heat_time) / 600.0);
+        }
+        celsius += ((rand() % 11) - 5) / 100.0;
+        double battery_mv = battery_sag ? 3700.0 - 500.0 * t / end : 0;
+        trace_add(t, celsius, battery_mv);
+    }
+}
+
+static void sample(double seconds, double *celsius, double *battery_mv)
+{
+    static size_t index = 0;
+    if (index > 0 && trace[index].seconds > seconds)
+    {
+        index = 0;
+    }
+    while (index + 2 < trace_length && trace[index + 1].seconds <= seconds)
+    {
+        index++;
+    }
+    const trace_point_t *a = &trace[index];
+    const trace_point_t *b = &trace[index + 1];
+    double f = (seconds - a->seconds) / (b->seconds - a->seconds);
+    if (f > 1)
+    {
+        f = 1;
+    }
+    *celsius = a->celsius + (b->celsius - a->celsius) * f;
+    *battery_mv = a->battery_mv + (b->battery_mv - a->battery_mv) * f;
+}
+
+typedef struct {
+    unsigned long wakes;
+    unsigned long reports;
+    unsigned long uplinks;
+    double error_sum;
+    double error_max;
+    unsigned long error_samples;
+} sim_result_t;
+
+static sim_result_t simulate(const scheduler_policy_t *policy)
+{
+    sim_result_t result = {0};
+    scheduler_state_t state;
+    scheduler_reset(&state);
+
+    double start = trace[0].seconds;
+    double end = trace[trace_length - 1].seconds;
+    double reported = NAN;
+    unsigned pending = 0;
+    double oldest = 0;
+
+    for (double t = start; t < end;)
+    {
+        double celsius, battery_mv;
+        sample(t, &celsius, &battery_mv);
+        scheduler_input_t input = {
+            .now = (uint32_t)(t - start),
+            .centi_celsius = (int32_t)lround(celsius * 100),
+            .battery_mv = (uint32_t)battery_mv};
+
+        // Same rule as rtc_batch_upload_due(), decided before the reading is taken
+        bool upload_due = pending + 1 >= BATCH_SEND_THRESHOLD ||
+                          (pending > 0 && t - oldest >= BATCH_MAX_AGE_SEC);
+
+        scheduler_decision_t decision = scheduler_step(&state, policy, &input);
+        result.wakes++;
+        if (decision.report)
+        {
+            result.reports++;
+            reported = input.centi_celsius / 100.0;
+            if (pending++ == 0)
+            {
+                oldest = t;
+            }
+        }
+        if (upload_due && pending > 0)
+        {
+            result.uplinks++;
+            pending = 0;
+        }
+
+        double next = t + decision.sleep_sec;
+        for (double s = t; s < next && s < end; s += 1)
+        {
+            double truth, unused;
+            sample(s, &truth, &unused);
+            double error = fabs(truth - reported);
+            result.error_sum += error;
+            result.error_max = error > result.error_max ? error : result.error_max;
+            result.error_samples++;
+        }
+        t = next;
+    }
+    return result;
+}
+
+int main(int argc, char **argv)
+{
+    const char *path = NULL;
+    double days = 7;
+    int battery_sag = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "i:d:b")) != -1)
+    {
+        switch (opt)
+        {
+        case 'i': path = optarg; break;
+        case 'd': days = atof(optarg); break;
+        case 'b': battery_sag = 1; break;
+        default:
+            fprintf(stderr, "usage: %s [-i trace.csv] [-d days] [-b]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (path != NULL ? load_trace(path) != 0 : (synthesize_trace(days, battery_sag), 0))
+    {
+        fprintf(stderr, "sched_sim: need a trace with at least two points\n");
+        return EXIT_FAILURE;
+    }
+
+    const scheduler_policy_t *policies[] = {&scheduler_policy_fixed, &scheduler_policy_adaptive};
+    sim_result_t results[2];
+    printf("%.1f h of trace, %zu points\n", (trace[trace_length - 1].seconds - trace[0].seconds) / 3600,
+           trace_length);
+    printf("%-10s %8s %8s %8s %10s %10s\n", "policy", "wakes", "reports", "uplinks", "mean err", "max err");
+    for (int i = 0; i < 2; i++)
+    {
+        results[i] = simulate(policies[i]);
+        printf("%-10s %8lu %8lu %8lu %8.3f C %8.3f C\n", policies[i]->name, results[i].wakes, results[i].reports,
+               results[i].uplinks, results[i].error_sum / results[i].error_samples, results[i].error_max);
+    }
+    printf("adaptive vs fixed: %.0f%% wakes, %.0f%% reports, %.0f%% uplinks\n",
+           100.0 * results[1].wakes / results[0].wakes, 100.0 * results[1].reports / results[0].reports,
+           100.0 * results[1].uplinks / results[0].uplinks);
+    free(trace);
+    return EXIT_SUCCESS;
+}
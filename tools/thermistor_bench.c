@@ -0,0 +1,138 @@
+// Host-side accuracy check and benchmark of the thermistor conversion.
+//
+// Compares the fixed-point table lookup in main/thermistor.c against the
+// float beta formula the firmware used before, over every code 0..4095 in
+// 1/16 LSB steps. Build with the host tools (see tools/CMakeLists.txt).
+// The host has an FPU, so the float timings here are a lower bound for the
+// ESP32-C6, where every float/double operation is emulated in software.
+#include "thermistor.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+static inline uint64_t read_cycles(void) { return __rdtsc(); }
+#elif defined(__riscv)
+static inline uint64_t read_cycles(void)
+{
+    uint64_t cycles;
+    __asm__ volatile("rdcycle %0" : "=r"(cycles));
+    return cycles;
+}
+#else
+static inline uint64_t read_cycles(void) { return 0; }
+#endif
+
+#define CODE_STEPS (((uint32_t)ADC_MAX_VALUE << ADC_CODE_FRACTION_BITS) + 1)
+#define BENCH_ROUNDS 50
+#define MAX_OPERATING_ERROR 5 // centi-degrees between -40 and 125 °C
+
+// The conversion as it was in measure_and_send(), float with a double log()
+static float float_celsius(float raw_value, float series_resistor)
+{
+    float v_out = (raw_value / ADC_MAX_VALUE) * VREF;
+    float resistance = series_resistor * v_out / (VREF - v_out);
+    float temperature_kelvin = BETA / (log(resistance / R2) + (BETA / T2));
+    return temperature_kelvin - KELVIN_TO_CELSIUS;
+}
+
+static double reference_centi(uint32_t code_q4, double series_resistor)
+{
+    double v_out = (double)code_q4 / (1 << ADC_CODE_FRACTION_BITS) / ADC_MAX_VALUE * VREF;
+    double resistance = series_resistor * v_out / (VREF - v_out);
+    return (BETA / (log(resistance / R2) + BETA / T2) - KELVIN_TO_CELSIUS) * 100.0;
+}
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int check_accuracy(const char *name, const int16_t *table, double series_resistor)
+{
+    double max_all = 0, max_operating = 0, sum_operating = 0;
+    uint32_t operating_points = 0;
+
+    // Codes 0 and 4095 are the rails where the divider equation is singular
+    for (uint32_t code_q4 = 1 << ADC_CODE_FRACTION_BITS;
+         code_q4 < ((uint32_t)ADC_MAX_VALUE << ADC_CODE_FRACTION_BITS); code_q4++)
+    {
+        double reference = reference_centi(code_q4, series_resistor);
+        double error = fabs(thermistor_lookup(table, code_q4) - reference);
+        if (error > max_all)
+        {
+            max_all = error;
+        }
+        if (reference >= -4000 && reference <= 12500)
+        {
+            if (error > max_operating)
+            {
+                max_operating = error;
+            }
+            sum_operating += error;
+            operating_points++;
+        }
+    }
+
+    printf("%-22s max error %8.3f °C (codes 1..4094), %.4f °C max / %.4f °C mean in -40..125 °C\n",
+           name, max_all / 100, max_operating / 100, sum_operating / operating_points / 100);
+    return max_operating <= MAX_OPERATING_ERROR ? 0 : 1;
+}
+
+int main(void)
+{
+    thermistor_table_t calibrated;
+    thermistor_build_table(&calibrated, SERIES_RESISTOR * 0.97f);
+
+    int failures = 0;
+    failures += check_accuracy("default table", thermistor_default_table_get(), SERIES_RESISTOR);
+    failures += check_accuracy("rebuilt table (-3 %)", calibrated.centi_celsius, SERIES_RESISTOR * 0.97f);
+
+    volatile int64_t sink = 0;
+    double start = now_ns();
+    uint64_t cycles = read_cycles();
+    for (int round = 0; round < BENCH_ROUNDS; round++)
+    {
+        for (uint32_t code_q4 = 0; code_q4 < CODE_STEPS; code_q4++)
+        {
+            sink += thermistor_lookup(thermistor_default_table_get(), code_q4);
+        }
+    }
+    uint64_t table_cycles = read_cycles() - cycles;
+    double table_ns = now_ns() - start;
+
+    start = now_ns();
+    cycles = read_cycles();
+    for (int round = 0; round < BENCH_ROUNDS; round++)
+    {
+        for (uint32_t code_q4 = 0; code_q4 < CODE_STEPS; code_q4++)
+        {
+            sink += (int64_t)(float_celsius(code_q4 / 16.0f, SERIES_RESISTOR) * 100);
+        }
+    }
+    uint64_t float_cycles = read_cycles() - cycles;
+    double float_ns = now_ns() - start;
+
+    start = now_ns();
+    for (int round = 0; round < BENCH_ROUNDS; round++)
+    {
+        thermistor_build_table(&calibrated, SERIES_RESISTOR + round);
+    }
+    double rebuild_ns = now_ns() - start;
+
+    double calls = (double)BENCH_ROUNDS * CODE_STEPS;
+    printf("table lookup:   %7.2f ns/call %7.1f cycles/call\n", table_ns / calls, table_cycles / calls);
+    printf("float formula:  %7.2f ns/call %7.1f cycles/call\n", float_ns / calls, float_cycles / calls);
+    printf("table rebuild:  %7.2f us\n", rebuild_ns / BENCH_ROUNDS / 1000);
+    (void)sink;
+
+    if (failures)
+    {
+        printf("FAIL: table error above %.2f °C in the operating range\n", MAX_OPERATING_ERROR / 100.0);
+    }
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
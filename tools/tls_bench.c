@@ -0,0 +1,273 @@
+// Handshake benchmark for transport_tls: full against resumed TLS 1.2.
+//
+// Connects count times without a session and count times with the session of
+// the previous connection, serialized in between the way tls_link.c keeps it
+// in RTC memory over deep sleep. Each connection sends one CSV line and closes
+// with close_notify, like an upload. Reports per kind of handshake the time,
+// client CPU time, round trips, TLS bytes and TCP segments, and an estimate of
+// the bytes on air. Fails when a resumption was not accepted.
+//
+//   tls_bench [-h host] [-p port] [-n count] [-c ca] [-m mss]
+//     -h  terminator address (default 127.0.0.1, i.e. tools/tls_collector)
+//     -p  port (default TLS_PORT)
+//     -n  handshakes of each kind (default 20)
+//     -c  CA certificate, PEM (default tls_collector.crt)
+//     -m  TCP MSS, a WiFi station's by default so segment counts match (default 1436)
+//
+// The client is OpenSSL with the suite, group and TLS version of tls_link.c,
+// its ClientHello extensions differ from mbedtls' by a few dozen bytes. Times
+// are the host's, the device logs its own for each handshake and keeps them in
+// the "tls" trace phase.
+#include "config.h"
+#include "latency_histogram.h"
+#include <arpa/inet.h>
+#include <linux/tcp.h> // tcp_info with segment counts
+#include <netinet/in.h>
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+// Per data frame: IPv4 and TCP with timestamps, 802.11 QoS header, CCMP, LLC/SNAP and FCS
+#define IP_TCP_HEADER_BYTES 52
+#define WIFI_FRAME_OVERHEAD_BYTES 54
+
+typedef struct {
+    latency_histogram_t time;
+    double cpu_ms;
+    uint64_t bytes_out;
+    uint64_t bytes_in;
+    uint64_t segments_out;
+    uint64_t segments_in;
+    uint64_t round_trips;
+    uint64_t resumed;
+    size_t ticket_length; // Of the last session
+} result_t;
+
+typedef struct {
+    bool wrote; // Last socket operation was a write
+    uint64_t round_trips;
+} flights_t;
+
+enum { FULL, RESUMED };
+
+static double now_s(int clock)
+{
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// A read that follows a write is a wait for the server, one round trip
+static long count_flights(BIO *bio, int operation, const char *argp, size_t len, int argi, long argl,
+                          int ret, size_t *processed)
+{
+    (void)argp;
+    (void)len;
+    (void)argi;
+    (void)argl;
+    (void)processed;
+    flights_t *flights = (flights_t *)BIO_get_callback_arg(bio);
+    if (ret > 0 && operation == (BIO_CB_WRITE | BIO_CB_RETURN))
+    {
+        flights->wrote = true;
+    }
+    else if (ret > 0 && operation == (BIO_CB_READ | BIO_CB_RETURN) && flights->wrote)
+    {
+        flights->wrote = false;
+        flights->round_trips++;
+    }
+    return ret;
+}
+
+static bool tcp_segments(int sock, uint64_t *out, uint64_t *in)
+{
+    struct tcp_info info;
+    socklen_t length = sizeof(info);
+    if (getsockopt(sock, IPPROTO_TCP, TCP_INFO, &info, &length) != 0)
+    {
+        return false;
+    }
+    *out = info.tcpi_segs_out;
+    *in = info.tcpi_segs_in;
+    return true;
+}
+
+// One upload. session is the serialized session of the last one, replaced
+// with the new one on success, and empty for a full handshake.
+static bool upload(SSL_CTX *context, const struct sockaddr_in *server, int mss,
+                   uint8_t *session, size_t *session_length, result_t *result)
+{
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    setsockopt(sock, IPPROTO_TCP, TCP_MAXSEG, &mss, sizeof(mss));
+    if (connect(sock, (const struct sockaddr *)server, sizeof(*server)) < 0)
+    {
+        perror("tls_bench: connect");
+        close(sock);
+        return false;
+    }
+
+    SSL *ssl = SSL_new(context);
+    SSL_set_fd(ssl, sock);
+    SSL_set_tlsext_host_name(ssl, TLS_SERVER_NAME);
+    SSL_set1_host(ssl, TLS_SERVER_NAME);
+    if (*session_length > 0)
+    {
+        const unsigned char *data = session;
+        SSL_SESSION *cached = d2i_SSL_SESSION(NULL, &data, (long)*session_length);
+        SSL_set_session(ssl, cached);
+        SSL_SESSION_free(cached);
+    }
+    flights_t flights = {0};
+    BIO *bio = SSL_get_rbio(ssl);
+    BIO_set_callback_ex(bio, count_flights);
+    BIO_set_callback_arg(bio, (char *)&flights);
+
+    uint64_t segments_out = 0, segments_in = 0;
+    tcp_segments(sock, &segments_out, &segments_in);
+    double started = now_s(CLOCK_MONOTONIC);
+    double cpu_started = now_s(CLOCK_PROCESS_CPUTIME_ID);
+    bool ok = SSL_connect(ssl) == 1;
+    double cpu_s = now_s(CLOCK_PROCESS_CPUTIME_ID) - cpu_started;
+    double elapsed_s = now_s(CLOCK_MONOTONIC) - started;
+    if (!ok)
+    {
+        ERR_print_errors_fp(stderr);
+    }
+    else
+    {
+        uint64_t out, in;
+        tcp_segments(sock, &out, &in);
+        latency_record(&result->time, (uint64_t)(elapsed_s * 1e6));
+        result->cpu_ms += cpu_s * 1000;
+        result->bytes_out += BIO_number_written(bio);
+        result->bytes_in += BIO_number_read(bio);
+        result->segments_out += out - segments_out;
+        result->segments_in += in - segments_in;
+        result->round_trips += flights.round_trips;
+        result->resumed += SSL_session_reused(ssl);
+
+        // Kept for the next connection like the RTC copy on the device
+        SSL_SESSION *next = SSL_get1_session(ssl);
+        int length = i2d_SSL_SESSION(next, NULL);
+        unsigned char *data = session;
+        *session_length = length > 0 && length <= 4096 ? (size_t)i2d_SSL_SESSION(next, &data) : 0;
+        const unsigned char *ticket;
+        SSL_SESSION_get0_ticket(next, &ticket, &result->ticket_length);
+        SSL_SESSION_free(next);
+
+        char line[96];
+        time_t now = time(NULL);
+        struct tm timeinfo;
+        gmtime_r(&now, &timeinfo);
+        int line_length = snprintf(line, sizeof(line), "%04d-%02d-%02d %02d:%02d:%02d+0000,%d,%.4f,%s\n",
+                                   timeinfo.tm_year + 1900, timeinfo.tm_mon + 1, timeinfo.tm_mday,
+                                   timeinfo.tm_hour, timeinfo.tm_min, timeinfo.tm_sec,
+                                   DEVICE_GROUP_ID, 4.2, "tls_bench");
+        ok = SSL_write(ssl, line, line_length) == line_length;
+        SSL_shutdown(ssl);
+    }
+    SSL_free(ssl);
+    close(sock);
+    return ok;
+}
+
+static void print_result(const char *label, const result_t *result)
+{
+    double count = result->time.count > 0 ? (double)result->time.count : 1;
+    double segments = (result->segments_out + result->segments_in) / count;
+    double bytes = (result->bytes_out + result->bytes_in) / count;
+    printf("%-8s %5.2f %7.2f %7.2f %6.1f %7.0f %7.0f %6.1f %6.1f %7.0f\n", label,
+           latency_percentile_ms(&result->time, 0.5), result->time.max_us / 1000.0,
+           result->cpu_ms / count, result->round_trips / count,
+           result->bytes_out / count, result->bytes_in / count,
+           result->segments_out / count, result->segments_in / count,
+           bytes + segments * (IP_TCP_HEADER_BYTES + WIFI_FRAME_OVERHEAD_BYTES));
+}
+
+int main(int argc, char **argv)
+{
+    const char *host = "127.0.0.1";
+    int port = TLS_PORT;
+    int count = 20;
+    const char *ca_path = "tls_collector.crt";
+    int mss = 1436;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "h:p:n:c:m:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'h': host = optarg; break;
+        case 'p': port = atoi(optarg); break;
+        case 'n': count = atoi(optarg); break;
+        case 'c': ca_path = optarg; break;
+        case 'm': mss = atoi(optarg); break;
+        default:
+            fprintf(stderr, "usage: %s [-h host] [-p port] [-n count] [-c ca] [-m mss]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    // The offer of tls_link.c
+    SSL_CTX *context = SSL_CTX_new(TLS_client_method());
+    SSL_CTX_set_min_proto_version(context, TLS1_2_VERSION);
+    SSL_CTX_set_max_proto_version(context, TLS1_2_VERSION);
+    SSL_CTX_set_cipher_list(context, "ECDHE-ECDSA-AES128-GCM-SHA256:ECDHE-RSA-AES128-GCM-SHA256");
+    SSL_CTX_set1_groups_list(context, "P-256");
+    SSL_CTX_set_verify(context, SSL_VERIFY_PEER, NULL);
+    if (SSL_CTX_load_verify_locations(context, ca_path, NULL) != 1)
+    {
+        ERR_print_errors_fp(stderr);
+        return EXIT_FAILURE;
+    }
+
+    struct sockaddr_in server = {.sin_family = AF_INET, .sin_port = htons(port)};
+    if (inet_pton(AF_INET, host, &server.sin_addr) != 1)
+    {
+        fprintf(stderr, "tls_bench: %s is not an IPv4 address\n", host);
+        return EXIT_FAILURE;
+    }
+
+    static uint8_t session[4096];
+    size_t session_length = 0;
+    result_t results[2] = {0};
+    for (int kind = FULL; kind <= RESUMED; kind++)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            if (kind == FULL)
+            {
+                session_length = 0;
+            }
+            if (!upload(context, &server, mss, session, &session_length, &results[kind]))
+            {
+                fprintf(stderr, "tls_bench: upload to %s:%d failed\n", host, port);
+                return EXIT_FAILURE;
+            }
+        }
+    }
+
+    printf("%d full and %d resumed handshakes with %s:%d, MSS %d\n", count, count, host, port, mss);
+    printf("%-8s %5s %7s %7s %6s %7s %7s %6s %6s %7s\n", "", "p50ms", "max ms", "cpu ms", "rtts",
+           "B out", "B in", "seg out", "seg in", "on air");
+    print_result("full", &results[FULL]);
+    print_result("resumed", &results[RESUMED]);
+    // OpenSSL keeps the whole server certificate, tls_link.c only its digest
+    printf("session ticket %zu bytes, TLS_SESSION_MAX_SIZE has to hold it and about 150 bytes more\n",
+           results[FULL].ticket_length);
+
+    if (results[RESUMED].resumed != (uint64_t)count)
+    {
+        fprintf(stderr, "tls_bench: FAIL, only %llu of %d sessions resumed\n",
+                (unsigned long long)results[RESUMED].resumed, count);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,415 @@
+// Local TLS terminator in front of the collector, the stand-in for what
+// transport_tls connects to on TLS_PORT.
+//
+// Accepts TLS 1.2 with session tickets, counts full and resumed handshakes
+// with their latency and bytes, and passes the plaintext on: to -o, or over
+// one TCP connection per device connection to -f, e.g. the plain collector or
+// pbl.permasense.uibk.ac.at:22504.
+//
+//   tls_collector [-l addr] [-p port] [-c cert] [-k key] [-T sec] [-f host:port] [-s sec] [-o file]
+//     -l  listen address (default 127.0.0.1)
+//     -p  port (default TLS_PORT)
+//     -c  certificate, PEM (default tls_collector.crt)
+//     -k  private key, PEM (default tls_collector.key)
+//     -T  session ticket lifetime in seconds (default 86400)
+//     -f  forward the plaintext to host:port
+//     -s  print statistics every sec seconds (default 5)
+//     -o  append every received line to file
+//
+// Without the certificate and key files a self-signed P-256 certificate for
+// TLS_SERVER_NAME is generated, written to them and printed as the TLS_CA_PEM
+// line for config.h. Ticket keys only live as long as the process: after a
+// restart every device does one full handshake.
+#include "config.h"
+#include "latency_histogram.h"
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/ssl.h>
+#include <openssl/x509v3.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef struct {
+    uint64_t lines;
+    uint64_t bytes;
+    uint64_t failed; // Handshakes that did not complete
+    uint64_t handshake_bytes[2]; // Both directions, by full and resumed
+    latency_histogram_t handshake[2];
+} stats_t;
+
+enum { FULL, RESUMED };
+
+static volatile sig_atomic_t running = 1;
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static stats_t interval_stats, total_stats;
+static FILE *line_log = NULL;
+static SSL_CTX *context = NULL;
+static struct sockaddr_in forward_address;
+static bool forwarding = false;
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void on_signal(int sig)
+{
+    (void)sig;
+    running = 0;
+}
+
+static void print_stats(const char *label, const stats_t *stats, double seconds)
+{
+    const latency_histogram_t *full = &stats->handshake[FULL];
+    const latency_histogram_t *resumed = &stats->handshake[RESUMED];
+    fprintf(stderr, "%s: %llu full, %llu resumed, %llu failed, %llu lines, %.1f kB/s\n", label,
+            (unsigned long long)full->count, (unsigned long long)resumed->count,
+            (unsigned long long)stats->failed, (unsigned long long)stats->lines, stats->bytes / seconds / 1000);
+    for (int kind = FULL; kind <= RESUMED; kind++)
+    {
+        const latency_histogram_t *hist = &stats->handshake[kind];
+        if (hist->count == 0)
+        {
+            continue;
+        }
+        fprintf(stderr, "  %-7s ", kind == FULL ? "full" : "resumed");
+        latency_print(stderr, "handshake", hist);
+        fprintf(stderr, ", %.0f bytes\n", (double)stats->handshake_bytes[kind] / hist->count);
+    }
+}
+
+static int connect_forward(void)
+{
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock >= 0 && connect(sock, (struct sockaddr *)&forward_address, sizeof(forward_address)) < 0)
+    {
+        perror("tls_collector: forward");
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+static bool send_all(int sock, const char *data, size_t length)
+{
+    while (length > 0)
+    {
+        ssize_t sent = send(sock, data, length, MSG_NOSIGNAL);
+        if (sent <= 0)
+        {
+            return false;
+        }
+        data += sent;
+        length -= sent;
+    }
+    return true;
+}
+
+// One thread per device connection, the devices hold it for a few round trips
+static void *serve(void *arg)
+{
+    int fd = (int)(intptr_t)arg;
+    struct timeval timeout = {.tv_sec = UPLINK_TIMEOUT_SEC * 2};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    SSL *ssl = SSL_new(context);
+    SSL_set_fd(ssl, fd);
+    double started = now_s();
+    if (SSL_accept(ssl) != 1)
+    {
+        pthread_mutex_lock(&stats_lock);
+        interval_stats.failed++;
+        total_stats.failed++;
+        pthread_mutex_unlock(&stats_lock);
+        SSL_free(ssl);
+        close(fd);
+        return NULL;
+    }
+
+    // SSL_accept() returns once the device's Finished arrived, in both kinds of handshake
+    uint64_t latency_us = (uint64_t)((now_s() - started) * 1e6);
+    int kind = SSL_session_reused(ssl) ? RESUMED : FULL;
+    BIO *bio = SSL_get_rbio(ssl);
+    uint64_t handshake_bytes = BIO_number_read(bio) + BIO_number_written(bio);
+    pthread_mutex_lock(&stats_lock);
+    latency_record(&interval_stats.handshake[kind], latency_us);
+    latency_record(&total_stats.handshake[kind], latency_us);
+    interval_stats.handshake_bytes[kind] += handshake_bytes;
+    total_stats.handshake_bytes[kind] += handshake_bytes;
+    pthread_mutex_unlock(&stats_lock);
+
+    int forward = forwarding ? connect_forward() : -1;
+    char buffer[4096];
+    int received;
+    while ((received = SSL_read(ssl, buffer, sizeof(buffer))) > 0)
+    {
+        uint64_t lines = 0;
+        for (int i = 0; i < received; i++)
+        {
+            lines += buffer[i] == '\n';
+        }
+        if (forward >= 0 && !send_all(forward, buffer, received))
+        {
+            fprintf(stderr, "tls_collector: forward connection lost\n");
+            close(forward);
+            forward = -1;
+        }
+        pthread_mutex_lock(&stats_lock);
+        interval_stats.lines += lines;
+        total_stats.lines += lines;
+        interval_stats.bytes += received;
+        total_stats.bytes += received;
+        if (line_log != NULL)
+        {
+            fwrite(buffer, 1, received, line_log);
+        }
+        pthread_mutex_unlock(&stats_lock);
+    }
+
+    if (SSL_get_error(ssl, received) == SSL_ERROR_ZERO_RETURN)
+    {
+        SSL_shutdown(ssl);
+    }
+    if (forward >= 0)
+    {
+        close(forward);
+    }
+    SSL_free(ssl);
+    close(fd);
+    return NULL;
+}
+
+// Self-signed and marked as a CA, so mbedtls takes it as the trust anchor for itself
+static bool generate_identity(const char *cert_path, const char *key_path)
+{
+    EVP_PKEY *key = EVP_EC_gen("P-256");
+    X509 *cert = X509_new();
+    if (key == NULL || cert == NULL)
+    {
+        return false;
+    }
+    X509_set_version(cert, 2);
+    ASN1_INTEGER_set(X509_get_serialNumber(cert), (long)time(NULL));
+    X509_gmtime_adj(X509_getm_notBefore(cert), -3600);
+    X509_gmtime_adj(X509_getm_notAfter(cert), 10L * 365 * 24 * 3600);
+    X509_set_pubkey(cert, key);
+    X509_NAME *name = X509_get_subject_name(cert);
+    X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (const unsigned char *)TLS_SERVER_NAME, -1, -1, 0);
+    X509_set_issuer_name(cert, name);
+
+    X509V3_CTX ext_context;
+    X509V3_set_ctx(&ext_context, cert, cert, NULL, NULL, 0);
+    const char *extensions[][2] = {
+        {"basicConstraints", "critical,CA:TRUE"},
+        {"subjectAltName", "DNS:" TLS_SERVER_NAME}};
+    for (size_t i = 0; i < sizeof(extensions) / sizeof(extensions[0]); i++)
+    {
+        X509_EXTENSION *ext = X509V3_EXT_conf(NULL, &ext_context, extensions[i][0], extensions[i][1]);
+        X509_add_ext(cert, ext, -1);
+        X509_EXTENSION_free(ext);
+    }
+    X509_sign(cert, key, EVP_sha256());
+
+    FILE *cert_file = fopen(cert_path, "w");
+    FILE *key_file = fopen(key_path, "w");
+    bool written = cert_file != NULL && key_file != NULL && PEM_write_X509(cert_file, cert) &&
+                   PEM_write_PrivateKey(key_file, key, NULL, NULL, 0, NULL, NULL);
+    if (cert_file != NULL)
+    {
+        fclose(cert_file);
+    }
+    if (key_file != NULL)
+    {
+        fclose(key_file);
+    }
+
+    if (written)
+    {
+        // One line, ready to paste into config.h
+        BIO *pem = BIO_new(BIO_s_mem());
+        PEM_write_bio_X509(pem, cert);
+        char *data;
+        long length = BIO_get_mem_data(pem, &data);
+        fprintf(stderr, "tls_collector: wrote %s and %s, for config.h:\n#define TLS_CA_PEM \"", cert_path, key_path);
+        for (long i = 0; i < length; i++)
+        {
+            if (data[i] == '\n')
+            {
+                fputs("\\n", stderr);
+            }
+            else
+            {
+                fputc(data[i], stderr);
+            }
+        }
+        fprintf(stderr, "\"\n");
+        BIO_free(pem);
+    }
+    X509_free(cert);
+    EVP_PKEY_free(key);
+    return written;
+}
+
+static bool parse_forward(const char *target)
+{
+    char host[256];
+    const char *colon = strrchr(target, ':');
+    if (colon == NULL || colon - target >= (long)sizeof(host))
+    {
+        return false;
+    }
+    memcpy(host, target, colon - target);
+    host[colon - target] = '\0';
+
+    struct addrinfo hints = {.ai_family = AF_INET, .ai_socktype = SOCK_STREAM};
+    struct addrinfo *result;
+    if (getaddrinfo(host, colon + 1, &hints, &result) != 0)
+    {
+        return false;
+    }
+    memcpy(&forward_address, result->ai_addr, sizeof(forward_address));
+    freeaddrinfo(result);
+    forwarding = true;
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    const char *address = "127.0.0.1";
+    int port = TLS_PORT;
+    const char *cert_path = "tls_collector.crt";
+    const char *key_path = "tls_collector.key";
+    long ticket_lifetime = 86400;
+    double stats_interval = 5;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "l:p:c:k:T:f:s:o:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'l': address = optarg; break;
+        case 'p': port = atoi(optarg); break;
+        case 'c': cert_path = optarg; break;
+        case 'k': key_path = optarg; break;
+        case 'T': ticket_lifetime = atol(optarg); break;
+        case 'f':
+            if (!parse_forward(optarg))
+            {
+                fprintf(stderr, "tls_collector: cannot resolve %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 's': stats_interval = atof(optarg); break;
+        case 'o':
+            line_log = fopen(optarg, "a");
+            if (line_log == NULL)
+            {
+                perror(optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-l addr] [-p port] [-c cert] [-k key] [-T sec] [-f host:port] [-s sec] [-o file]\n",
+                    argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (access(cert_path, R_OK) != 0 && !generate_identity(cert_path, key_path))
+    {
+        fprintf(stderr, "tls_collector: cannot create %s and %s\n", cert_path, key_path);
+        return EXIT_FAILURE;
+    }
+
+    // What transport_tls offers, see tls_link.c
+    context = SSL_CTX_new(TLS_server_method());
+    SSL_CTX_set_min_proto_version(context, TLS1_2_VERSION);
+    SSL_CTX_set_max_proto_version(context, TLS1_2_VERSION);
+    SSL_CTX_set_cipher_list(context, "ECDHE-ECDSA-AES128-GCM-SHA256:ECDHE-RSA-AES128-GCM-SHA256");
+    SSL_CTX_set1_groups_list(context, "P-256");
+    SSL_CTX_set_timeout(context, ticket_lifetime);
+    // Tickets only, the devices never come back with a bare session ID
+    SSL_CTX_set_session_cache_mode(context, SSL_SESS_CACHE_OFF);
+    if (SSL_CTX_use_certificate_chain_file(context, cert_path) != 1 ||
+        SSL_CTX_use_PrivateKey_file(context, key_path, SSL_FILETYPE_PEM) != 1)
+    {
+        ERR_print_errors_fp(stderr);
+        return EXIT_FAILURE;
+    }
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    signal(SIGPIPE, SIG_IGN);
+
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    int yes = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    struct sockaddr_in bind_address = {.sin_family = AF_INET, .sin_port = htons(port)};
+    inet_pton(AF_INET, address, &bind_address.sin_addr);
+    if (bind(listener, (struct sockaddr *)&bind_address, sizeof(bind_address)) < 0 ||
+        listen(listener, 1024) < 0)
+    {
+        perror("tls_collector: listen");
+        return EXIT_FAILURE;
+    }
+    fprintf(stderr, "tls_collector: listening on %s:%d as %s\n", address, port, TLS_SERVER_NAME);
+
+    double started = now_s();
+    double interval_start = started;
+    while (running)
+    {
+        struct pollfd listen_poll = {.fd = listener, .events = POLLIN};
+        int timeout_ms = (int)((interval_start + stats_interval - now_s()) * 1000) + 1;
+        if (poll(&listen_poll, 1, timeout_ms > 0 ? timeout_ms : 0) > 0)
+        {
+            int fd = accept(listener, NULL, NULL);
+            pthread_t thread;
+            if (fd >= 0 && pthread_create(&thread, NULL, serve, (void *)(intptr_t)fd) == 0)
+            {
+                pthread_detach(thread);
+            }
+            else if (fd >= 0)
+            {
+                close(fd);
+            }
+        }
+
+        double now = now_s();
+        if (now - interval_start >= stats_interval)
+        {
+            pthread_mutex_lock(&stats_lock);
+            print_stats("interval", &interval_stats, now - interval_start);
+            memset(&interval_stats, 0, sizeof(interval_stats));
+            if (line_log != NULL)
+            {
+                fflush(line_log);
+            }
+            pthread_mutex_unlock(&stats_lock);
+            interval_start = now;
+        }
+    }
+
+    pthread_mutex_lock(&stats_lock);
+    print_stats("total", &total_stats, now_s() - started);
+    if (line_log != NULL)
+    {
+        fclose(line_log);
+    }
+    pthread_mutex_unlock(&stats_lock);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,78 @@
+// Host run of the per-wake CPU kernels in bench/, see bench/main for the
+// same suite on the ESP32-C6.
+//
+//   wake_bench [-i trace.csv]
+//     -i  replay "seconds,raw_q4" lines through convert, scheduler and
+//         serialization (default bench/sample_trace.csv)
+//
+// The host has an FPU and a table-driven libc, so soft-float and newlib
+// costs show up only in the on-target numbers.
+#include "bench_kernels.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#ifndef BENCH_SAMPLE_TRACE
+#define BENCH_SAMPLE_TRACE "sample_trace.csv"
+#endif
+
+static char *read_file(const char *path, size_t *length)
+{
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+    {
+        perror(path);
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    rewind(file);
+    char *text = malloc(size + 1);
+    if (text == NULL || fread(text, 1, size, file) != (size_t)size)
+    {
+        fprintf(stderr, "%s: read failed\n", path);
+        free(text);
+        fclose(file);
+        return NULL;
+    }
+    fclose(file);
+    text[size] = '\0';
+    *length = size;
+    return text;
+}
+
+int main(int argc, char **argv)
+{
+    const char *trace_path = BENCH_SAMPLE_TRACE;
+    int option;
+    while ((option = getopt(argc, argv, "i:")) != -1)
+    {
+        switch (option)
+        {
+        case 'i':
+            trace_path = optarg;
+            break;
+        default:
+            fprintf(stderr, "usage: wake_bench [-i trace.csv]\n");
+            return EXIT_FAILURE;
+        }
+    }
+
+    bench_run_all();
+
+    size_t length;
+    char *text = read_file(trace_path, &length);
+    if (text == NULL)
+    {
+        return EXIT_FAILURE;
+    }
+    printf("\n");
+    int readings = bench_replay(text, length);
+    free(text);
+    if (readings == 0)
+    {
+        fprintf(stderr, "%s: no \"seconds,raw_q4\" lines\n", trace_path);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
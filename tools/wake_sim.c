@@ -0,0 +1,472 @@
+// Runs the unmodified firmware state machine through days of deep-sleep wakes
+// against mocked hardware and projects the battery life from an energy model.
+//
+//   wake_sim [-d days] [-c mAh] [-f percent] [-b percent] [-O hour:hours] [-L days] [-p name=value] [-v] [-t]
+//     -d  simulated time (default 7 days)
+//     -c  battery capacity (default 2600 mAh)
+//     -f  share of connection attempts that fail
+//     -b  share of transmissions that brown the device out
+//     -O  uplink outage starting at this hour of the run and lasting this many hours
+//     -L  exit with status 1 when the projected battery life is shorter than this
+//     -p  override a model parameter, -p list prints all of them
+//     -v  print the firmware log
+//     -t  hang each wake cycle phase in turn, every time it is entered, until the
+//         task watchdog resets the chip. Fails unless every cycle gives up on the
+//         phase after CYCLE_MAX_INTERRUPTS resets and the device keeps sleeping.
+//
+// Every wake is a forked child that starts app_main() from clean statics and
+// ends in esp_deep_sleep(), or in a reset that reboots it right away. RTC
+// memory, NVS, the spool partition, the clock and the energy accounting are
+// kept in a shared mapping between wakes.
+#include "config.h"
+#include "sim.h"
+#include "wake_cycle.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define SIM_START_EPOCH 1767225600UL // 2026-01-01
+#define WAKE_REAL_TIME_LIMIT_SEC 10  // A wake that takes longer on the host is hung
+#define HANG_TEST_DAYS 1
+
+void app_main(void);
+
+// RTC_DATA_ATTR and RTC_NOINIT_ATTR variables, see mock/idf.h
+extern uint8_t __start_mock_rtc_data[];
+extern uint8_t __stop_mock_rtc_data[];
+extern uint8_t __start_mock_rtc_noinit[];
+extern uint8_t __stop_mock_rtc_noinit[];
+
+static const char *const phase_names[SIM_PHASE_COUNT] = {
+    "boot", "cpu", "adc", "flash", "radio", "tx", "sleep"};
+
+static double outage_start_sec = -1;
+static double outage_length_sec = 0;
+static int fail_percent = 0;
+static int brownout_percent = 0;
+static int hang_phase = -1;        // Wake cycle phase that never returns, -1 for none
+static int most_resets_in_row = 0; // Resets without a deep sleep between them
+
+static struct {
+    const char *name;
+    double *value;
+} parameters[] = {
+    {"boot_ms", &sim_model.boot_ms},
+    {"app_ms", &sim_model.app_ms},
+    {"associate_ms", &sim_model.associate_ms},
+    {"associate_fast_ms", &sim_model.associate_fast_ms},
+    {"dhcp_ms", &sim_model.dhcp_ms},
+    {"connect_fail_ms", &sim_model.connect_fail_ms},
+    {"rtt_ms", &sim_model.rtt_ms},
+    {"tx_kbps", &sim_model.tx_kbps},
+    {"espnow_start_ms", &sim_model.espnow_start_ms},
+    {"rf_cal_full_ms", &sim_model.rf_cal_full_ms},
+    {"espnow_kbps", &sim_model.espnow_kbps},
+    {"espnow_ack_ms", &sim_model.espnow_ack_ms},
+    {"tls_full_ms", &sim_model.tls_full_ms},
+    {"tls_resumed_ms", &sim_model.tls_resumed_ms},
+    {"tls_full_tx_bytes", &sim_model.tls_full_tx_bytes},
+    {"tls_resumed_tx_bytes", &sim_model.tls_resumed_tx_bytes},
+    {"tls_ticket_hours", &sim_model.tls_ticket_hours},
+    {"nvs_commit_ms", &sim_model.nvs_commit_ms},
+    {"flash_write_us_per_byte", &sim_model.flash_write_us_per_byte},
+    {"flash_erase_ms", &sim_model.flash_erase_ms},
+    {"uart_us_per_char", &sim_model.uart_us_per_char},
+    {"boot_ma", &sim_model.current_ma[SIM_BOOT]},
+    {"cpu_ma", &sim_model.current_ma[SIM_CPU]},
+    {"adc_ma", &sim_model.current_ma[SIM_ADC]},
+    {"flash_ma", &sim_model.current_ma[SIM_FLASH]},
+    {"radio_ma", &sim_model.current_ma[SIM_RADIO]},
+    {"tx_ma", &sim_model.current_ma[SIM_TX]},
+    {"sleep_ma", &sim_model.current_ma[SIM_SLEEP]},
+    {"drift_ppm", &sim_model.drift_ppm},
+};
+
+// Rough ESP32-C6 figures: 160 MHz CPU, 802.11n at +20 dBm, board quiescent
+// current included in deep sleep
+static void default_model(void)
+{
+    sim_model = (sim_model_t){
+        .boot_ms = 120,
+        .app_ms = 20,
+        .associate_ms = 1200,
+        .associate_fast_ms = 250,
+        .dhcp_ms = 500,
+        .connect_fail_ms = FAST_CONNECT_TIMEOUT_MS + WIFI_MAXIMUM_RETRY * 1000,
+        .rtt_ms = 40,
+        .tx_kbps = 2000,
+        .espnow_start_ms = 30,
+        .rf_cal_full_ms = 100,
+        .espnow_kbps = 1000,
+        .espnow_ack_ms = 1,
+        .tls_full_ms = 250,
+        .tls_resumed_ms = 5,
+        .tls_full_tx_bytes = 290,
+        .tls_resumed_tx_bytes = 407,
+        .tls_ticket_hours = 24,
+        .nvs_commit_ms = 8,
+        .flash_write_us_per_byte = 3,
+        .flash_erase_ms = 45,
+        .uart_us_per_char = 86.8, // 115200 baud, 10 bits per character
+        .current_ma = {
+            [SIM_BOOT] = 30,
+            [SIM_CPU] = 32,
+            [SIM_ADC] = 34,
+            [SIM_FLASH] = 40,
+            [SIM_RADIO] = 80,
+            [SIM_TX] = 240,
+            [SIM_SLEEP] = 0.012},
+        .drift_ppm = 200,
+        .battery_mah = 2600};
+}
+
+static int set_parameter(const char *assignment)
+{
+    const char *equals = strchr(assignment, '=');
+    for (size_t i = 0; i < sizeof(parameters) / sizeof(parameters[0]); i++)
+    {
+        if (equals == NULL)
+        {
+            printf("%-24s %g\n", parameters[i].name, *parameters[i].value);
+        }
+        else if (strncmp(assignment, parameters[i].name, equals - assignment) == 0 &&
+                 parameters[i].name[equals - assignment] == '\0')
+        {
+            *parameters[i].value = atof(equals + 1);
+            return 0;
+        }
+    }
+    return equals == NULL ? 1 : -1;
+}
+
+// Same freezer as sched_sim: -18 °C, heater on for 15 min every 6 h
+double sim_environment_celsius(double seconds)
+{
+    const double defrost_period = 6 * 3600;
+    const double heat_time = 15 * 60;
+    double phase = fmod(seconds, defrost_period);
+    if (phase < heat_time)
+    {
+        return -18.0 + 22.0 * phase / heat_time;
+    }
+    return -18.0 + 22.0 * exp(-(phase - heat_time) / 600.0);
+}
+
+// Li-ion cell, linear from 4.1 V full to 3.0 V empty
+double sim_battery_mv(void)
+{
+    double used = sim_charge_mah() / sim_model.battery_mah;
+    return used >= 1 ? 3000 : 4100 - 1100 * used;
+}
+
+uint32_t sim_epoch(void)
+{
+    return (uint32_t)(SIM_START_EPOCH + sim->now_us / 1000000);
+}
+
+bool sim_connect_fails(void)
+{
+    return !sim->network_up || rand() % 100 < fail_percent;
+}
+
+bool sim_brownout(void)
+{
+    return rand() % 100 < brownout_percent;
+}
+
+// Feeding the watchdog on entering the hung phase is the last time it is fed
+void sim_watchdog_fed(void)
+{
+    if (hang_phase >= 0 && wake_cycle_phase() == (cycle_phase_t)hang_phase)
+    {
+        sim_idle(WATCHDOG_TIMEOUT_SEC * 1e6);
+        sim_reset(ESP_RST_TASK_WDT);
+    }
+}
+
+static void save_noinit(void)
+{
+    memcpy(sim->rtc_noinit, __start_mock_rtc_noinit, __stop_mock_rtc_noinit - __start_mock_rtc_noinit);
+}
+
+// Runs in the child, RTC memory survives and everything else is lost
+void sim_sleep(void)
+{
+    sim->radio_on = false;
+    memcpy(sim->rtc_memory, __start_mock_rtc_data, __stop_mock_rtc_data - __start_mock_rtc_data);
+    save_noinit();
+    sim->slept = true;
+    fflush(stdout);
+    _exit(EXIT_SUCCESS);
+}
+
+// The parent loads RTC_DATA_ATTR from the image again before the next wake
+void sim_reset(esp_reset_reason_t reason)
+{
+    sim->radio_on = false;
+    save_noinit();
+    sim->reset_reason = reason;
+    sim->reset = true;
+    sim->counters.resets++;
+    fflush(stdout);
+    _exit(EXIT_SUCCESS);
+}
+
+static int run_wake(void)
+{
+    double now_sec = sim->now_us / 1e6;
+    sim->network_up = !(now_sec >= outage_start_sec && now_sec < outage_start_sec + outage_length_sec);
+    sim->slept = false;
+    sim->reset = false;
+    sim->wake_us = sim->now_us;
+    sim->counters.wakes++;
+    unsigned long attempts_before = sim->counters.connect_attempts;
+    fflush(stdout);
+
+    pid_t child = fork();
+    if (child < 0)
+    {
+        perror("fork");
+        return -1;
+    }
+    if (child == 0)
+    {
+        memcpy(__start_mock_rtc_data, sim->rtc_memory, __stop_mock_rtc_data - __start_mock_rtc_data);
+        memcpy(__start_mock_rtc_noinit, sim->rtc_noinit, __stop_mock_rtc_noinit - __start_mock_rtc_noinit);
+        srand((unsigned)sim->counters.wakes);
+        alarm(WAKE_REAL_TIME_LIMIT_SEC);
+        sim_spend(SIM_BOOT, sim_model.boot_ms * 1000);
+        sim_spend(SIM_CPU, sim_model.app_ms * 1000);
+        app_main();
+        fprintf(stderr, "app_main() returned\n");
+        _exit(EXIT_FAILURE);
+    }
+
+    int status;
+    waitpid(child, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS || !(sim->slept || sim->reset))
+    {
+        fprintf(stderr, "wake %lu at %.0f s did not reach deep sleep (%s %d)\n", sim->counters.wakes,
+                now_sec, WIFSIGNALED(status) ? "signal" : "status",
+                WIFSIGNALED(status) ? WTERMSIG(status) : WEXITSTATUS(status));
+        return -1;
+    }
+    if (sim->counters.connect_attempts > attempts_before)
+    {
+        sim->counters.radio_wakes++;
+    }
+    return 0;
+}
+
+static void report(double seconds, double depleted_sec)
+{
+    double hours = seconds / 3600;
+    double charge = sim_charge_mah();
+    double average_ma = charge / hours;
+    const sim_counters_t *c = &sim->counters;
+
+    printf("%.1f days, %lu wakes (%.1f/h), %lu with the radio on, %lu connection attempts (%lu failed), %lu uplinks\n",
+           seconds / 86400, c->wakes, c->wakes / hours, c->radio_wakes, c->connect_attempts, c->connect_failures,
+           c->uplinks);
+    printf("%lu readings sent in %lu bytes, %lu NVS commits, %lu sector erases, %lu RF calibrations, %lu resets\n",
+           c->readings_sent, c->bytes_sent, c->nvs_commits, c->flash_erases, c->rf_calibrations, c->resets);
+    printf("%-6s %12s %8s %12s %7s\n", "phase", "time s", "mA", "charge mAh", "share");
+    for (int i = 0; i < SIM_PHASE_COUNT; i++)
+    {
+        double phase_charge = sim->phase_us[i] * sim_model.current_ma[i] / 3.6e9;
+        printf("%-6s %12.1f %8.3f %12.3f %6.1f%%\n", phase_names[i], sim->phase_us[i] / 1e6,
+               sim_model.current_ma[i], phase_charge, charge > 0 ? 100 * phase_charge / charge : 0);
+    }
+    printf("average %.1f uA, %.3f mAh per wake\n", average_ma * 1000, charge / c->wakes);
+    if (depleted_sec > 0)
+    {
+        printf("battery of %.0f mAh depleted after %.1f days\n", sim_model.battery_mah, depleted_sec / 86400);
+    }
+    else
+    {
+        printf("projected battery life with %.0f mAh: %.0f days\n", sim_model.battery_mah,
+               sim_model.battery_mah / average_ma / 24);
+    }
+}
+
+static void power_on(void)
+{
+    size_t noinit_size = __stop_mock_rtc_noinit - __start_mock_rtc_noinit;
+    memset(sim, 0, sizeof(*sim));
+    memcpy(sim->rtc_memory, __start_mock_rtc_data, __stop_mock_rtc_data - __start_mock_rtc_data);
+    // No-init RTC memory holds whatever it powered up with
+    srand(0);
+    for (size_t i = 0; i < noinit_size; i++)
+    {
+        sim->rtc_noinit[i] = (uint8_t)rand();
+    }
+    memset(sim->spool, 0xFF, sizeof(sim->spool));
+    sim->wake_cause = ESP_SLEEP_WAKEUP_UNDEFINED;
+    sim->reset_reason = ESP_RST_POWERON;
+    most_resets_in_row = 0;
+}
+
+// Wakes until end_sec of simulated time, or until the device sleeps for good
+static int simulate(double end_sec, double *depleted_sec)
+{
+    int resets_in_row = 0;
+    while (sim->now_us / 1e6 < end_sec)
+    {
+        if (run_wake() != 0)
+        {
+            return -1;
+        }
+        if (sim->reset)
+        {
+            // The parent's own copy of the sections was never touched
+            memcpy(sim->rtc_memory, __start_mock_rtc_data, __stop_mock_rtc_data - __start_mock_rtc_data);
+            sim->wake_cause = ESP_SLEEP_WAKEUP_UNDEFINED;
+            if (++resets_in_row > most_resets_in_row)
+            {
+                most_resets_in_row = resets_in_row;
+            }
+            continue;
+        }
+        resets_in_row = 0;
+        if (sim->sleep_us == 0)
+        {
+            printf("device went to sleep without a timer after %.1f days\n", sim->now_us / 86400e6);
+            break;
+        }
+        sim_spend(SIM_SLEEP, sim->sleep_us);
+        sim->wake_cause = ESP_SLEEP_WAKEUP_TIMER;
+        sim->reset_reason = ESP_RST_DEEPSLEEP;
+        if (*depleted_sec == 0 && sim_charge_mah() >= sim_model.battery_mah)
+        {
+            *depleted_sec = sim->now_us / 1e6;
+        }
+    }
+    return 0;
+}
+
+// A phase that hangs on every entry costs each cycle at most CYCLE_MAX_INTERRUPTS
+// resets, after that the cycle takes the phase's fallback and the device sleeps
+static int run_hang_test(void)
+{
+    int failures = 0;
+    for (int phase = 0; phase < CYCLE_PHASE_COUNT; phase++)
+    {
+        hang_phase = phase;
+        power_on();
+        double depleted_sec = 0;
+        bool passed = simulate(HANG_TEST_DAYS * 86400, &depleted_sec) == 0 && sim->counters.resets > 0 &&
+                      most_resets_in_row <= CYCLE_MAX_INTERRUPTS && sim->sleep_us != 0;
+        printf("phase %d hung: %lu wakes, %lu resets, at most %d in a row, %lu readings sent%s\n", phase,
+               sim->counters.wakes, sim->counters.resets, most_resets_in_row, sim->counters.readings_sent,
+               passed ? "" : ", FAILED");
+        if (!passed)
+        {
+            failures++;
+        }
+    }
+    hang_phase = -1;
+    printf("%d of %d phases failed\n", failures, CYCLE_PHASE_COUNT);
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int main(int argc, char **argv)
+{
+    double days = 7;
+    double minimum_life_days = 0;
+    bool hang_test = false;
+    int option;
+
+    default_model();
+    while ((option = getopt(argc, argv, "d:c:f:b:O:L:p:vt")) != -1)
+    {
+        switch (option)
+        {
+        case 'd':
+            days = atof(optarg);
+            break;
+        case 'c':
+            sim_model.battery_mah = atof(optarg);
+            break;
+        case 'f':
+            fail_percent = atoi(optarg);
+            break;
+        case 'b':
+            brownout_percent = atoi(optarg);
+            break;
+        case 'O':
+        {
+            double start_hour, hours;
+            if (sscanf(optarg, "%lf:%lf", &start_hour, &hours) != 2)
+            {
+                fprintf(stderr, "wake_sim: -O wants hour:hours\n");
+                return EXIT_FAILURE;
+            }
+            outage_start_sec = start_hour * 3600;
+            outage_length_sec = hours * 3600;
+            break;
+        }
+        case 'L':
+            minimum_life_days = atof(optarg);
+            break;
+        case 'p':
+        {
+            int result = set_parameter(optarg);
+            if (result > 0)
+            {
+                return EXIT_SUCCESS;
+            }
+            if (result < 0)
+            {
+                fprintf(stderr, "wake_sim: unknown parameter %s, -p list shows them\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        }
+        case 'v':
+            mock_log_enabled = true;
+            break;
+        case 't':
+            hang_test = true;
+            break;
+        default:
+            fprintf(stderr, "usage: wake_sim [-d days] [-c mAh] [-f percent] [-b percent] [-O hour:hours] "
+                            "[-L days] [-p name=value] [-v] [-t]\n");
+            return EXIT_FAILURE;
+        }
+    }
+
+    size_t rtc_size = __stop_mock_rtc_data - __start_mock_rtc_data;
+    size_t noinit_size = __stop_mock_rtc_noinit - __start_mock_rtc_noinit;
+    if (rtc_size > SIM_RTC_SIZE || noinit_size > SIM_RTC_SIZE)
+    {
+        fprintf(stderr, "wake_sim: %zu + %zu bytes of RTC data, SIM_RTC_SIZE is too small\n", rtc_size,
+                noinit_size);
+        return EXIT_FAILURE;
+    }
+    sim = mmap(NULL, sizeof(*sim), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (sim == MAP_FAILED)
+    {
+        perror("mmap");
+        return EXIT_FAILURE;
+    }
+    if (hang_test)
+    {
+        return run_hang_test();
+    }
+
+    power_on();
+    double depleted_sec = 0;
+    if (simulate(days * 86400, &depleted_sec) != 0)
+    {
+        return EXIT_FAILURE;
+    }
+    double seconds = sim->now_us / 1e6;
+    report(seconds, depleted_sec);
+
+    double life_days = depleted_sec > 0 ? depleted_sec / 86400
+                                        : sim_model.battery_mah / (sim_charge_mah() / (seconds / 3600)) / 24;
+    return life_days < minimum_life_days ? EXIT_FAILURE : EXIT_SUCCESS;
+}